@@ -0,0 +1,904 @@
+// cNBT benchmark suite.
+//
+// Generates reproducible synthetic corpora and measures cNBT_Parse() (also
+// with budgets, with cNBT_PARSE_ARRAY_VIEWS, with a shape cache, with
+// deduplication and from a bundle), cNBT_DecodeStruct(), cNBT_Write() (also
+// with a write session), cNBT_WriteV(), cNBT_EncodeStruct(), cNBT_Freeze(),
+// key lookups (also in shaped trees and frozen images), loading files with a
+// cNBTLoader, cNBT_Delete() and cNBT_DeleteAsync() on them in both
+// endiannesses.
+// Each corpus runs in a child process so its peak RSS is reported separately.
+//
+// Every measurement is printed as one JSON object per line:
+//
+//   {"corpus":"chunk","endian":"big","op":"parse","bytes":...,"nodes":...,
+//    "iterations":...,"ns_per_op":...,"mb_per_s":...,"ns_per_node":...,
+//    "allocs_per_op":...,"peak_rss_kb":...}
+//
+// Usage: bench [-t seconds] [-s scale] [corpus...]
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "../nbt.h"
+
+//-----------------------------------------------------------------------------
+// [SECTION] HELPERS
+//-----------------------------------------------------------------------------
+
+static uint64_t gAllocations = 0;
+
+static void *cNBT_API Bench_Alloc(size_t size, void *userData) {
+  (void)userData;
+  // The workers of loaders allocate too.
+  __atomic_fetch_add(&gAllocations, 1, __ATOMIC_RELAXED);
+  return malloc(size);
+}
+
+static void cNBT_API Bench_Free(void *ptr, void *userData) {
+  (void)userData;
+  free(ptr);
+}
+
+static void *cNBT_API Bench_Realloc(void *ptr, size_t size, void *userData) {
+  (void)userData;
+  __atomic_fetch_add(&gAllocations, 1, __ATOMIC_RELAXED);
+  return realloc(ptr, size);
+}
+
+static uint64_t gRandom = 0x243F6A8885A308D3ULL;
+
+// xorshift64, with a fixed seed so every run generates the same corpora.
+static uint64_t Bench_Random(void) {
+  gRandom ^= gRandom << 13;
+  gRandom ^= gRandom >> 7;
+  gRandom ^= gRandom << 17;
+  return gRandom;
+}
+
+static double Bench_Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static long Bench_PeakRSS(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static size_t Bench_CountNodes(const cNBT *nbt) {
+  size_t result = 1;
+  const cNBT *item;
+  cNBT_ForEach(nbt, item)
+    result += Bench_CountNodes(item);
+  return result;
+}
+
+static cNBT *Bench_Add(cNBT *parent, uint8_t type, const char *key) {
+  cNBT *item = cNBT_CreateNode(type);
+  cNBT_AddNode(parent, item, key);
+  return item;
+}
+
+static cNBT *Bench_AddList(cNBT *parent, uint8_t elementType, const char *key) {
+  cNBT *item = Bench_Add(parent, cNBT_LST, key);
+  cNBT_SetListElementType(item, elementType);
+  return item;
+}
+
+#define Bench_AddI08(p, k, v) cNBT_SetValueI08(Bench_Add(p, cNBT_I08, k), v)
+#define Bench_AddI16(p, k, v) cNBT_SetValueI16(Bench_Add(p, cNBT_I16, k), v)
+#define Bench_AddI32(p, k, v) cNBT_SetValueI32(Bench_Add(p, cNBT_I32, k), v)
+#define Bench_AddI64(p, k, v) cNBT_SetValueI64(Bench_Add(p, cNBT_I64, k), v)
+#define Bench_AddF32(p, k, v) cNBT_SetValueF32(Bench_Add(p, cNBT_F32, k), v)
+#define Bench_AddF64(p, k, v) cNBT_SetValueF64(Bench_Add(p, cNBT_F64, k), v)
+#define Bench_AddStr(p, k, v) cNBT_SetValueString(Bench_Add(p, cNBT_STR, k), v, 0)
+
+static void Bench_AddArray(cNBT *parent, uint8_t type, const char *key, int32_t length) {
+  size_t size = type == cNBT_A08 ? 1 : type == cNBT_A32 ? 4 : 8;
+  uint8_t *data = malloc(length * size + 8);
+  for (int32_t i = 0; i < length; i++) {
+    uint64_t value = Bench_Random();
+    memcpy(data + i * size, &value, size);
+  }
+  cNBT_SetValueArray(Bench_Add(parent, type, key), data, length);
+  free(data);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] CORPORA
+//-----------------------------------------------------------------------------
+
+static const char *const gBlockNames[] = {
+  "minecraft:air", "minecraft:stone", "minecraft:dirt", "minecraft:grass_block",
+  "minecraft:oak_log", "minecraft:water", "minecraft:iron_ore", "minecraft:deepslate"
+};
+
+// Chunk-like documents with big long arrays.
+static cNBT *Bench_MakeChunk(int scale) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBT *level = Bench_Add(root, cNBT_OBJ, "Level");
+  char name[32];
+
+  Bench_AddI32(level, "xPos", -12);
+  Bench_AddI32(level, "zPos", 40);
+  Bench_AddI64(level, "LastUpdate", 1234567);
+  Bench_AddStr(level, "Status", "full");
+  Bench_AddArray(level, cNBT_A32, "Biomes", 1024);
+
+  cNBT *heightmaps = Bench_Add(level, cNBT_OBJ, "Heightmaps");
+  Bench_AddArray(heightmaps, cNBT_A64, "MOTION_BLOCKING", 37);
+  Bench_AddArray(heightmaps, cNBT_A64, "OCEAN_FLOOR", 37);
+  Bench_AddArray(heightmaps, cNBT_A64, "WORLD_SURFACE", 37);
+
+  cNBT *sections = Bench_AddList(level, cNBT_OBJ, "Sections");
+  for (int i = 0; i < 16 * scale; i++) {
+    cNBT *section = Bench_Add(sections, cNBT_OBJ, "");
+    Bench_AddI08(section, "Y", (int8_t)i);
+    Bench_AddArray(section, cNBT_A64, "BlockStates", 256 + (int32_t)(Bench_Random() % 512));
+    Bench_AddArray(section, cNBT_A08, "BlockLight", 2048);
+    Bench_AddArray(section, cNBT_A08, "SkyLight", 2048);
+    cNBT *palette = Bench_AddList(section, cNBT_OBJ, "Palette");
+    for (int j = 0; j < 8; j++) {
+      cNBT *block = Bench_Add(palette, cNBT_OBJ, "");
+      Bench_AddStr(block, "Name", gBlockNames[j]);
+      if (j & 1) {
+        cNBT *properties = Bench_Add(block, cNBT_OBJ, "Properties");
+        snprintf(name, sizeof(name), "%d", (int)(Bench_Random() % 16));
+        Bench_AddStr(properties, "level", name);
+        Bench_AddStr(properties, "axis", "y");
+      }
+    }
+  }
+
+  return root;
+}
+
+// Entity lists with primitive sublists.
+static cNBT *Bench_MakeEntities(int scale) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBT *entities = Bench_AddList(root, cNBT_OBJ, "Entities");
+
+  for (int i = 0; i < 500 * scale; i++) {
+    cNBT *entity = Bench_Add(entities, cNBT_OBJ, "");
+    cNBT *pos = Bench_AddList(entity, cNBT_F64, "Pos")
+      , *motion = Bench_AddList(entity, cNBT_F64, "Motion")
+      , *rotation = Bench_AddList(entity, cNBT_F32, "Rotation");
+    for (int j = 0; j < 3; j++) {
+      cNBT_SetValueF64(Bench_Add(pos, cNBT_F64, ""), (double)(Bench_Random() % 100000) / 16);
+      cNBT_SetValueF64(Bench_Add(motion, cNBT_F64, ""), (double)(Bench_Random() % 100) / 100);
+    }
+    for (int j = 0; j < 2; j++)
+      cNBT_SetValueF32(Bench_Add(rotation, cNBT_F32, ""), (float)(Bench_Random() % 360));
+    Bench_AddStr(entity, "id", i & 1 ? "minecraft:zombie" : "minecraft:cow");
+    Bench_AddArray(entity, cNBT_A32, "UUID", 4);
+    Bench_AddF32(entity, "FallDistance", 0.0f);
+    Bench_AddI16(entity, "Fire", -1);
+    Bench_AddI16(entity, "Air", 300);
+    Bench_AddI08(entity, "OnGround", 1);
+    Bench_AddI32(entity, "PortalCooldown", 0);
+    Bench_AddF32(entity, "Health", 20.0f);
+    cNBT *attributes = Bench_AddList(entity, cNBT_OBJ, "Attributes");
+    for (int j = 0; j < 3; j++) {
+      cNBT *attribute = Bench_Add(attributes, cNBT_OBJ, "");
+      Bench_AddStr(attribute, "Name", j ? "minecraft:generic.movement_speed" : "minecraft:generic.max_health");
+      Bench_AddF64(attribute, "Base", 0.25 * (j + 1));
+    }
+  }
+
+  return root;
+}
+
+// Wide objects.
+static cNBT *Bench_MakeWide(int scale) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  char key[32];
+
+  for (int i = 0; i < 5000 * scale; i++) {
+    snprintf(key, sizeof(key), "key_%08x_%d", (unsigned)Bench_Random(), i);
+    if (i % 3)
+      Bench_AddI32(root, key, (int32_t)Bench_Random());
+    else
+      Bench_AddF64(root, key, (double)i / 3);
+  }
+
+  return root;
+}
+
+// Deep nesting.
+static cNBT *Bench_MakeDeep(int scale) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ), *item = root;
+  int depth = 128 * scale;
+
+  // Every other level adds a list, keep the nesting within cNBT_MAX_DEPTH.
+  if (depth > 320)
+    depth = 320;
+
+  for (int i = 0; i < depth; i++) {
+    Bench_AddI32(item, "depth", i);
+    Bench_AddStr(item, "name", "node");
+    if (i & 1) {
+      cNBT *list = Bench_AddList(item, cNBT_OBJ, "next");
+      item = Bench_Add(list, cNBT_OBJ, "");
+    } else {
+      item = Bench_Add(item, cNBT_OBJ, "next");
+    }
+  }
+
+  return root;
+}
+
+static const char *const gEnchantments[] = {
+  "minecraft:sharpness", "minecraft:unbreaking", "minecraft:mending",
+  "minecraft:looting", "minecraft:fire_aspect"
+};
+
+// String-heavy item NBT.
+static cNBT *Bench_MakeItems(int scale) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBT *items = Bench_AddList(root, cNBT_OBJ, "Items");
+  char text[128];
+
+  for (int i = 0; i < 1000 * scale; i++) {
+    cNBT *item = Bench_Add(items, cNBT_OBJ, "");
+    Bench_AddI08(item, "Slot", (int8_t)(i % 36));
+    Bench_AddStr(item, "id", gBlockNames[i % 8]);
+    Bench_AddI08(item, "Count", (int8_t)(1 + Bench_Random() % 64));
+    cNBT *tag = Bench_Add(item, cNBT_OBJ, "tag");
+    Bench_AddI32(tag, "Damage", (int32_t)(Bench_Random() % 1500));
+    cNBT *display = Bench_Add(tag, cNBT_OBJ, "display");
+    snprintf(text, sizeof(text), "{\"text\":\"Item #%d\",\"color\":\"gold\",\"italic\":false}", i);
+    Bench_AddStr(display, "Name", text);
+    cNBT *lore = Bench_AddList(display, cNBT_STR, "Lore");
+    for (int j = 0; j < 3; j++) {
+      snprintf(text, sizeof(text), "{\"text\":\"Lore line %d of item %d\"}", j, i);
+      cNBT_SetValueString(Bench_Add(lore, cNBT_STR, ""), text, 0);
+    }
+    cNBT *enchantments = Bench_AddList(tag, cNBT_OBJ, "Enchantments");
+    for (int j = 0; j < (int)(Bench_Random() % 4); j++) {
+      cNBT *enchantment = Bench_Add(enchantments, cNBT_OBJ, "");
+      Bench_AddStr(enchantment, "id", gEnchantments[(i + j) % 5]);
+      Bench_AddI16(enchantment, "lvl", (int16_t)(1 + j));
+    }
+  }
+
+  return root;
+}
+
+// Compounds of randomly typed primitives, lists and arrays, so the type of
+// the next tag can't be predicted from the previous one.
+static cNBT *Bench_MakeMixed(int scale) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBT *records = Bench_AddList(root, cNBT_OBJ, "Records");
+  char key[16];
+
+  for (int i = 0; i < 1000 * scale; i++) {
+    cNBT *record = Bench_Add(records, cNBT_OBJ, "");
+    for (int j = 0; j < 16; j++) {
+      snprintf(key, sizeof(key), "f%d", j);
+      switch (Bench_Random() % 10) {
+        case 0: Bench_AddI08(record, key, (int8_t)Bench_Random()); break;
+        case 1: Bench_AddI16(record, key, (int16_t)Bench_Random()); break;
+        case 2: Bench_AddI32(record, key, (int32_t)Bench_Random()); break;
+        case 3: Bench_AddI64(record, key, (int64_t)Bench_Random()); break;
+        case 4: Bench_AddF32(record, key, (float)(Bench_Random() % 1000) / 7); break;
+        case 5: Bench_AddF64(record, key, (double)(Bench_Random() % 1000) / 7); break;
+        case 6: Bench_AddStr(record, key, gBlockNames[Bench_Random() % 8]); break;
+        case 7: Bench_AddArray(record, cNBT_A32, key, (int32_t)(Bench_Random() % 8)); break;
+        case 8: {
+          cNBT *list = Bench_AddList(record, cNBT_F64, key);
+          for (int k = 0; k < 3; k++)
+            cNBT_SetValueF64(Bench_Add(list, cNBT_F64, ""), (double)k / 3);
+          break;
+        }
+        default: {
+          cNBT *list = Bench_AddList(record, cNBT_I32, key);
+          for (int k = 0; k < 4; k++)
+            cNBT_SetValueI32(Bench_Add(list, cNBT_I32, ""), (int32_t)Bench_Random());
+          break;
+        }
+      }
+    }
+  }
+
+  return root;
+}
+
+// Structs decoded by the decode_struct benchmark.
+typedef struct {
+  char *name;
+  double base;
+} BenchAttribute;
+
+typedef struct {
+  cNBTSchemaArray pos;
+  cNBTSchemaArray motion;
+  cNBTSchemaArray rotation;
+  char *id;
+  cNBTSchemaArray uuid;
+  float fallDistance;
+  int16_t fire;
+  int16_t air;
+  int8_t onGround;
+  int32_t portalCooldown;
+  float health;
+  cNBTSchemaArray attributes;
+} BenchEntity;
+
+typedef struct {
+  cNBTSchemaArray entities;
+} BenchEntities;
+
+static const cNBTSchemaField gAttributeFields[] = {
+  { "Name", cNBT_STR, 0, 0, offsetof(BenchAttribute, name) },
+  { "Base", cNBT_F64, 0, 0, offsetof(BenchAttribute, base) }
+};
+static const cNBTSchemaField gEntityFields[] = {
+  { "Pos", cNBT_LST, cNBT_F64, 0, offsetof(BenchEntity, pos) },
+  { "Motion", cNBT_LST, cNBT_F64, 0, offsetof(BenchEntity, motion) },
+  { "Rotation", cNBT_LST, cNBT_F32, 0, offsetof(BenchEntity, rotation) },
+  { "id", cNBT_STR, 0, cNBT_FIELD_REQUIRED, offsetof(BenchEntity, id) },
+  { "UUID", cNBT_A32, 0, 0, offsetof(BenchEntity, uuid) },
+  { "FallDistance", cNBT_F32, 0, 0, offsetof(BenchEntity, fallDistance) },
+  { "Fire", cNBT_I16, 0, 0, offsetof(BenchEntity, fire) },
+  { "Air", cNBT_I16, 0, 0, offsetof(BenchEntity, air) },
+  { "OnGround", cNBT_I08, 0, 0, offsetof(BenchEntity, onGround) },
+  { "PortalCooldown", cNBT_I32, 0, 0, offsetof(BenchEntity, portalCooldown) },
+  { "Health", cNBT_F32, 0, 0, offsetof(BenchEntity, health) },
+  {
+    "Attributes", cNBT_LST, cNBT_OBJ, 0, offsetof(BenchEntity, attributes),
+    gAttributeFields, 2, sizeof(BenchAttribute)
+  }
+};
+static const cNBTSchemaField gEntitiesFields[] = {
+  {
+    "Entities", cNBT_LST, cNBT_OBJ, 0, offsetof(BenchEntities, entities),
+    gEntityFields, sizeof(gEntityFields) / sizeof(gEntityFields[0]), sizeof(BenchEntity)
+  }
+};
+
+typedef struct {
+  const char *name;
+  cNBT *(*make)(int scale);
+  // Paths looked up by the lookup benchmark, separated by '/'.
+  const char *const *lookups;
+  // Schema of the decode_struct and encode_struct benchmarks, and the size of
+  // its struct.
+  const cNBTSchemaField *fields;
+  size_t fieldCount;
+  size_t structSize;
+} BenchCorpus;
+
+static const char *const gChunkLookups[] = {
+  "Level/xPos", "Level/Status", "Level/Sections/7/BlockStates",
+  "Level/Sections/15/Palette/3/Properties/level", "Level/Heightmaps/WORLD_SURFACE", cNBT_NULLPTR
+};
+static const char *const gEntityLookups[] = {
+  "Entities/0/id", "Entities/250/Pos/1", "Entities/499/Attributes/2/Base",
+  "Entities/100/Health", cNBT_NULLPTR
+};
+static const char *const gWideLookups[] = {
+  "missing_key", cNBT_NULLPTR
+};
+static const char *const gDeepLookups[] = {
+  "next/0/next/next/0/next/depth", "next/0/next/next/0/next/next/0/next/next/0/name",
+  cNBT_NULLPTR
+};
+static const char *const gItemLookups[] = {
+  "Items/0/tag/display/Name", "Items/500/tag/display/Lore/2", "Items/999/Count",
+  cNBT_NULLPTR
+};
+static const char *const gMixedLookups[] = {
+  "Records/0/f0", "Records/500/f7", "Records/999/f15", cNBT_NULLPTR
+};
+
+static const BenchCorpus gCorpora[] = {
+  { "chunk", Bench_MakeChunk, gChunkLookups },
+  {
+    "entities", Bench_MakeEntities, gEntityLookups,
+    gEntitiesFields, 1, sizeof(BenchEntities)
+  },
+  { "wide", Bench_MakeWide, gWideLookups },
+  { "deep", Bench_MakeDeep, gDeepLookups },
+  { "items", Bench_MakeItems, gItemLookups },
+  { "mixed", Bench_MakeMixed, gMixedLookups }
+};
+
+//-----------------------------------------------------------------------------
+// [SECTION] MEASUREMENTS
+//-----------------------------------------------------------------------------
+
+typedef struct {
+  const char *corpus;
+  const char *endian;
+  size_t bytes;
+  size_t nodes;
+} BenchContext;
+
+static void Bench_Report(
+  const BenchContext *context,
+  const char *op,
+  uint64_t iterations,
+  double seconds,
+  uint64_t allocations,
+  size_t ops,
+  uint8_t perDocument
+) {
+  double perOp = seconds / (double)(iterations * ops);
+  printf(
+    "{\"corpus\":\"%s\",\"endian\":\"%s\",\"op\":\"%s\",\"bytes\":%zu,\"nodes\":%zu,"
+    "\"iterations\":%llu,\"ns_per_op\":%.1f,\"mb_per_s\":%.2f,\"ns_per_node\":%.2f,"
+    "\"allocs_per_op\":%.2f,\"peak_rss_kb\":%ld}\n",
+    context->corpus,
+    context->endian,
+    op,
+    context->bytes,
+    context->nodes,
+    (unsigned long long)iterations,
+    perOp * 1e9,
+    perDocument ? (double)context->bytes * (double)iterations / seconds / 1e6 : 0.0,
+    perDocument ? perOp * 1e9 / (double)context->nodes : 0.0,
+    (double)allocations / (double)(iterations * ops),
+    Bench_PeakRSS());
+  fflush(stdout);
+}
+
+static const cNBT *Bench_Lookup(const cNBT *nbt, const char *path) {
+  char segment[64];
+
+  while (nbt && *path) {
+    size_t length = strcspn(path, "/");
+    memcpy(segment, path, length);
+    segment[length] = '\0';
+    path += length + (path[length] == '/');
+    if (nbt->type == cNBT_LST)
+      nbt = cNBT_GetNodeByIndex(nbt, atoi(segment));
+    else
+      nbt = cNBT_GetNodeByKey(nbt, segment);
+  }
+
+  return nbt;
+}
+
+// Same as Bench_Lookup(), in a frozen image.
+static cNBTFrozen Bench_LookupFrozen(cNBTFrozen nbt, const char *path) {
+  char segment[64];
+
+  while (nbt.image && *path) {
+    size_t length = strcspn(path, "/");
+    memcpy(segment, path, length);
+    segment[length] = '\0';
+    path += length + (path[length] == '/');
+    if (cNBT_FrozenType(nbt) == cNBT_LST)
+      nbt = cNBT_FrozenAt(nbt, atoi(segment));
+    else
+      nbt = cNBT_FrozenGet(nbt, segment);
+  }
+
+  return nbt;
+}
+
+static void Bench_RunCorpus(const BenchCorpus *corpus, int scale, double seconds) {
+  cNBT *source = corpus->make(scale);
+
+  for (uint8_t bigEndian = 0; bigEndian < 2; bigEndian++) {
+    BenchContext context = {
+      .corpus = corpus->name,
+      .endian = bigEndian ? "big" : "little",
+      .nodes = Bench_CountNodes(source)
+    };
+    const void *data = cNBT_Write(source, 0, bigEndian, &context.bytes);
+    cNBT *check = cNBT_Parse(data, context.bytes, bigEndian);
+
+    if (!check) {
+      fprintf(stderr, "bench: corpus %s can't be parsed\n", corpus->name);
+      exit(1);
+    }
+    cNBT_Delete(check);
+    uint64_t iterations, allocations;
+    double start, elapsed;
+    size_t length, lookups = 0;
+    volatile uintptr_t sink = 0;
+
+    // Parse. Only the time spent in cNBT_Parse() is measured.
+    iterations = 0;
+    elapsed = 0;
+    allocations = 0;
+    do {
+      uint64_t before = gAllocations;
+      start = Bench_Now();
+      cNBT *nbt = cNBT_Parse(data, context.bytes, bigEndian);
+      elapsed += Bench_Now() - start;
+      allocations += gAllocations - before;
+      cNBT_Delete(nbt);
+      iterations++;
+    } while (elapsed < seconds);
+    Bench_Report(&context, "parse", iterations, elapsed, allocations, 1, 1);
+
+    // Parse with budgets, all of them set but generous enough for the corpus.
+    cNBTParseOptions budgetOptions = { 0 };
+    budgetOptions.maxBytes = (size_t)1 << 30;
+    budgetOptions.maxNodes = (size_t)1 << 24;
+    budgetOptions.maxArrayLength = (uint32_t)1 << 24;
+    budgetOptions.maxStringLength = 65535;
+    iterations = 0;
+    elapsed = 0;
+    allocations = 0;
+    do {
+      uint64_t before = gAllocations;
+      start = Bench_Now();
+      cNBT *nbt = cNBT_ParseEx(data, context.bytes, bigEndian, &budgetOptions);
+      elapsed += Bench_Now() - start;
+      allocations += gAllocations - before;
+      cNBT_Delete(nbt);
+      iterations++;
+    } while (elapsed < seconds);
+    Bench_Report(&context, "parse_budgets", iterations, elapsed, allocations, 1, 1);
+
+    // Parse with arrays left in the source data.
+    cNBTParseOptions viewOptions = { cNBT_PARSE_ARRAY_VIEWS, 0 };
+    iterations = 0;
+    elapsed = 0;
+    allocations = 0;
+    do {
+      uint64_t before = gAllocations;
+      start = Bench_Now();
+      cNBT *nbt = cNBT_ParseEx(data, context.bytes, bigEndian, &viewOptions);
+      elapsed += Bench_Now() - start;
+      allocations += gAllocations - before;
+      cNBT_Delete(nbt);
+      iterations++;
+    } while (elapsed < seconds);
+    Bench_Report(&context, "parse_views", iterations, elapsed, allocations, 1, 1);
+
+    // Parse with a shape cache, learned by the first iteration.
+    cNBTShapeCache *shapes = cNBT_CreateShapeCache(0);
+    cNBTParseOptions shapeOptions = { 0, 0, shapes };
+    cNBT_Delete(cNBT_ParseEx(data, context.bytes, bigEndian, &shapeOptions));
+    iterations = 0;
+    elapsed = 0;
+    allocations = 0;
+    do {
+      uint64_t before = gAllocations;
+      start = Bench_Now();
+      cNBT *nbt = cNBT_ParseEx(data, context.bytes, bigEndian, &shapeOptions);
+      elapsed += Bench_Now() - start;
+      allocations += gAllocations - before;
+      cNBT_Delete(nbt);
+      iterations++;
+    } while (elapsed < seconds);
+    Bench_Report(&context, "parse_shapes", iterations, elapsed, allocations, 1, 1);
+
+    // Parse sharing identical lists and objects.
+    cNBTParseOptions dedupOptions = { cNBT_PARSE_DEDUPLICATE, 0, NULL, NULL };
+    iterations = 0;
+    elapsed = 0;
+    allocations = 0;
+    do {
+      uint64_t before = gAllocations;
+      start = Bench_Now();
+      cNBT *nbt = cNBT_ParseEx(data, context.bytes, bigEndian, &dedupOptions);
+      elapsed += Bench_Now() - start;
+      allocations += gAllocations - before;
+      cNBT_Delete(nbt);
+      iterations++;
+    } while (elapsed < seconds);
+    Bench_Report(&context, "parse_dedup", iterations, elapsed, allocations, 1, 1);
+
+    // Parse from a bundle holding the document.
+    cNBTBundleBuilder *builder = cNBT_CreateBundleBuilder();
+    size_t bundleLength;
+    void *bundleData;
+    cNBTBundle bundle;
+    cNBT_BundleAdd(builder, data, context.bytes, bigEndian);
+    bundleData = cNBT_WriteBundle(builder, &bundleLength);
+    cNBT_DeleteBundleBuilder(builder);
+    if (cNBT_OpenBundle(bundleData, bundleLength, &bundle)) {
+      iterations = 0;
+      elapsed = 0;
+      allocations = 0;
+      do {
+        uint64_t before = gAllocations;
+        start = Bench_Now();
+        cNBT *nbt = cNBT_BundleParse(&bundle, 0);
+        elapsed += Bench_Now() - start;
+        allocations += gAllocations - before;
+        cNBT_Delete(nbt);
+        iterations++;
+      } while (elapsed < seconds);
+      Bench_Report(&context, "parse_bundle", iterations, elapsed, allocations, 1, 1);
+    }
+    cNBT_Free(bundleData);
+
+    // Decode into structs. Only the time spent in cNBT_DecodeStruct() is
+    // measured.
+    cNBTSchema *schema = cNBT_NULLPTR;
+    void *object = cNBT_NULLPTR;
+    if (corpus->fields) {
+      schema = cNBT_CompileSchema(corpus->fields, corpus->fieldCount);
+      object = malloc(corpus->structSize);
+      iterations = 0;
+      elapsed = 0;
+      allocations = 0;
+      do {
+        uint64_t before = gAllocations;
+        start = Bench_Now();
+        if (!cNBT_DecodeStruct(schema, data, context.bytes, bigEndian, object)) {
+          fprintf(stderr, "bench: corpus %s can't be decoded\n", corpus->name);
+          exit(1);
+        }
+        elapsed += Bench_Now() - start;
+        allocations += gAllocations - before;
+        cNBT_ReleaseStruct(schema, object);
+        iterations++;
+      } while (elapsed < seconds);
+      Bench_Report(&context, "decode_struct", iterations, elapsed, allocations, 1, 1);
+    }
+
+    cNBT *tree = cNBT_Parse(data, context.bytes, bigEndian);
+
+    // Write.
+    iterations = 0;
+    allocations = gAllocations;
+    start = Bench_Now();
+    do {
+      const void *output = cNBT_Write(tree, 0, bigEndian, &length);
+      sink += (uintptr_t)output;
+      cNBT_Free(output);
+      iterations++;
+    } while ((elapsed = Bench_Now() - start) < seconds);
+    Bench_Report(&context, "write", iterations, elapsed, gAllocations - allocations, 1, 1);
+
+    // Write with a session, reusing its buffer.
+    cNBTWriteSession *session = cNBT_CreateWriteSession(0);
+    iterations = 0;
+    allocations = gAllocations;
+    start = Bench_Now();
+    do {
+      cNBT_SessionReset(session);
+      sink += (uintptr_t)cNBT_SessionWrite(session, tree, bigEndian, &length);
+      iterations++;
+    } while ((elapsed = Bench_Now() - start) < seconds);
+    Bench_Report(&context, "write_session", iterations, elapsed, gAllocations - allocations, 1, 1);
+    cNBT_DeleteWriteSession(session);
+
+    // Write to segments referencing the arrays and long strings of the tree.
+    size_t segmentCount;
+    iterations = 0;
+    allocations = gAllocations;
+    start = Bench_Now();
+    do {
+      const cNBTSegment *segments = cNBT_WriteV(tree, bigEndian, 0, &segmentCount, &length);
+      sink += (uintptr_t)segments;
+      cNBT_FreeSegments(segments);
+      iterations++;
+    } while ((elapsed = Bench_Now() - start) < seconds);
+    Bench_Report(&context, "write_v", iterations, elapsed, gAllocations - allocations, 1, 1);
+
+    // Encode from structs.
+    if (schema) {
+      cNBT_DecodeStruct(schema, data, context.bytes, bigEndian, object);
+      iterations = 0;
+      allocations = gAllocations;
+      start = Bench_Now();
+      do {
+        const void *output = cNBT_EncodeStruct(schema, object, 0, bigEndian, &length);
+        sink += (uintptr_t)output;
+        cNBT_Free(output);
+        iterations++;
+      } while ((elapsed = Bench_Now() - start) < seconds);
+      Bench_Report(&context, "encode_struct", iterations, elapsed, gAllocations - allocations, 1, 1);
+      cNBT_ReleaseStruct(schema, object);
+      free(object);
+      cNBT_FreeSchema(schema);
+    }
+
+    // Lookup.
+    while (corpus->lookups[lookups])
+      lookups++;
+    iterations = 0;
+    allocations = gAllocations;
+    start = Bench_Now();
+    do {
+      for (size_t i = 0; i < lookups; i++)
+        sink += (uintptr_t)Bench_Lookup(tree, corpus->lookups[i]);
+      iterations++;
+    } while ((elapsed = Bench_Now() - start) < seconds);
+    Bench_Report(&context, "lookup", iterations, elapsed, gAllocations - allocations, lookups, 0);
+
+    // Lookup in a shaped tree.
+    cNBT *shaped = cNBT_ParseEx(data, context.bytes, bigEndian, &shapeOptions);
+    iterations = 0;
+    allocations = gAllocations;
+    start = Bench_Now();
+    do {
+      for (size_t i = 0; i < lookups; i++)
+        sink += (uintptr_t)Bench_Lookup(shaped, corpus->lookups[i]);
+      iterations++;
+    } while ((elapsed = Bench_Now() - start) < seconds);
+    Bench_Report(&context, "lookup_shapes", iterations, elapsed, gAllocations - allocations, lookups, 0);
+    cNBT_Delete(shaped);
+    cNBT_DeleteShapeCache(shapes);
+
+    // Freeze the tree, then look up in the frozen image.
+    size_t frozenLength = 0;
+    void *image = cNBT_NULLPTR;
+    iterations = 0;
+    allocations = gAllocations;
+    start = Bench_Now();
+    do {
+      cNBT_Free(image);
+      image = cNBT_Freeze(tree, &frozenLength);
+      iterations++;
+    } while ((elapsed = Bench_Now() - start) < seconds);
+    Bench_Report(&context, "freeze", iterations, elapsed, gAllocations - allocations, 1, 1);
+
+    cNBTFrozen frozen;
+    if (cNBT_OpenFrozen(image, frozenLength, &frozen)) {
+      iterations = 0;
+      allocations = gAllocations;
+      start = Bench_Now();
+      do {
+        for (size_t i = 0; i < lookups; i++)
+          sink += Bench_LookupFrozen(frozen, corpus->lookups[i]).item;
+        iterations++;
+      } while ((elapsed = Bench_Now() - start) < seconds);
+      Bench_Report(&context, "lookup_frozen", iterations, elapsed, gAllocations - allocations, lookups, 0);
+    }
+    cNBT_Free(image);
+
+    // Snapshot the tree, modify the item of the first lookup, which copies
+    // its path, and release the snapshot.
+    iterations = 0;
+    allocations = gAllocations;
+    start = Bench_Now();
+    do {
+      const cNBT *snapshot = cNBT_Snapshot(tree);
+      cNBT *item = (cNBT *)Bench_Lookup(tree, corpus->lookups[0]);
+      if (item)
+        cNBT_MarkDirty(cNBT_Unshare(item));
+      cNBT_ReleaseSnapshot(snapshot);
+      iterations++;
+    } while ((elapsed = Bench_Now() - start) < seconds);
+    Bench_Report(&context, "snapshot", iterations, elapsed, gAllocations - allocations, 1, 0);
+
+    // Load batches of copies of the document from a file, read and parsed
+    // by the workers of a loader. Each copy counts as an iteration.
+    char path[] = "/tmp/cnbt-bench-XXXXXX";
+    int file = mkstemp(path);
+    ssize_t written = -1;
+    if (file >= 0) {
+      written = write(file, data, context.bytes);
+      close(file);
+    }
+    if (written == (ssize_t)context.bytes) {
+      cNBT *loaded[32];
+      size_t count;
+      cNBTLoader *loader = cNBT_CreateLoader(0, bigEndian, cNBT_NULLPTR);
+      cNBTLoadResult result;
+      iterations = 0;
+      elapsed = 0;
+      allocations = 0;
+      do {
+        uint64_t before = gAllocations;
+        start = Bench_Now();
+        for (size_t i = 0; i < 32; i++)
+          cNBT_LoaderSubmit(loader, path, cNBT_NULLPTR);
+        for (count = 0; cNBT_LoaderNext(loader, &result, 1); count++)
+          loaded[count] = result.nbt;
+        elapsed += Bench_Now() - start;
+        allocations += gAllocations - before;
+        for (size_t i = 0; i < count; i++) {
+          if (!loaded[i]) {
+            fprintf(stderr, "bench: corpus %s can't be loaded\n", corpus->name);
+            exit(1);
+          }
+          cNBT_Delete(loaded[i]);
+        }
+        iterations += count;
+      } while (elapsed < seconds);
+      Bench_Report(&context, "load", iterations, elapsed, allocations, 1, 1);
+      cNBT_DeleteLoader(loader);
+    }
+    if (file >= 0)
+      unlink(path);
+
+    // Delete. Only the time spent in cNBT_Delete() is measured.
+    cNBT_Delete(tree);
+    iterations = 0;
+    elapsed = 0;
+    allocations = 0;
+    do {
+      tree = cNBT_Parse(data, context.bytes, bigEndian);
+      uint64_t before = gAllocations;
+      start = Bench_Now();
+      cNBT_Delete(tree);
+      elapsed += Bench_Now() - start;
+      allocations += gAllocations - before;
+      iterations++;
+    } while (elapsed < seconds);
+    Bench_Report(&context, "delete", iterations, elapsed, allocations, 1, 1);
+
+    // Delete on the background thread. Only the time spent by the caller is
+    // measured.
+    iterations = 0;
+    elapsed = 0;
+    allocations = 0;
+    do {
+      tree = cNBT_Parse(data, context.bytes, bigEndian);
+      uint64_t before = gAllocations;
+      start = Bench_Now();
+      cNBT_DeleteAsync(tree);
+      elapsed += Bench_Now() - start;
+      allocations += gAllocations - before;
+      cNBT_WaitDeletes();
+      iterations++;
+    } while (elapsed < seconds);
+    Bench_Report(&context, "delete_async", iterations, elapsed, allocations, 1, 1);
+
+    cNBT_Free(data);
+  }
+
+  cNBT_Delete(source);
+}
+
+int main(int argc, char **argv) {
+  double seconds = 0.5;
+  int scale = 1, selected = 0;
+
+  cNBT_SetAllocators(Bench_Alloc, Bench_Free, cNBT_NULLPTR);
+  cNBT_SetReallocFn(Bench_Realloc);
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-t") && i + 1 < argc)
+      seconds = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+      scale = atoi(argv[++i]);
+    else
+      selected = 1;
+  }
+  if (scale < 1)
+    scale = 1;
+
+  for (size_t c = 0; c < sizeof(gCorpora) / sizeof(gCorpora[0]); c++) {
+    int run = !selected;
+    for (int i = 1; i < argc && !run; i++) {
+      if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "-s"))
+        i++;
+      else if (!strcmp(argv[i], gCorpora[c].name))
+        run = 1;
+    }
+    if (!run)
+      continue;
+
+    // Run each corpus in its own process, so the peak RSS is per corpus.
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+      Bench_RunCorpus(&gCorpora[c], scale, seconds);
+      fflush(stdout);
+      _exit(0);
+    }
+    if (child < 0) {
+      perror("fork");
+      return 1;
+    }
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+      fprintf(stderr, "bench: corpus %s failed\n", gCorpora[c].name);
+      return 1;
+    }
+  }
+
+  return 0;
+}
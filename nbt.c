@@ -1,9 +1,190 @@
+// syscall() and the other POSIX functions of the loader aren't declared with
+// -std=c11 otherwise.
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include "nbt.h"
 #include "nbtconfig.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+// Counters shared between threads are updated atomically where possible.
+#if defined(__GNUC__) || defined(__clang__)
+#define cNBT_StatAdd(field, value) (void)__atomic_fetch_add(&(field), (value), __ATOMIC_RELAXED)
+#define cNBT_StatSub(field, value) (void)__atomic_fetch_sub(&(field), (value), __ATOMIC_RELAXED)
+#define cNBT_StatLoad(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define cNBT_StatRaise(field, value) do {\
+  size_t peak = __atomic_load_n(&(field), __ATOMIC_RELAXED);\
+  while (peak < (value) && !__atomic_compare_exchange_n(\
+    &(field), &peak, (value), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));\
+} while (0)
+// Share counts of chains, see [SECTION] SNAPSHOTS.
+#define cNBT_ShareLoad(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define cNBT_ShareSwap(field, expected, desired) __atomic_compare_exchange_n(\
+  &(field), &(expected), (desired), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+#define cNBT_StatAdd(field, value) (void)((field) += (value))
+#define cNBT_StatSub(field, value) (void)((field) -= (value))
+#define cNBT_StatLoad(field) (field)
+#define cNBT_StatRaise(field, value) do {\
+  if ((field) < (value))\
+    (field) = (value);\
+} while (0)
+#define cNBT_ShareLoad(field) (field)
+#define cNBT_ShareSwap(field, expected, desired)\
+  ((field) == (expected) ? ((field) = (desired), 1) : ((expected) = (field), 0))
+#endif
+
+//-----------------------------------------------------------------------------
+// [SECTION] PROFILING
+//-----------------------------------------------------------------------------
+
+// State of an item being measured. Time spent in nested items is collected in
+// `*children` so the self time of each item can be derived.
+typedef struct {
+  uint64_t start;
+  uint64_t outerChildren;
+} cNBTProfileScope;
+
+#ifdef cNBT_ENABLE_PROFILING
+#include <time.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#define cNBT_PROFILE_TSC
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define cNBT_PROFILE_TSC
+#endif
+
+static cNBTProfile gProfile;
+static uint64_t gProfileTicksPerSecond = 0;
+
+static inline uint64_t cNBT_ProfileNanoseconds(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// Read the timer. Time stamp counter on x86, nanoseconds elsewhere.
+static inline uint64_t cNBT_ProfileNow(void) {
+#ifdef cNBT_PROFILE_TSC
+  return __rdtsc();
+#else
+  return cNBT_ProfileNanoseconds();
+#endif
+}
+
+// Measure the frequency of the timer once.
+static uint64_t cNBT_ProfileTicksPerSecond(void) {
+#ifdef cNBT_PROFILE_TSC
+  if (!gProfileTicksPerSecond) {
+    uint64_t startNs = cNBT_ProfileNanoseconds()
+      , startTicks = cNBT_ProfileNow()
+      , elapsedNs;
+    while ((elapsedNs = cNBT_ProfileNanoseconds() - startNs) < 10000000);
+    gProfileTicksPerSecond = (cNBT_ProfileNow() - startTicks) * 1000000000 / elapsedNs;
+  }
+#else
+  gProfileTicksPerSecond = 1000000000;
+#endif
+  return gProfileTicksPerSecond;
+}
+
+static inline void cNBT_ProfileBegin(
+  cNBTProfileScope *scope,
+  uint64_t *children
+) {
+  scope->outerChildren = *children;
+  *children = 0;
+  scope->start = cNBT_ProfileNow();
+}
+
+static inline void cNBT_ProfileCount(
+  cNBTProfileCounter *counter,
+  uint64_t bytes,
+  uint64_t ticks,
+  uint64_t selfTicks
+) {
+  counter->count++;
+  counter->bytes += bytes;
+  counter->ticks += ticks;
+  counter->selfTicks += selfTicks;
+}
+
+static inline void cNBT_ProfileEnd(
+  cNBTProfileScope *scope,
+  uint64_t *children,
+  cNBTProfileCounter *type,
+  cNBTProfileCounter *depth,
+  uint64_t bytes
+) {
+  uint64_t ticks = cNBT_ProfileNow() - scope->start;
+
+  cNBT_ProfileCount(type, bytes, ticks, ticks - *children);
+  cNBT_ProfileCount(depth, bytes, ticks, ticks - *children);
+  *children = scope->outerChildren + ticks;
+}
+
+// Add a counter atomically to the global profile.
+static void cNBT_ProfileMergeCounter(
+  cNBTProfileCounter *global,
+  const cNBTProfileCounter *local
+) {
+  if (!local->count)
+    return;
+  cNBT_StatAdd(global->count, local->count);
+  cNBT_StatAdd(global->bytes, local->bytes);
+  cNBT_StatAdd(global->ticks, local->ticks);
+  cNBT_StatAdd(global->selfTicks, local->selfTicks);
+}
+
+// Merge the counters collected by a reader or writer into the global profile.
+static void cNBT_ProfileMerge(
+  const cNBTProfile *local
+) {
+  for (int i = 0; i <= cNBT_A64; i++) {
+    cNBT_ProfileMergeCounter(&gProfile.parseTypes[i], &local->parseTypes[i]);
+    cNBT_ProfileMergeCounter(&gProfile.writeTypes[i], &local->writeTypes[i]);
+  }
+  for (int i = 0; i < cNBT_PROFILE_DEPTHS; i++) {
+    cNBT_ProfileMergeCounter(&gProfile.parseDepths[i], &local->parseDepths[i]);
+    cNBT_ProfileMergeCounter(&gProfile.writeDepths[i], &local->writeDepths[i]);
+  }
+  if (local->parses)
+    cNBT_StatAdd(gProfile.parses, local->parses);
+  if (local->writes)
+    cNBT_StatAdd(gProfile.writes, local->writes);
+}
+
+#define cNBT_ProfileDepth(depth) \
+  ((depth) < cNBT_PROFILE_DEPTHS ? (depth) : cNBT_PROFILE_DEPTHS - 1)
+#endif
+
+uint8_t cNBT_GetProfile(
+  cNBTProfile *profile
+) {
+#ifdef cNBT_ENABLE_PROFILING
+  if (profile) {
+    *profile = gProfile;
+    profile->ticksPerSecond = cNBT_ProfileTicksPerSecond();
+  }
+  return 1;
+#else
+  if (profile)
+    memset((void *)profile, 0, sizeof(cNBTProfile));
+  return 0;
+#endif
+}
+
+void cNBT_ResetProfile(void) {
+#ifdef cNBT_ENABLE_PROFILING
+  memset((void *)&gProfile, 0, sizeof(cNBTProfile));
+#endif
+}
+
 //-----------------------------------------------------------------------------
 // [SECTION] MEMORY MANAGEMENT
 //-----------------------------------------------------------------------------
@@ -11,25 +192,279 @@
 #ifndef cNBT_DISABLE_DEFAULT_ALLOCATORS
 static void *cNBT_MallocWrapper(size_t size, void *userData) { (void)userData; return malloc(size); }
 static void cNBT_FreeWrapper(void *ptr, void *userData) { (void)userData; free(ptr); }
+static void *cNBT_ReallocWrapper(void *ptr, size_t size, void *userData) { (void)userData; return realloc(ptr, size); }
+#define cNBT_DEFAULT_REALLOC cNBT_ReallocWrapper
 #else
 static void *cNBT_MallocWrapper(size_t size, void *userData) { (void)userData; (void)size; return cNBT_NULLPTR; }
 static void cNBT_FreeWrapper(void *ptr, void *userData) { (void)userData; (void)ptr; }
+#define cNBT_DEFAULT_REALLOC cNBT_NULLPTR
 #endif
 
 static cNBTMemAllocFn gMemAllocFn = cNBT_MallocWrapper;
 static cNBTMemFreeFn gMemFreeFn = cNBT_FreeWrapper;
+static cNBTMemFreeManyFn gMemFreeManyFn = cNBT_NULLPTR;
+static cNBTMemReallocFn gMemReallocFn = cNBT_DEFAULT_REALLOC;
 static void *gMemUserData = cNBT_NULLPTR;
 
+#ifdef cNBT_ENABLE_PROFILING
+// Call the allocator functions, and record the time spent in them.
+static void *cNBT_CallAlloc(
+  size_t size
+) {
+  uint64_t start = cNBT_ProfileNow();
+  void *result = gMemAllocFn(size, gMemUserData);
+  uint64_t ticks = cNBT_ProfileNow() - start;
+
+  cNBT_StatAdd(gProfile.alloc.count, 1);
+  cNBT_StatAdd(gProfile.alloc.bytes, size);
+  cNBT_StatAdd(gProfile.alloc.ticks, ticks);
+  cNBT_StatAdd(gProfile.alloc.selfTicks, ticks);
+
+  return result;
+}
+
+static void *cNBT_CallRealloc(
+  void *ptr,
+  size_t size
+) {
+  uint64_t start = cNBT_ProfileNow();
+  void *result = gMemReallocFn(ptr, size, gMemUserData);
+  uint64_t ticks = cNBT_ProfileNow() - start;
+
+  cNBT_StatAdd(gProfile.alloc.count, 1);
+  cNBT_StatAdd(gProfile.alloc.bytes, size);
+  cNBT_StatAdd(gProfile.alloc.ticks, ticks);
+  cNBT_StatAdd(gProfile.alloc.selfTicks, ticks);
+
+  return result;
+}
+
+static void cNBT_CallFree(
+  const void *ptr
+) {
+  uint64_t start = cNBT_ProfileNow();
+  gMemFreeFn((void *)ptr, gMemUserData);
+  uint64_t ticks = cNBT_ProfileNow() - start;
+
+  cNBT_StatAdd(gProfile.free.count, 1);
+  cNBT_StatAdd(gProfile.free.ticks, ticks);
+  cNBT_StatAdd(gProfile.free.selfTicks, ticks);
+}
+
+static void cNBT_CallFreeMany(
+  void **ptrs,
+  size_t count
+) {
+  uint64_t start = cNBT_ProfileNow();
+  gMemFreeManyFn(ptrs, count, gMemUserData);
+  uint64_t ticks = cNBT_ProfileNow() - start;
+
+  cNBT_StatAdd(gProfile.free.count, count);
+  cNBT_StatAdd(gProfile.free.ticks, ticks);
+  cNBT_StatAdd(gProfile.free.selfTicks, ticks);
+}
+
+#else
+#define cNBT_CallAlloc(size) gMemAllocFn((size), gMemUserData)
+#define cNBT_CallRealloc(ptr, size) gMemReallocFn((ptr), (size), gMemUserData)
+#define cNBT_CallFree(ptr) gMemFreeFn((void *)(ptr), gMemUserData)
+#define cNBT_CallFreeMany(ptrs, count) gMemFreeManyFn((ptrs), (count), gMemUserData)
+#endif
+
+#ifdef cNBT_ENABLE_MEMORY_STATS
+// Every allocation is prefixed with a header recording its size and category,
+// so cNBT_Free() can account for it.
+typedef struct {
+  size_t size;
+  uint8_t category;
+} cNBTAllocHeader;
+
+#define cNBT_ALLOC_HEADER_SIZE \
+  ((sizeof(cNBTAllocHeader) + 15) & ~(size_t)15)
+
+static cNBTMemoryStats gMemStats;
+
+static void cNBT_StatAlloc(
+  cNBTMemoryCounters *counters,
+  size_t size
+) {
+  cNBT_StatAdd(counters->allocations, 1);
+  cNBT_StatAdd(counters->liveBytes, size);
+  size_t live = cNBT_StatLoad(counters->liveBytes);
+  cNBT_StatRaise(counters->peakBytes, live);
+}
+
+static void cNBT_StatFree(
+  cNBTMemoryCounters *counters,
+  size_t size
+) {
+  cNBT_StatAdd(counters->frees, 1);
+  cNBT_StatSub(counters->liveBytes, size);
+}
+#endif
+
+// Allocate memory accounted to the given cNBT_MEM_* category.
+static inline void *cNBT_AllocAs(
+  size_t size,
+  uint8_t category
+) {
+#ifdef cNBT_ENABLE_MEMORY_STATS
+  uint8_t *result = cNBT_CallAlloc(cNBT_ALLOC_HEADER_SIZE + size);
+
+  if (!result)
+    return cNBT_NULLPTR;
+
+  ((cNBTAllocHeader *)result)->size = size;
+  ((cNBTAllocHeader *)result)->category = category;
+  cNBT_StatAlloc(&gMemStats.total, size);
+  cNBT_StatAlloc(&gMemStats.category[category], size);
+
+  return result + cNBT_ALLOC_HEADER_SIZE;
+#else
+  (void)category;
+  return cNBT_CallAlloc(size);
+#endif
+}
+
 void *cNBT_Alloc(
   size_t size
 ) {
-  return gMemAllocFn(size, gMemUserData);
+  return cNBT_AllocAs(size, cNBT_MEM_OTHER);
+}
+
+// Resize memory from cNBT_AllocAs() to `size` bytes, keeping its first `used`
+// bytes. Returns NULL on failure, and the memory is left as is.
+static void *cNBT_ReallocAs(
+  void *ptr,
+  size_t used,
+  size_t size,
+  uint8_t category
+) {
+  if (!ptr)
+    return cNBT_AllocAs(size, category);
+
+  if (!gMemReallocFn) {
+    void *result = cNBT_AllocAs(size, category);
+
+    if (result) {
+      memcpy(result, ptr, used < size ? used : size);
+      cNBT_Free(ptr);
+    }
+
+    return result;
+  }
+
+  (void)used;
+#ifdef cNBT_ENABLE_MEMORY_STATS
+  cNBTAllocHeader *header = (cNBTAllocHeader *)((uint8_t *)ptr - cNBT_ALLOC_HEADER_SIZE);
+  size_t oldSize = header->size;
+
+  header = cNBT_CallRealloc(header, cNBT_ALLOC_HEADER_SIZE + size);
+  if (!header)
+    return cNBT_NULLPTR;
+
+  // Accounted as the old block freed and a new one allocated.
+  cNBT_StatFree(&gMemStats.total, oldSize);
+  cNBT_StatFree(&gMemStats.category[category], oldSize);
+  header->size = size;
+  cNBT_StatAlloc(&gMemStats.total, size);
+  cNBT_StatAlloc(&gMemStats.category[category], size);
+
+  return (uint8_t *)header + cNBT_ALLOC_HEADER_SIZE;
+#else
+  (void)category;
+  return cNBT_CallRealloc(ptr, size);
+#endif
+}
+
+// Account for a non-NULL pointer being freed, and get the pointer returned by
+// the allocator function.
+static inline void *cNBT_FreeAccount(
+  const void *ptr
+) {
+#ifdef cNBT_ENABLE_MEMORY_STATS
+  const cNBTAllocHeader *header = (const cNBTAllocHeader *)((const uint8_t *)ptr - cNBT_ALLOC_HEADER_SIZE);
+
+  cNBT_StatFree(&gMemStats.total, header->size);
+  cNBT_StatFree(&gMemStats.category[header->category], header->size);
+  ptr = header;
+#endif
+  return (void *)ptr;
 }
 
 void cNBT_Free(
   const void *ptr
 ) {
-  gMemFreeFn((void *)ptr, gMemUserData);
+#ifdef cNBT_ENABLE_MEMORY_STATS
+  if (!ptr)
+    return;
+#endif
+  cNBT_CallFree(cNBT_FreeAccount(ptr));
+}
+
+// Number of pointers passed to the free-many function at once.
+#define cNBT_FREE_BATCH 256
+
+typedef struct {
+  void *ptrs[cNBT_FREE_BATCH];
+  size_t count;
+} cNBTFreeBatch;
+
+static void cNBT_BatchFlush(
+  cNBTFreeBatch *batch
+) {
+  if (batch->count)
+    cNBT_CallFreeMany(batch->ptrs, batch->count);
+  batch->count = 0;
+}
+
+// Free a pointer with the free-many function if it is set, or free it at once.
+static inline void cNBT_BatchFree(
+  cNBTFreeBatch *batch,
+  const void *ptr
+) {
+  if (!gMemFreeManyFn) {
+    cNBT_Free(ptr);
+    return;
+  }
+  if (!ptr)
+    return;
+
+  batch->ptrs[batch->count++] = cNBT_FreeAccount(ptr);
+  if (batch->count == cNBT_FREE_BATCH)
+    cNBT_BatchFlush(batch);
+}
+
+uint8_t cNBT_GetMemoryStats(
+  cNBTMemoryStats *stats
+) {
+#ifdef cNBT_ENABLE_MEMORY_STATS
+  if (stats)
+    *stats = gMemStats;
+  return 1;
+#else
+  if (stats)
+    memset((void *)stats, 0, sizeof(cNBTMemoryStats));
+  return 0;
+#endif
+}
+
+#ifdef cNBT_ENABLE_MEMORY_STATS
+static void cNBT_ResetCounters(
+  cNBTMemoryCounters *counters
+) {
+  counters->allocations = 0;
+  counters->frees = 0;
+  counters->peakBytes = counters->liveBytes;
+}
+#endif
+
+void cNBT_ResetMemoryStats(void) {
+#ifdef cNBT_ENABLE_MEMORY_STATS
+  cNBT_ResetCounters(&gMemStats.total);
+  for (int i = 0; i < cNBT_MEM_CATEGORIES; i++)
+    cNBT_ResetCounters(&gMemStats.category[i]);
+#endif
 }
 
 void cNBT_GetAllocators(
@@ -49,13 +484,137 @@ void cNBT_SetAllocators(
 ) {
   gMemAllocFn = allocFn;
   gMemFreeFn = freeFn;
+  gMemFreeManyFn = cNBT_NULLPTR;
+  gMemReallocFn = cNBT_NULLPTR;
   gMemUserData = userData;
 }
 
+void cNBT_SetFreeManyFn(
+  cNBTMemFreeManyFn freeManyFn
+) {
+  gMemFreeManyFn = freeManyFn;
+}
+
+void cNBT_SetReallocFn(
+  cNBTMemReallocFn reallocFn
+) {
+  gMemReallocFn = reallocFn;
+}
+
+// Chains shared by several items, see [SECTION] SNAPSHOTS. They are counted
+// once by cNBT_MemoryUsage().
+typedef struct {
+  const cNBT **chains;
+  // Capacity - 1, or 0 before the first chain.
+  size_t mask;
+  size_t count;
+} cNBTChainSet;
+
+// Add a chain to the set. Returns 0 if it's already there, or if the memory
+// can't be allocated, so the chain is skipped rather than counted twice.
+static uint8_t cNBT_ChainSetAdd(
+  cNBTChainSet *set,
+  const cNBT *chain
+) {
+  size_t i;
+
+  // Keep the load factor under 1/2.
+  if ((set->count + 1) * 2 > set->mask) {
+    size_t capacity = set->mask ? (set->mask + 1) * 2 : 64;
+    const cNBT **chains = cNBT_AllocAs(capacity * sizeof(cNBT *), cNBT_MEM_OTHER);
+
+    if (!chains)
+      return 0;
+    memset((void *)chains, 0, capacity * sizeof(cNBT *));
+    for (i = 0; set->mask && i <= set->mask; i++) {
+      if (!set->chains[i])
+        continue;
+      size_t j = ((uintptr_t)set->chains[i] >> 4) * 0x9E3779B97F4A7C15ULL & (capacity - 1);
+      while (chains[j])
+        j = (j + 1) & (capacity - 1);
+      chains[j] = set->chains[i];
+    }
+    if (set->chains)
+      cNBT_Free((void *)set->chains);
+    set->chains = chains;
+    set->mask = capacity - 1;
+  }
+
+  for (
+    i = ((uintptr_t)chain >> 4) * 0x9E3779B97F4A7C15ULL & set->mask;
+    set->chains[i];
+    i = (i + 1) & set->mask
+  )
+    if (set->chains[i] == chain)
+      return 0;
+
+  set->chains[i] = chain;
+  set->count++;
+
+  return 1;
+}
+
+// Add the memory owned by an item and its descendants to `usage`. The parent
+// pointers of shared items may lead to another item, so the subtree is walked
+// recursively.
+static void cNBT_MemoryUsageX(
+  const cNBT *item,
+  size_t *usage,
+  cNBTChainSet *shared
+) {
+  usage[cNBT_MEM_NODE] += sizeof(cNBT);
+  if (item->key && !(item->flags & cNBT_FLAG_BORROWED_KEY))
+    usage[cNBT_MEM_KEY] += strlen(item->key) + 1;
+  if (!(item->flags & cNBT_FLAG_BORROWED_VALUE)) {
+    if (item->type == cNBT_STR && item->value.valueString)
+      usage[cNBT_MEM_STRING] += (size_t)item->value.lengthString + 1;
+    else if (
+      (item->type == cNBT_A08 || item->type == cNBT_A32 || item->type == cNBT_A64)
+      && item->value.valueArray
+    )
+      usage[cNBT_MEM_ARRAY] += (size_t)item->value.lengthArray
+        * (item->type == cNBT_A08 ? 1 : item->type == cNBT_A32 ? 4 : 8);
+  }
+
+  if (
+    item->child
+    && cNBT_ShareLoad(item->child->shares)
+    && !cNBT_ChainSetAdd(shared, item->child)
+  )
+    return;
+
+  for (const cNBT *child = item->child; child; child = child->next)
+    cNBT_MemoryUsageX(child, usage, shared);
+}
+
+size_t cNBT_MemoryUsage(
+  const cNBT *nbt,
+  size_t *breakdown
+) {
+  size_t usage[cNBT_MEM_CATEGORIES] = { 0 }
+    , result = 0;
+  cNBTChainSet shared = { 0 };
+
+  // The sibling chain of `nbt` itself is not included.
+  if (nbt)
+    cNBT_MemoryUsageX(nbt, usage, &shared);
+  if (shared.chains)
+    cNBT_Free((void *)shared.chains);
+
+  for (int i = 0; i < cNBT_MEM_CATEGORIES; i++) {
+    result += usage[i];
+    if (breakdown)
+      breakdown[i] = usage[i];
+  }
+
+  return result;
+}
+
 static inline char *cNBT_StrNDup(
   const char *string,
   size_t maxLen,
-  size_t *copiedLen
+  size_t *copiedLen,
+  uint8_t category
 ) {
   char *result;
   size_t length = strlen(string);
@@ -63,7 +622,7 @@ static inline char *cNBT_StrNDup(
   if (maxLen && length > maxLen)
     length = maxLen;
 
-  result = cNBT_Alloc(length + 1);
+  result = cNBT_AllocAs(length + 1, category);
   if (length)
     memcpy((void *)result, string, length);
 
@@ -75,1072 +634,9436 @@ static inline char *cNBT_StrNDup(
   return result;
 }
 
-#define cNBT_StrDup(string) cNBT_StrNDup(string, 0, cNBT_NULLPTR)
-
-//-----------------------------------------------------------------------------
-// [SECTION] NBT READER
-//-----------------------------------------------------------------------------
+#define cNBT_StrDup(string, category) cNBT_StrNDup(string, 0, cNBT_NULLPTR, category)
 
-// We do not use memcpy() because we do not know what endian the target machine
-// and raw data used.
-#define cNBT_GetByteLE(curs, offs) (((uint32_t)*((curs) + (offs))) << ((offs) * 8))
-#define cNBT_GetByteBE(curs, offs, size) (((uint32_t)*((curs) + (offs))) << ((size) - (offs) * 8 - 8))
+#define cNBT_ARENA_ALIGN 8
+#define cNBT_ARENA_DEFAULT_BLOCK 0x10000
 
-#define cNBT_GetCursor(obj) (((uint8_t *)(obj)->data + (obj)->offset))
+typedef struct cNBTArenaBlock_t {
+  struct cNBTArenaBlock_t *next;
+  size_t used;
+  size_t capacity;
+} cNBTArenaBlock;
 
-typedef struct {
-  const void *data;
-  size_t offset;
-  size_t length;
-  uint8_t bigEndian;
-  uint32_t errorFlag;
-} cNBTReader;
+struct cNBTArena_t {
+  cNBTArenaBlock *blocks;
+  size_t blockSize;
+};
 
-// Declaration of the dispatcher function.
-static void cNBT_ParseX(
-  cNBTReader *reader,
-  cNBT *item,
-  uint8_t type);
+// Size of the block header, rounded up to keep the payload aligned.
+#define cNBT_ArenaHeaderSize \
+  ((sizeof(cNBTArenaBlock) + cNBT_ARENA_ALIGN - 1) & ~(size_t)(cNBT_ARENA_ALIGN - 1))
 
-static int8_t cNBT_ParseI08(
-  cNBTReader *reader
+cNBTArena *cNBT_CreateArena(
+  size_t blockSize
 ) {
-  const uint8_t *cursor = cNBT_GetCursor(reader);
-  reader->offset += 1;
-  return (int8_t)cNBT_GetByteLE(cursor, 0);
+  cNBTArena *arena = cNBT_AllocAs(sizeof(cNBTArena), cNBT_MEM_ARENA);
+
+  if (!arena)
+    return cNBT_NULLPTR;
+
+  arena->blocks = cNBT_NULLPTR;
+  arena->blockSize = blockSize ? blockSize : cNBT_ARENA_DEFAULT_BLOCK;
+
+  return arena;
 }
 
-static int16_t cNBT_ParseI16(
-  cNBTReader *reader
+void *cNBT_ArenaAlloc(
+  cNBTArena *arena,
+  size_t size
 ) {
-  const uint8_t *cursor = cNBT_GetCursor(reader);
-  uint16_t result;
+  cNBTArenaBlock *block;
 
-  reader->offset += 2;
+  if (!arena)
+    return cNBT_NULLPTR;
 
-  if (reader->bigEndian) {
-    result = cNBT_GetByteBE(cursor, 0, 16)
-           | cNBT_GetByteBE(cursor, 1, 16);
-  } else {
-    result = cNBT_GetByteLE(cursor, 0)
-           | cNBT_GetByteLE(cursor, 1);
+  size = (size + cNBT_ARENA_ALIGN - 1) & ~(size_t)(cNBT_ARENA_ALIGN - 1);
+  block = arena->blocks;
+
+  if (!block || block->capacity - block->used < size) {
+    size_t capacity = arena->blockSize;
+
+    if (size > capacity / 4) {
+      // Give large allocations their own block, and keep using the current
+      // block for small allocations.
+      block = cNBT_AllocAs(cNBT_ArenaHeaderSize + size, cNBT_MEM_ARENA);
+      if (!block)
+        return cNBT_NULLPTR;
+      block->capacity = block->used = size;
+      if (arena->blocks) {
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+      } else {
+        block->next = cNBT_NULLPTR;
+        arena->blocks = block;
+      }
+      return (uint8_t *)block + cNBT_ArenaHeaderSize;
+    }
+
+    block = cNBT_AllocAs(cNBT_ArenaHeaderSize + capacity, cNBT_MEM_ARENA);
+    if (!block)
+      return cNBT_NULLPTR;
+    block->capacity = capacity;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
   }
 
-  return (int16_t)result;
+  void *result = (uint8_t *)block + cNBT_ArenaHeaderSize + block->used;
+  block->used += size;
+
+  return result;
 }
 
-static int32_t cNBT_ParseI32(
-  cNBTReader *reader
+void cNBT_DeleteArena(
+  cNBTArena *arena
 ) {
-  const uint8_t *cursor = cNBT_GetCursor(reader);
-  uint32_t result;
-
-  reader->offset += 4;
+  if (!arena)
+    return;
 
-  if (reader->bigEndian) {
-    result = cNBT_GetByteBE(cursor, 0, 32)
-           | cNBT_GetByteBE(cursor, 1, 32)
-           | cNBT_GetByteBE(cursor, 2, 32)
-           | cNBT_GetByteBE(cursor, 3, 32);
-  } else {
-    result = cNBT_GetByteLE(cursor, 0)
-           | cNBT_GetByteLE(cursor, 1)
-           | cNBT_GetByteLE(cursor, 2)
-           | cNBT_GetByteLE(cursor, 3);
+  for (cNBTArenaBlock *block = arena->blocks, *next; block; block = next) {
+    next = block->next;
+    cNBT_Free(block);
   }
 
-  return (int32_t)result;
+  cNBT_Free(arena);
 }
 
-static int64_t cNBT_ParseI64(
-  cNBTReader *reader
+//-----------------------------------------------------------------------------
+// [SECTION] THREADS
+//-----------------------------------------------------------------------------
+
+#if defined(cNBT_DISABLE_THREADS)
+// Background work runs synchronously.
+#elif defined(_WIN32)
+#define cNBT_THREADS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+typedef SRWLOCK cNBTMutex;
+typedef CONDITION_VARIABLE cNBTCond;
+
+#define cNBT_MUTEX_INIT SRWLOCK_INIT
+#define cNBT_COND_INIT CONDITION_VARIABLE_INIT
+#define cNBT_MutexLock(mutex) AcquireSRWLockExclusive(mutex)
+#define cNBT_MutexUnlock(mutex) ReleaseSRWLockExclusive(mutex)
+#define cNBT_CondWait(cond, mutex) SleepConditionVariableSRW((cond), (mutex), INFINITE, 0)
+#define cNBT_CondSignal(cond) WakeConditionVariable(cond)
+#define cNBT_CondBroadcast(cond) WakeAllConditionVariable(cond)
+#define cNBT_MutexInit(mutex) InitializeSRWLock(mutex)
+#define cNBT_CondInit(cond) InitializeConditionVariable(cond)
+#define cNBT_MutexDestroy(mutex) ((void)(mutex))
+#define cNBT_CondDestroy(cond) ((void)(cond))
+#define cNBT_THREAD_FN(name) static DWORD WINAPI name(LPVOID arg)
+
+// Start a detached thread. Returns 0 on failure.
+static uint8_t cNBT_ThreadStart(
+  LPTHREAD_START_ROUTINE fn,
+  void *arg
 ) {
-  const uint8_t *cursor = cNBT_GetCursor(reader);
-  uint32_t resultHi, resultLo;
-  uint64_t result;
+  HANDLE thread = CreateThread(cNBT_NULLPTR, 0, fn, arg, 0, cNBT_NULLPTR);
 
-  reader->offset += 8;
+  if (!thread)
+    return 0;
+  CloseHandle(thread);
 
-  if (reader->bigEndian) {
-    resultHi = cNBT_GetByteBE(cursor, 0, 32)
-             | cNBT_GetByteBE(cursor, 1, 32)
-             | cNBT_GetByteBE(cursor, 2, 32)
-             | cNBT_GetByteBE(cursor, 3, 32);
-    resultLo = cNBT_GetByteBE(cursor + 4, 0, 32)
-             | cNBT_GetByteBE(cursor + 4, 1, 32)
-             | cNBT_GetByteBE(cursor + 4, 2, 32)
-             | cNBT_GetByteBE(cursor + 4, 3, 32);
-  } else {
-    resultLo = cNBT_GetByteLE(cursor, 0)
-             | cNBT_GetByteLE(cursor, 1)
-             | cNBT_GetByteLE(cursor, 2)
-             | cNBT_GetByteLE(cursor, 3);
-    resultHi = cNBT_GetByteLE(cursor + 4, 0)
-             | cNBT_GetByteLE(cursor + 4, 1)
-             | cNBT_GetByteLE(cursor + 4, 2)
-             | cNBT_GetByteLE(cursor + 4, 3);
-  }
+  return 1;
+}
+#elif defined(__unix__) || defined(__APPLE__)
+#define cNBT_THREADS
+#include <pthread.h>
+
+typedef pthread_mutex_t cNBTMutex;
+typedef pthread_cond_t cNBTCond;
+
+#define cNBT_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define cNBT_COND_INIT PTHREAD_COND_INITIALIZER
+#define cNBT_MutexLock(mutex) pthread_mutex_lock(mutex)
+#define cNBT_MutexUnlock(mutex) pthread_mutex_unlock(mutex)
+#define cNBT_CondWait(cond, mutex) pthread_cond_wait((cond), (mutex))
+#define cNBT_CondSignal(cond) pthread_cond_signal(cond)
+#define cNBT_CondBroadcast(cond) pthread_cond_broadcast(cond)
+#define cNBT_MutexInit(mutex) pthread_mutex_init((mutex), cNBT_NULLPTR)
+#define cNBT_CondInit(cond) pthread_cond_init((cond), cNBT_NULLPTR)
+#define cNBT_MutexDestroy(mutex) pthread_mutex_destroy(mutex)
+#define cNBT_CondDestroy(cond) pthread_cond_destroy(cond)
+#define cNBT_THREAD_FN(name) static void *name(void *arg)
+
+// Start a detached thread. Returns 0 on failure.
+static uint8_t cNBT_ThreadStart(
+  void *(*fn)(void *),
+  void *arg
+) {
+  pthread_t thread;
 
-  result = (uint64_t)resultHi << 32 | (uint64_t)resultLo;
+  if (pthread_create(&thread, cNBT_NULLPTR, fn, arg))
+    return 0;
+  pthread_detach(thread);
 
-  return (int64_t)result;
+  return 1;
 }
+#endif
 
-static float cNBT_ParseF32(
-  cNBTReader *reader
+//-----------------------------------------------------------------------------
+// [SECTION] NBT READER
+//-----------------------------------------------------------------------------
+
+// Portable access to bytes, for targets whose byte order is unknown.
+#define cNBT_GetByteLE(curs, offs) (((uint32_t)*((curs) + (offs))) << ((offs) * 8))
+#define cNBT_GetByteBE(curs, offs, size) (((uint32_t)*((curs) + (offs))) << ((size) - (offs) * 8 - 8))
+
+// The reader and the writer are instantiated once per byte order, with the
+// byte order passed as a constant to the functions below. On targets with a
+// known byte order, values are loaded and stored with memcpy() and swapped
+// when the data uses the other one.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define cNBT_HOST_BIG_ENDIAN 1
+#else
+#define cNBT_HOST_BIG_ENDIAN 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define cNBT_FORCE_INLINE inline __attribute__((always_inline))
+#ifdef __BYTE_ORDER__
+#define cNBT_NATIVE_CODEC
+#define cNBT_BSwap16(x) __builtin_bswap16(x)
+#define cNBT_BSwap32(x) __builtin_bswap32(x)
+#define cNBT_BSwap64(x) __builtin_bswap64(x)
+#endif
+#elif defined(_MSC_VER)
+#define cNBT_FORCE_INLINE __forceinline
+#define cNBT_NATIVE_CODEC
+#define cNBT_BSwap16(x) _byteswap_ushort(x)
+#define cNBT_BSwap32(x) _byteswap_ulong(x)
+#define cNBT_BSwap64(x) _byteswap_uint64(x)
+#else
+#define cNBT_FORCE_INLINE inline
+#endif
+
+static cNBT_FORCE_INLINE uint16_t cNBT_Load16(
+  const uint8_t *cursor,
+  const uint8_t bigEndian
+) {
+#ifdef cNBT_NATIVE_CODEC
+  uint16_t result;
+  memcpy((void *)&result, (void *)cursor, sizeof(result));
+  return !bigEndian == !cNBT_HOST_BIG_ENDIAN ? result : cNBT_BSwap16(result);
+#else
+  if (bigEndian)
+    return (uint16_t)(cNBT_GetByteBE(cursor, 0, 16)
+                    | cNBT_GetByteBE(cursor, 1, 16));
+  return (uint16_t)(cNBT_GetByteLE(cursor, 0)
+                  | cNBT_GetByteLE(cursor, 1));
+#endif
+}
+
+static cNBT_FORCE_INLINE uint32_t cNBT_Load32(
+  const uint8_t *cursor,
+  const uint8_t bigEndian
+) {
+#ifdef cNBT_NATIVE_CODEC
+  uint32_t result;
+  memcpy((void *)&result, (void *)cursor, sizeof(result));
+  return !bigEndian == !cNBT_HOST_BIG_ENDIAN ? result : cNBT_BSwap32(result);
+#else
+  if (bigEndian)
+    return cNBT_GetByteBE(cursor, 0, 32)
+         | cNBT_GetByteBE(cursor, 1, 32)
+         | cNBT_GetByteBE(cursor, 2, 32)
+         | cNBT_GetByteBE(cursor, 3, 32);
+  return cNBT_GetByteLE(cursor, 0)
+       | cNBT_GetByteLE(cursor, 1)
+       | cNBT_GetByteLE(cursor, 2)
+       | cNBT_GetByteLE(cursor, 3);
+#endif
+}
+
+static cNBT_FORCE_INLINE uint64_t cNBT_Load64(
+  const uint8_t *cursor,
+  const uint8_t bigEndian
+) {
+#ifdef cNBT_NATIVE_CODEC
+  uint64_t result;
+  memcpy((void *)&result, (void *)cursor, sizeof(result));
+  return !bigEndian == !cNBT_HOST_BIG_ENDIAN ? result : cNBT_BSwap64(result);
+#else
+  if (bigEndian)
+    return (uint64_t)cNBT_Load32(cursor, 1) << 32 | cNBT_Load32(cursor + 4, 1);
+  return (uint64_t)cNBT_Load32(cursor + 4, 0) << 32 | cNBT_Load32(cursor, 0);
+#endif
+}
+
+// Convert `length` elements of `size` bytes between the byte order of the
+// data and the byte order of the target, in place.
+static cNBT_FORCE_INLINE void cNBT_SwapArray(
+  void *data,
+  size_t length,
+  const size_t size,
+  const uint8_t bigEndian
+) {
+  uint8_t *cursor = (uint8_t *)data;
+
+#ifdef cNBT_NATIVE_CODEC
+  if (size == 1 || !bigEndian == !cNBT_HOST_BIG_ENDIAN)
+    return;
+#endif
+
+  if (size == 2) {
+    for (size_t i = 0; i < length; i++, cursor += 2) {
+      uint16_t value = cNBT_Load16(cursor, bigEndian);
+      memcpy((void *)cursor, (void *)&value, 2);
+    }
+  } else if (size == 4) {
+    for (size_t i = 0; i < length; i++, cursor += 4) {
+      uint32_t value = cNBT_Load32(cursor, bigEndian);
+      memcpy((void *)cursor, (void *)&value, 4);
+    }
+  } else if (size == 8) {
+    for (size_t i = 0; i < length; i++, cursor += 8) {
+      uint64_t value = cNBT_Load64(cursor, bigEndian);
+      memcpy((void *)cursor, (void *)&value, 8);
+    }
+  }
+}
+
+#define cNBT_GetCursor(obj) (((uint8_t *)(obj)->data + (obj)->offset))
+
+#ifndef cNBT_MAX_DEPTH
+#define cNBT_MAX_DEPTH 512
+#endif
+
+// A list or object recorded by cNBT_PARSE_DEDUPLICATE, with the position of
+// its payload in the source data.
+typedef struct {
+  uint64_t hash;
+  size_t start;
+  size_t length;
+  cNBT *item;
+} cNBTDedupEntry;
+
+// Hash table of the lists and objects read so far, local to a parse.
+typedef struct {
+  cNBTDedupEntry *entries;
+  // Capacity - 1, or 0 before the first entry.
+  size_t mask;
+  size_t count;
+  cNBTDedupStats stats;
+} cNBTDedup;
+
+typedef struct {
+  const void *data;
+  size_t offset;
+  size_t length;
+  uint8_t bigEndian;
+  uint32_t errorFlag;
+  // Current nesting level of lists and objects.
+  uint32_t depth;
+  // Combination of cNBT_PARSE_* flags.
+  uint32_t flags;
+  // Maximum nesting level accepted by cNBT_ParseX(), 0 for cNBT_MAX_DEPTH.
+  uint32_t maxDepth;
+  // Shape cache of cNBT_ParseX(), or NULL.
+  cNBTShapeCache *shapes;
+  // Subtrees recorded by cNBT_PARSE_DEDUPLICATE, or NULL.
+  cNBTDedup *dedup;
+  // Whether budgets of cNBTParseOptions are set, and the budgets, 0 for no
+  // limit, with what's used of them.
+  uint8_t budgeted;
+  size_t maxBytes;
+  size_t maxNodes;
+  uint32_t maxArrayLength;
+  uint32_t maxStringLength;
+  size_t bytes;
+  size_t nodes;
+#ifdef cNBT_ENABLE_PROFILING
+  // Local counters merged into the global profile after parsing, or NULL.
+  cNBTProfile *profile;
+  uint64_t profileChildren;
+#endif
+} cNBTReader;
+
+// Declaration of the dispatcher function.
+static void cNBT_ParseX(
+  cNBTReader *reader,
+  cNBT *item,
+  uint8_t type);
+
+// Check whether `size` bytes can be read at the cursor. The error flag is set
+// when the data is truncated, and all further reads will return zero.
+static inline uint8_t cNBT_ReaderCheck(
+  cNBTReader *reader,
+  size_t size
+) {
+  if (reader->errorFlag || reader->length - reader->offset < size) {
+    if (!reader->errorFlag)
+      reader->errorFlag = cNBT_PARSE_ERROR_MALFORMED;
+    return 0;
+  }
+  return 1;
+}
+
+// Stop the reader with a cNBT_PARSE_ERROR_* code, unless it already failed.
+#define cNBT_ReaderFail(reader, code) do {\
+  if (!(reader)->errorFlag)\
+    (reader)->errorFlag = (code);\
+} while (0)
+
+// Charge `nodes` nodes and `bytes` heap bytes to the budgets of the reader,
+// before allocating them. Only called when `reader->budgeted` is set. Returns
+// 0, with the error set, if a budget is exceeded.
+static uint8_t cNBT_ReaderCharge(
+  cNBTReader *reader,
+  size_t nodes,
+  size_t bytes
+) {
+  if (reader->maxNodes && nodes > reader->maxNodes - reader->nodes) {
+    cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_NODES);
+    return 0;
+  }
+  if (reader->maxBytes && bytes > reader->maxBytes - reader->bytes) {
+    cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_BYTES);
+    return 0;
+  }
+  reader->nodes += nodes;
+  reader->bytes += bytes;
+
+  return 1;
+}
+
+static int8_t cNBT_ParseI08(
+  cNBTReader *reader
+) {
+  if (!cNBT_ReaderCheck(reader, 1))
+    return 0;
+  const uint8_t *cursor = cNBT_GetCursor(reader);
+  reader->offset += 1;
+  return (int8_t)cNBT_GetByteLE(cursor, 0);
+}
+
+// Basic type readers. The *E variants take the byte order as a constant, the
+// others read it from the reader.
+
+static cNBT_FORCE_INLINE int16_t cNBT_ParseI16E(
+  cNBTReader *reader,
+  const uint8_t bigEndian
+) {
+  if (!cNBT_ReaderCheck(reader, 2))
+    return 0;
+  const uint8_t *cursor = cNBT_GetCursor(reader);
+  reader->offset += 2;
+  return (int16_t)cNBT_Load16(cursor, bigEndian);
+}
+
+static cNBT_FORCE_INLINE int32_t cNBT_ParseI32E(
+  cNBTReader *reader,
+  const uint8_t bigEndian
+) {
+  if (!cNBT_ReaderCheck(reader, 4))
+    return 0;
+  const uint8_t *cursor = cNBT_GetCursor(reader);
+  reader->offset += 4;
+  return (int32_t)cNBT_Load32(cursor, bigEndian);
+}
+
+static cNBT_FORCE_INLINE int64_t cNBT_ParseI64E(
+  cNBTReader *reader,
+  const uint8_t bigEndian
+) {
+  if (!cNBT_ReaderCheck(reader, 8))
+    return 0;
+  const uint8_t *cursor = cNBT_GetCursor(reader);
+  reader->offset += 8;
+  return (int64_t)cNBT_Load64(cursor, bigEndian);
+}
+
+static cNBT_FORCE_INLINE float cNBT_ParseF32E(
+  cNBTReader *reader,
+  const uint8_t bigEndian
 ) {
   float result;
-  int32_t tmp = cNBT_ParseI32(reader);
+  int32_t tmp = cNBT_ParseI32E(reader, bigEndian);
   memcpy((void *)&result, (void *)&tmp, sizeof(float));
   return result;
 }
 
-static double cNBT_ParseF64(
-  cNBTReader *reader
+static cNBT_FORCE_INLINE double cNBT_ParseF64E(
+  cNBTReader *reader,
+  const uint8_t bigEndian
+) {
+  double result;
+  int64_t tmp = cNBT_ParseI64E(reader, bigEndian);
+  memcpy((void *)&result, (void *)&tmp, sizeof(double));
+  return result;
+}
+
+static int16_t cNBT_ParseI16(
+  cNBTReader *reader
+) {
+  return cNBT_ParseI16E(reader, reader->bigEndian);
+}
+
+static int32_t cNBT_ParseI32(
+  cNBTReader *reader
+) {
+  return cNBT_ParseI32E(reader, reader->bigEndian);
+}
+
+static int64_t cNBT_ParseI64(
+  cNBTReader *reader
+) {
+  return cNBT_ParseI64E(reader, reader->bigEndian);
+}
+
+static float cNBT_ParseF32(
+  cNBTReader *reader
+) {
+  return cNBT_ParseF32E(reader, reader->bigEndian);
+}
+
+static double cNBT_ParseF64(
+  cNBTReader *reader
+) {
+  return cNBT_ParseF64E(reader, reader->bigEndian);
+}
+
+// Read a string.
+static cNBT_FORCE_INLINE uint16_t cNBT_ParseStrE(
+  cNBTReader *reader,
+  char **result,
+  uint8_t category,
+  const uint8_t bigEndian
+) {
+  uint16_t length = (uint16_t)cNBT_ParseI16E(reader, bigEndian);
+
+  if (!cNBT_ReaderCheck(reader, length)) {
+    *result = cNBT_NULLPTR;
+    return 0;
+  }
+  if (reader->budgeted) {
+    if (reader->maxStringLength && length > reader->maxStringLength)
+      cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_STRING_LENGTH);
+    if (reader->errorFlag || !cNBT_ReaderCharge(reader, 0, (size_t)length + 1)) {
+      *result = cNBT_NULLPTR;
+      return 0;
+    }
+  }
+
+  const uint8_t *cursor = cNBT_GetCursor(reader);
+  char *valueString = cNBT_AllocAs(length + 1, category);
+
+  if (!valueString) {
+    cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_NO_MEMORY);
+    *result = cNBT_NULLPTR;
+    return 0;
+  }
+  if (length)
+    memcpy((void *)valueString, (void *)cursor, length);
+  valueString[length] = '\0';
+  reader->offset += length;
+
+  *result = valueString;
+
+  return length;
+}
+
+static uint16_t cNBT_ParseStr(
+  cNBTReader *reader,
+  char **result,
+  uint8_t category
+) {
+  return cNBT_ParseStrE(reader, result, category, reader->bigEndian);
+}
+
+// Minimal size of the payload of each type, used to reject lists and arrays
+// with lengths that can't fit in the remaining data before allocating them.
+static const uint8_t cNBT_PayloadMinSize[] = {
+  0, 1, 2, 4, 8, 4, 8, 4, 2, 5, 1, 4, 4
+};
+
+// Read an array of `size`-byte integers. The elements are copied at once and
+// swapped in place if needed, or left in the source data with
+// cNBT_PARSE_ARRAY_VIEWS.
+static cNBT_FORCE_INLINE void cNBT_ParseArrE(
+  cNBTReader *reader,
+  cNBT *item,
+  const size_t size,
+  const uint8_t bigEndian
+) {
+  int32_t l = cNBT_ParseI32E(reader, bigEndian);
+  void *valueArr = cNBT_NULLPTR;
+
+  if (l < 0 || !cNBT_ReaderCheck(reader, (size_t)l * size)) {
+    cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_MALFORMED);
+    l = 0;
+  } else if (
+    reader->budgeted
+    && (
+      (reader->maxArrayLength && (uint32_t)l > reader->maxArrayLength)
+      || (
+        !(reader->flags & cNBT_PARSE_ARRAY_VIEWS)
+        && !cNBT_ReaderCharge(reader, 0, (size_t)l * size)
+      )
+    )
+  ) {
+    cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_ARRAY_LENGTH);
+    l = 0;
+  } else if (l && (reader->flags & cNBT_PARSE_ARRAY_VIEWS)) {
+    valueArr = (void *)cNBT_GetCursor(reader);
+    reader->offset += (size_t)l * size;
+    item->flags |= cNBT_FLAG_BORROWED_VALUE | cNBT_FLAG_ARRAY_VIEW;
+    if (bigEndian)
+      item->flags |= cNBT_FLAG_SOURCE_BIG_ENDIAN;
+  } else if (l) {
+    valueArr = cNBT_AllocAs((size_t)l * size, cNBT_MEM_ARRAY);
+    if (!valueArr) {
+      cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_NO_MEMORY);
+      l = 0;
+    } else {
+      memcpy(valueArr, (void *)cNBT_GetCursor(reader), (size_t)l * size);
+      reader->offset += (size_t)l * size;
+      cNBT_SwapArray(valueArr, (size_t)l, size, bigEndian);
+    }
+  }
+
+  item->value.lengthArray = l;
+  item->value.valueArray = valueArr;
+}
+
+// Number of parser stack frames kept on the C stack, 48 bytes each on 64-bit
+// targets (64 with cNBT_ENABLE_PROFILING), so 12 KB. The stack is moved to the
+// heap for data nested deeper than this.
+#define cNBT_PARSE_INLINE_FRAMES 256
+
+#define cNBT_ReaderMaxDepth(reader) \
+  ((reader)->maxDepth ? (reader)->maxDepth : cNBT_MAX_DEPTH)
+
+// A list or object being read by cNBT_ParseX(). The last child read is found
+// with `item->child->prev`.
+typedef struct {
+  cNBT *item;
+  // Offset of the payload of the item.
+  size_t start;
+  // With a shape cache, the shape an object matches so far, or the predicted
+  // shape of the objects of a list.
+  cNBTShape *shape;
+  // With deduplication, the hash of the payload up to offset `hashed`.
+  uint64_t hash;
+  size_t hashed;
+  // Number of elements left in a list, or -1 for an object.
+  int32_t remaining;
+  // Slot of the next item of an object in `shape`.
+  uint32_t slot;
+#ifdef cNBT_ENABLE_PROFILING
+  cNBTProfileScope scope;
+#define cNBT_FrameScope(frame) (&(frame)->scope)
+#else
+#define cNBT_FrameScope(frame) cNBT_NULLPTR
+#endif
+} cNBTParseFrame;
+
+// Shape hooks of cNBT_ParseX(), see [SECTION] SHAPES. Set the predicted shape
+// of a frame just pushed.
+static void cNBT_ShapePush(
+  cNBTReader *reader,
+  cNBTParseFrame *frames,
+  uint32_t index);
+
+// Read the key of the next item of an object matching its shape, the type
+// byte being read. Returns 0 if it doesn't match, without reading the key.
+static uint8_t cNBT_ShapeMatchKey(
+  cNBTReader *reader,
+  cNBTParseFrame *frame,
+  cNBT *item);
+
+// Shape an object or list whose frame was just popped.
+static void cNBT_ShapePop(
+  cNBTReader *reader,
+  cNBTParseFrame *frames,
+  uint32_t index);
+
+// Deduplication hook of cNBT_ParseX(), see [SECTION] DEDUPLICATION. Share
+// the children of an identical list or object read before with the one whose
+// frame was just popped, or record it.
+static void cNBT_DedupPop(
+  cNBTReader *reader,
+  cNBTParseFrame *frames,
+  uint32_t index);
+
+// Double the capacity of the parser stack.
+static uint8_t cNBT_ParseGrow(
+  cNBTParseFrame **frames,
+  uint32_t *capacity,
+  const cNBTParseFrame *inlineFrames
+) {
+  cNBTParseFrame *result = cNBT_Alloc((size_t)*capacity * 2 * sizeof(cNBTParseFrame));
+
+  if (!result)
+    return 0;
+
+  memcpy((void *)result, *frames, (size_t)*capacity * sizeof(cNBTParseFrame));
+  if (*frames != inlineFrames)
+    cNBT_Free(*frames);
+  *frames = result;
+  *capacity *= 2;
+
+  return 1;
+}
+
+// Finish an item whose payload ends at the cursor.
+static inline void cNBT_ParseEnd(
+  cNBTReader *reader,
+  cNBT *item,
+  size_t start,
+  cNBTProfileScope *scope
+) {
+  if (
+    (reader->flags & cNBT_PARSE_TRACK_SOURCE)
+    && reader->offset - start <= UINT32_MAX
+  ) {
+    item->source = (const uint8_t *)reader->data + start;
+    item->sourceLength = (uint32_t)(reader->offset - start);
+    if (reader->bigEndian)
+      item->flags |= cNBT_FLAG_SOURCE_BIG_ENDIAN;
+  }
+
+#ifdef cNBT_ENABLE_PROFILING
+  if (reader->profile)
+    cNBT_ProfileEnd(
+      scope,
+      &reader->profileChildren,
+      &reader->profile->parseTypes[item->type],
+      &reader->profile->parseDepths[cNBT_ProfileDepth(reader->depth)],
+      reader->offset - start);
+#else
+  (void)scope;
+#endif
+}
+
+// Read the elements of a list of non-container items in one loop per type,
+// instead of dispatching on the type of each element.
+#define cNBT_ParseLeafLoop(reader, list, length, read) do {\
+  cNBT *first = cNBT_NULLPTR\
+    , *last = cNBT_NULLPTR;\
+  for (int32_t i = 0; i < (length) && !(reader)->errorFlag; i++) {\
+    cNBT *item = cNBT_AllocAs(sizeof(cNBT), cNBT_MEM_NODE);\
+    size_t start = (reader)->offset;\
+    if (!item) {\
+      cNBT_ReaderFail((reader), cNBT_PARSE_ERROR_NO_MEMORY);\
+      break;\
+    }\
+    memset((void *)item, 0, sizeof(cNBT));\
+    item->type = (list)->listElementType;\
+    item->parent = (list);\
+    if (last) {\
+      last->next = item;\
+      item->prev = last;\
+    } else {\
+      first = item;\
+    }\
+    last = item;\
+    read;\
+    cNBT_ParseEnd((reader), item, start, cNBT_NULLPTR);\
+  }\
+  if (first)\
+    first->prev = last;\
+  (list)->child = first;\
+} while (0)
+
+static cNBT_FORCE_INLINE void cNBT_ParseLeafList(
+  cNBTReader *reader,
+  cNBT *list,
+  int32_t length,
+  const uint8_t bigEndian
+) {
+  switch (list->listElementType) {
+    case cNBT_I08:
+      cNBT_ParseLeafLoop(reader, list, length, item->value.valueI08 = cNBT_ParseI08(reader));
+      break;
+    case cNBT_I16:
+      cNBT_ParseLeafLoop(reader, list, length, item->value.valueI16 = cNBT_ParseI16E(reader, bigEndian));
+      break;
+    case cNBT_I32:
+      cNBT_ParseLeafLoop(reader, list, length, item->value.valueI32 = cNBT_ParseI32E(reader, bigEndian));
+      break;
+    case cNBT_I64:
+      cNBT_ParseLeafLoop(reader, list, length, item->value.valueI64 = cNBT_ParseI64E(reader, bigEndian));
+      break;
+    case cNBT_F32:
+      cNBT_ParseLeafLoop(reader, list, length, item->value.valueF32 = cNBT_ParseF32E(reader, bigEndian));
+      break;
+    case cNBT_F64:
+      cNBT_ParseLeafLoop(reader, list, length, item->value.valueF64 = cNBT_ParseF64E(reader, bigEndian));
+      break;
+    case cNBT_STR:
+      cNBT_ParseLeafLoop(
+        reader,
+        list,
+        length,
+        item->value.lengthString = cNBT_ParseStrE(reader, &item->value.valueString, cNBT_MEM_STRING, bigEndian));
+      break;
+    case cNBT_A08:
+      cNBT_ParseLeafLoop(
+        reader,
+        list,
+        length,
+        cNBT_ParseArrE(reader, item, 1, bigEndian));
+      break;
+    case cNBT_A32:
+      cNBT_ParseLeafLoop(
+        reader,
+        list,
+        length,
+        cNBT_ParseArrE(reader, item, 4, bigEndian));
+      break;
+    case cNBT_A64:
+      cNBT_ParseLeafLoop(
+        reader,
+        list,
+        length,
+        cNBT_ParseArrE(reader, item, 8, bigEndian));
+      break;
+  }
+}
+
+// The reader jumps to the handler of each type through a table of label
+// addresses where the compiler supports it, and uses a switch elsewhere.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(cNBT_DISABLE_COMPUTED_GOTO)
+#define cNBT_COMPUTED_GOTO
+#define cNBT_DispatchTable(table) static const void *const table[] = {\
+  &&parseInvalid, &&parseI08, &&parseI16, &&parseI32, &&parseI64,\
+  &&parseF32, &&parseF64, &&parseA08, &&parseStr, &&parseLst,\
+  &&parseObj, &&parseA32, &&parseA64\
+};
+#define cNBT_Dispatch(table, type) goto *(table)[(type) <= cNBT_A64 ? (type) : cNBT_END];
+#define cNBT_Handler(label, type) label
+#define cNBT_DefaultHandler(label) label
+#else
+#define cNBT_DispatchTable(table)
+#define cNBT_Dispatch(table, type) switch (type)
+#define cNBT_Handler(label, type) case type
+#define cNBT_DefaultHandler(label) default
+#endif
+
+// Profiling hooks of cNBT_ParseX(), usable inside macros.
+#ifdef cNBT_ENABLE_PROFILING
+#define cNBT_ReaderProfiling(reader) ((reader)->profile != cNBT_NULLPTR)
+#define cNBT_ReaderProfileBegin(reader, scope) do {\
+  if ((reader)->profile)\
+    cNBT_ProfileBegin((scope), &(reader)->profileChildren);\
+} while (0)
+#define cNBT_FrameSetScope(frame, value) ((frame)->scope = (value))
+#else
+#define cNBT_ReaderProfiling(reader) 0
+#define cNBT_ReaderProfileBegin(reader, scope) (void)(scope)
+#define cNBT_FrameSetScope(frame, value) (void)(value)
+#endif
+
+// Define cNBT_ParseX##suffix(), which parses an item of the specified type in
+// the byte order `bigEndian`. `item` must be zeroed except for its key and
+// links. Lists and objects are read with an explicit stack instead of
+// recursion, so the usage of the C stack doesn't depend on the nesting level
+// of the data.
+//
+// The parser is a macro rather than an inline function because compilers
+// can't duplicate functions taking the address of their labels.
+#define cNBT_DefineParseX(suffix, bigEndian) \
+static void cNBT_ParseX##suffix(\
+  cNBTReader *reader,\
+  cNBT *item,\
+  uint8_t type\
+) {\
+  cNBTParseFrame inlineFrames[cNBT_PARSE_INLINE_FRAMES]\
+    , *frames = inlineFrames\
+    , *frame;\
+  uint32_t top = 0\
+    , capacity = cNBT_PARSE_INLINE_FRAMES\
+    , maxDepth = cNBT_ReaderMaxDepth(reader);\
+  int32_t remaining;\
+  uint8_t elementType;\
+  size_t start;\
+  cNBTProfileScope scope;\
+  cNBT_DispatchTable(handlers)\
+\
+  for (;;) {\
+    /* Read the payload of `item`. */\
+    start = reader->offset;\
+    cNBT_ReaderProfileBegin(reader, &scope);\
+    item->type = type;\
+\
+    cNBT_Dispatch(handlers, type) {\
+      /* Basic types. */\
+      cNBT_Handler(parseI08, cNBT_I08):\
+        item->value.valueI08 = cNBT_ParseI08(reader);\
+        goto itemDone;\
+      cNBT_Handler(parseI16, cNBT_I16):\
+        item->value.valueI16 = cNBT_ParseI16E(reader, bigEndian);\
+        goto itemDone;\
+      cNBT_Handler(parseI32, cNBT_I32):\
+        item->value.valueI32 = cNBT_ParseI32E(reader, bigEndian);\
+        goto itemDone;\
+      cNBT_Handler(parseI64, cNBT_I64):\
+        item->value.valueI64 = cNBT_ParseI64E(reader, bigEndian);\
+        goto itemDone;\
+      cNBT_Handler(parseF32, cNBT_F32):\
+        item->value.valueF32 = cNBT_ParseF32E(reader, bigEndian);\
+        goto itemDone;\
+      cNBT_Handler(parseF64, cNBT_F64):\
+        item->value.valueF64 = cNBT_ParseF64E(reader, bigEndian);\
+        goto itemDone;\
+\
+      /* Arrays. */\
+      cNBT_Handler(parseA08, cNBT_A08):\
+        cNBT_ParseArrE(reader, item, 1, bigEndian);\
+        goto itemDone;\
+      cNBT_Handler(parseA32, cNBT_A32):\
+        cNBT_ParseArrE(reader, item, 4, bigEndian);\
+        goto itemDone;\
+      cNBT_Handler(parseA64, cNBT_A64):\
+        cNBT_ParseArrE(reader, item, 8, bigEndian);\
+        goto itemDone;\
+\
+      /* String. */\
+      cNBT_Handler(parseStr, cNBT_STR):\
+        item->value.lengthString = cNBT_ParseStrE(\
+          reader, &item->value.valueString, cNBT_MEM_STRING, bigEndian);\
+        goto itemDone;\
+\
+      /* List. */\
+      cNBT_Handler(parseLst, cNBT_LST):\
+        if (reader->depth >= maxDepth) {\
+          cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_DEPTH);\
+          goto itemDone;\
+        }\
+\
+        elementType = cNBT_ParseI08(reader);\
+        remaining = cNBT_ParseI32E(reader, bigEndian);\
+        if (\
+          elementType > cNBT_A64\
+          || remaining < 0\
+          || (elementType == cNBT_END && remaining)\
+        ) {\
+          cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_MALFORMED);\
+          goto itemDone;\
+        }\
+        item->listElementType = elementType;\
+        if (\
+          !remaining\
+          || !cNBT_ReaderCheck(reader, (size_t)remaining * cNBT_PayloadMinSize[elementType])\
+        )\
+          goto itemDone;\
+        /* The elements are charged at once. */\
+        if (\
+          reader->budgeted\
+          && !cNBT_ReaderCharge(reader, (size_t)remaining, (size_t)remaining * sizeof(cNBT))\
+        )\
+          goto itemDone;\
+\
+        if (\
+          elementType != cNBT_LST\
+          && elementType != cNBT_OBJ\
+          && !cNBT_ReaderProfiling(reader)\
+          && !reader->dedup\
+        ) {\
+          /* Lists of non-container items don't need a stack frame, unless\
+             they're deduplicated when popped. */\
+          reader->depth++;\
+          cNBT_ParseLeafList(reader, item, remaining, bigEndian);\
+          reader->depth--;\
+          goto itemDone;\
+        }\
+        goto pushFrame;\
+\
+      /* Object. */\
+      cNBT_Handler(parseObj, cNBT_OBJ):\
+        if (reader->depth >= maxDepth) {\
+          cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_DEPTH);\
+          goto itemDone;\
+        }\
+        remaining = -1;\
+\
+      pushFrame:\
+        if (top == capacity && !cNBT_ParseGrow(&frames, &capacity, inlineFrames)) {\
+          cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_NO_MEMORY);\
+          goto itemDone;\
+        }\
+\
+        frame = &frames[top++];\
+        frame->item = item;\
+        frame->remaining = remaining;\
+        frame->start = start;\
+        frame->shape = cNBT_NULLPTR;\
+        frame->hash = type;\
+        frame->hashed = start;\
+        cNBT_FrameSetScope(frame, scope);\
+        if (reader->shapes)\
+          cNBT_ShapePush(reader, frames, top - 1);\
+        reader->depth++;\
+        goto nextItem;\
+\
+      cNBT_DefaultHandler(parseInvalid):\
+        /* Invalid type byte. */\
+        cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_MALFORMED);\
+        goto nextItem;\
+    }\
+\
+  itemDone:\
+    cNBT_ParseEnd(reader, item, start, &scope);\
+\
+  nextItem:\
+    /* Find the next item to read, and close finished lists and objects. */\
+    item = cNBT_NULLPTR;\
+    while (top && !reader->errorFlag) {\
+      frame = &frames[top - 1];\
+\
+      if (frame->remaining > 0) {\
+        frame->remaining--;\
+        type = frame->item->listElementType;\
+      } else if (frame->remaining < 0 && (type = cNBT_ParseI08(reader)) != cNBT_END) {\
+        if (type > cNBT_A64) {\
+          cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_MALFORMED);\
+          break;\
+        }\
+        /* Items of objects are charged one by one. */\
+        if (reader->budgeted && !cNBT_ReaderCharge(reader, 1, sizeof(cNBT)))\
+          break;\
+      } else {\
+        top--;\
+        reader->depth--;\
+        if (reader->shapes)\
+          cNBT_ShapePop(reader, frames, top);\
+        cNBT_ParseEnd(reader, frame->item, frame->start, cNBT_FrameScope(frame));\
+        if (reader->dedup)\
+          cNBT_DedupPop(reader, frames, top);\
+        continue;\
+      }\
+\
+      /* Create next node. */\
+      item = cNBT_AllocAs(sizeof(cNBT), cNBT_MEM_NODE);\
+      if (!item) {\
+        cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_NO_MEMORY);\
+        break;\
+      }\
+      memset((void *)item, 0, sizeof(cNBT));\
+      item->parent = frame->item;\
+      if (frame->item->child) {\
+        cNBT *first = frame->item->child;\
+        first->prev->next = item;\
+        item->prev = first->prev;\
+        first->prev = item;\
+      } else {\
+        frame->item->child = item;\
+        item->prev = item;\
+      }\
+\
+      /* Parse the key of the element. */\
+      if (\
+        frame->remaining < 0\
+        && !(frame->shape && cNBT_ShapeMatchKey(reader, frame, item))\
+      )\
+        cNBT_ParseStrE(reader, &item->key, cNBT_MEM_KEY, bigEndian);\
+      break;\
+    }\
+\
+    if (!item || reader->errorFlag)\
+      break;\
+  }\
+\
+  reader->depth -= top;\
+\
+  if (frames != inlineFrames)\
+    cNBT_Free(frames);\
+}
+
+cNBT_DefineParseX(BE, 1)
+cNBT_DefineParseX(LE, 0)
+
+// Parse an item in the byte order of the reader.
+static void cNBT_ParseX(
+  cNBTReader *reader,
+  cNBT *item,
+  uint8_t type
+) {
+  if (reader->bigEndian)
+    cNBT_ParseXBE(reader, item, type);
+  else
+    cNBT_ParseXLE(reader, item, type);
+}
+
+// Skip a payload of the specified type without building any node.
+static void cNBT_SkipX(
+  cNBTReader *reader,
+  uint8_t type
+) {
+  int32_t length;
+  uint8_t elementType;
+
+  switch (type) {
+    case cNBT_I08:
+    case cNBT_I16:
+    case cNBT_I32:
+    case cNBT_I64:
+    case cNBT_F32:
+    case cNBT_F64:
+      if (cNBT_ReaderCheck(reader, cNBT_PayloadMinSize[type]))
+        reader->offset += cNBT_PayloadMinSize[type];
+      return;
+
+    case cNBT_STR:
+      length = (uint16_t)cNBT_ParseI16(reader);
+      if (cNBT_ReaderCheck(reader, (size_t)length))
+        reader->offset += (size_t)length;
+      return;
+
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      length = cNBT_ParseI32(reader);
+      if (length < 0) {
+        reader->errorFlag = 1;
+        return;
+      }
+      if (cNBT_ReaderCheck(reader, (size_t)length * (type == cNBT_A08 ? 1 : type == cNBT_A32 ? 4 : 8)))
+        reader->offset += (size_t)length * (type == cNBT_A08 ? 1 : type == cNBT_A32 ? 4 : 8);
+      return;
+
+    case cNBT_LST:
+      elementType = cNBT_ParseI08(reader);
+      length = cNBT_ParseI32(reader);
+      if (
+        elementType > cNBT_A64
+        || length < 0
+        || (elementType == cNBT_END && length)
+        || !cNBT_ReaderCheck(reader, (size_t)length * cNBT_PayloadMinSize[elementType])
+      ) {
+        reader->errorFlag = 1;
+        return;
+      }
+      if (elementType <= cNBT_F64) {
+        // Fixed size elements.
+        reader->offset += (size_t)length * cNBT_PayloadMinSize[elementType];
+        return;
+      }
+      if (++reader->depth > cNBT_MAX_DEPTH) {
+        reader->errorFlag = 1;
+        return;
+      }
+      while (length-- > 0 && !reader->errorFlag)
+        cNBT_SkipX(reader, elementType);
+      reader->depth--;
+      return;
+
+    case cNBT_OBJ:
+      if (++reader->depth > cNBT_MAX_DEPTH) {
+        reader->errorFlag = 1;
+        return;
+      }
+      for (
+        uint8_t childType = cNBT_ParseI08(reader);
+        childType && !reader->errorFlag;
+        childType = cNBT_ParseI08(reader)
+      ) {
+        // Skip the key and the payload.
+        cNBT_SkipX(reader, cNBT_STR);
+        if (childType > cNBT_A64)
+          reader->errorFlag = 1;
+        else
+          cNBT_SkipX(reader, childType);
+      }
+      reader->depth--;
+      return;
+
+    default:
+      reader->errorFlag = 1;
+      return;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] NBT WRITER
+//-----------------------------------------------------------------------------
+
+#define cNBT_SetByteLE(curs, offs, data) (void)(*(((uint8_t *)(curs)) + (offs)) = ((data) >> ((offs) * 8)) & 0xFF)
+#define cNBT_SetByteBE(curs, offs, data, size) (void)(*(((uint8_t *)(curs)) + (offs)) = ((data) >> ((size) - (offs) * 8 - 8)) & 0xFF)
+
+typedef struct {
+  void *data;
+  size_t offset;
+  size_t capacity;
+  uint8_t bigEndian;
+  uint32_t errorFlag;
+  // Minimum length of the payloads referenced in place by cNBT_WriteV(), or 0
+  // to copy them all into `data`.
+  size_t reference;
+  // Segments of cNBT_WriteV(). Segments with a NULL `data` are bytes of
+  // `data`, following the previous ones.
+  cNBTSegment *segments;
+  size_t segmentCount;
+  size_t segmentCapacity;
+  // Start of the bytes written since the last segment.
+  size_t segmentOffset;
+#ifdef cNBT_ENABLE_PROFILING
+  cNBTProfile *profile;
+  uint64_t profileChildren;
+  uint32_t depth;
+#endif
+} cNBTWriter;
+
+// Dispatcher function.
+static void cNBT_WriteX(
+  cNBTWriter *writer, cNBT *item);
+
+// Expand the capacity of the writer. Returns 0 and sets `errorFlag` when the
+// memory can't be allocated, in which case the buffer is left as is and
+// nothing must be written.
+static inline uint8_t cNBT_Expand(
+  cNBTWriter *writer,
+  size_t length
+) {
+  if (writer->offset + length <= writer->capacity)
+    return 1;
+  size_t capacity = writer->capacity * 2;
+  while (capacity < writer->offset + length)
+    capacity *= 2;
+  void *data = cNBT_ReallocAs(writer->data, writer->offset, capacity, cNBT_MEM_WRITER);
+  if (!data) {
+    writer->errorFlag = 1;
+    return 0;
+  }
+  writer->data = data;
+  writer->capacity = capacity;
+  return 1;
+}
+
+static void cNBT_WriteBytes(
+  cNBTWriter *writer,
+  const void *data,
+  size_t length
+) {
+  if (!length || !cNBT_Expand(writer, length))
+    return;
+  memcpy(cNBT_GetCursor(writer), data, length);
+  writer->offset += length;
+}
+
+// Whether arrays of `size`-byte elements in the byte order of the host are
+// also in the byte order `bigEndian`.
+#ifdef cNBT_NATIVE_CODEC
+#define cNBT_IsHostOrder(size, bigEndian) ((size) == 1 || !(bigEndian) == !cNBT_HOST_BIG_ENDIAN)
+#else
+#define cNBT_IsHostOrder(size, bigEndian) ((size) == 1)
+#endif
+
+static void cNBT_PushSegment(
+  cNBTWriter *writer,
+  const void *data,
+  size_t length
+) {
+  if (writer->segmentCount == writer->segmentCapacity) {
+    size_t capacity = writer->segmentCapacity ? writer->segmentCapacity * 2 : 16;
+    cNBTSegment *segments = cNBT_ReallocAs(
+      writer->segments,
+      writer->segmentCount * sizeof(cNBTSegment),
+      capacity * sizeof(cNBTSegment),
+      cNBT_MEM_WRITER);
+
+    if (!segments) {
+      writer->errorFlag = 1;
+      return;
+    }
+    writer->segments = segments;
+    writer->segmentCapacity = capacity;
+  }
+
+  writer->segments[writer->segmentCount].data = data;
+  writer->segments[writer->segmentCount].length = length;
+  writer->segmentCount++;
+}
+
+// Reference `length` bytes at `data` as a segment of cNBT_WriteV() instead of
+// copying them. The caller checks `writer->reference` first.
+static void cNBT_WriteReference(
+  cNBTWriter *writer,
+  const void *data,
+  size_t length
+) {
+  if (writer->offset > writer->segmentOffset)
+    cNBT_PushSegment(writer, cNBT_NULLPTR, writer->offset - writer->segmentOffset);
+  writer->segmentOffset = writer->offset;
+  cNBT_PushSegment(writer, data, length);
+}
+
+// Basic type writers.
+
+static void cNBT_WriteI08(
+  cNBTWriter *writer,
+  uint8_t data
+) {
+  if (!cNBT_Expand(writer, sizeof(int8_t)))
+    return;
+  uint8_t *cursor = cNBT_GetCursor(writer);
+  *cursor = data;
+  writer->offset += 1;
+}
+
+static cNBT_FORCE_INLINE void cNBT_Store16(
+  uint8_t *cursor,
+  uint16_t data,
+  const uint8_t bigEndian
+) {
+#ifdef cNBT_NATIVE_CODEC
+  if (!bigEndian != !cNBT_HOST_BIG_ENDIAN)
+    data = cNBT_BSwap16(data);
+  memcpy((void *)cursor, (void *)&data, sizeof(data));
+#else
+  if (bigEndian) {
+    cNBT_SetByteBE(cursor, 0, data, 16);
+    cNBT_SetByteBE(cursor, 1, data, 16);
+  } else {
+    cNBT_SetByteLE(cursor, 0, data);
+    cNBT_SetByteLE(cursor, 1, data);
+  }
+#endif
+}
+
+static cNBT_FORCE_INLINE void cNBT_Store32(
+  uint8_t *cursor,
+  uint32_t data,
+  const uint8_t bigEndian
+) {
+#ifdef cNBT_NATIVE_CODEC
+  if (!bigEndian != !cNBT_HOST_BIG_ENDIAN)
+    data = cNBT_BSwap32(data);
+  memcpy((void *)cursor, (void *)&data, sizeof(data));
+#else
+  if (bigEndian) {
+    cNBT_SetByteBE(cursor, 0, data, 32);
+    cNBT_SetByteBE(cursor, 1, data, 32);
+    cNBT_SetByteBE(cursor, 2, data, 32);
+    cNBT_SetByteBE(cursor, 3, data, 32);
+  } else {
+    cNBT_SetByteLE(cursor, 0, data);
+    cNBT_SetByteLE(cursor, 1, data);
+    cNBT_SetByteLE(cursor, 2, data);
+    cNBT_SetByteLE(cursor, 3, data);
+  }
+#endif
+}
+
+static cNBT_FORCE_INLINE void cNBT_Store64(
+  uint8_t *cursor,
+  uint64_t data,
+  const uint8_t bigEndian
+) {
+#ifdef cNBT_NATIVE_CODEC
+  if (!bigEndian != !cNBT_HOST_BIG_ENDIAN)
+    data = cNBT_BSwap64(data);
+  memcpy((void *)cursor, (void *)&data, sizeof(data));
+#else
+  if (bigEndian) {
+    cNBT_Store32(cursor, (uint32_t)(data >> 32), 1);
+    cNBT_Store32(cursor + 4, (uint32_t)data, 1);
+  } else {
+    cNBT_Store32(cursor, (uint32_t)data, 0);
+    cNBT_Store32(cursor + 4, (uint32_t)(data >> 32), 0);
+  }
+#endif
+}
+
+// Basic type writers. The *E variants take the byte order as a constant, the
+// others read it from the writer.
+
+static cNBT_FORCE_INLINE void cNBT_WriteI16E(
+  cNBTWriter *writer,
+  int16_t data,
+  const uint8_t bigEndian
+) {
+  if (!cNBT_Expand(writer, sizeof(int16_t)))
+    return;
+  cNBT_Store16(cNBT_GetCursor(writer), (uint16_t)data, bigEndian);
+  writer->offset += 2;
+}
+
+static cNBT_FORCE_INLINE void cNBT_WriteI32E(
+  cNBTWriter *writer,
+  int32_t data,
+  const uint8_t bigEndian
+) {
+  if (!cNBT_Expand(writer, sizeof(int32_t)))
+    return;
+  cNBT_Store32(cNBT_GetCursor(writer), (uint32_t)data, bigEndian);
+  writer->offset += 4;
+}
+
+static cNBT_FORCE_INLINE void cNBT_WriteI64E(
+  cNBTWriter *writer,
+  int64_t data,
+  const uint8_t bigEndian
+) {
+  if (!cNBT_Expand(writer, sizeof(int64_t)))
+    return;
+  cNBT_Store64(cNBT_GetCursor(writer), (uint64_t)data, bigEndian);
+  writer->offset += 8;
+}
+
+static cNBT_FORCE_INLINE void cNBT_WriteF32E(
+  cNBTWriter *writer,
+  float data,
+  const uint8_t bigEndian
+) {
+  int32_t tmp;
+  memcpy((void *)&tmp, (void *)&data, sizeof(float));
+  cNBT_WriteI32E(writer, tmp, bigEndian);
+}
+
+static cNBT_FORCE_INLINE void cNBT_WriteF64E(
+  cNBTWriter *writer,
+  double data,
+  const uint8_t bigEndian
+) {
+  int64_t tmp;
+  memcpy((void *)&tmp, (void *)&data, sizeof(double));
+  cNBT_WriteI64E(writer, tmp, bigEndian);
+}
+
+static cNBT_FORCE_INLINE void cNBT_WriteStrE(
+  cNBTWriter *writer,
+  const char *string,
+  const uint8_t bigEndian
+) {
+  uint16_t length = 0;
+
+  if (string)
+    length = strlen(string);
+  cNBT_WriteI16E(writer, length, bigEndian);
+
+  if (string && length) {
+    // We consider NULL strings as empty string.
+    if (writer->reference && length >= writer->reference) {
+      cNBT_WriteReference(writer, string, length);
+      return;
+    }
+    if (!cNBT_Expand(writer, length))
+      return;
+    memcpy(cNBT_GetCursor(writer), string, length);
+    writer->offset += length;
+  }
+}
+
+// Write an array of `size`-byte integers.
+static cNBT_FORCE_INLINE void cNBT_WriteArrE(
+  cNBTWriter *writer,
+  int32_t length,
+  const void *data,
+  const size_t size,
+  const uint8_t bigEndian
+) {
+  cNBT_WriteI32E(writer, length, bigEndian);
+  if (length <= 0)
+    return;
+
+  if (
+    writer->reference
+    && (size_t)length * size >= writer->reference
+    && cNBT_IsHostOrder(size, bigEndian)
+  ) {
+    cNBT_WriteReference(writer, data, (size_t)length * size);
+    return;
+  }
+
+  if (!cNBT_Expand(writer, (size_t)length * size))
+    return;
+  uint8_t *cursor = cNBT_GetCursor(writer);
+  memcpy((void *)cursor, data, (size_t)length * size);
+  cNBT_SwapArray(cursor, (size_t)length, size, bigEndian);
+  writer->offset += (size_t)length * size;
+}
+
+// Write the array of an item, decoding array views.
+static cNBT_FORCE_INLINE void cNBT_WriteArrItemE(
+  cNBTWriter *writer,
+  cNBT *item,
+  const size_t size,
+  const uint8_t bigEndian
+) {
+  int32_t length = item->value.lengthArray;
+  const uint8_t *data = (const uint8_t *)item->value.valueArray;
+  uint8_t sourceBigEndian = !!(item->flags & cNBT_FLAG_SOURCE_BIG_ENDIAN);
+
+  if (!(item->flags & cNBT_FLAG_ARRAY_VIEW)) {
+    cNBT_WriteArrE(writer, length, data, size, bigEndian);
+    return;
+  }
+
+  cNBT_WriteI32E(writer, length, bigEndian);
+  if (length <= 0)
+    return;
+
+  if (
+    writer->reference
+    && (size_t)length * size >= writer->reference
+    && (size == 1 || sourceBigEndian == !!bigEndian)
+  ) {
+    cNBT_WriteReference(writer, data, (size_t)length * size);
+    return;
+  }
+
+  if (!cNBT_Expand(writer, (size_t)length * size))
+    return;
+  uint8_t *cursor = cNBT_GetCursor(writer);
+  writer->offset += (size_t)length * size;
+
+  if (size == 1 || sourceBigEndian == !!bigEndian) {
+    memcpy((void *)cursor, (void *)data, (size_t)length * size);
+  } else if (size == 4) {
+    for (int32_t i = 0; i < length; i++)
+      cNBT_Store32(cursor + i * 4, cNBT_Load32(data + i * 4, sourceBigEndian), bigEndian);
+  } else {
+    for (int32_t i = 0; i < length; i++)
+      cNBT_Store64(cursor + i * 8, cNBT_Load64(data + i * 8, sourceBigEndian), bigEndian);
+  }
+}
+
+static void cNBT_WriteI16(
+  cNBTWriter *writer,
+  int16_t data
+) {
+  cNBT_WriteI16E(writer, data, writer->bigEndian);
+}
+
+static void cNBT_WriteI32(
+  cNBTWriter *writer,
+  int32_t data
+) {
+  cNBT_WriteI32E(writer, data, writer->bigEndian);
+}
+
+static void cNBT_WriteStr(
+  cNBTWriter *writer,
+  const char *string
+) {
+  cNBT_WriteStrE(writer, string, writer->bigEndian);
+}
+
+// Payload writers of each type, called through a table indexed by type. Each
+// table belongs to one byte order.
+typedef void (*cNBTWriteFn)(
+  cNBTWriter *writer, cNBT *item);
+
+static cNBT_FORCE_INLINE void cNBT_WriteLstE(
+  cNBTWriter *writer,
+  cNBT *nbt,
+  const uint8_t bigEndian,
+  const cNBTWriteFn *handlers);
+
+static cNBT_FORCE_INLINE void cNBT_WriteObjE(
+  cNBTWriter *writer,
+  cNBT *nbt,
+  const uint8_t bigEndian,
+  const cNBTWriteFn *handlers);
+
+// Write the payload of an item.
+static cNBT_FORCE_INLINE void cNBT_WritePayloadE(
+  cNBTWriter *writer,
+  cNBT *item,
+  const uint8_t bigEndian,
+  const cNBTWriteFn *handlers
+) {
+  if (
+    item->source
+    && !(item->flags & cNBT_FLAG_DIRTY)
+    && !(item->flags & cNBT_FLAG_SOURCE_BIG_ENDIAN) == !bigEndian
+  ) {
+    // Unmodified since parsing, copy the payload from the source data.
+    if (writer->reference && item->sourceLength >= writer->reference)
+      cNBT_WriteReference(writer, item->source, item->sourceLength);
+    else
+      cNBT_WriteBytes(writer, item->source, item->sourceLength);
+    return;
+  }
+
+  if (item->type <= cNBT_A64)
+    handlers[item->type](writer, item);
+}
+
+static cNBT_FORCE_INLINE void cNBT_WriteXE(
+  cNBTWriter *writer,
+  cNBT *item,
+  const uint8_t bigEndian,
+  const cNBTWriteFn *handlers
+) {
+#ifdef cNBT_ENABLE_PROFILING
+  if (writer->profile && item->type && item->type <= cNBT_A64) {
+    cNBTProfileScope scope;
+    size_t start = writer->offset;
+    uint32_t depth = writer->depth;
+    uint8_t container = item->type == cNBT_LST || item->type == cNBT_OBJ;
+
+    cNBT_ProfileBegin(&scope, &writer->profileChildren);
+    writer->depth += container;
+    cNBT_WritePayloadE(writer, item, bigEndian, handlers);
+    writer->depth -= container;
+    cNBT_ProfileEnd(
+      &scope,
+      &writer->profileChildren,
+      &writer->profile->writeTypes[item->type],
+      &writer->profile->writeDepths[cNBT_ProfileDepth(depth)],
+      writer->offset - start);
+    return;
+  }
+#endif
+  cNBT_WritePayloadE(writer, item, bigEndian, handlers);
+}
+
+static cNBT_FORCE_INLINE void cNBT_WriteLstE(
+  cNBTWriter *writer,
+  cNBT *nbt,
+  const uint8_t bigEndian,
+  const cNBTWriteFn *handlers
+) {
+  int32_t length = 0;
+  cNBT *item;
+
+  if (!nbt)
+    return;
+
+  cNBT_ForEach(nbt, item)
+    length++;
+  
+  if (length < 0)
+    return;
+
+  cNBT_WriteI08(writer, nbt->listElementType);
+  cNBT_WriteI32E(writer, length, bigEndian);
+
+  if (
+    nbt->listElementType
+    && nbt->listElementType <= cNBT_A64
+    && nbt->listElementType != cNBT_LST
+    && nbt->listElementType != cNBT_OBJ
+#ifdef cNBT_ENABLE_PROFILING
+    && !writer->profile
+#endif
+  ) {
+    // The elements can't contain unmodified subtrees, and encoding them again
+    // gives the same bytes as copying their source, so call the writer of the
+    // element type directly.
+    cNBTWriteFn write = handlers[nbt->listElementType];
+    cNBT_ForEach(nbt, item) {
+      if (item->type == nbt->listElementType)
+        write(writer, item);
+      else
+        cNBT_WriteXE(writer, item, bigEndian, handlers);
+    }
+    return;
+  }
+
+  cNBT_ForEach(nbt, item) {
+    cNBT_WriteXE(writer, item, bigEndian, handlers);
+  }
+}
+
+static cNBT_FORCE_INLINE void cNBT_WriteObjE(
+  cNBTWriter *writer,
+  cNBT *nbt,
+  const uint8_t bigEndian,
+  const cNBTWriteFn *handlers
+) {
+  if (!nbt)
+    return;
+
+  cNBT *item;
+  cNBT_ForEach(nbt, item) {
+    cNBT_WriteI08(writer, item->type);
+    cNBT_WriteStrE(writer, item->key, bigEndian);
+    cNBT_WriteXE(writer, item, bigEndian, handlers);
+  }
+  cNBT_WriteI08(writer, cNBT_END);
+}
+
+static void cNBT_WriteItemNone(
+  cNBTWriter *writer,
+  cNBT *item
+) {
+  (void)writer;
+  (void)item;
+}
+
+static void cNBT_WriteItemI08(
+  cNBTWriter *writer,
+  cNBT *item
+) {
+  cNBT_WriteI08(writer, item->value.valueI08);
+}
+
+// Define cNBT_WriteX##suffix() and the payload writers it dispatches to, in
+// the byte order `bigEndian`.
+#define cNBT_DefineWriteX(suffix, bigEndian) \
+static const cNBTWriteFn cNBT_WriteHandlers##suffix[cNBT_A64 + 1];\
+\
+static void cNBT_WriteItemI16##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteI16E(writer, item->value.valueI16, bigEndian);\
+}\
+static void cNBT_WriteItemI32##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteI32E(writer, item->value.valueI32, bigEndian);\
+}\
+static void cNBT_WriteItemI64##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteI64E(writer, item->value.valueI64, bigEndian);\
+}\
+static void cNBT_WriteItemF32##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteF32E(writer, item->value.valueF32, bigEndian);\
+}\
+static void cNBT_WriteItemF64##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteF64E(writer, item->value.valueF64, bigEndian);\
+}\
+static void cNBT_WriteItemStr##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteStrE(writer, item->value.valueString, bigEndian);\
+}\
+static void cNBT_WriteItemA08##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteArrItemE(writer, item, 1, bigEndian);\
+}\
+static void cNBT_WriteItemA32##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteArrItemE(writer, item, 4, bigEndian);\
+}\
+static void cNBT_WriteItemA64##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteArrItemE(writer, item, 8, bigEndian);\
+}\
+static void cNBT_WriteLst##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteLstE(writer, item, bigEndian, cNBT_WriteHandlers##suffix);\
+}\
+static void cNBT_WriteObj##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteObjE(writer, item, bigEndian, cNBT_WriteHandlers##suffix);\
+}\
+\
+static const cNBTWriteFn cNBT_WriteHandlers##suffix[cNBT_A64 + 1] = {\
+  cNBT_WriteItemNone,\
+  cNBT_WriteItemI08,\
+  cNBT_WriteItemI16##suffix,\
+  cNBT_WriteItemI32##suffix,\
+  cNBT_WriteItemI64##suffix,\
+  cNBT_WriteItemF32##suffix,\
+  cNBT_WriteItemF64##suffix,\
+  cNBT_WriteItemA08##suffix,\
+  cNBT_WriteItemStr##suffix,\
+  cNBT_WriteLst##suffix,\
+  cNBT_WriteObj##suffix,\
+  cNBT_WriteItemA32##suffix,\
+  cNBT_WriteItemA64##suffix\
+};\
+\
+static void cNBT_WriteX##suffix(cNBTWriter *writer, cNBT *item) {\
+  cNBT_WriteXE(writer, item, bigEndian, cNBT_WriteHandlers##suffix);\
+}
+
+cNBT_DefineWriteX(BE, 1)
+cNBT_DefineWriteX(LE, 0)
+
+// Write the payload of an item in the byte order of the writer.
+static void cNBT_WriteX(
+  cNBTWriter *writer,
+  cNBT *item
+) {
+  if (writer->bigEndian)
+    cNBT_WriteXBE(writer, item);
+  else
+    cNBT_WriteXLE(writer, item);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] VALUE OPERATIONS
+//-----------------------------------------------------------------------------
+
+uint8_t cNBT_IsType(
+  const cNBT *const nbt,
+  uint8_t type
+) {
+  if (!nbt)
+    // Invalid object.
+    return 0;
+
+  if (type > cNBT_A64)
+    // Invalid type byte.
+    return 0;
+
+  if (nbt->type != type)
+    return 0;
+
+  return 1;
+}
+
+// Find an item of a shaped object with a slot table, see [SECTION] SHAPES.
+static cNBT *cNBT_ShapeFindNode(
+  const cNBT *nbt,
+  const char *key,
+  size_t length);
+
+cNBT *cNBT_GetNodeByKey(
+  const cNBT *const nbt,
+  const char *key
+) {
+  if (!nbt || !key || nbt->type != cNBT_OBJ)
+    return cNBT_NULLPTR;
+
+  if ((nbt->flags & cNBT_FLAG_SHAPED) && nbt->value.slots)
+    return cNBT_ShapeFindNode(nbt, key, strlen(key));
+
+  cNBT *item;
+  cNBT_ForEach(nbt, item) {
+    if (item->key && !strcmp(key, item->key))
+      return item;
+  }
+
+  return cNBT_NULLPTR;
+}
+
+cNBT *cNBT_GetNodeByKeyTyped(
+  const cNBT *const nbt,
+  const char *key,
+  uint8_t type
+) {
+  if (!nbt || !key || nbt->type != cNBT_OBJ)
+    return cNBT_NULLPTR;
+
+  if ((nbt->flags & cNBT_FLAG_SHAPED) && nbt->value.slots) {
+    cNBT *item = cNBT_ShapeFindNode(nbt, key, strlen(key));
+    return item && item->type == type ? item : cNBT_NULLPTR;
+  }
+
+  cNBT *item;
+  cNBT_ForEach(nbt, item) {
+    if (item->key && !strcmp(key, item->key) && item->type == type)
+      return item;
+  }
+
+  return cNBT_NULLPTR;
+}
+
+cNBT *cNBT_GetNodeByIndex(
+  const cNBT *const nbt,
+  int32_t index
+) {
+  cNBT *result;
+
+  if (!nbt || index < 0)
+    return cNBT_NULLPTR;
+
+  if (nbt->type != cNBT_OBJ && nbt->type != cNBT_LST)
+    return cNBT_NULLPTR;
+
+  result = nbt->child;
+
+  while (index && result) {
+    result = result->next;
+    index--;
+  }
+
+  return result;
+}
+
+uint8_t cNBT_GetNodeType(
+  const cNBT *const nbt
+) {
+  if (!nbt)
+    // Invalid type.
+    return cNBT_END;
+
+  return nbt->type;
+}
+
+const char *cNBT_GetNodeKey(
+  const cNBT *const nbt
+) {
+  if (!nbt)
+    return cNBT_NULLPTR;
+
+  return nbt->key;
+}
+
+uint16_t cNBT_GetValueStringLength(
+  const cNBT *const nbt
+) {
+  if (!nbt || nbt->type != cNBT_STR || !nbt->value.valueString)
+    return 0;
+
+  return nbt->value.lengthString;
+}
+
+const char *cNBT_GetValueString(
+  const cNBT *const nbt
+) {
+  if (!nbt || nbt->type != cNBT_STR  || !nbt->value.valueString)
+    return cNBT_NULLPTR;
+
+  return nbt->value.valueString;
+}
+
+#define cNBT_IsArrayType(type) \
+  ((type) == cNBT_A08 || (type) == cNBT_A32 || (type) == cNBT_A64)
+
+// Byte order of the elements of an array node in memory.
+static inline uint8_t cNBT_ArrayBigEndian(
+  const cNBT *nbt
+) {
+  if (nbt->flags & cNBT_FLAG_ARRAY_VIEW)
+    return !!(nbt->flags & cNBT_FLAG_SOURCE_BIG_ENDIAN);
+  return cNBT_HOST_BIG_ENDIAN;
+}
+
+// Read an element of an array node of any type. `index` must be valid.
+static inline int64_t cNBT_ArrayElement(
+  const cNBT *nbt,
+  int32_t index
+) {
+  const uint8_t *data = (const uint8_t *)nbt->value.valueArray;
+
+  if (nbt->type == cNBT_A08)
+    return ((const int8_t *)data)[index];
+
+  if (nbt->flags & cNBT_FLAG_ARRAY_VIEW) {
+    uint8_t bigEndian = !!(nbt->flags & cNBT_FLAG_SOURCE_BIG_ENDIAN);
+    if (nbt->type == cNBT_A32)
+      return (int32_t)cNBT_Load32(data + (size_t)index * 4, bigEndian);
+    return (int64_t)cNBT_Load64(data + (size_t)index * 8, bigEndian);
+  }
+
+  if (nbt->type == cNBT_A32)
+    return ((const int32_t *)data)[index];
+  return ((const int64_t *)data)[index];
+}
+
+int32_t cNBT_GetArrayLength(
+  const cNBT *const nbt
+) {
+  if (!nbt || !cNBT_IsArrayType(nbt->type) || !nbt->value.valueArray)
+    return 0;
+
+  return nbt->value.lengthArray;
+}
+
+// Check that `index` is a valid element of an array node of the given type.
+#define cNBT_ArrayIndexValid(nbt, type_, index) \
+  ((nbt)\
+  && (nbt)->type == (type_)\
+  && (nbt)->value.valueArray\
+  && (index) >= 0\
+  && (index) < (nbt)->value.lengthArray)
+
+int8_t cNBT_GetArrayElementI08(
+  const cNBT *const nbt,
+  int32_t index
+) {
+  if (!cNBT_ArrayIndexValid(nbt, cNBT_A08, index))
+    return 0;
+
+  return (int8_t)cNBT_ArrayElement(nbt, index);
+}
+
+int32_t cNBT_GetArrayElementI32(
+  const cNBT *const nbt,
+  int32_t index
+) {
+  if (!cNBT_ArrayIndexValid(nbt, cNBT_A32, index))
+    return 0;
+
+  return (int32_t)cNBT_ArrayElement(nbt, index);
+}
+
+int64_t cNBT_GetArrayElementI64(
+  const cNBT *const nbt,
+  int32_t index
+) {
+  if (!cNBT_ArrayIndexValid(nbt, cNBT_A64, index))
+    return 0;
+
+  return cNBT_ArrayElement(nbt, index);
+}
+
+uint8_t cNBT_ArrayMaterialize(
+  cNBT *nbt
+) {
+  if (!nbt)
+    return 0;
+  if (!(nbt->flags & cNBT_FLAG_ARRAY_VIEW))
+    return 1;
+
+  size_t size = nbt->type == cNBT_A08 ? 1 : nbt->type == cNBT_A32 ? 4 : 8;
+  void *data = cNBT_NULLPTR;
+
+  if (nbt->value.lengthArray > 0) {
+    data = cNBT_AllocAs((size_t)nbt->value.lengthArray * size, cNBT_MEM_ARRAY);
+    if (!data)
+      return 0;
+    memcpy(data, nbt->value.valueArray, (size_t)nbt->value.lengthArray * size);
+    cNBT_SwapArray(
+      data,
+      (size_t)nbt->value.lengthArray,
+      size,
+      !!(nbt->flags & cNBT_FLAG_SOURCE_BIG_ENDIAN));
+  }
+
+  // The content doesn't change, so the node isn't marked as modified.
+  nbt->value.valueArray = data;
+  nbt->flags &= ~(cNBT_FLAG_ARRAY_VIEW | cNBT_FLAG_BORROWED_VALUE);
+
+  return 1;
+}
+
+// Copy the chains on the path to `nbt` and its own child chain if they are
+// shared, and move `*item` to its copy. See [SECTION] SNAPSHOTS.
+static cNBT *cNBT_UnshareChildren(
+  cNBT *nbt,
+  cNBT **item);
+
+// Drop the shape of an object, before its children change.
+static void cNBT_DropShape(
+  cNBT *nbt
+) {
+  if (!nbt || !(nbt->flags & cNBT_FLAG_SHAPED))
+    return;
+
+  if (nbt->value.slots)
+    cNBT_Free(nbt->value.slots);
+  nbt->value.shape = cNBT_NULLPTR;
+  nbt->value.slots = cNBT_NULLPTR;
+  nbt->flags &= ~cNBT_FLAG_SHAPED;
+}
+
+cNBT *cNBT_CreateNode(
+  uint8_t type
+) {
+  if (type > cNBT_A64)
+    // Invalid type byte.
+    return cNBT_NULLPTR;
+
+  cNBT *result = cNBT_AllocAs(sizeof(cNBT), cNBT_MEM_NODE);
+  memset((void *)result, 0, sizeof(cNBT));
+
+  result->type = type;
+
+  return result;
+}
+
+cNBT *cNBT_AddNode(
+  cNBT *nbt,
+  cNBT *item,
+  const char *key
+) {
+  if (!nbt || !item)
+    // Invalid parameters.
+    return cNBT_NULLPTR;
+
+  if (nbt->type != cNBT_LST && nbt->type != cNBT_OBJ)
+    // Not compatible types.
+    return cNBT_NULLPTR;
+
+  if (nbt->type == cNBT_OBJ && (!key || cNBT_GetNodeByKey(nbt, key)))
+    // Missing or existed key.
+    return cNBT_NULLPTR;
+
+  if (nbt->type == cNBT_LST && item->type != nbt->listElementType)
+    // Not compatible types.
+    return cNBT_NULLPTR;
+
+  if (item->next || item->prev)
+    // Not independent item.
+    // We don't know where the item from, so we just return.
+    return cNBT_NULLPTR;
+
+  nbt = cNBT_UnshareChildren(nbt, cNBT_NULLPTR);
+
+  // Free the existing key.
+  if (item->key && !(item->flags & cNBT_FLAG_BORROWED_KEY))
+    cNBT_Free(item->key);
+  item->flags &= ~cNBT_FLAG_BORROWED_KEY;
+
+  // Copy the key.
+  if (nbt->type != cNBT_LST)
+    // FIXME: Add length check for the key.
+    item->key = cNBT_StrDup(key, cNBT_MEM_KEY);
+  else
+    item->key = cNBT_NULLPTR;
+
+  item->parent = nbt;
+  cNBT_DropShape(nbt);
+  cNBT_MarkDirty(nbt);
+
+  if (!nbt->child) {
+    // Set as a child of given object.
+    nbt->child = item;
+    item->prev = item;
+    item->next = cNBT_NULLPTR;
+
+    return nbt;
+  }
+
+  // Append to the child list. The first item points to the last one.
+  cNBT *last = nbt->child->prev;
+  last->next = item;
+  item->next = cNBT_NULLPTR;
+  item->prev = last;
+  nbt->child->prev = item;
+
+  return nbt;
+}
+
+cNBT *cNBT_SetListElementType(
+  cNBT *nbt,
+  uint8_t type
+) {
+  if (!nbt || nbt->type != cNBT_LST)
+    // Invalid NBT object.
+    return cNBT_NULLPTR;
+
+  if (!type || type > cNBT_A64)
+    // Invalid type byte.
+    return cNBT_NULLPTR;
+
+  if (nbt->listElementType && nbt->child)
+    // We can't override the type of a list with child nodes.
+    return cNBT_NULLPTR;
+
+  nbt = cNBT_Unshare(nbt);
+  nbt->listElementType = type;
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+cNBT *cNBT_SetValueI08(
+  cNBT *nbt,
+  int8_t data
+) {
+  if (!nbt || nbt->type != cNBT_I08)
+    return cNBT_NULLPTR;
+
+  nbt = cNBT_Unshare(nbt);
+  nbt->value.valueI08 = data;
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+cNBT *cNBT_SetValueI16(
+  cNBT *nbt,
+  int16_t data
+) {
+  if (!nbt || nbt->type != cNBT_I16)
+    return cNBT_NULLPTR;
+
+  nbt = cNBT_Unshare(nbt);
+  nbt->value.valueI16 = data;
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+cNBT *cNBT_SetValueI32(
+  cNBT *nbt,
+  int32_t data
+) {
+  if (!nbt || nbt->type != cNBT_I32)
+    return cNBT_NULLPTR;
+
+  nbt = cNBT_Unshare(nbt);
+  nbt->value.valueI32 = data;
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+cNBT *cNBT_SetValueI64(
+  cNBT *nbt,
+  int64_t data
+) {
+  if (!nbt || nbt->type != cNBT_I64)
+    return cNBT_NULLPTR;
+
+  nbt = cNBT_Unshare(nbt);
+  nbt->value.valueI64 = data;
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+cNBT *cNBT_SetValueF32(
+  cNBT *nbt,
+  float data
+) {
+  if (!nbt || nbt->type != cNBT_F32)
+    return cNBT_NULLPTR;
+
+  nbt = cNBT_Unshare(nbt);
+  nbt->value.valueF32 = data;
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+cNBT *cNBT_SetValueF64(
+  cNBT *nbt,
+  double data
+) {
+  if (!nbt || nbt->type != cNBT_F64)
+    return cNBT_NULLPTR;
+
+  nbt = cNBT_Unshare(nbt);
+  nbt->value.valueF64 = data;
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+cNBT *cNBT_SetValueString(
+  cNBT *nbt,
+  const char *string,
+  uint16_t length
+) {
+  size_t actualLength;
+
+  if (!nbt || !string || nbt->type != cNBT_STR)
+    return cNBT_NULLPTR;
+
+  if (!length) {
+    actualLength = strlen(string);
+    if (actualLength > 65535)
+      // Does nothing when the string is too long.
+      return cNBT_NULLPTR;
+    // Get the string's actual length.
+    length = (uint16_t)actualLength;
+  }
+
+  nbt = cNBT_Unshare(nbt);
+  if (nbt->value.valueString && !(nbt->flags & cNBT_FLAG_BORROWED_VALUE))
+    cNBT_Free(nbt->value.valueString);
+  nbt->flags &= ~cNBT_FLAG_BORROWED_VALUE;
+
+  nbt->value.valueString = cNBT_StrNDup(string, length, &actualLength, cNBT_MEM_STRING);
+  nbt->value.lengthString = (uint16_t)actualLength;
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+cNBT *cNBT_SetValueArray(
+  cNBT *nbt,
+  const void *data,
+  int32_t length
+) {
+  size_t perElement = 0;
+
+  if (!nbt || !data || length < 0)
+    return cNBT_NULLPTR;
+
+  switch (nbt->type) {
+    case cNBT_A08:
+      perElement = sizeof(int8_t);
+      break;
+
+    case cNBT_A32:
+      perElement = sizeof(int32_t);
+      break;
+
+    case cNBT_A64:
+      perElement = sizeof(int64_t);
+      break;
+
+    default:
+      return cNBT_NULLPTR;
+  }
+
+  nbt = cNBT_Unshare(nbt);
+  if (nbt->value.valueArray && !(nbt->flags & cNBT_FLAG_BORROWED_VALUE))
+    cNBT_Free(nbt->value.valueArray);
+  nbt->flags &= ~(cNBT_FLAG_BORROWED_VALUE | cNBT_FLAG_ARRAY_VIEW);
+
+  nbt->value.lengthArray = length;
+
+  if (length) {
+    nbt->value.valueArray = cNBT_AllocAs(length * perElement, cNBT_MEM_ARRAY);
+    memcpy(nbt->value.valueArray, data, length * perElement);
+  } else {
+    nbt->value.valueArray = cNBT_NULLPTR;
+  }
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+cNBT *cNBT_RemoveNode(
+  cNBT *nbt,
+  cNBT *item
+) {
+  if (!nbt || !item)
+    // Invalid parameters.
+    return cNBT_NULLPTR;
+
+  if (item->parent != nbt || (item != nbt->child && !item->prev))
+    // The item is the child of other objects.
+    return cNBT_NULLPTR;
+
+  nbt = cNBT_UnshareChildren(nbt, &item);
+  if (item != nbt->child)
+    // Not the first element.
+    item->prev->next = item->next;
+
+  if (item->next)
+    // Not the last element.
+    item->next->prev = item->prev;
+
+  if (item == nbt->child)
+    // The first element of the list.
+    nbt->child = item->next;
+  else if (!item->next)
+    // The last element of the list.
+    nbt->child->prev = item->prev;
+
+  // Detach the node from the list.
+  item->next = item->prev = item->parent = cNBT_NULLPTR;
+  cNBT_DropShape(nbt);
+  cNBT_MarkDirty(nbt);
+
+  return item;
+}
+
+cNBT *cNBT_Clear(
+  cNBT *nbt
+) {
+  if (!nbt)
+    return cNBT_NULLPTR;
+
+  if (nbt->type != cNBT_LST && nbt->type != cNBT_OBJ)
+    return cNBT_NULLPTR;
+
+  // The chain is only released if it's shared.
+  nbt = cNBT_Unshare(nbt);
+  if (nbt->type == cNBT_LST)
+    nbt->listElementType = cNBT_END;
+
+  cNBT_Delete(nbt->child);
+  nbt->child = cNBT_NULLPTR;
+  cNBT_DropShape(nbt);
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+void cNBT_MarkDirty(
+  cNBT *nbt
+) {
+  // The ancestors of a dirty item are always dirty.
+  for (; nbt && !(nbt->flags & cNBT_FLAG_DIRTY); nbt = nbt->parent)
+    nbt->flags |= cNBT_FLAG_DIRTY;
+}
+
+void cNBT_ReleaseSource(
+  cNBT *nbt
+) {
+  if (!nbt)
+    return;
+
+  nbt->source = cNBT_NULLPTR;
+  nbt->sourceLength = 0;
+  if (cNBT_ArrayMaterialize(nbt))
+    nbt->flags &= ~cNBT_FLAG_SOURCE_BIG_ENDIAN;
+
+  cNBT *item;
+  cNBT_ForEach(nbt, item)
+    cNBT_ReleaseSource(item);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] GENERAL OPERATIONS
+//-----------------------------------------------------------------------------
+
+// Drop a reference to a chain. Returns 1 if it wasn't shared, and the caller
+// frees it. See [SECTION] SNAPSHOTS.
+static inline uint8_t cNBT_ChainRelease(
+  cNBT *chain);
+
+void cNBT_Delete(
+  cNBT *nbt
+) {
+  cNBTFreeBatch batch;
+
+  batch.count = 0;
+
+  if (nbt && !cNBT_ChainRelease(nbt))
+    // The chain is still shared, by snapshots or by the tree.
+    return;
+
+  for (cNBT *item = nbt, *next; item; item = next) {
+    next = item->next;
+
+    if (item->child && cNBT_ChainRelease(item->child)) {
+      // Splice the child chain in front of the remaining items instead of
+      // recursing, the last child is found with the `prev` of the first one.
+      cNBT *last = item->child->prev;
+      if (!last || last->next)
+        for (last = item->child; last->next; last = last->next);
+      last->next = next;
+      next = item->child;
+    }
+
+    if (!(item->flags & cNBT_FLAG_BORROWED_VALUE)) {
+      if (
+        item->type == cNBT_A08
+        || item->type == cNBT_A32
+        || item->type == cNBT_A64
+      )
+        cNBT_BatchFree(&batch, item->value.valueArray);
+      if (item->type == cNBT_STR)
+        cNBT_BatchFree(&batch, item->value.valueString);
+    }
+    if ((item->flags & cNBT_FLAG_SHAPED) && item->value.slots)
+      cNBT_BatchFree(&batch, item->value.slots);
+    if (item->key && !(item->flags & cNBT_FLAG_BORROWED_KEY))
+      cNBT_BatchFree(&batch, item->key);
+
+    if (!(item->flags & cNBT_FLAG_ARENA))
+      cNBT_BatchFree(&batch, item);
+  }
+
+  cNBT_BatchFlush(&batch);
+}
+
+#ifdef cNBT_THREADS
+static cNBTMutex gDeleteMutex = cNBT_MUTEX_INIT;
+// Signaled when trees are queued, and when all queued trees are freed.
+static cNBTCond gDeleteQueued = cNBT_COND_INIT;
+static cNBTCond gDeleteDone = cNBT_COND_INIT;
+// Trees waiting to be freed, linked with their `parent` pointers.
+static cNBT *gDeleteQueue = cNBT_NULLPTR;
+// Number of trees queued or being freed.
+static size_t gDeletePending = 0;
+static uint8_t gDeleteThread = 0;
+
+cNBT_THREAD_FN(cNBT_DeleteWorker) {
+  (void)arg;
+
+  cNBT_MutexLock(&gDeleteMutex);
+  for (;;) {
+    while (!gDeleteQueue)
+      cNBT_CondWait(&gDeleteQueued, &gDeleteMutex);
+
+    cNBT *queue = gDeleteQueue;
+    size_t count = 0;
+
+    gDeleteQueue = cNBT_NULLPTR;
+    cNBT_MutexUnlock(&gDeleteMutex);
+
+    for (cNBT *item = queue, *next; item; item = next) {
+      next = item->parent;
+      cNBT_Delete(item);
+      count++;
+    }
+
+    cNBT_MutexLock(&gDeleteMutex);
+    gDeletePending -= count;
+    if (!gDeletePending)
+      cNBT_CondBroadcast(&gDeleteDone);
+  }
+
+  return 0;
+}
+#endif
+
+void cNBT_DeleteAsync(
+  cNBT *nbt
+) {
+  if (!nbt)
+    return;
+
+#ifdef cNBT_THREADS
+  cNBT_MutexLock(&gDeleteMutex);
+  if (!gDeleteThread)
+    gDeleteThread = cNBT_ThreadStart(cNBT_DeleteWorker, cNBT_NULLPTR);
+  if (gDeleteThread) {
+    nbt->parent = gDeleteQueue;
+    gDeleteQueue = nbt;
+    gDeletePending++;
+    cNBT_CondSignal(&gDeleteQueued);
+    cNBT_MutexUnlock(&gDeleteMutex);
+    return;
+  }
+  cNBT_MutexUnlock(&gDeleteMutex);
+#endif
+
+  // No thread available.
+  cNBT_Delete(nbt);
+}
+
+void cNBT_WaitDeletes(void) {
+#ifdef cNBT_THREADS
+  cNBT_MutexLock(&gDeleteMutex);
+  while (gDeletePending)
+    cNBT_CondWait(&gDeleteDone, &gDeleteMutex);
+  cNBT_MutexUnlock(&gDeleteMutex);
+#endif
+}
+
+cNBT *cNBT_Parse(
+  const void *data,
+  size_t size,
+  uint8_t bigEndian
+) {
+  return cNBT_ParseEx(data, size, bigEndian, cNBT_NULLPTR);
+}
+
+cNBT *cNBT_ParseEx(
+  const void *data,
+  size_t size,
+  uint8_t bigEndian,
+  const cNBTParseOptions *options
+) {
+  uint8_t *error = options ? options->error : cNBT_NULLPTR;
+
+  if (!data) {
+    if (error)
+      *error = cNBT_PARSE_ERROR_MALFORMED;
+    return cNBT_NULLPTR;
+  }
+
+  cNBTReader reader = {
+    .bigEndian = bigEndian,
+    .data = data,
+    .length = size,
+    .offset = 0,
+    .errorFlag = 0,
+    .depth = 0,
+    .flags = options ? options->flags : 0,
+    .maxDepth = options ? options->maxDepth : 0,
+    .shapes = options ? options->shapes : cNBT_NULLPTR
+  };
+  cNBTDedup dedup;
+
+  if (options) {
+    reader.maxBytes = options->maxBytes;
+    reader.maxNodes = options->maxNodes;
+    reader.maxArrayLength = options->maxArrayLength;
+    reader.maxStringLength = options->maxStringLength;
+    reader.budgeted = reader.maxBytes || reader.maxNodes
+      || reader.maxArrayLength || reader.maxStringLength;
+  }
+
+  if (reader.flags & cNBT_PARSE_DEDUPLICATE) {
+    memset(&dedup, 0, sizeof(cNBTDedup));
+    reader.dedup = &dedup;
+  }
+
+#ifdef cNBT_ENABLE_PROFILING
+  cNBTProfile profile = { .parses = 1 };
+  reader.profile = &profile;
+#endif
+
+  cNBT *result = cNBT_NULLPTR;
+  uint8_t type = cNBT_ParseI08(&reader);
+
+  if (reader.budgeted)
+    cNBT_ReaderCharge(&reader, 1, sizeof(cNBT));
+  if (!reader.errorFlag && !(result = cNBT_AllocAs(sizeof(cNBT), cNBT_MEM_NODE)))
+    reader.errorFlag = cNBT_PARSE_ERROR_NO_MEMORY;
+
+  if (result) {
+    memset((void *)result, 0, sizeof(cNBT));
+
+    // Parse the key of the element.
+    cNBT_ParseStr(&reader, &result->key, cNBT_MEM_KEY);
+    cNBT_ParseX(&reader, result, type);
+  }
+
+#ifdef cNBT_ENABLE_PROFILING
+  cNBT_ProfileMerge(&profile);
+#endif
+
+  if (reader.dedup) {
+    if (options->dedupStats)
+      *options->dedupStats = dedup.stats;
+    if (dedup.entries)
+      cNBT_Free(dedup.entries);
+  }
+
+  if (!reader.errorFlag && type == cNBT_END)
+    reader.errorFlag = cNBT_PARSE_ERROR_MALFORMED;
+  if (error)
+    *error = (uint8_t)reader.errorFlag;
+
+  if (reader.errorFlag) {
+    // Truncated or malformed data, or a budget exceeded.
+    cNBT_Delete(result);
+    return cNBT_NULLPTR;
+  }
+
+  return result;
+}
+
+// Write a whole document, the root tag and its payload, after the output of
+// the writer. Returns 0 when the buffer couldn't grow, the writer's offset is
+// then meaningless and the caller must discard what was written.
+static uint8_t cNBT_WriteDocument(
+  cNBTWriter *writer,
+  cNBT *nbt
+) {
+#ifdef cNBT_ENABLE_PROFILING
+  cNBTProfile profile = { .writes = 1 };
+  writer->profile = &profile;
+#endif
+
+  cNBT_WriteI08(writer, nbt->type);
+  cNBT_WriteStr(writer, nbt->key);
+  cNBT_WriteX(writer, nbt);
+
+#ifdef cNBT_ENABLE_PROFILING
+  writer->profile = cNBT_NULLPTR;
+  cNBT_ProfileMerge(&profile);
+#endif
+
+  return !writer->errorFlag;
+}
+
+const void *cNBT_Write(
+  cNBT *nbt,
+  size_t initialCapacity,
+  uint8_t bigEndian,
+  size_t *length
+) {
+  if (!nbt)
+    return cNBT_NULLPTR;
+  if (!initialCapacity)
+    initialCapacity = 0x40;
+
+  cNBTWriter w = {
+    .bigEndian = bigEndian,
+    .capacity = initialCapacity,
+    .errorFlag = 0,
+    .offset = 0,
+    .data = cNBT_AllocAs(initialCapacity, cNBT_MEM_WRITER)
+  };
+
+  if (!w.data)
+    return cNBT_NULLPTR;
+
+  if (!cNBT_WriteDocument(&w, nbt)) {
+    cNBT_Free(w.data);
+    return cNBT_NULLPTR;
+  }
+
+  if (length)
+    *length = w.offset;
+
+  return w.data;
+}
+
+const cNBTSegment *cNBT_WriteV(
+  cNBT *nbt,
+  uint8_t bigEndian,
+  size_t minLength,
+  size_t *count,
+  size_t *length
+) {
+  if (!nbt)
+    return cNBT_NULLPTR;
+
+  cNBTWriter w = {
+    .bigEndian = bigEndian,
+    .capacity = 0x40,
+    .reference = minLength ? minLength : cNBT_WRITEV_MIN_LENGTH,
+    .data = cNBT_AllocAs(0x40, cNBT_MEM_WRITER)
+  };
+  uint8_t *cursor;
+  size_t total = 0;
+
+  if (!w.data)
+    return cNBT_NULLPTR;
+
+  // The first segment keeps the buffer for cNBT_FreeSegments(), and isn't
+  // returned.
+  cNBT_PushSegment(&w, cNBT_NULLPTR, 0);
+  cNBT_WriteI08(&w, nbt->type);
+  cNBT_WriteStr(&w, nbt->key);
+  cNBT_WriteX(&w, nbt);
+  if (w.offset > w.segmentOffset)
+    cNBT_PushSegment(&w, cNBT_NULLPTR, w.offset - w.segmentOffset);
+
+  if (w.errorFlag) {
+    cNBT_Free(w.segments);
+    cNBT_Free(w.data);
+    return cNBT_NULLPTR;
+  }
+
+  // The buffer can't move anymore, point the segments into it.
+  cursor = (uint8_t *)w.data;
+  for (size_t i = 1; i < w.segmentCount; i++) {
+    if (!w.segments[i].data) {
+      w.segments[i].data = cursor;
+      cursor += w.segments[i].length;
+    }
+    total += w.segments[i].length;
+  }
+  w.segments[0].data = w.data;
+
+  if (count)
+    *count = w.segmentCount - 1;
+  if (length)
+    *length = total;
+
+  return w.segments + 1;
+}
+
+void cNBT_FreeSegments(
+  const cNBTSegment *segments
+) {
+  if (!segments)
+    return;
+
+  cNBT_Free(segments[-1].data);
+  cNBT_Free(segments - 1);
+}
+
+struct cNBTWriteSession_t {
+  cNBTWriter writer;
+};
+
+cNBTWriteSession *cNBT_CreateWriteSession(
+  size_t initialCapacity
+) {
+  cNBTWriteSession *session = cNBT_AllocAs(sizeof(cNBTWriteSession), cNBT_MEM_OTHER);
+
+  if (!session)
+    return cNBT_NULLPTR;
+  if (!initialCapacity)
+    initialCapacity = 0x40;
+
+  memset(session, 0, sizeof(cNBTWriteSession));
+  session->writer.capacity = initialCapacity;
+  session->writer.data = cNBT_AllocAs(initialCapacity, cNBT_MEM_WRITER);
+  if (!session->writer.data) {
+    cNBT_Free(session);
+    return cNBT_NULLPTR;
+  }
+
+  return session;
+}
+
+const void *cNBT_SessionWrite(
+  cNBTWriteSession *session,
+  cNBT *nbt,
+  uint8_t bigEndian,
+  size_t *length
+) {
+  if (!session || !nbt)
+    return cNBT_NULLPTR;
+
+  cNBTWriter *writer = &session->writer;
+  size_t start = writer->offset;
+
+  writer->bigEndian = bigEndian;
+  writer->errorFlag = 0;
+  if (!cNBT_WriteDocument(writer, nbt)) {
+    // Drop the partial document, the previous ones are still valid.
+    writer->offset = start;
+    writer->errorFlag = 0;
+    return cNBT_NULLPTR;
+  }
+
+  if (length)
+    *length = writer->offset - start;
+
+  return (const uint8_t *)writer->data + start;
+}
+
+const void *cNBT_SessionData(
+  const cNBTWriteSession *session,
+  size_t *length
+) {
+  if (!session)
+    return cNBT_NULLPTR;
+
+  if (length)
+    *length = session->writer.offset;
+
+  return session->writer.data;
+}
+
+void cNBT_SessionReset(
+  cNBTWriteSession *session
+) {
+  if (session)
+    session->writer.offset = 0;
+}
+
+void cNBT_DeleteWriteSession(
+  cNBTWriteSession *session
+) {
+  if (!session)
+    return;
+
+  cNBT_Free(session->writer.data);
+  cNBT_Free(session);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] JSON EXPORT
+//-----------------------------------------------------------------------------
+
+// Size of the staging buffer; the output is handed to the sink in chunks of
+// at most this many bytes.
+#define cNBT_JSON_BUFFER_SIZE 4096
+
+typedef struct {
+  cNBTSinkFn sink;
+  void *userData;
+  uint32_t flags;
+  int32_t base64Threshold;
+  size_t offset;
+  size_t total;
+  uint8_t failed;
+  char buffer[cNBT_JSON_BUFFER_SIZE];
+} cNBTJSONWriter;
+
+typedef struct {
+  uint8_t pending[3];
+  uint8_t count;
+} cNBTBase64State;
+
+static const char *const cNBT_JSONTypeNames[] = {
+  "end", "byte", "short", "int", "long", "float", "double", "byte_array",
+  "string", "list", "compound", "int_array", "long_array"
+};
+
+static const char cNBT_Base64Digits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void cNBT_JSONFlush(
+  cNBTJSONWriter *json
+) {
+  if (json->offset && !json->failed)
+    if (!json->sink(json->buffer, json->offset, json->userData))
+      json->failed = 1;
+  json->total += json->offset;
+  json->offset = 0;
+}
+
+static void cNBT_JSONPut(
+  cNBTJSONWriter *json,
+  const char *data,
+  size_t length
+) {
+  while (length && !json->failed) {
+    size_t chunk = cNBT_JSON_BUFFER_SIZE - json->offset;
+    if (chunk > length)
+      chunk = length;
+    memcpy(json->buffer + json->offset, data, chunk);
+    json->offset += chunk;
+    data += chunk;
+    length -= chunk;
+    if (json->offset == cNBT_JSON_BUFFER_SIZE)
+      cNBT_JSONFlush(json);
+  }
+}
+
+#define cNBT_JSONPutLiteral(json, literal) \
+  cNBT_JSONPut(json, literal, sizeof(literal) - 1)
+
+static inline void cNBT_JSONPutChar(
+  cNBTJSONWriter *json,
+  char c
+) {
+  json->buffer[json->offset++] = c;
+  if (json->offset == cNBT_JSON_BUFFER_SIZE)
+    cNBT_JSONFlush(json);
+}
+
+// Write a quoted and escaped string. Bytes above 0x7F are passed through, so
+// the output is UTF-8 as long as the NBT string is.
+static void cNBT_JSONPutString(
+  cNBTJSONWriter *json,
+  const char *string,
+  size_t length
+) {
+  static const char hex[] = "0123456789abcdef";
+  size_t start = 0;
+
+  cNBT_JSONPutChar(json, '"');
+  for (size_t i = 0; i < length; i++) {
+    uint8_t c = (uint8_t)string[i];
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+
+    // Copy the run of plain characters before the escaped one.
+    cNBT_JSONPut(json, string + start, i - start);
+    start = i + 1;
+
+    switch (c) {
+      case '"': cNBT_JSONPutLiteral(json, "\\\""); break;
+      case '\\': cNBT_JSONPutLiteral(json, "\\\\"); break;
+      case '\n': cNBT_JSONPutLiteral(json, "\\n"); break;
+      case '\r': cNBT_JSONPutLiteral(json, "\\r"); break;
+      case '\t': cNBT_JSONPutLiteral(json, "\\t"); break;
+      default: {
+        char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+        cNBT_JSONPut(json, escaped, 6);
+      }
+    }
+  }
+  cNBT_JSONPut(json, string + start, length - start);
+  cNBT_JSONPutChar(json, '"');
+}
+
+static void cNBT_JSONPutI64(
+  cNBTJSONWriter *json,
+  int64_t value
+) {
+  char digits[20], *cursor = digits + sizeof(digits);
+  uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+  do {
+    *--cursor = '0' + (char)(magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude);
+
+  if (value < 0)
+    cNBT_JSONPutChar(json, '-');
+  cNBT_JSONPut(json, cursor, digits + sizeof(digits) - cursor);
+}
+
+static void cNBT_JSONPutF64(
+  cNBTJSONWriter *json,
+  double value,
+  int precision
+) {
+  char text[32];
+  int length, i, j;
+
+  if (value != value || value - value != 0) {
+    // NaN and infinities have no JSON representation.
+    cNBT_JSONPutLiteral(json, "null");
+    return;
+  }
+
+  length = snprintf(text, sizeof(text), "%.*g", precision, value);
+
+  // The radix character comes from the locale, and may be a comma or span
+  // several bytes. Replace it with a dot.
+  for (i = j = 0; i < length; i++) {
+    char c = text[i];
+
+    if ((c < '0' || c > '9') && c != '-' && c != '+' && c != 'e') {
+      if (!j || text[j - 1] != '.')
+        text[j++] = '.';
+    } else {
+      text[j++] = c;
+    }
+  }
+  cNBT_JSONPut(json, text, (size_t)j);
+}
+
+static void cNBT_JSONBase64Feed(
+  cNBTJSONWriter *json,
+  cNBTBase64State *state,
+  const uint8_t *data,
+  size_t length
+) {
+  char quad[4];
+
+  while (length) {
+    if (!state->count && length >= 3) {
+      // Fast path for whole groups of 3 bytes.
+      quad[0] = cNBT_Base64Digits[data[0] >> 2];
+      quad[1] = cNBT_Base64Digits[(data[0] & 0x03) << 4 | data[1] >> 4];
+      quad[2] = cNBT_Base64Digits[(data[1] & 0x0F) << 2 | data[2] >> 6];
+      quad[3] = cNBT_Base64Digits[data[2] & 0x3F];
+      cNBT_JSONPut(json, quad, 4);
+      data += 3;
+      length -= 3;
+      continue;
+    }
+
+    state->pending[state->count++] = *data++;
+    length--;
+    if (state->count < 3)
+      continue;
+
+    quad[0] = cNBT_Base64Digits[state->pending[0] >> 2];
+    quad[1] = cNBT_Base64Digits[(state->pending[0] & 0x03) << 4 | state->pending[1] >> 4];
+    quad[2] = cNBT_Base64Digits[(state->pending[1] & 0x0F) << 2 | state->pending[2] >> 6];
+    quad[3] = cNBT_Base64Digits[state->pending[2] & 0x3F];
+    cNBT_JSONPut(json, quad, 4);
+    state->count = 0;
+  }
+}
+
+static void cNBT_JSONBase64End(
+  cNBTJSONWriter *json,
+  cNBTBase64State *state
+) {
+  char quad[4] = { '=', '=', '=', '=' };
+
+  if (state->count) {
+    uint8_t b1 = state->count > 1 ? state->pending[1] : 0;
+    quad[0] = cNBT_Base64Digits[state->pending[0] >> 2];
+    quad[1] = cNBT_Base64Digits[(state->pending[0] & 0x03) << 4 | b1 >> 4];
+    if (state->count > 1)
+      quad[2] = cNBT_Base64Digits[(b1 & 0x0F) << 2];
+    cNBT_JSONPut(json, quad, 4);
+  }
+  cNBT_JSONPutChar(json, '"');
+}
+
+// Check whether an array of `length` elements is emitted as a base64 string.
+#define cNBT_JSONUseBase64(json, length) \
+  (((json)->flags & cNBT_JSON_BASE64_ARRAYS) && (length) >= (json)->base64Threshold)
+
+// Open the `{"type":...,"value":` wrapper of an annotated value.
+static void cNBT_JSONBeginTyped(
+  cNBTJSONWriter *json,
+  uint8_t type,
+  uint8_t listElementType
+) {
+  cNBT_JSONPutLiteral(json, "{\"type\":\"");
+  cNBT_JSONPut(json, cNBT_JSONTypeNames[type], strlen(cNBT_JSONTypeNames[type]));
+  if (type == cNBT_LST) {
+    cNBT_JSONPutLiteral(json, "\",\"elementType\":\"");
+    cNBT_JSONPut(
+      json,
+      cNBT_JSONTypeNames[listElementType],
+      strlen(cNBT_JSONTypeNames[listElementType]));
+  }
+  cNBT_JSONPutLiteral(json, "\",\"value\":");
+}
+
+static void cNBT_JSONArray(
+  cNBTJSONWriter *json,
+  const cNBT *item
+) {
+  uint8_t type = item->type;
+  int32_t length = item->value.lengthArray;
+
+  if (cNBT_JSONUseBase64(json, length)) {
+    // Encode the elements in little-endian byte order.
+    uint8_t chunk[768];
+    size_t used = 0;
+    cNBTBase64State state = { { 0 }, 0 };
+
+    cNBT_JSONPutChar(json, '"');
+    for (int32_t i = 0; i < length; i++) {
+      if (type == cNBT_A08) {
+        chunk[used++] = (uint8_t)cNBT_ArrayElement(item, i);
+      } else if (type == cNBT_A32) {
+        uint32_t d = (uint32_t)cNBT_ArrayElement(item, i);
+        cNBT_SetByteLE(chunk + used, 0, d);
+        cNBT_SetByteLE(chunk + used, 1, d);
+        cNBT_SetByteLE(chunk + used, 2, d);
+        cNBT_SetByteLE(chunk + used, 3, d);
+        used += 4;
+      } else {
+        uint64_t d = (uint64_t)cNBT_ArrayElement(item, i);
+        for (int b = 0; b < 8; b++)
+          cNBT_SetByteLE(chunk + used, b, d);
+        used += 8;
+      }
+      if (used + 8 > sizeof(chunk)) {
+        cNBT_JSONBase64Feed(json, &state, chunk, used);
+        used = 0;
+      }
+    }
+    cNBT_JSONBase64Feed(json, &state, chunk, used);
+    cNBT_JSONBase64End(json, &state);
+    return;
+  }
+
+  cNBT_JSONPutChar(json, '[');
+  for (int32_t i = 0; i < length && !json->failed; i++) {
+    if (i)
+      cNBT_JSONPutChar(json, ',');
+    cNBT_JSONPutI64(json, cNBT_ArrayElement(item, i));
+  }
+  cNBT_JSONPutChar(json, ']');
+}
+
+// Export a node of a cNBT tree. List elements are only annotated when they're
+// lists themselves, since the list carries their type but not their element
+// type.
+static void cNBT_JSONNode(
+  cNBTJSONWriter *json,
+  const cNBT *item,
+  uint8_t typed
+) {
+  const cNBT *child;
+  uint8_t first = 1;
+
+  if (typed)
+    cNBT_JSONBeginTyped(json, item->type, item->listElementType);
+
+  switch (item->type) {
+    case cNBT_I08:
+      cNBT_JSONPutI64(json, item->value.valueI08);
+      break;
+    case cNBT_I16:
+      cNBT_JSONPutI64(json, item->value.valueI16);
+      break;
+    case cNBT_I32:
+      cNBT_JSONPutI64(json, item->value.valueI32);
+      break;
+    case cNBT_I64:
+      cNBT_JSONPutI64(json, item->value.valueI64);
+      break;
+    case cNBT_F32:
+      cNBT_JSONPutF64(json, item->value.valueF32, 9);
+      break;
+    case cNBT_F64:
+      cNBT_JSONPutF64(json, item->value.valueF64, 17);
+      break;
+
+    case cNBT_STR:
+      if (item->value.valueString)
+        cNBT_JSONPutString(json, item->value.valueString, item->value.lengthString);
+      else
+        cNBT_JSONPutLiteral(json, "\"\"");
+      break;
+
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      cNBT_JSONArray(json, item);
+      break;
+
+    case cNBT_LST:
+      cNBT_JSONPutChar(json, '[');
+      cNBT_ForEach(item, child) {
+        if (json->failed)
+          break;
+        if (!first)
+          cNBT_JSONPutChar(json, ',');
+        first = 0;
+        cNBT_JSONNode(json, child, (json->flags & cNBT_JSON_TYPED) && child->type == cNBT_LST);
+      }
+      cNBT_JSONPutChar(json, ']');
+      break;
+
+    case cNBT_OBJ:
+      cNBT_JSONPutChar(json, '{');
+      cNBT_ForEach(item, child) {
+        if (json->failed)
+          break;
+        if (!first)
+          cNBT_JSONPutChar(json, ',');
+        first = 0;
+        cNBT_JSONPutString(json, child->key ? child->key : "", child->key ? strlen(child->key) : 0);
+        cNBT_JSONPutChar(json, ':');
+        cNBT_JSONNode(json, child, json->flags & cNBT_JSON_TYPED);
+      }
+      cNBT_JSONPutChar(json, '}');
+      break;
+
+    default:
+      cNBT_JSONPutLiteral(json, "null");
+      break;
+  }
+
+  if (typed)
+    cNBT_JSONPutChar(json, '}');
+}
+
+static void cNBT_JSONRawArray(
+  cNBTJSONWriter *json,
+  cNBTReader *reader,
+  uint8_t type
+) {
+  size_t elementSize = type == cNBT_A08 ? 1 : type == cNBT_A32 ? 4 : 8;
+  int32_t length = cNBT_ParseI32(reader);
+
+  if (length < 0 || !cNBT_ReaderCheck(reader, (size_t)length * elementSize)) {
+    reader->errorFlag = 1;
+    return;
+  }
+
+  if (cNBT_JSONUseBase64(json, length)) {
+    cNBTBase64State state = { { 0 }, 0 };
+    const uint8_t *cursor = cNBT_GetCursor(reader);
+
+    cNBT_JSONPutChar(json, '"');
+    if (elementSize == 1 || !reader->bigEndian) {
+      // Already in little-endian byte order.
+      cNBT_JSONBase64Feed(json, &state, cursor, (size_t)length * elementSize);
+    } else {
+      uint8_t swapped[8];
+      for (int32_t i = 0; i < length; i++, cursor += elementSize) {
+        for (size_t b = 0; b < elementSize; b++)
+          swapped[b] = cursor[elementSize - 1 - b];
+        cNBT_JSONBase64Feed(json, &state, swapped, elementSize);
+      }
+    }
+    cNBT_JSONBase64End(json, &state);
+    reader->offset += (size_t)length * elementSize;
+    return;
+  }
+
+  cNBT_JSONPutChar(json, '[');
+  for (int32_t i = 0; i < length && !json->failed; i++) {
+    if (i)
+      cNBT_JSONPutChar(json, ',');
+    if (type == cNBT_A08)
+      cNBT_JSONPutI64(json, cNBT_ParseI08(reader));
+    else if (type == cNBT_A32)
+      cNBT_JSONPutI64(json, cNBT_ParseI32(reader));
+    else
+      cNBT_JSONPutI64(json, cNBT_ParseI64(reader));
+  }
+  cNBT_JSONPutChar(json, ']');
+}
+
+// Export a payload read from binary data, without building any node.
+static void cNBT_JSONRaw(
+  cNBTJSONWriter *json,
+  cNBTReader *reader,
+  uint8_t type,
+  uint8_t typed
+) {
+  uint8_t elementType = cNBT_END;
+  int32_t length = 0;
+
+  if (type > cNBT_A64) {
+    // Also indexes the type names of the annotation.
+    reader->errorFlag = 1;
+    return;
+  }
+
+  if (type == cNBT_LST) {
+    // The element type is needed by the annotation.
+    elementType = cNBT_ParseI08(reader);
+    length = cNBT_ParseI32(reader);
+    if (
+      elementType > cNBT_A64
+      || length < 0
+      || (elementType == cNBT_END && length)
+      || !cNBT_ReaderCheck(reader, (size_t)length * cNBT_PayloadMinSize[elementType])
+    ) {
+      reader->errorFlag = 1;
+      return;
+    }
+  }
+
+  if (typed)
+    cNBT_JSONBeginTyped(json, type, elementType);
+
+  switch (type) {
+    case cNBT_I08:
+      cNBT_JSONPutI64(json, cNBT_ParseI08(reader));
+      break;
+    case cNBT_I16:
+      cNBT_JSONPutI64(json, cNBT_ParseI16(reader));
+      break;
+    case cNBT_I32:
+      cNBT_JSONPutI64(json, cNBT_ParseI32(reader));
+      break;
+    case cNBT_I64:
+      cNBT_JSONPutI64(json, cNBT_ParseI64(reader));
+      break;
+    case cNBT_F32:
+      cNBT_JSONPutF64(json, cNBT_ParseF32(reader), 9);
+      break;
+    case cNBT_F64:
+      cNBT_JSONPutF64(json, cNBT_ParseF64(reader), 17);
+      break;
+
+    case cNBT_STR:
+      length = (uint16_t)cNBT_ParseI16(reader);
+      if (!cNBT_ReaderCheck(reader, (size_t)length))
+        return;
+      cNBT_JSONPutString(json, (const char *)cNBT_GetCursor(reader), (size_t)length);
+      reader->offset += (size_t)length;
+      break;
+
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      cNBT_JSONRawArray(json, reader, type);
+      break;
+
+    case cNBT_LST:
+      if (++reader->depth > cNBT_MAX_DEPTH) {
+        reader->errorFlag = 1;
+        return;
+      }
+      cNBT_JSONPutChar(json, '[');
+      for (int32_t i = 0; i < length && !reader->errorFlag && !json->failed; i++) {
+        if (i)
+          cNBT_JSONPutChar(json, ',');
+        cNBT_JSONRaw(
+          json, reader, elementType, (json->flags & cNBT_JSON_TYPED) && elementType == cNBT_LST);
+      }
+      cNBT_JSONPutChar(json, ']');
+      reader->depth--;
+      break;
+
+    case cNBT_OBJ:
+      if (++reader->depth > cNBT_MAX_DEPTH) {
+        reader->errorFlag = 1;
+        return;
+      }
+      cNBT_JSONPutChar(json, '{');
+      for (
+        uint8_t first = 1, childType = cNBT_ParseI08(reader);
+        childType && !reader->errorFlag && !json->failed;
+        first = 0, childType = cNBT_ParseI08(reader)
+      ) {
+        if (childType > cNBT_A64) {
+          reader->errorFlag = 1;
+          return;
+        }
+        if (!first)
+          cNBT_JSONPutChar(json, ',');
+        length = (uint16_t)cNBT_ParseI16(reader);
+        if (!cNBT_ReaderCheck(reader, (size_t)length))
+          return;
+        cNBT_JSONPutString(json, (const char *)cNBT_GetCursor(reader), (size_t)length);
+        reader->offset += (size_t)length;
+        cNBT_JSONPutChar(json, ':');
+        cNBT_JSONRaw(json, reader, childType, json->flags & cNBT_JSON_TYPED);
+      }
+      cNBT_JSONPutChar(json, '}');
+      reader->depth--;
+      break;
+
+    default:
+      reader->errorFlag = 1;
+      return;
+  }
+
+  if (typed)
+    cNBT_JSONPutChar(json, '}');
+}
+
+static void cNBT_JSONInit(
+  cNBTJSONWriter *json,
+  const cNBTJSONOptions *options,
+  cNBTSinkFn sink,
+  void *userData
+) {
+  json->sink = sink;
+  json->userData = userData;
+  json->flags = options ? options->flags : 0;
+  json->base64Threshold = options ? options->base64Threshold : 0;
+  json->offset = 0;
+  json->total = 0;
+  json->failed = 0;
+}
+
+size_t cNBT_WriteJSON(
+  const cNBT *nbt,
+  const cNBTJSONOptions *options,
+  cNBTSinkFn sink,
+  void *userData
+) {
+  cNBTJSONWriter json;
+
+  if (!nbt || !sink)
+    return 0;
+
+  cNBT_JSONInit(&json, options, sink, userData);
+  cNBT_JSONNode(&json, nbt, json.flags & cNBT_JSON_TYPED);
+  cNBT_JSONFlush(&json);
+
+  return json.failed ? 0 : json.total;
+}
+
+size_t cNBT_WriteJSONRaw(
+  const void *data,
+  size_t size,
+  uint8_t bigEndian,
+  const cNBTJSONOptions *options,
+  cNBTSinkFn sink,
+  void *userData
+) {
+  cNBTJSONWriter json;
+
+  if (!data || !sink)
+    return 0;
+
+  cNBTReader reader = {
+    .bigEndian = bigEndian,
+    .data = data,
+    .length = size,
+    .offset = 0,
+    .errorFlag = 0,
+    .depth = 0,
+    .flags = 0
+  };
+
+  uint8_t type = cNBT_ParseI08(&reader);
+  uint16_t keyLength = (uint16_t)cNBT_ParseI16(&reader);
+
+  // Skip the name of the root tag.
+  if (type == cNBT_END || type > cNBT_A64 || !cNBT_ReaderCheck(&reader, keyLength))
+    return 0;
+  reader.offset += keyLength;
+
+  cNBT_JSONInit(&json, options, sink, userData);
+  cNBT_JSONRaw(&json, &reader, type, json.flags & cNBT_JSON_TYPED);
+  cNBT_JSONFlush(&json);
+
+  return json.failed || reader.errorFlag ? 0 : json.total;
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] CLONE, COMPARISON AND HASHING
+//-----------------------------------------------------------------------------
+
+// Allocate from the arena if given, or from the cNBT allocator.
+#define cNBT_AllocIn(arena, size, category) \
+  ((arena) ? cNBT_ArenaAlloc((arena), (size)) : cNBT_AllocAs((size), (category)))
+
+static char *cNBT_CloneBytes(
+  const void *data,
+  size_t length,
+  size_t padding,
+  cNBTArena *arena,
+  uint8_t category
+) {
+  char *result = cNBT_AllocIn(arena, length + padding, category);
+
+  if (length)
+    memcpy(result, data, length);
+  if (padding)
+    result[length] = '\0';
+
+  return result;
+}
+
+// Copy a single node. The child chain is copied by the caller.
+static cNBT *cNBT_CloneNode(
+  const cNBT *nbt,
+  cNBTArena *arena
+) {
+  cNBT *result = cNBT_AllocIn(arena, sizeof(cNBT), cNBT_MEM_NODE);
+
+  memset((void *)result, 0, sizeof(cNBT));
+  result->type = nbt->type;
+  result->listElementType = nbt->listElementType;
+  if (nbt->type != cNBT_OBJ)
+    // The payload of objects is the shape of shaped objects.
+    result->value = nbt->value;
+  if (arena)
+    result->flags = cNBT_FLAG_ARENA | cNBT_FLAG_BORROWED_KEY | cNBT_FLAG_BORROWED_VALUE;
+
+  if (nbt->key)
+    result->key = cNBT_CloneBytes(nbt->key, strlen(nbt->key), 1, arena, cNBT_MEM_KEY);
+
+  switch (nbt->type) {
+    case cNBT_STR:
+      if (nbt->value.valueString)
+        result->value.valueString = cNBT_CloneBytes(
+          nbt->value.valueString,
+          nbt->value.lengthString,
+          1,
+          arena,
+          cNBT_MEM_STRING);
+      break;
+
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      if (nbt->value.valueArray && nbt->value.lengthArray > 0) {
+        size_t size = nbt->type == cNBT_A08 ? 1 : nbt->type == cNBT_A32 ? 4 : 8;
+        result->value.valueArray = cNBT_CloneBytes(
+          nbt->value.valueArray,
+          (size_t)nbt->value.lengthArray * size,
+          0,
+          arena,
+          cNBT_MEM_ARRAY);
+        // Clones of array views own decoded arrays.
+        if (nbt->flags & cNBT_FLAG_ARRAY_VIEW)
+          cNBT_SwapArray(
+            result->value.valueArray,
+            (size_t)nbt->value.lengthArray,
+            size,
+            !!(nbt->flags & cNBT_FLAG_SOURCE_BIG_ENDIAN));
+      } else
+        result->value.valueArray = cNBT_NULLPTR;
+      break;
+  }
+
+  return result;
+}
+
+static cNBT *cNBT_CloneChain(
+  const cNBT *first,
+  cNBT *parent,
+  cNBTArena *arena
+) {
+  cNBT *result = cNBT_NULLPTR
+    , *last = cNBT_NULLPTR;
+
+  for (const cNBT *item = first; item; item = item->next) {
+    cNBT *copy = cNBT_CloneNode(item, arena);
+
+    copy->parent = parent;
+    if (item->child)
+      copy->child = cNBT_CloneChain(item->child, copy, arena);
+
+    if (last) {
+      last->next = copy;
+      copy->prev = last;
+    } else {
+      result = copy;
+    }
+    last = copy;
+  }
+
+  if (result)
+    result->prev = last;
+
+  return result;
+}
+
+cNBT *cNBT_Clone(
+  const cNBT *nbt,
+  cNBTArena *arena
+) {
+  if (!nbt)
+    return cNBT_NULLPTR;
+
+  cNBT *result = cNBT_CloneNode(nbt, arena);
+
+  if (nbt->child)
+    result->child = cNBT_CloneChain(nbt->child, result, arena);
+
+  return result;
+}
+
+static int cNBT_CompareKeys(
+  const void *a,
+  const void *b
+) {
+  const char *keyA = (*(const cNBT *const *)a)->key
+    , *keyB = (*(const cNBT *const *)b)->key;
+
+  return strcmp(keyA ? keyA : "", keyB ? keyB : "");
+}
+
+// Objects with more items than this are compared through sorted item arrays
+// instead of linear lookups.
+#define cNBT_EQUAL_LINEAR_LIMIT 8
+
+// Pair each item of `itemsA` with a distinct equal item of `itemsB`, moving
+// the paired items of `itemsB` to the same index, so duplicate keys are
+// compared as multisets. When both arrays are sorted by key, the item paired
+// with `itemsA[i]` is in the run of its key starting at `itemsB[i]`.
+static uint8_t cNBT_EqualItems(
+  const cNBT **itemsA,
+  const cNBT **itemsB,
+  size_t count,
+  uint8_t sorted
+) {
+  for (size_t i = 0; i < count; i++) {
+    size_t j = i;
+
+    for (; j < count; j++) {
+      if (cNBT_CompareKeys(&itemsA[i], &itemsB[j])) {
+        if (sorted)
+          return 0;
+      } else if (cNBT_Equal(itemsA[i], itemsB[j]))
+        break;
+    }
+    if (j == count)
+      return 0;
+
+    const cNBT *swap = itemsB[i];
+    itemsB[i] = itemsB[j];
+    itemsB[j] = swap;
+  }
+
+  return 1;
+}
+
+static uint8_t cNBT_EqualObj(
+  const cNBT *a,
+  const cNBT *b
+) {
+  const cNBT *itemA, *itemB, *local[cNBT_EQUAL_LINEAR_LIMIT * 2], **items = local;
+  size_t countA = 0, countB = 0, i = 0;
+  uint8_t sorted = 0, result;
+
+  cNBT_ForEach(a, itemA)
+    countA++;
+  cNBT_ForEach(b, itemB)
+    countB++;
+
+  if (countA != countB)
+    return 0;
+
+  if (countA > cNBT_EQUAL_LINEAR_LIMIT) {
+    items = cNBT_Alloc(countA * 2 * sizeof(cNBT *));
+    if (!items)
+      return 0;
+    sorted = 1;
+  }
+
+  cNBT_ForEach(a, itemA)
+    items[i++] = itemA;
+  cNBT_ForEach(b, itemB)
+    items[i++] = itemB;
+
+  if (sorted) {
+    qsort((void *)items, countA, sizeof(cNBT *), cNBT_CompareKeys);
+    qsort((void *)(items + countA), countB, sizeof(cNBT *), cNBT_CompareKeys);
+  }
+
+  result = cNBT_EqualItems(items, items + countA, countA, sorted);
+
+  if (items != local)
+    cNBT_Free((void *)items);
+
+  return result;
+}
+
+uint8_t cNBT_Equal(
+  const cNBT *a,
+  const cNBT *b
+) {
+  const cNBT *itemA, *itemB;
+  size_t size;
+
+  if (a == b)
+    return 1;
+  if (!a || !b || a->type != b->type)
+    return 0;
+
+  switch (a->type) {
+    case cNBT_I08:
+      return a->value.valueI08 == b->value.valueI08;
+    case cNBT_I16:
+      return a->value.valueI16 == b->value.valueI16;
+    case cNBT_I32:
+      return a->value.valueI32 == b->value.valueI32;
+    case cNBT_I64:
+      return a->value.valueI64 == b->value.valueI64;
+    case cNBT_F32:
+      return !memcmp(&a->value.valueF32, &b->value.valueF32, sizeof(float));
+    case cNBT_F64:
+      return !memcmp(&a->value.valueF64, &b->value.valueF64, sizeof(double));
+
+    case cNBT_STR:
+      return cNBT_GetValueStringLength(a) == cNBT_GetValueStringLength(b)
+        && !memcmp(
+          a->value.valueString ? a->value.valueString : "",
+          b->value.valueString ? b->value.valueString : "",
+          cNBT_GetValueStringLength(a));
+
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      if (a->value.lengthArray != b->value.lengthArray)
+        return 0;
+      if (a->value.lengthArray <= 0 || a->value.valueArray == b->value.valueArray)
+        return 1;
+      size = a->type == cNBT_A08 ? 1 : a->type == cNBT_A32 ? 4 : 8;
+      if (size == 1 || cNBT_ArrayBigEndian(a) == cNBT_ArrayBigEndian(b))
+        return !memcmp(a->value.valueArray, b->value.valueArray, (size_t)a->value.lengthArray * size);
+      for (int32_t i = 0; i < a->value.lengthArray; i++)
+        if (cNBT_ArrayElement(a, i) != cNBT_ArrayElement(b, i))
+          return 0;
+      return 1;
+
+    case cNBT_LST:
+      if (a->listElementType != b->listElementType)
+        return 0;
+      for (
+        itemA = a->child, itemB = b->child;
+        itemA && itemB;
+        itemA = itemA->next, itemB = itemB->next
+      ) {
+        if (!cNBT_Equal(itemA, itemB))
+          return 0;
+      }
+      return !itemA && !itemB;
+
+    case cNBT_OBJ:
+      return cNBT_EqualObj(a, b);
+
+    default:
+      return 1;
+  }
+}
+
+static inline uint64_t cNBT_RotL64(
+  uint64_t value,
+  int shift
+) {
+  return value << shift | value >> (64 - shift);
+}
+
+// Murmur3 finalizer.
+static inline uint64_t cNBT_HashFinal(
+  uint64_t h
+) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline uint64_t cNBT_HashMix(
+  uint64_t h,
+  uint64_t value
+) {
+  value *= 0x87C37B91114253D5ULL;
+  value = cNBT_RotL64(value, 31);
+  value *= 0x4CF5AD432745937FULL;
+  h ^= value;
+  return cNBT_RotL64(h, 27) * 5 + 0x52DCE729;
+}
+
+// Hash the whole 64-bit words of a byte sequence, read as little-endian.
+static uint64_t cNBT_HashWords(
+  uint64_t h,
+  const void *data,
+  size_t length
+) {
+  const uint8_t *cursor = data;
+  uint64_t word;
+
+  for (; length >= 8; cursor += 8, length -= 8) {
+    memcpy(&word, cursor, 8);
+#if cNBT_HOST_BIG_ENDIAN
+    word = __builtin_bswap64(word);
+#endif
+    h = cNBT_HashMix(h, word);
+  }
+
+  return h;
+}
+
+// Hash a byte sequence, reading it as little-endian 64-bit words.
+static uint64_t cNBT_HashBytes(
+  uint64_t h,
+  const void *data,
+  size_t length
+) {
+  const uint8_t *cursor = (const uint8_t *)data + (length & ~(size_t)7);
+  uint64_t word;
+
+  h = cNBT_HashWords(h, data, length);
+  length &= 7;
+  word = (uint64_t)length << 56;
+  for (size_t i = 0; i < length; i++)
+    word |= (uint64_t)cursor[i] << (i * 8);
+
+  return cNBT_HashMix(h, word);
+}
+
+// Hash the elements of an array as little-endian bytes.
+static uint64_t cNBT_HashArray(
+  uint64_t h,
+  uint8_t type,
+  const void *data,
+  int32_t length,
+  uint8_t bigEndian
+) {
+  size_t size = type == cNBT_A08 ? 1 : type == cNBT_A32 ? 4 : 8;
+
+  if (length <= 0 || !data)
+    return cNBT_HashMix(h, 0);
+
+  // Hash the elements in little-endian byte order.
+  if (bigEndian && size > 1) {
+    uint8_t chunk[512];
+    size_t used = 0;
+
+    for (int32_t i = 0; i < length; i++) {
+      const uint8_t *element = (const uint8_t *)data + i * size;
+      for (size_t b = 0; b < size; b++)
+        chunk[used + b] = element[size - 1 - b];
+      used += size;
+      if (used == sizeof(chunk)) {
+        // The tail is only hashed at the end, as for contiguous bytes.
+        h = cNBT_HashWords(h, chunk, used);
+        used = 0;
+      }
+    }
+    return cNBT_HashBytes(h, chunk, used);
+  }
+
+  return cNBT_HashBytes(h, data, (size_t)length * size);
+}
+
+uint64_t cNBT_Hash(
+  const cNBT *nbt
+) {
+  const cNBT *item;
+  uint64_t h, accumulator = 0, count = 0;
+
+  if (!nbt)
+    return 0;
+
+  h = cNBT_HashMix(0x9E3779B97F4A7C15ULL, nbt->type);
+
+  switch (nbt->type) {
+    case cNBT_I08:
+      h = cNBT_HashMix(h, (uint64_t)(int64_t)nbt->value.valueI08);
+      break;
+    case cNBT_I16:
+      h = cNBT_HashMix(h, (uint64_t)(int64_t)nbt->value.valueI16);
+      break;
+    case cNBT_I32:
+      h = cNBT_HashMix(h, (uint64_t)(int64_t)nbt->value.valueI32);
+      break;
+    case cNBT_I64:
+      h = cNBT_HashMix(h, (uint64_t)nbt->value.valueI64);
+      break;
+    case cNBT_F32: {
+      uint32_t bits;
+      memcpy(&bits, &nbt->value.valueF32, sizeof(float));
+      h = cNBT_HashMix(h, bits);
+      break;
+    }
+    case cNBT_F64: {
+      uint64_t bits;
+      memcpy(&bits, &nbt->value.valueF64, sizeof(double));
+      h = cNBT_HashMix(h, bits);
+      break;
+    }
+
+    case cNBT_STR:
+      h = cNBT_HashBytes(
+        h,
+        nbt->value.valueString ? nbt->value.valueString : "",
+        cNBT_GetValueStringLength(nbt));
+      break;
+
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      h = cNBT_HashArray(h, nbt->type, nbt->value.valueArray, nbt->value.lengthArray, cNBT_ArrayBigEndian(nbt));
+      break;
+
+    case cNBT_LST:
+      // Ordered.
+      h = cNBT_HashMix(h, nbt->listElementType);
+      cNBT_ForEach(nbt, item) {
+        h = cNBT_HashMix(h, cNBT_Hash(item));
+        count++;
+      }
+      h = cNBT_HashMix(h, count);
+      break;
+
+    case cNBT_OBJ:
+      // Unordered, the hashes of the items are combined with a commutative
+      // operation.
+      cNBT_ForEach(nbt, item) {
+        uint64_t keyHash = item->key
+          ? cNBT_HashBytes(0, item->key, strlen(item->key))
+          : cNBT_HashBytes(0, "", 0);
+        accumulator += cNBT_HashFinal(cNBT_HashMix(keyHash, cNBT_Hash(item)));
+        count++;
+      }
+      h = cNBT_HashMix(cNBT_HashMix(h, accumulator), count);
+      break;
+  }
+
+  return cNBT_HashFinal(h);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] DIFF AND PATCH
+//-----------------------------------------------------------------------------
+
+// Layout of a patch:
+//
+//   "cNBP" version:u8 flags:u8 operation* 0:u8
+//   operation := op:u8 depth:u16 segment{depth} [type:u8 payload]
+//   segment := 0x08 key:string | 0x03 index:i32
+//
+// Numbers are stored in the byte order given by the flags, and ADD and CHANGE
+// operations carry the new value. List elements are only added and removed at
+// the end of lists, so indices always refer to the positions in the old list.
+
+#define cNBT_PATCH_VERSION 1
+#define cNBT_PATCH_FLAG_BIG_ENDIAN 0x01
+#define cNBT_PATCH_HEADER_SIZE 6
+
+#define cNBT_PATCH_END 0
+#define cNBT_PATCH_ADD 1
+#define cNBT_PATCH_REMOVE 2
+#define cNBT_PATCH_CHANGE 3
+
+typedef struct {
+  // NULL for list indices.
+  const char *key;
+  int32_t index;
+} cNBTPathSegment;
+
+typedef struct {
+  cNBTWriter writer;
+  cNBTPathSegment *path;
+  size_t depth;
+  size_t capacity;
+} cNBTDiffState;
+
+static void cNBT_DiffNode(
+  cNBTDiffState *state,
+  const cNBT *oldNbt,
+  const cNBT *newNbt);
+
+static void cNBT_DiffPush(
+  cNBTDiffState *state,
+  const char *key,
+  int32_t index
+) {
+  if (state->writer.errorFlag) {
+    // Only keep the depth balanced, nothing is emitted after a failure.
+    state->depth++;
+    return;
+  }
+
+  if (state->depth == state->capacity) {
+    cNBTPathSegment *path = cNBT_Alloc(state->capacity * 2 * sizeof(cNBTPathSegment));
+    if (!path) {
+      state->writer.errorFlag = 1;
+      state->depth++;
+      return;
+    }
+    memcpy(path, state->path, state->depth * sizeof(cNBTPathSegment));
+    cNBT_Free(state->path);
+    state->path = path;
+    state->capacity *= 2;
+  }
+
+  state->path[state->depth].key = key;
+  state->path[state->depth].index = index;
+  state->depth++;
+}
+
+#define cNBT_DiffPushKey(state, key) cNBT_DiffPush(state, (key) ? (key) : "", 0)
+#define cNBT_DiffPushIndex(state, index) cNBT_DiffPush(state, cNBT_NULLPTR, index)
+
+static void cNBT_DiffEmit(
+  cNBTDiffState *state,
+  uint8_t op,
+  const cNBT *value
+) {
+  cNBTWriter *writer = &state->writer;
+
+  if (writer->errorFlag)
+    return;
+
+  cNBT_WriteI08(writer, op);
+  cNBT_WriteI16(writer, (int16_t)state->depth);
+  for (size_t i = 0; i < state->depth; i++) {
+    if (state->path[i].key) {
+      cNBT_WriteI08(writer, cNBT_STR);
+      cNBT_WriteStr(writer, state->path[i].key);
+    } else {
+      cNBT_WriteI08(writer, cNBT_I32);
+      cNBT_WriteI32(writer, state->path[i].index);
+    }
+  }
+
+  if (value) {
+    cNBT_WriteI08(writer, value->type);
+    cNBT_WriteX(writer, (cNBT *)value);
+  }
+}
+
+// Diff two items at the current path.
+static void cNBT_DiffItem(
+  cNBTDiffState *state,
+  const cNBT *oldNbt,
+  const cNBT *newNbt
+) {
+  if (
+    oldNbt->type != newNbt->type
+    || (oldNbt->type == cNBT_LST && oldNbt->listElementType != newNbt->listElementType)
+  )
+    cNBT_DiffEmit(state, cNBT_PATCH_CHANGE, newNbt);
+  else if (oldNbt->type == cNBT_OBJ || oldNbt->type == cNBT_LST)
+    cNBT_DiffNode(state, oldNbt, newNbt);
+  else if (!cNBT_Equal(oldNbt, newNbt))
+    cNBT_DiffEmit(state, cNBT_PATCH_CHANGE, newNbt);
+}
+
+static void cNBT_DiffObj(
+  cNBTDiffState *state,
+  const cNBT *oldNbt,
+  const cNBT *newNbt
+) {
+  const cNBT *item, **sortedOld, **sortedNew;
+  size_t countOld = 0, countNew = 0, i = 0, j = 0;
+
+  cNBT_ForEach(oldNbt, item)
+    countOld++;
+  cNBT_ForEach(newNbt, item)
+    countNew++;
+
+  if ((!countOld && !countNew) || state->writer.errorFlag)
+    return;
+
+  // Match the items by their keys through sorted item arrays.
+  sortedOld = cNBT_Alloc((countOld + countNew) * sizeof(cNBT *));
+  if (!sortedOld) {
+    state->writer.errorFlag = 1;
+    return;
+  }
+  sortedNew = sortedOld + countOld;
+  cNBT_ForEach(oldNbt, item)
+    sortedOld[i++] = item;
+  cNBT_ForEach(newNbt, item)
+    sortedNew[j++] = item;
+  qsort((void *)sortedOld, countOld, sizeof(cNBT *), cNBT_CompareKeys);
+  qsort((void *)sortedNew, countNew, sizeof(cNBT *), cNBT_CompareKeys);
+
+  for (i = 0, j = 0; i < countOld || j < countNew;) {
+    int order = i == countOld
+      ? 1
+      : j == countNew
+        ? -1
+        : cNBT_CompareKeys(&sortedOld[i], &sortedNew[j]);
+
+    if (order < 0) {
+      cNBT_DiffPushKey(state, sortedOld[i]->key);
+      cNBT_DiffEmit(state, cNBT_PATCH_REMOVE, cNBT_NULLPTR);
+      i++;
+    } else if (order > 0) {
+      cNBT_DiffPushKey(state, sortedNew[j]->key);
+      cNBT_DiffEmit(state, cNBT_PATCH_ADD, sortedNew[j]);
+      j++;
+    } else {
+      cNBT_DiffPushKey(state, sortedOld[i]->key);
+      cNBT_DiffItem(state, sortedOld[i], sortedNew[j]);
+      i++;
+      j++;
+    }
+    state->depth--;
+  }
+
+  cNBT_Free((void *)sortedOld);
+}
+
+static void cNBT_DiffLst(
+  cNBTDiffState *state,
+  const cNBT *oldNbt,
+  const cNBT *newNbt
+) {
+  const cNBT *itemOld = oldNbt->child
+    , *itemNew = newNbt->child;
+  int32_t index = 0, lengthOld;
+
+  // Common prefix.
+  for (; itemOld && itemNew; itemOld = itemOld->next, itemNew = itemNew->next, index++) {
+    cNBT_DiffPushIndex(state, index);
+    cNBT_DiffItem(state, itemOld, itemNew);
+    state->depth--;
+  }
+
+  // Appended elements.
+  for (; itemNew; itemNew = itemNew->next, index++) {
+    cNBT_DiffPushIndex(state, index);
+    cNBT_DiffEmit(state, cNBT_PATCH_ADD, itemNew);
+    state->depth--;
+  }
+
+  // Removed elements, from the last one.
+  for (lengthOld = index; itemOld; itemOld = itemOld->next)
+    lengthOld++;
+  while (lengthOld > index) {
+    cNBT_DiffPushIndex(state, --lengthOld);
+    cNBT_DiffEmit(state, cNBT_PATCH_REMOVE, cNBT_NULLPTR);
+    state->depth--;
+  }
+}
+
+// Diff two containers of the same type.
+static void cNBT_DiffNode(
+  cNBTDiffState *state,
+  const cNBT *oldNbt,
+  const cNBT *newNbt
+) {
+  if (oldNbt->type == cNBT_OBJ)
+    cNBT_DiffObj(state, oldNbt, newNbt);
+  else
+    cNBT_DiffLst(state, oldNbt, newNbt);
+}
+
+const void *cNBT_Diff(
+  const cNBT *oldNbt,
+  const cNBT *newNbt,
+  uint8_t bigEndian,
+  size_t *length
+) {
+  if (!oldNbt || !newNbt)
+    return cNBT_NULLPTR;
+
+  cNBTDiffState state = {
+    .writer = {
+      .bigEndian = bigEndian,
+      .capacity = 0x40,
+      .errorFlag = 0,
+      .offset = 0,
+      .data = cNBT_AllocAs(0x40, cNBT_MEM_WRITER)
+    },
+    .path = cNBT_Alloc(16 * sizeof(cNBTPathSegment)),
+    .depth = 0,
+    .capacity = 16
+  };
+
+  if (!state.writer.data || !state.path) {
+    if (state.writer.data)
+      cNBT_Free(state.writer.data);
+    if (state.path)
+      cNBT_Free(state.path);
+    return cNBT_NULLPTR;
+  }
+
+  cNBT_WriteI08(&state.writer, 'c');
+  cNBT_WriteI08(&state.writer, 'N');
+  cNBT_WriteI08(&state.writer, 'B');
+  cNBT_WriteI08(&state.writer, 'P');
+  cNBT_WriteI08(&state.writer, cNBT_PATCH_VERSION);
+  cNBT_WriteI08(&state.writer, bigEndian ? cNBT_PATCH_FLAG_BIG_ENDIAN : 0);
+
+  cNBT_DiffItem(&state, oldNbt, newNbt);
+
+  cNBT_WriteI08(&state.writer, cNBT_PATCH_END);
+  cNBT_Free(state.path);
+
+  if (state.writer.errorFlag) {
+    cNBT_Free(state.writer.data);
+    return cNBT_NULLPTR;
+  }
+
+  if (length)
+    *length = state.writer.offset;
+
+  return state.writer.data;
+}
+
+// Initialize a reader on the operations of a patch.
+static uint8_t cNBT_PatchOpen(
+  cNBTReader *reader,
+  const void *patch,
+  size_t size
+) {
+  const uint8_t *header = patch;
+
+  if (
+    !patch
+    || size < cNBT_PATCH_HEADER_SIZE
+    || memcmp(header, "cNBP", 4)
+    || header[4] != cNBT_PATCH_VERSION
+  )
+    return 0;
+
+  memset((void *)reader, 0, sizeof(cNBTReader));
+  reader->data = patch;
+  reader->length = size;
+  reader->offset = cNBT_PATCH_HEADER_SIZE;
+  reader->bigEndian = header[5] & cNBT_PATCH_FLAG_BIG_ENDIAN;
+
+  return 1;
+}
+
+// Read the value of an ADD or CHANGE operation.
+static cNBT *cNBT_PatchReadValue(
+  cNBTReader *reader
+) {
+  uint8_t type = cNBT_ParseI08(reader);
+  cNBT *result;
+
+  if (type == cNBT_END || type > cNBT_A64) {
+    reader->errorFlag = 1;
+    return cNBT_NULLPTR;
+  }
+
+  result = cNBT_AllocAs(sizeof(cNBT), cNBT_MEM_NODE);
+  if (!result) {
+    reader->errorFlag = 1;
+    return cNBT_NULLPTR;
+  }
+  memset((void *)result, 0, sizeof(cNBT));
+  cNBT_ParseX(reader, result, type);
+
+  if (reader->errorFlag) {
+    cNBT_Delete(result);
+    return cNBT_NULLPTR;
+  }
+
+  return result;
+}
+
+// Find the item with a key which is not null-terminated.
+static cNBT *cNBT_GetNodeByKeyN(
+  const cNBT *nbt,
+  const char *key,
+  size_t length
+) {
+  cNBT *item;
+
+  if ((nbt->flags & cNBT_FLAG_SHAPED) && nbt->value.slots)
+    return cNBT_ShapeFindNode(nbt, key, length);
+
+  cNBT_ForEach(nbt, item) {
+    // `key` may hold NULs, so compare the lengths first.
+    if (item->key && strlen(item->key) == length && !memcmp(item->key, key, length))
+      return item;
+  }
+
+  return cNBT_NULLPTR;
+}
+
+// Flags describing the payload of an item rather than the item.
+#define cNBT_VALUE_FLAGS \
+  (cNBT_FLAG_BORROWED_VALUE | cNBT_FLAG_ARRAY_VIEW | cNBT_FLAG_SOURCE_BIG_ENDIAN)
+
+// Move the payload of `source` into `nbt`, and free `source`.
+static void cNBT_ReplaceValue(
+  cNBT *nbt,
+  cNBT *source
+) {
+  nbt = cNBT_Unshare(nbt);
+  if (nbt->child)
+    cNBT_Delete(nbt->child);
+  // The shape of the parent may change with the type.
+  cNBT_DropShape(nbt);
+  cNBT_DropShape(nbt->parent);
+  if (!(nbt->flags & cNBT_FLAG_BORROWED_VALUE)) {
+    if (nbt->type == cNBT_STR)
+      cNBT_Free(nbt->value.valueString);
+    else if (nbt->type == cNBT_A08 || nbt->type == cNBT_A32 || nbt->type == cNBT_A64)
+      cNBT_Free(nbt->value.valueArray);
+  }
+
+  nbt->type = source->type;
+  nbt->listElementType = source->listElementType;
+  nbt->value = source->value;
+  nbt->child = source->child;
+  nbt->source = cNBT_NULLPTR;
+  nbt->flags = (nbt->flags & ~cNBT_VALUE_FLAGS)
+    | (source->flags & cNBT_VALUE_FLAGS);
+
+  source->child = cNBT_NULLPTR;
+  source->flags |= cNBT_FLAG_BORROWED_VALUE;
+  cNBT_Delete(source);
+
+  cNBT *item;
+  cNBT_ForEach(nbt, item)
+    item->parent = nbt;
+  cNBT_MarkDirty(nbt);
+}
+
+cNBT *cNBT_ApplyPatch(
+  cNBT *nbt,
+  const void *patch,
+  size_t size
+) {
+  cNBTReader reader;
+  uint8_t op;
+
+  if (!nbt || !cNBT_PatchOpen(&reader, patch, size))
+    return cNBT_NULLPTR;
+
+  while ((op = cNBT_ParseI08(&reader)) != cNBT_PATCH_END && !reader.errorFlag) {
+    uint16_t depth = (uint16_t)cNBT_ParseI16(&reader), keyLength = 0;
+    cNBT *parent = cNBT_NULLPTR, *item = nbt, *value = cNBT_NULLPTR;
+    const char *key = cNBT_NULLPTR;
+    int32_t index = 0;
+
+    // Follow the path. The item may be missing only at the last segment.
+    for (uint16_t i = 0; i < depth && !reader.errorFlag; i++) {
+      uint8_t segment = cNBT_ParseI08(&reader);
+
+      if (!item)
+        return cNBT_NULLPTR;
+      parent = item;
+
+      if (segment == cNBT_STR) {
+        keyLength = (uint16_t)cNBT_ParseI16(&reader);
+        if (!cNBT_ReaderCheck(&reader, keyLength))
+          return cNBT_NULLPTR;
+        key = (const char *)cNBT_GetCursor(&reader);
+        reader.offset += keyLength;
+        item = parent->type == cNBT_OBJ
+          ? cNBT_GetNodeByKeyN(parent, key, keyLength)
+          : cNBT_NULLPTR;
+      } else if (segment == cNBT_I32) {
+        key = cNBT_NULLPTR;
+        index = cNBT_ParseI32(&reader);
+        item = parent->type == cNBT_LST
+          ? cNBT_GetNodeByIndex(parent, index)
+          : cNBT_NULLPTR;
+      } else {
+        return cNBT_NULLPTR;
+      }
+    }
+
+    if (op == cNBT_PATCH_ADD || op == cNBT_PATCH_CHANGE) {
+      value = cNBT_PatchReadValue(&reader);
+      if (!value)
+        return cNBT_NULLPTR;
+    }
+
+    switch (op) {
+      case cNBT_PATCH_ADD:
+        if (item || !parent) {
+          cNBT_Delete(value);
+          return cNBT_NULLPTR;
+        }
+
+        if (parent->type == cNBT_OBJ && key) {
+          char *keyCopy = cNBT_Alloc((size_t)keyLength + 1);
+          if (!keyCopy) {
+            cNBT_Delete(value);
+            return cNBT_NULLPTR;
+          }
+          memcpy(keyCopy, key, keyLength);
+          keyCopy[keyLength] = '\0';
+          item = cNBT_AddNode(parent, value, keyCopy);
+          cNBT_Free(keyCopy);
+        } else if (parent->type == cNBT_LST && !key) {
+          // Elements are only appended.
+          parent = cNBT_Unshare(parent);
+          if (!parent->child && !parent->listElementType)
+            parent->listElementType = value->type;
+          item = index ? cNBT_GetNodeByIndex(parent, index - 1) : cNBT_NULLPTR;
+          if (index ? !item || item->next : !!parent->child)
+            item = cNBT_NULLPTR;
+          else
+            item = cNBT_AddNode(parent, value, cNBT_NULLPTR);
+        }
+
+        if (!item) {
+          cNBT_Delete(value);
+          return cNBT_NULLPTR;
+        }
+        break;
+
+      case cNBT_PATCH_REMOVE:
+        if (!item || !parent)
+          return cNBT_NULLPTR;
+        cNBT_Delete(cNBT_RemoveNode(parent, item));
+        break;
+
+      case cNBT_PATCH_CHANGE:
+        if (!item) {
+          cNBT_Delete(value);
+          return cNBT_NULLPTR;
+        }
+        cNBT_ReplaceValue(item, value);
+        break;
+
+      default:
+        return cNBT_NULLPTR;
+    }
+  }
+
+  return reader.errorFlag ? cNBT_NULLPTR : nbt;
+}
+
+// Operations of a patch arranged as a tree of paths.
+typedef struct cNBTPatchNode_t {
+  struct cNBTPatchNode_t *child;
+  struct cNBTPatchNode_t *next;
+  // NULL for list indices. Not null-terminated.
+  const char *key;
+  uint16_t keyLength;
+  int32_t index;
+  uint8_t op;
+  uint8_t visited;
+  cNBT *value;
+} cNBTPatchNode;
+
+static void cNBT_PatchFreeValues(
+  cNBTPatchNode *node
+) {
+  for (; node; node = node->next) {
+    if (node->value)
+      cNBT_Delete(node->value);
+    cNBT_PatchFreeValues(node->child);
+  }
+}
+
+// Build the path tree of a patch. Returns NULL if the patch is malformed or
+// has conflicting operations.
+static cNBTPatchNode *cNBT_PatchBuildTree(
+  cNBTReader *reader,
+  cNBTArena *arena
+) {
+  cNBTPatchNode *root = cNBT_ArenaAlloc(arena, sizeof(cNBTPatchNode));
+  uint8_t op;
+
+  memset(root, 0, sizeof(cNBTPatchNode));
+
+  while ((op = cNBT_ParseI08(reader)) != cNBT_PATCH_END && !reader->errorFlag) {
+    uint16_t depth = (uint16_t)cNBT_ParseI16(reader);
+    cNBTPatchNode *node = root;
+
+    if (op > cNBT_PATCH_CHANGE)
+      reader->errorFlag = 1;
+
+    for (uint16_t i = 0; i < depth && !reader->errorFlag; i++) {
+      uint8_t segment = cNBT_ParseI08(reader);
+      const char *key = cNBT_NULLPTR;
+      uint16_t keyLength = 0;
+      int32_t index = 0;
+      cNBTPatchNode *child;
+
+      if (node->op) {
+        // Operations inside an added, removed or changed item.
+        reader->errorFlag = 1;
+        break;
+      }
+
+      if (segment == cNBT_STR) {
+        keyLength = (uint16_t)cNBT_ParseI16(reader);
+        if (!cNBT_ReaderCheck(reader, keyLength))
+          break;
+        key = (const char *)cNBT_GetCursor(reader);
+        reader->offset += keyLength;
+      } else if (segment == cNBT_I32) {
+        index = cNBT_ParseI32(reader);
+      } else {
+        reader->errorFlag = 1;
+        break;
+      }
+
+      for (child = node->child; child; child = child->next) {
+        if (
+          key
+            ? child->key && child->keyLength == keyLength && !memcmp(child->key, key, keyLength)
+            : !child->key && child->index == index
+        )
+          break;
+      }
+
+      if (!child) {
+        child = cNBT_ArenaAlloc(arena, sizeof(cNBTPatchNode));
+        memset(child, 0, sizeof(cNBTPatchNode));
+        child->key = key;
+        child->keyLength = keyLength;
+        child->index = index;
+        child->next = node->child;
+        node->child = child;
+      }
+      node = child;
+    }
+
+    if (reader->errorFlag)
+      break;
+
+    if (node->op || node->child || (!depth && op != cNBT_PATCH_CHANGE)) {
+      reader->errorFlag = 1;
+      break;
+    }
+
+    node->op = op;
+    if (op != cNBT_PATCH_REMOVE)
+      node->value = cNBT_PatchReadValue(reader);
+  }
+
+  if (reader->errorFlag) {
+    cNBT_PatchFreeValues(root);
+    return cNBT_NULLPTR;
+  }
+
+  return root;
+}
+
+static int cNBT_ComparePatchIndices(
+  const void *a,
+  const void *b
+) {
+  int32_t indexA = (*(const cNBTPatchNode *const *)a)->index
+    , indexB = (*(const cNBTPatchNode *const *)b)->index;
+
+  return (indexA > indexB) - (indexA < indexB);
+}
+
+static void cNBT_PatchRaw(
+  cNBTReader *reader,
+  cNBTWriter *writer,
+  uint8_t type,
+  cNBTPatchNode *patch,
+  cNBTArena *arena);
+
+static void cNBT_PatchRawObj(
+  cNBTReader *reader,
+  cNBTWriter *writer,
+  cNBTPatchNode *patch,
+  cNBTArena *arena
+) {
+  cNBTPatchNode *child;
+
+  for (uint8_t type = cNBT_ParseI08(reader); type && !reader->errorFlag; type = cNBT_ParseI08(reader)) {
+    size_t start = reader->offset - 1;
+    uint16_t keyLength = (uint16_t)cNBT_ParseI16(reader);
+    const char *key;
+
+    if (type > cNBT_A64 || !cNBT_ReaderCheck(reader, keyLength)) {
+      reader->errorFlag = 1;
+      return;
+    }
+    key = (const char *)cNBT_GetCursor(reader);
+    reader->offset += keyLength;
+
+    for (child = patch->child; child; child = child->next) {
+      if (
+        child->key
+        && !child->visited
+        && child->keyLength == keyLength
+        && !memcmp(child->key, key, keyLength)
+      )
+        break;
+    }
+
+    if (!child) {
+      // Unchanged item.
+      cNBT_SkipX(reader, type);
+      cNBT_WriteBytes(writer, (const uint8_t *)reader->data + start, reader->offset - start);
+      continue;
+    }
+
+    child->visited = 1;
+    switch (child->op) {
+      case cNBT_PATCH_REMOVE:
+        cNBT_SkipX(reader, type);
+        break;
+
+      case cNBT_PATCH_CHANGE:
+        cNBT_SkipX(reader, type);
+        cNBT_WriteI08(writer, child->value->type);
+        cNBT_WriteI16(writer, (int16_t)keyLength);
+        cNBT_WriteBytes(writer, key, keyLength);
+        cNBT_WriteX(writer, child->value);
+        break;
+
+      case cNBT_PATCH_ADD:
+        // The key already exists.
+        reader->errorFlag = 1;
+        return;
+
+      default:
+        cNBT_WriteI08(writer, type);
+        cNBT_WriteI16(writer, (int16_t)keyLength);
+        cNBT_WriteBytes(writer, key, keyLength);
+        cNBT_PatchRaw(reader, writer, type, child, arena);
+        break;
+    }
+  }
+
+  // Added items.
+  for (child = patch->child; child && !reader->errorFlag; child = child->next) {
+    if (child->visited)
+      continue;
+    if (child->op != cNBT_PATCH_ADD || !child->key) {
+      reader->errorFlag = 1;
+      return;
+    }
+    cNBT_WriteI08(writer, child->value->type);
+    cNBT_WriteI16(writer, (int16_t)child->keyLength);
+    cNBT_WriteBytes(writer, child->key, child->keyLength);
+    cNBT_WriteX(writer, child->value);
+  }
+
+  cNBT_WriteI08(writer, cNBT_END);
+}
+
+static void cNBT_PatchRawLst(
+  cNBTReader *reader,
+  cNBTWriter *writer,
+  cNBTPatchNode *patch,
+  cNBTArena *arena
+) {
+  uint8_t type = cNBT_ParseI08(reader);
+  int32_t length = cNBT_ParseI32(reader), removed = 0, added = 0, count = 0, kept;
+  cNBTPatchNode *child, **sorted;
+
+  if (type > cNBT_A64 || length < 0 || (type == cNBT_END && length)) {
+    reader->errorFlag = 1;
+    return;
+  }
+
+  for (child = patch->child; child; child = child->next) {
+    if (child->key) {
+      reader->errorFlag = 1;
+      return;
+    }
+    removed += child->op == cNBT_PATCH_REMOVE;
+    added += child->op == cNBT_PATCH_ADD;
+    count++;
+  }
+
+  sorted = cNBT_ArenaAlloc(arena, (size_t)count * sizeof(cNBTPatchNode *));
+  count = 0;
+  for (child = patch->child; child; child = child->next)
+    sorted[count++] = child;
+  qsort(sorted, (size_t)count, sizeof(cNBTPatchNode *), cNBT_ComparePatchIndices);
+
+  // Removed elements must be at the end of the old list, and added elements
+  // must follow the kept elements.
+  kept = length - removed;
+  for (int32_t i = 0, nextAdded = kept; i < count; i++) {
+    child = sorted[i];
+    if (
+      (i && child->index == sorted[i - 1]->index)
+      || child->index < 0
+      || (child->op == cNBT_PATCH_REMOVE && (child->index < kept || child->index >= length))
+      || (child->op == cNBT_PATCH_ADD && child->index != nextAdded++)
+      || (child->op != cNBT_PATCH_REMOVE && child->op != cNBT_PATCH_ADD && child->index >= kept)
+    ) {
+      reader->errorFlag = 1;
+      return;
+    }
+    if (child->op == cNBT_PATCH_ADD || child->op == cNBT_PATCH_CHANGE) {
+      if (!length && !kept && type == cNBT_END)
+        type = child->value->type;
+      if (child->value->type != type) {
+        reader->errorFlag = 1;
+        return;
+      }
+    }
+  }
+
+  cNBT_WriteI08(writer, type);
+  cNBT_WriteI32(writer, kept + added);
+
+  for (int32_t i = 0, next = 0; i < length && !reader->errorFlag; i++) {
+    size_t start = reader->offset;
+
+    child = next < count && sorted[next]->index == i ? sorted[next++] : cNBT_NULLPTR;
+    if (!child) {
+      cNBT_SkipX(reader, type);
+      cNBT_WriteBytes(writer, (const uint8_t *)reader->data + start, reader->offset - start);
+    } else if (child->op == cNBT_PATCH_REMOVE) {
+      cNBT_SkipX(reader, type);
+    } else if (child->op == cNBT_PATCH_CHANGE) {
+      cNBT_SkipX(reader, type);
+      cNBT_WriteX(writer, child->value);
+    } else {
+      cNBT_PatchRaw(reader, writer, type, child, arena);
+    }
+  }
+
+  for (int32_t i = 0; i < count; i++) {
+    if (sorted[i]->op == cNBT_PATCH_ADD)
+      cNBT_WriteX(writer, sorted[i]->value);
+  }
+}
+
+// Write the patched payload of an item with operations inside it.
+static void cNBT_PatchRaw(
+  cNBTReader *reader,
+  cNBTWriter *writer,
+  uint8_t type,
+  cNBTPatchNode *patch,
+  cNBTArena *arena
+) {
+  if (++reader->depth > cNBT_MAX_DEPTH) {
+    reader->errorFlag = 1;
+    return;
+  }
+
+  if (type == cNBT_OBJ)
+    cNBT_PatchRawObj(reader, writer, patch, arena);
+  else if (type == cNBT_LST)
+    cNBT_PatchRawLst(reader, writer, patch, arena);
+  else
+    // The path goes through a value which is not a container.
+    reader->errorFlag = 1;
+
+  reader->depth--;
+}
+
+const void *cNBT_ApplyPatchRaw(
+  const void *data,
+  size_t size,
+  uint8_t bigEndian,
+  const void *patch,
+  size_t patchSize,
+  size_t *length
+) {
+  cNBTReader patchReader;
+  cNBTPatchNode *root;
+  cNBTArena *arena;
+
+  if (!data || !cNBT_PatchOpen(&patchReader, patch, patchSize))
+    return cNBT_NULLPTR;
+
+  arena = cNBT_CreateArena(0x1000);
+  root = cNBT_PatchBuildTree(&patchReader, arena);
+  if (!root) {
+    cNBT_DeleteArena(arena);
+    return cNBT_NULLPTR;
+  }
+
+  cNBTReader reader = {
+    .bigEndian = bigEndian,
+    .data = data,
+    .length = size,
+    .offset = 0,
+    .errorFlag = 0,
+    .depth = 0,
+    .flags = 0
+  };
+
+  cNBTWriter writer = {
+    .bigEndian = bigEndian,
+    .capacity = size + patchSize + 0x40,
+    .errorFlag = 0,
+    .offset = 0,
+    .data = cNBT_AllocAs(size + patchSize + 0x40, cNBT_MEM_WRITER)
+  };
+
+  uint8_t type = cNBT_ParseI08(&reader);
+  uint16_t keyLength = (uint16_t)cNBT_ParseI16(&reader);
+
+  if (type == cNBT_END || type > cNBT_A64 || !cNBT_ReaderCheck(&reader, keyLength)) {
+    reader.errorFlag = 1;
+  } else {
+    const char *key = (const char *)cNBT_GetCursor(&reader);
+    reader.offset += keyLength;
+
+    cNBT_WriteI08(&writer, root->op == cNBT_PATCH_CHANGE ? root->value->type : type);
+    cNBT_WriteI16(&writer, (int16_t)keyLength);
+    cNBT_WriteBytes(&writer, key, keyLength);
+
+    if (root->op == cNBT_PATCH_CHANGE) {
+      cNBT_SkipX(&reader, type);
+      cNBT_WriteX(&writer, root->value);
+    } else if (root->child) {
+      cNBT_PatchRaw(&reader, &writer, type, root, arena);
+    } else {
+      size_t start = reader.offset;
+      cNBT_SkipX(&reader, type);
+      cNBT_WriteBytes(&writer, (const uint8_t *)data + start, reader.offset - start);
+    }
+  }
+
+  cNBT_PatchFreeValues(root);
+  cNBT_DeleteArena(arena);
+
+  if (reader.errorFlag) {
+    cNBT_Free(writer.data);
+    return cNBT_NULLPTR;
+  }
+
+  if (length)
+    *length = writer.offset;
+
+  return writer.data;
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] OFFSET INDEX
+//-----------------------------------------------------------------------------
+
+// Size of the fixed size payloads and array elements, 0 for other types.
+static const uint8_t cNBT_ElementSize[] = {
+  0, 1, 2, 4, 8, 4, 8, 1, 0, 0, 0, 4, 8
+};
+
+typedef struct {
+  cNBTReader reader;
+  cNBTOffset *offsets;
+  // The unmatched part of each path.
+  const char **rest;
+  // The number of matched segments of each path, or UINT32_MAX when the path
+  // is resolved.
+  uint32_t *matched;
+  size_t count;
+  size_t pending;
+} cNBTIndexState;
+
+#define cNBT_INDEX_RESOLVED UINT32_MAX
+
+// Match the key segment at the beginning of a path. Returns the remaining part
+// of the path, or NULL if it doesn't match.
+static const char *cNBT_PathMatchKey(
+  const char *path,
+  const char *key,
+  size_t length
+) {
+  if (*path == '[')
+    return cNBT_NULLPTR;
+
+  for (; *path && *path != '.' && *path != '['; path++, key++, length--) {
+    if (*path == '\\' && path[1])
+      path++;
+    if (!length || *path != *key)
+      return cNBT_NULLPTR;
+  }
+
+  if (length)
+    return cNBT_NULLPTR;
+
+  return *path == '.' ? path + 1 : path;
+}
+
+// Read the index segment at the beginning of a path. Returns the remaining
+// part of the path, or NULL if it's not an index.
+static const char *cNBT_PathReadIndex(
+  const char *path,
+  int32_t *index
+) {
+  int64_t result = 0;
+
+  if (*path != '[' || path[1] == ']')
+    return cNBT_NULLPTR;
+
+  for (path++; *path != ']'; path++) {
+    if (*path < '0' || *path > '9' || result > INT32_MAX)
+      return cNBT_NULLPTR;
+    result = result * 10 + (*path - '0');
+  }
+
+  if (result > INT32_MAX)
+    return cNBT_NULLPTR;
+
+  *index = (int32_t)result;
+  path++;
+
+  return *path == '.' ? path + 1 : path;
+}
+
+static void cNBT_IndexRecord(
+  cNBTIndexState *state,
+  size_t path,
+  uint8_t type
+) {
+  cNBTReader *reader = &state->reader;
+  cNBTOffset *offset = &state->offsets[path];
+  const uint8_t *cursor = cNBT_GetCursor(reader);
+
+  offset->offset = reader->offset;
+  offset->type = type;
+  offset->length = 0;
+
+  if (type == cNBT_STR && reader->length - reader->offset >= 2)
+    offset->length = reader->bigEndian
+      ? cNBT_GetByteBE(cursor, 0, 16) | cNBT_GetByteBE(cursor, 1, 16)
+      : cNBT_GetByteLE(cursor, 0) | cNBT_GetByteLE(cursor, 1);
+  else if (
+    (type == cNBT_A08 || type == cNBT_A32 || type == cNBT_A64)
+    && reader->length - reader->offset >= 4
+  )
+    offset->length = (int32_t)(reader->bigEndian
+      ? cNBT_GetByteBE(cursor, 0, 32) | cNBT_GetByteBE(cursor, 1, 32)
+        | cNBT_GetByteBE(cursor, 2, 32) | cNBT_GetByteBE(cursor, 3, 32)
+      : cNBT_GetByteLE(cursor, 0) | cNBT_GetByteLE(cursor, 1)
+        | cNBT_GetByteLE(cursor, 2) | cNBT_GetByteLE(cursor, 3));
+
+  state->matched[path] = cNBT_INDEX_RESOLVED;
+  state->pending--;
+}
+
+static void cNBT_IndexX(
+  cNBTIndexState *state,
+  uint8_t type,
+  uint32_t depth);
+
+// Visit a child item whose payload is at the cursor. The paths advanced into
+// it have `depth + 1` matched segments.
+static void cNBT_IndexChild(
+  cNBTIndexState *state,
+  uint8_t type,
+  uint32_t depth
+) {
+  uint8_t descend = 0;
+
+  for (size_t i = 0; i < state->count; i++) {
+    if (state->matched[i] != depth + 1)
+      continue;
+    if (*state->rest[i])
+      descend = 1;
+    else
+      cNBT_IndexRecord(state, i, type);
+  }
+
+  if (descend)
+    cNBT_IndexX(state, type, depth + 1);
+  else if (state->pending)
+    cNBT_SkipX(&state->reader, type);
+
+  // Paths that weren't resolved inside the item don't exist.
+  for (size_t i = 0; i < state->count; i++) {
+    if (state->matched[i] != cNBT_INDEX_RESOLVED && state->matched[i] > depth) {
+      state->matched[i] = cNBT_INDEX_RESOLVED;
+      state->pending--;
+    }
+  }
+}
+
+// Scan the payload at the cursor for paths with `depth` matched segments.
+static void cNBT_IndexX(
+  cNBTIndexState *state,
+  uint8_t type,
+  uint32_t depth
+) {
+  cNBTReader *reader = &state->reader;
+
+  if (++reader->depth > cNBT_MAX_DEPTH) {
+    reader->errorFlag = 1;
+    return;
+  }
+
+  if (type == cNBT_OBJ) {
+    for (
+      uint8_t childType = cNBT_ParseI08(reader);
+      childType && !reader->errorFlag && state->pending;
+      childType = cNBT_ParseI08(reader)
+    ) {
+      uint16_t keyLength = (uint16_t)cNBT_ParseI16(reader);
+      const char *key, *rest;
+      uint8_t found = 0;
+
+      if (childType > cNBT_A64 || !cNBT_ReaderCheck(reader, keyLength)) {
+        reader->errorFlag = 1;
+        break;
+      }
+      key = (const char *)cNBT_GetCursor(reader);
+      reader->offset += keyLength;
+
+      for (size_t i = 0; i < state->count; i++) {
+        if (state->matched[i] != depth)
+          continue;
+        rest = cNBT_PathMatchKey(state->rest[i], key, keyLength);
+        if (rest) {
+          state->rest[i] = rest;
+          state->matched[i] = depth + 1;
+          found = 1;
+        }
+      }
+
+      if (found)
+        cNBT_IndexChild(state, childType, depth);
+      else
+        cNBT_SkipX(reader, childType);
+    }
+  } else if (type == cNBT_LST) {
+    uint8_t elementType = cNBT_ParseI08(reader);
+    int32_t length = cNBT_ParseI32(reader), last = -1, index;
+    size_t elementSize;
+
+    if (
+      elementType > cNBT_A64
+      || length < 0
+      || (elementType == cNBT_END && length)
+      || !cNBT_ReaderCheck(reader, (size_t)length * cNBT_PayloadMinSize[elementType])
+    ) {
+      reader->errorFlag = 1;
+      reader->depth--;
+      return;
+    }
+
+    // The last index wanted by the paths.
+    for (size_t i = 0; i < state->count; i++) {
+      if (state->matched[i] == depth && cNBT_PathReadIndex(state->rest[i], &index) && index > last)
+        last = index;
+    }
+
+    elementSize = elementType <= cNBT_F64 ? cNBT_ElementSize[elementType] : 0;
+    for (int32_t element = 0; element < length && !reader->errorFlag; element++) {
+      uint8_t found = 0;
+
+      if (!state->pending)
+        // Everything is found, the rest of the data is not needed.
+        break;
+
+      if (element > last) {
+        // Skip the remaining elements.
+        if (elementSize) {
+          reader->offset += (size_t)(length - element) * elementSize;
+        } else {
+          for (; element < length && !reader->errorFlag; element++)
+            cNBT_SkipX(reader, elementType);
+        }
+        break;
+      }
+
+      for (size_t i = 0; i < state->count; i++) {
+        const char *rest;
+        if (state->matched[i] != depth)
+          continue;
+        rest = cNBT_PathReadIndex(state->rest[i], &index);
+        if (rest && index == element) {
+          state->rest[i] = rest;
+          state->matched[i] = depth + 1;
+          found = 1;
+        }
+      }
+
+      if (found)
+        cNBT_IndexChild(state, elementType, depth);
+      else if (elementSize)
+        reader->offset += elementSize;
+      else
+        cNBT_SkipX(reader, elementType);
+    }
+  } else {
+    cNBT_SkipX(reader, type);
+  }
+
+  reader->depth--;
+}
+
+uint8_t cNBT_IndexOffsets(
+  const void *data,
+  size_t size,
+  uint8_t bigEndian,
+  const char *const *paths,
+  size_t count,
+  cNBTOffset *offsets
+) {
+  cNBTIndexState state = {
+    .reader = {
+      .bigEndian = bigEndian,
+      .data = data,
+      .length = size,
+      .offset = 0,
+      .errorFlag = 0,
+      .depth = 0,
+      .flags = 0
+    },
+    .offsets = offsets,
+    .count = count,
+    .pending = count
+  };
+  uint8_t type;
+  uint16_t keyLength;
+
+  if (!data || (count && (!paths || !offsets)))
+    return 0;
+
+  for (size_t i = 0; i < count; i++) {
+    offsets[i].offset = SIZE_MAX;
+    offsets[i].type = cNBT_END;
+    offsets[i].length = 0;
+  }
+
+  // Skip the type and the name of the root tag.
+  type = cNBT_ParseI08(&state.reader);
+  keyLength = (uint16_t)cNBT_ParseI16(&state.reader);
+  if (type == cNBT_END || type > cNBT_A64 || !cNBT_ReaderCheck(&state.reader, keyLength))
+    return 0;
+  state.reader.offset += keyLength;
+
+  if (!count)
+    return 1;
+
+  state.rest = cNBT_Alloc(count * (sizeof(const char *) + sizeof(uint32_t)));
+  if (!state.rest)
+    return 0;
+  state.matched = (uint32_t *)(state.rest + count);
+  for (size_t i = 0; i < count; i++) {
+    state.rest[i] = paths[i] ? paths[i] : "";
+    state.matched[i] = 0;
+  }
+
+  // The root itself is matched by empty paths.
+  for (size_t i = 0; i < count; i++) {
+    if (!*state.rest[i]) {
+      state.matched[i] = 1;
+      cNBT_IndexRecord(&state, i, type);
+    }
+  }
+  if (state.pending)
+    cNBT_IndexX(&state, type, 0);
+
+  cNBT_Free(state.rest);
+
+  if (state.reader.errorFlag) {
+    for (size_t i = 0; i < count; i++)
+      offsets[i].offset = SIZE_MAX;
+    return 0;
+  }
+
+  return 1;
+}
+
+// Load an unsigned integer of `size` bytes.
+static inline uint64_t cNBT_LoadRaw(
+  const uint8_t *cursor,
+  size_t size,
+  uint8_t bigEndian
+) {
+  uint64_t result = 0;
+
+  if (bigEndian) {
+    for (size_t i = 0; i < size; i++)
+      result = result << 8 | cursor[i];
+  } else {
+    for (size_t i = size; i > 0; i--)
+      result = result << 8 | cursor[i - 1];
+  }
+
+  return result;
+}
+
+// Store the lowest `size` bytes of an integer.
+static inline void cNBT_StoreRaw(
+  uint8_t *cursor,
+  size_t size,
+  uint8_t bigEndian,
+  uint64_t value
+) {
+  if (bigEndian) {
+    for (size_t i = size; i > 0; i--, value >>= 8)
+      cursor[i - 1] = (uint8_t)value;
+  } else {
+    for (size_t i = 0; i < size; i++, value >>= 8)
+      cursor[i] = (uint8_t)value;
+  }
+}
+
+// Sign extend the lowest `size` bytes of an integer.
+static inline int64_t cNBT_SignExtend(
+  uint64_t value,
+  size_t size
+) {
+  if (size < 8 && value & (uint64_t)1 << (size * 8 - 1))
+    value |= ~(uint64_t)0 << (size * 8);
+  return (int64_t)value;
+}
+
+// Check whether an integer fits in `size` bytes.
+#define cNBT_FitsIn(value, size) \
+  ((size) == 8 || ((value) >= -((int64_t)1 << ((size) * 8 - 1)) && (value) < ((int64_t)1 << ((size) * 8 - 1))))
+
+uint8_t cNBT_GetRawInt(
+  const void *data,
+  uint8_t bigEndian,
+  const cNBTOffset *offset,
+  int64_t *value
+) {
+  if (!data || !offset || !value || offset->type < cNBT_I08 || offset->type > cNBT_I64)
+    return 0;
+
+  size_t size = cNBT_ElementSize[offset->type];
+  *value = cNBT_SignExtend(
+    cNBT_LoadRaw((const uint8_t *)data + offset->offset, size, bigEndian),
+    size);
+
+  return 1;
+}
+
+uint8_t cNBT_SetRawInt(
+  void *data,
+  uint8_t bigEndian,
+  const cNBTOffset *offset,
+  int64_t value
+) {
+  if (!data || !offset || offset->type < cNBT_I08 || offset->type > cNBT_I64)
+    return 0;
+
+  size_t size = cNBT_ElementSize[offset->type];
+  if (!cNBT_FitsIn(value, size))
+    return 0;
+
+  cNBT_StoreRaw((uint8_t *)data + offset->offset, size, bigEndian, (uint64_t)value);
+
+  return 1;
+}
+
+uint8_t cNBT_GetRawFloat(
+  const void *data,
+  uint8_t bigEndian,
+  const cNBTOffset *offset,
+  double *value
+) {
+  const uint8_t *cursor;
+
+  if (!data || !offset || !value)
+    return 0;
+
+  cursor = (const uint8_t *)data + offset->offset;
+  if (offset->type == cNBT_F32) {
+    uint32_t bits = (uint32_t)cNBT_LoadRaw(cursor, 4, bigEndian);
+    float result;
+    memcpy(&result, &bits, sizeof(float));
+    *value = result;
+  } else if (offset->type == cNBT_F64) {
+    uint64_t bits = cNBT_LoadRaw(cursor, 8, bigEndian);
+    memcpy(value, &bits, sizeof(double));
+  } else {
+    return 0;
+  }
+
+  return 1;
+}
+
+uint8_t cNBT_SetRawFloat(
+  void *data,
+  uint8_t bigEndian,
+  const cNBTOffset *offset,
+  double value
+) {
+  uint8_t *cursor;
+
+  if (!data || !offset)
+    return 0;
+
+  cursor = (uint8_t *)data + offset->offset;
+  if (offset->type == cNBT_F32) {
+    float single = (float)value;
+    uint32_t bits;
+    memcpy(&bits, &single, sizeof(float));
+    cNBT_StoreRaw(cursor, 4, bigEndian, bits);
+  } else if (offset->type == cNBT_F64) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+    cNBT_StoreRaw(cursor, 8, bigEndian, bits);
+  } else {
+    return 0;
+  }
+
+  return 1;
+}
+
+uint8_t cNBT_GetRawArrayElement(
+  const void *data,
+  uint8_t bigEndian,
+  const cNBTOffset *offset,
+  int32_t index,
+  int64_t *value
+) {
+  if (
+    !data || !offset || !value
+    || (offset->type != cNBT_A08 && offset->type != cNBT_A32 && offset->type != cNBT_A64)
+    || index < 0 || index >= offset->length
+  )
+    return 0;
+
+  size_t size = cNBT_ElementSize[offset->type];
+  *value = cNBT_SignExtend(
+    cNBT_LoadRaw((const uint8_t *)data + offset->offset + 4 + (size_t)index * size, size, bigEndian),
+    size);
+
+  return 1;
+}
+
+uint8_t cNBT_SetRawArrayElement(
+  void *data,
+  uint8_t bigEndian,
+  const cNBTOffset *offset,
+  int32_t index,
+  int64_t value
+) {
+  if (
+    !data || !offset
+    || (offset->type != cNBT_A08 && offset->type != cNBT_A32 && offset->type != cNBT_A64)
+    || index < 0 || index >= offset->length
+  )
+    return 0;
+
+  size_t size = cNBT_ElementSize[offset->type];
+  if (!cNBT_FitsIn(value, size))
+    return 0;
+
+  cNBT_StoreRaw((uint8_t *)data + offset->offset + 4 + (size_t)index * size, size, bigEndian, (uint64_t)value);
+
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] PACKED ARRAYS
+//-----------------------------------------------------------------------------
+
+// The AVX2 kernels are compiled for x86 with GCC and Clang regardless of the
+// target flags, and only called when the CPU supports them. They read the
+// longs as a little-endian bit stream, so they're only used for arrays stored
+// in little-endian order.
+#if (defined(__GNUC__) || defined(__clang__))\
+  && (defined(__x86_64__) || defined(__i386__))\
+  && !cNBT_HOST_BIG_ENDIAN\
+  && !defined(cNBT_DISABLE_SIMD)
+#define cNBT_PACKED_AVX2
+#include <immintrin.h>
+#define cNBT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+int32_t cNBT_PackedLength(
+  size_t count,
+  uint8_t bits,
+  uint8_t layout
+) {
+  uint64_t result;
+
+  if (bits < 1 || bits > 16 || count > (size_t)INT32_MAX)
+    return -1;
+
+  if (layout == cNBT_PACKED_SPANNING)
+    result = ((uint64_t)count * bits + 63) / 64;
+  else if (layout == cNBT_PACKED_ALIGNED)
+    result = (count + 64 / bits - 1) / (64 / bits);
+  else
+    return -1;
+
+  return (int32_t)result;
+}
+
+// Scalar kernels, reading and writing the longs in the specified byte order.
+
+static cNBT_FORCE_INLINE void cNBT_UnpackSpanningE(
+  const uint8_t *data,
+  uint16_t *output,
+  size_t begin,
+  size_t count,
+  uint8_t bits,
+  const uint8_t bigEndian
+) {
+  uint64_t mask = (1ULL << bits) - 1;
+  size_t bit = begin * bits;
+
+  for (size_t i = begin; i < count; i++, bit += bits) {
+    size_t index = bit >> 6;
+    uint32_t shift = bit & 63;
+    uint64_t value = cNBT_Load64(data + index * 8, bigEndian) >> shift;
+    if (shift + bits > 64)
+      value |= cNBT_Load64(data + index * 8 + 8, bigEndian) << (64 - shift);
+    output[i] = (uint16_t)(value & mask);
+  }
+}
+
+static cNBT_FORCE_INLINE void cNBT_UnpackAlignedE(
+  const uint8_t *data,
+  uint16_t *output,
+  size_t begin,
+  size_t count,
+  uint8_t bits,
+  const uint8_t bigEndian
+) {
+  uint64_t mask = (1ULL << bits) - 1;
+  uint32_t perLong = 64 / bits;
+  size_t i = begin;
+
+  for (size_t index = begin / perLong; i < count; index++) {
+    uint64_t word = cNBT_Load64(data + index * 8, bigEndian);
+    for (uint32_t j = 0; j < perLong && i < count; j++, i++, word >>= bits)
+      output[i] = (uint16_t)(word & mask);
+  }
+}
+
+static void cNBT_UnpackScalar(
+  const uint8_t *data,
+  uint16_t *output,
+  size_t begin,
+  size_t count,
+  uint8_t bits,
+  uint8_t layout,
+  uint8_t bigEndian
+) {
+  if (layout == cNBT_PACKED_SPANNING) {
+    if (bigEndian)
+      cNBT_UnpackSpanningE(data, output, begin, count, bits, 1);
+    else
+      cNBT_UnpackSpanningE(data, output, begin, count, bits, 0);
+  } else {
+    if (bigEndian)
+      cNBT_UnpackAlignedE(data, output, begin, count, bits, 1);
+    else
+      cNBT_UnpackAlignedE(data, output, begin, count, bits, 0);
+  }
+}
+
+// Pack into native longs, starting from the long containing index `begin`.
+static void cNBT_PackScalar(
+  uint64_t *data,
+  const uint16_t *input,
+  size_t begin,
+  size_t count,
+  uint8_t bits,
+  uint8_t layout
+) {
+  uint64_t mask = (1ULL << bits) - 1
+    , word = 0;
+  uint32_t used = 0;
+
+  if (layout == cNBT_PACKED_SPANNING) {
+    for (size_t i = begin; i < count; i++) {
+      uint64_t value = input[i] & mask;
+      word |= value << used;
+      used += bits;
+      if (used >= 64) {
+        *data++ = word;
+        used -= 64;
+        word = used ? value >> (bits - used) : 0;
+      }
+    }
+  } else {
+    for (size_t i = begin; i < count; i++) {
+      word |= (input[i] & mask) << used;
+      used += bits;
+      if (used + bits > 64) {
+        *data++ = word;
+        used = 0;
+        word = 0;
+      }
+    }
+  }
+
+  if (used)
+    *data = word;
+}
+
+#ifdef cNBT_PACKED_AVX2
+// Unpack 8 indices per step. Each index is read from a 32-bit window starting
+// at the byte containing its first bit, gathered from `data`. Returns the
+// number of indices unpacked; the rest is left to the scalar kernel.
+cNBT_TARGET_AVX2
+static size_t cNBT_UnpackAVX2(
+  const uint8_t *data,
+  size_t length,
+  uint16_t *output,
+  size_t count,
+  uint8_t bits,
+  uint8_t layout
+) {
+  const __m256i mask = _mm256_set1_epi32((1 << bits) - 1)
+    , lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  size_t bytes = length * 8
+    , i = 0;
+
+  if (layout == cNBT_PACKED_SPANNING) {
+    // 8 indices take `bits` bytes, so the windows of each step are at the
+    // same offsets from the start of the step.
+    __m256i position = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(bits))
+      , offsets = _mm256_srli_epi32(position, 3)
+      , shifts = _mm256_and_si256(position, _mm256_set1_epi32(7));
+    // Bytes read by a step: the last window starts at (7 * bits) / 8.
+    size_t reach = (7 * bits >> 3) + 4;
+
+    for (size_t base = 0; i + 8 <= count && base + reach <= bytes; i += 8, base += bits) {
+      __m256i v = _mm256_i32gather_epi32((const int *)(data + base), offsets, 1);
+      v = _mm256_and_si256(_mm256_srlv_epi32(v, shifts), mask);
+      _mm_storeu_si128(
+        (__m128i *)(output + i),
+        _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+    }
+    return i;
+  }
+
+  // Aligned layout. Each long is unpacked in steps of 8 indices; lanes past
+  // the end of the long produce garbage, which is overwritten by the next
+  // long or by the scalar kernel.
+  uint32_t perLong = 64 / bits
+    , steps = (perLong + 7) / 8;
+  __m256i offsets[8], shifts[8];
+  size_t reach = ((8 * steps - 1) * bits >> 3) + 4
+    , index = 0;
+
+  for (uint32_t s = 0; s < steps; s++) {
+    __m256i position = _mm256_mullo_epi32(
+      _mm256_add_epi32(lanes, _mm256_set1_epi32(8 * s)),
+      _mm256_set1_epi32(bits));
+    offsets[s] = _mm256_srli_epi32(position, 3);
+    shifts[s] = _mm256_and_si256(position, _mm256_set1_epi32(7));
+  }
+
+  for (; i + 8 * steps <= count && index * 8 + reach <= bytes; index++, i += perLong) {
+    const int *base = (const int *)(data + index * 8);
+    for (uint32_t s = 0; s < steps; s++) {
+      __m256i v = _mm256_i32gather_epi32(base, offsets[s], 1);
+      v = _mm256_and_si256(_mm256_srlv_epi32(v, shifts[s]), mask);
+      _mm_storeu_si128(
+        (__m128i *)(output + i + 8 * s),
+        _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+    }
+  }
+
+  return i;
+}
+
+// Pack the aligned layout, 4 indices per step. Returns the number of indices
+// packed, always a multiple of the indices per long.
+cNBT_TARGET_AVX2
+static size_t cNBT_PackAlignedAVX2(
+  uint64_t *data,
+  const uint16_t *input,
+  size_t count,
+  uint8_t bits
+) {
+  const __m256i mask = _mm256_set1_epi64x((1 << bits) - 1);
+  uint32_t perLong = 64 / bits
+    , steps = (perLong + 3) / 4;
+  __m256i shifts[16];
+  size_t i = 0;
+
+  // Lanes past the end of the long are shifted by 64, which gives zero.
+  for (uint32_t s = 0; s < steps; s++) {
+    int64_t lane[4];
+    for (uint32_t l = 0; l < 4; l++)
+      lane[l] = 4 * s + l < perLong ? (int64_t)(4 * s + l) * bits : 64;
+    shifts[s] = _mm256_setr_epi64x(lane[0], lane[1], lane[2], lane[3]);
+  }
+
+  for (; i + 4 * steps <= count; i += perLong) {
+    __m256i word = _mm256_setzero_si256();
+    for (uint32_t s = 0; s < steps; s++) {
+      __m256i v = _mm256_cvtepu16_epi64(_mm_loadl_epi64((const __m128i *)(input + i + 4 * s)));
+      word = _mm256_or_si256(word, _mm256_sllv_epi64(_mm256_and_si256(v, mask), shifts[s]));
+    }
+    __m128i half = _mm_or_si128(_mm256_castsi256_si128(word), _mm256_extracti128_si256(word, 1));
+    half = _mm_or_si128(half, _mm_unpackhi_epi64(half, half));
+    _mm_storel_epi64((__m128i *)data++, half);
+  }
+
+  return i;
+}
+
+static uint8_t cNBT_HasAVX2(void) {
+  static int8_t result = -1;
+
+  if (result < 0) {
+    __builtin_cpu_init();
+    result = __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+
+  return (uint8_t)result;
+}
+#endif
+
+uint8_t cNBT_UnpackIndices(
+  const cNBT *nbt,
+  uint16_t *output,
+  size_t count,
+  uint8_t bits,
+  uint8_t layout
+) {
+  int32_t length = cNBT_PackedLength(count, bits, layout);
+  const uint8_t *data;
+  uint8_t bigEndian;
+  size_t done = 0;
+
+  if (!nbt || nbt->type != cNBT_A64 || length < 0 || (count && !output))
+    return 0;
+  if (!count)
+    return 1;
+  if (!nbt->value.valueArray || nbt->value.lengthArray < length)
+    return 0;
+
+  data = (const uint8_t *)nbt->value.valueArray;
+  bigEndian = cNBT_ArrayBigEndian(nbt);
+
+#ifdef cNBT_PACKED_AVX2
+  if (!bigEndian && cNBT_HasAVX2())
+    done = cNBT_UnpackAVX2(data, (size_t)nbt->value.lengthArray, output, count, bits, layout);
+#endif
+
+  cNBT_UnpackScalar(data, output, done, count, bits, layout, bigEndian);
+
+  return 1;
+}
+
+cNBT *cNBT_PackIndices(
+  cNBT *nbt,
+  const uint16_t *input,
+  size_t count,
+  uint8_t bits,
+  uint8_t layout
+) {
+  int32_t length = cNBT_PackedLength(count, bits, layout);
+  uint64_t *data = cNBT_NULLPTR;
+  size_t done = 0;
+
+  if (!nbt || nbt->type != cNBT_A64 || length < 0 || (count && !input))
+    return cNBT_NULLPTR;
+
+  if (length) {
+    data = cNBT_AllocAs((size_t)length * sizeof(uint64_t), cNBT_MEM_ARRAY);
+    if (!data)
+      return cNBT_NULLPTR;
+
+#ifdef cNBT_PACKED_AVX2
+    if (layout == cNBT_PACKED_ALIGNED && cNBT_HasAVX2())
+      done = cNBT_PackAlignedAVX2(data, input, count, bits);
+#endif
+
+    cNBT_PackScalar(data + done / (64 / bits), input, done, count, bits, layout);
+  }
+
+  nbt = cNBT_Unshare(nbt);
+  if (nbt->value.valueArray && !(nbt->flags & cNBT_FLAG_BORROWED_VALUE))
+    cNBT_Free(nbt->value.valueArray);
+  nbt->flags &= ~(cNBT_FLAG_BORROWED_VALUE | cNBT_FLAG_ARRAY_VIEW);
+  nbt->value.valueArray = data;
+  nbt->value.lengthArray = length;
+  cNBT_MarkDirty(nbt);
+
+  return nbt;
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] SCHEMAS
+//-----------------------------------------------------------------------------
+
+typedef struct {
+  // Type byte and key of the item as written in little endian, then in big
+  // endian. `key` points into the first one.
+  uint8_t *header;
+  const char *key;
+  uint32_t hash;
+  uint16_t keyLength;
+  uint8_t type;
+  uint8_t elementType;
+  uint8_t flags;
+  size_t offset;
+  size_t elementSize;
+  cNBTPayload defaultValue;
+  // Fields of embedded structs and of list elements.
+  cNBTSchema *schema;
+  // Bytes of the headers and scalar payloads of the following entries,
+  // and of the end tag.
+  size_t fixedAfter;
+} cNBTSchemaEntry;
+
+struct cNBTSchema_t {
+  cNBTSchemaEntry *entries;
+  uint32_t count;
+  // Open addressing table of entry indices plus one, 0 for empty slots.
+  uint32_t *slots;
+  uint32_t mask;
+  // Bytes of all headers and scalar payloads of an object, end tag included.
+  size_t fixedSize;
+};
+
+// Size of scalar members and list elements, 0 for other types.
+static const uint8_t cNBT_SchemaScalarSize[] = {
+  0, 1, 2, 4, 8, 4, 8, 0, 0, 0, 0, 0, 0
+};
+
+// Hash of a key, shared by schemas and shapes.
+static inline uint32_t cNBT_KeyHash(
+  const char *key,
+  size_t length
+) {
+  return (uint32_t)cNBT_HashFinal(cNBT_HashBytes(0, key, length));
+}
+
+static cNBTSchema *cNBT_CompileSchemaX(
+  const cNBTSchemaField *fields,
+  size_t fieldCount,
+  uint32_t depth
+) {
+  cNBTSchema *result;
+  uint32_t slotCount = 1;
+
+  if ((fieldCount && !fields) || fieldCount > UINT16_MAX || depth > cNBT_MAX_DEPTH)
+    return cNBT_NULLPTR;
+
+  while (slotCount < fieldCount * 2)
+    slotCount *= 2;
+
+  result = cNBT_AllocAs(sizeof(cNBTSchema), cNBT_MEM_OTHER);
+  if (!result)
+    return cNBT_NULLPTR;
+  memset((void *)result, 0, sizeof(cNBTSchema));
+  result->entries = cNBT_AllocAs(fieldCount * sizeof(cNBTSchemaEntry) + 1, cNBT_MEM_OTHER);
+  result->slots = cNBT_AllocAs(slotCount * sizeof(uint32_t), cNBT_MEM_OTHER);
+  result->mask = slotCount - 1;
+  if (!result->entries || !result->slots) {
+    cNBT_FreeSchema(result);
+    return cNBT_NULLPTR;
+  }
+  memset((void *)result->slots, 0, slotCount * sizeof(uint32_t));
+
+  for (size_t i = 0; i < fieldCount; i++) {
+    const cNBTSchemaField *field = &fields[i];
+    cNBTSchemaEntry *entry = &result->entries[i];
+    size_t keyLength = field->key ? strlen(field->key) : 0;
+    uint8_t valid = field->key
+      && keyLength <= UINT16_MAX
+      && field->type > cNBT_END
+      && field->type <= cNBT_A64;
+
+    memset((void *)entry, 0, sizeof(cNBTSchemaEntry));
+    result->count++;
+
+    if (valid && field->type == cNBT_LST)
+      valid = cNBT_SchemaScalarSize[field->elementType]
+        || field->elementType == cNBT_STR
+        || (field->elementType == cNBT_OBJ && field->elementSize);
+    if (!valid) {
+      cNBT_FreeSchema(result);
+      return cNBT_NULLPTR;
+    }
+
+    entry->keyLength = (uint16_t)keyLength;
+    entry->hash = cNBT_KeyHash(field->key, keyLength);
+    entry->type = field->type;
+    entry->elementType = field->elementType;
+    entry->flags = field->flags;
+    entry->offset = field->offset;
+    entry->elementSize = field->elementSize;
+    entry->defaultValue = field->defaultValue;
+    entry->header = cNBT_AllocAs(2 * (keyLength + 3), cNBT_MEM_KEY);
+    if (entry->header) {
+      uint8_t *header = entry->header;
+      for (uint8_t bigEndian = 0; bigEndian < 2; bigEndian++, header += keyLength + 3) {
+        header[0] = entry->type;
+        cNBT_Store16(header + 1, (uint16_t)keyLength, bigEndian);
+        memcpy((void *)(header + 3), field->key, keyLength);
+      }
+      entry->key = (const char *)entry->header + 3;
+    }
+
+    if (
+      entry->key
+      && entry->type == cNBT_STR
+      && entry->defaultValue.valueString
+    ) {
+      // Keep a copy of the default string.
+      size_t length = strlen(entry->defaultValue.valueString);
+      char *copy = cNBT_AllocAs(length + 1, cNBT_MEM_STRING);
+      if (copy)
+        memcpy((void *)copy, entry->defaultValue.valueString, length + 1);
+      entry->defaultValue.valueString = copy;
+      entry->defaultValue.lengthString = (uint16_t)length;
+      if (!copy) {
+        cNBT_FreeSchema(result);
+        return cNBT_NULLPTR;
+      }
+    } else if (entry->type == cNBT_STR) {
+      entry->defaultValue.valueString = cNBT_NULLPTR;
+    }
+
+    if (
+      entry->key
+      && (entry->type == cNBT_OBJ || (entry->type == cNBT_LST && entry->elementType == cNBT_OBJ))
+    )
+      entry->schema = cNBT_CompileSchemaX(field->fields, field->fieldCount, depth + 1);
+
+    if (
+      !entry->key
+      || (
+        (entry->type == cNBT_OBJ || (entry->type == cNBT_LST && entry->elementType == cNBT_OBJ))
+        && !entry->schema
+      )
+    ) {
+      cNBT_FreeSchema(result);
+      return cNBT_NULLPTR;
+    }
+
+    // Insert the entry, duplicated keys are rejected.
+    uint32_t slot = entry->hash & result->mask;
+    while (result->slots[slot]) {
+      const cNBTSchemaEntry *other = &result->entries[result->slots[slot] - 1];
+      if (other->keyLength == entry->keyLength && !memcmp(other->key, entry->key, keyLength)) {
+        cNBT_FreeSchema(result);
+        return cNBT_NULLPTR;
+      }
+      slot = (slot + 1) & result->mask;
+    }
+    result->slots[slot] = (uint32_t)i + 1;
+  }
+
+  // Sizes reserved at once by the encoder.
+  result->fixedSize = 1;
+  for (size_t i = fieldCount; i-- > 0;) {
+    cNBTSchemaEntry *entry = &result->entries[i];
+    entry->fixedAfter = result->fixedSize;
+    result->fixedSize += entry->keyLength + 3 + cNBT_SchemaScalarSize[entry->type];
+  }
+
+  return result;
+}
+
+cNBTSchema *cNBT_CompileSchema(
+  const cNBTSchemaField *fields,
+  size_t fieldCount
+) {
+  return cNBT_CompileSchemaX(fields, fieldCount, 0);
+}
+
+void cNBT_FreeSchema(
+  cNBTSchema *schema
+) {
+  if (!schema)
+    return;
+
+  if (schema->entries) {
+    for (uint32_t i = 0; i < schema->count; i++) {
+      cNBTSchemaEntry *entry = &schema->entries[i];
+      cNBT_Free(entry->header);
+      if (entry->type == cNBT_STR)
+        cNBT_Free(entry->defaultValue.valueString);
+      cNBT_FreeSchema(entry->schema);
+    }
+    cNBT_Free(schema->entries);
+  }
+  cNBT_Free(schema->slots);
+  cNBT_Free(schema);
+}
+
+static const cNBTSchemaEntry *cNBT_SchemaFind(
+  const cNBTSchema *schema,
+  const char *key,
+  uint16_t length
+) {
+  uint32_t hash = cNBT_KeyHash(key, length)
+    , slot = hash & schema->mask
+    , index;
+
+  while ((index = schema->slots[slot])) {
+    const cNBTSchemaEntry *entry = &schema->entries[index - 1];
+    if (
+      entry->hash == hash
+      && entry->keyLength == length
+      && !memcmp(entry->key, key, length)
+    )
+      return entry;
+    slot = (slot + 1) & schema->mask;
+  }
+
+  return cNBT_NULLPTR;
+}
+
+// Write the defaults of scalar members, and zero the others, so the struct
+// can be released at any point of decoding.
+static void cNBT_SchemaInit(
+  const cNBTSchema *schema,
+  uint8_t *object
+) {
+  for (uint32_t i = 0; i < schema->count; i++) {
+    const cNBTSchemaEntry *entry = &schema->entries[i];
+    uint8_t *member = object + entry->offset;
+
+    if (cNBT_SchemaScalarSize[entry->type])
+      // All members of the payload union start at its beginning.
+      memcpy((void *)member, (void *)&entry->defaultValue, cNBT_SchemaScalarSize[entry->type]);
+    else if (entry->type == cNBT_STR)
+      memset((void *)member, 0, sizeof(char *));
+    else if (entry->type == cNBT_OBJ)
+      cNBT_SchemaInit(entry->schema, member);
+    else
+      memset((void *)member, 0, sizeof(cNBTSchemaArray));
+  }
+}
+
+static void cNBT_SchemaRelease(
+  const cNBTSchema *schema,
+  uint8_t *object);
+
+static void cNBT_SchemaReleaseMember(
+  const cNBTSchemaEntry *entry,
+  uint8_t *member
+) {
+  cNBTSchemaArray *array = (cNBTSchemaArray *)member;
+
+  if (cNBT_SchemaScalarSize[entry->type])
+    return;
+
+  if (entry->type == cNBT_STR) {
+    cNBT_Free(*(char **)member);
+    *(char **)member = cNBT_NULLPTR;
+    return;
+  }
+
+  if (entry->type == cNBT_OBJ) {
+    cNBT_SchemaRelease(entry->schema, member);
+    return;
+  }
+
+  if (entry->type == cNBT_LST && array->data) {
+    for (int32_t i = 0; i < array->length; i++) {
+      if (entry->elementType == cNBT_STR)
+        cNBT_Free(((char **)array->data)[i]);
+      else if (entry->elementType == cNBT_OBJ)
+        cNBT_SchemaRelease(entry->schema, (uint8_t *)array->data + (size_t)i * entry->elementSize);
+    }
+  }
+  cNBT_Free(array->data);
+  array->data = cNBT_NULLPTR;
+  array->length = 0;
+}
+
+static void cNBT_SchemaRelease(
+  const cNBTSchema *schema,
+  uint8_t *object
+) {
+  for (uint32_t i = 0; i < schema->count; i++)
+    cNBT_SchemaReleaseMember(&schema->entries[i], object + schema->entries[i].offset);
+}
+
+void cNBT_ReleaseStruct(
+  const cNBTSchema *schema,
+  void *object
+) {
+  if (schema && object)
+    cNBT_SchemaRelease(schema, (uint8_t *)object);
+}
+
+// Read `length` fixed size elements, and convert them to the byte order of
+// the target.
+static void cNBT_SchemaReadElements(
+  cNBTReader *reader,
+  cNBTSchemaArray *array,
+  int32_t length,
+  size_t size
+) {
+  if (length < 0 || !cNBT_ReaderCheck(reader, (size_t)length * size)) {
+    reader->errorFlag = 1;
+    return;
+  }
+  if (!length)
+    return;
+
+  array->data = cNBT_AllocAs((size_t)length * size, cNBT_MEM_ARRAY);
+  if (!array->data) {
+    reader->errorFlag = 1;
+    return;
+  }
+  memcpy(array->data, (void *)cNBT_GetCursor(reader), (size_t)length * size);
+  reader->offset += (size_t)length * size;
+  cNBT_SwapArray(array->data, (size_t)length, size, reader->bigEndian);
+  array->length = length;
+}
+
+static void cNBT_SchemaDecodeObj(
+  cNBTReader *reader,
+  const cNBTSchema *schema,
+  uint8_t *object);
+
+// Copy the default strings of a missing member, including the members of a
+// missing object. Returns 0 if an allocation failed.
+static uint8_t cNBT_SchemaDefaultStrings(
+  const cNBTSchemaEntry *entry,
+  uint8_t *member
+) {
+  if (entry->type == cNBT_OBJ) {
+    for (uint32_t i = 0; i < entry->schema->count; i++) {
+      const cNBTSchemaEntry *child = &entry->schema->entries[i];
+      if (!cNBT_SchemaDefaultStrings(child, member + child->offset))
+        return 0;
+    }
+    return 1;
+  }
+
+  if (entry->type != cNBT_STR || !entry->defaultValue.valueString)
+    return 1;
+
+  char *copy = cNBT_AllocAs((size_t)entry->defaultValue.lengthString + 1, cNBT_MEM_STRING);
+  if (!copy)
+    return 0;
+  memcpy((void *)copy, entry->defaultValue.valueString, (size_t)entry->defaultValue.lengthString + 1);
+  *(char **)member = copy;
+
+  return 1;
+}
+
+// Decode a payload matching the type of `entry` into its member.
+static void cNBT_SchemaDecodeValue(
+  cNBTReader *reader,
+  const cNBTSchemaEntry *entry,
+  uint8_t *member
+) {
+  cNBTSchemaArray *array = (cNBTSchemaArray *)member;
+  uint8_t elementType;
+  int32_t length;
+
+  switch (entry->type) {
+    case cNBT_I08:
+      *(int8_t *)member = cNBT_ParseI08(reader);
+      return;
+    case cNBT_I16:
+      *(int16_t *)member = cNBT_ParseI16(reader);
+      return;
+    case cNBT_I32:
+      *(int32_t *)member = cNBT_ParseI32(reader);
+      return;
+    case cNBT_I64:
+      *(int64_t *)member = cNBT_ParseI64(reader);
+      return;
+    case cNBT_F32:
+      *(float *)member = cNBT_ParseF32(reader);
+      return;
+    case cNBT_F64:
+      *(double *)member = cNBT_ParseF64(reader);
+      return;
+
+    case cNBT_STR:
+      cNBT_ParseStr(reader, (char **)member, cNBT_MEM_STRING);
+      return;
+
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      length = cNBT_ParseI32(reader);
+      cNBT_SchemaReadElements(
+        reader,
+        array,
+        length,
+        entry->type == cNBT_A08 ? 1 : entry->type == cNBT_A32 ? 4 : 8);
+      return;
+
+    case cNBT_OBJ:
+      cNBT_SchemaDecodeObj(reader, entry->schema, member);
+      return;
+
+    case cNBT_LST:
+      elementType = cNBT_ParseI08(reader);
+      length = cNBT_ParseI32(reader);
+      if (reader->errorFlag || length <= 0) {
+        if (length < 0)
+          reader->errorFlag = 1;
+        return;
+      }
+      if (
+        elementType != entry->elementType
+        || !cNBT_ReaderCheck(reader, (size_t)length * cNBT_PayloadMinSize[elementType])
+      ) {
+        reader->errorFlag = 1;
+        return;
+      }
+
+      if (cNBT_SchemaScalarSize[elementType]) {
+        cNBT_SchemaReadElements(reader, array, length, cNBT_SchemaScalarSize[elementType]);
+        return;
+      }
+
+      if (elementType == cNBT_STR) {
+        array->data = cNBT_AllocAs((size_t)length * sizeof(char *), cNBT_MEM_ARRAY);
+        if (!array->data) {
+          reader->errorFlag = 1;
+          return;
+        }
+        memset(array->data, 0, (size_t)length * sizeof(char *));
+        array->length = length;
+        for (int32_t i = 0; i < length && !reader->errorFlag; i++)
+          cNBT_ParseStr(reader, &((char **)array->data)[i], cNBT_MEM_STRING);
+        return;
+      }
+
+      // Lists of objects.
+      array->data = cNBT_AllocAs((size_t)length * entry->elementSize, cNBT_MEM_ARRAY);
+      if (!array->data) {
+        reader->errorFlag = 1;
+        return;
+      }
+      array->length = length;
+      for (int32_t i = 0; i < length; i++)
+        cNBT_SchemaInit(entry->schema, (uint8_t *)array->data + (size_t)i * entry->elementSize);
+      for (int32_t i = 0; i < length && !reader->errorFlag; i++)
+        cNBT_SchemaDecodeObj(reader, entry->schema, (uint8_t *)array->data + (size_t)i * entry->elementSize);
+      return;
+  }
+}
+
+// Decode the payload of an object. Members must have been initialized with
+// cNBT_SchemaInit().
+static void cNBT_SchemaDecodeObj(
+  cNBTReader *reader,
+  const cNBTSchema *schema,
+  uint8_t *object
+) {
+  uint64_t inlineSeen[4]
+    , *seen = inlineSeen;
+  size_t words = (schema->count + 63) / 64;
+  uint8_t type;
+
+  if (reader->depth >= cNBT_ReaderMaxDepth(reader)) {
+    reader->errorFlag = 1;
+    return;
+  }
+
+  if (words > 4) {
+    seen = cNBT_Alloc(words * sizeof(uint64_t));
+    if (!seen) {
+      reader->errorFlag = 1;
+      return;
+    }
+  }
+  memset((void *)seen, 0, words * sizeof(uint64_t));
+  reader->depth++;
+
+  while ((type = cNBT_ParseI08(reader)) != cNBT_END && !reader->errorFlag) {
+    uint16_t keyLength = (uint16_t)cNBT_ParseI16(reader);
+    const char *key = (const char *)cNBT_GetCursor(reader);
+    const cNBTSchemaEntry *entry;
+    uint8_t *member;
+    uint32_t index;
+
+    if (type > cNBT_A64 || !cNBT_ReaderCheck(reader, keyLength)) {
+      reader->errorFlag = 1;
+      break;
+    }
+    reader->offset += keyLength;
+
+    entry = cNBT_SchemaFind(schema, key, keyLength);
+    if (!entry) {
+      cNBT_SkipX(reader, type);
+      continue;
+    }
+    if (entry->type != type) {
+      reader->errorFlag = 1;
+      break;
+    }
+
+    index = (uint32_t)(entry - schema->entries);
+    member = object + entry->offset;
+    if (seen[index / 64] & (1ULL << (index % 64))) {
+      // Repeated key, the last value wins.
+      cNBT_SchemaReleaseMember(entry, member);
+      if (entry->type == cNBT_OBJ)
+        cNBT_SchemaInit(entry->schema, member);
+    }
+    seen[index / 64] |= 1ULL << (index % 64);
+    cNBT_SchemaDecodeValue(reader, entry, member);
+  }
+
+  // Check the missing fields.
+  for (uint32_t i = 0; i < schema->count && !reader->errorFlag; i++) {
+    const cNBTSchemaEntry *entry = &schema->entries[i];
+
+    if (seen[i / 64] & (1ULL << (i % 64)))
+      continue;
+    if (entry->flags & cNBT_FIELD_REQUIRED)
+      reader->errorFlag = 1;
+    else if (!cNBT_SchemaDefaultStrings(entry, object + entry->offset))
+      reader->errorFlag = 1;
+  }
+
+  reader->depth--;
+  if (seen != inlineSeen)
+    cNBT_Free(seen);
+}
+
+uint8_t cNBT_DecodeStruct(
+  const cNBTSchema *schema,
+  const void *data,
+  size_t size,
+  uint8_t bigEndian,
+  void *object
+) {
+  cNBTReader reader;
+  uint8_t type;
+  uint16_t keyLength;
+
+  if (!schema || !data || !object)
+    return 0;
+
+  memset((void *)&reader, 0, sizeof(reader));
+  reader.data = data;
+  reader.length = size;
+  reader.bigEndian = bigEndian;
+
+  cNBT_SchemaInit(schema, (uint8_t *)object);
+
+  // Skip the type and the key of the root.
+  type = cNBT_ParseI08(&reader);
+  keyLength = (uint16_t)cNBT_ParseI16(&reader);
+  if (type != cNBT_OBJ || !cNBT_ReaderCheck(&reader, keyLength))
+    return 0;
+  reader.offset += keyLength;
+
+  cNBT_SchemaDecodeObj(&reader, schema, (uint8_t *)object);
+
+  if (reader.errorFlag) {
+    cNBT_SchemaRelease(schema, (uint8_t *)object);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void cNBT_SchemaEncodeObj(
+  cNBTWriter *writer,
+  const cNBTSchema *schema,
+  const uint8_t *object);
+
+// Length of the array of a member, 0 for NULL or negative length arrays.
+static inline int32_t cNBT_SchemaArrayLength(
+  const cNBTSchemaArray *array
+) {
+  return array->data && array->length > 0 ? array->length : 0;
+}
+
+// Encode the payload of a string, array, list or object member.
+static cNBT_FORCE_INLINE void cNBT_SchemaEncodeValueE(
+  cNBTWriter *writer,
+  const cNBTSchemaEntry *entry,
+  const uint8_t *member,
+  const uint8_t bigEndian
+) {
+  const cNBTSchemaArray *array = (const cNBTSchemaArray *)member;
+  int32_t length;
+
+  switch (entry->type) {
+    case cNBT_STR:
+      cNBT_WriteStrE(writer, *(char *const *)member, bigEndian);
+      return;
+
+    case cNBT_A08:
+      cNBT_WriteArrE(writer, cNBT_SchemaArrayLength(array), array->data, 1, bigEndian);
+      return;
+    case cNBT_A32:
+      cNBT_WriteArrE(writer, cNBT_SchemaArrayLength(array), array->data, 4, bigEndian);
+      return;
+    case cNBT_A64:
+      cNBT_WriteArrE(writer, cNBT_SchemaArrayLength(array), array->data, 8, bigEndian);
+      return;
+
+    case cNBT_OBJ:
+      cNBT_SchemaEncodeObj(writer, entry->schema, member);
+      return;
+
+    case cNBT_LST:
+      length = cNBT_SchemaArrayLength(array);
+      cNBT_WriteI08(writer, length ? entry->elementType : cNBT_END);
+      cNBT_WriteI32E(writer, length, bigEndian);
+      if (!length)
+        return;
+
+      if (cNBT_SchemaScalarSize[entry->elementType]) {
+        size_t size = (size_t)length * cNBT_SchemaScalarSize[entry->elementType];
+        if (!cNBT_Expand(writer, size))
+          return;
+        memcpy((void *)cNBT_GetCursor(writer), array->data, size);
+        cNBT_SwapArray(
+          cNBT_GetCursor(writer),
+          (size_t)length,
+          cNBT_SchemaScalarSize[entry->elementType],
+          bigEndian);
+        writer->offset += size;
+      } else if (entry->elementType == cNBT_STR) {
+        for (int32_t i = 0; i < length; i++)
+          cNBT_WriteStrE(writer, ((char *const *)array->data)[i], bigEndian);
+      } else {
+        for (int32_t i = 0; i < length; i++)
+          cNBT_SchemaEncodeObj(
+            writer,
+            entry->schema,
+            (const uint8_t *)array->data + (size_t)i * entry->elementSize);
+      }
+      return;
+  }
+}
+
+// Encode the payload of an object. The headers and scalar payloads are
+// reserved at once, and copied from the precomputed headers.
+static cNBT_FORCE_INLINE void cNBT_SchemaEncodeObjE(
+  cNBTWriter *writer,
+  const cNBTSchema *schema,
+  const uint8_t *object,
+  const uint8_t bigEndian
+) {
+  if (!cNBT_Expand(writer, schema->fixedSize))
+    return;
+
+  for (uint32_t i = 0; i < schema->count; i++) {
+    const cNBTSchemaEntry *entry = &schema->entries[i];
+    const uint8_t *member = object + entry->offset;
+    size_t headerLength = (size_t)entry->keyLength + 3;
+    uint8_t *cursor = cNBT_GetCursor(writer);
+    uint16_t value16;
+    uint32_t value32;
+    uint64_t value64;
+
+    memcpy((void *)cursor, (void *)(entry->header + (bigEndian ? headerLength : 0)), headerLength);
+    cursor += headerLength;
+
+    switch (entry->type) {
+      case cNBT_I08:
+        *cursor = *member;
+        writer->offset += headerLength + 1;
+        continue;
+      case cNBT_I16:
+        memcpy((void *)&value16, (void *)member, 2);
+        cNBT_Store16(cursor, value16, bigEndian);
+        writer->offset += headerLength + 2;
+        continue;
+      case cNBT_I32:
+      case cNBT_F32:
+        memcpy((void *)&value32, (void *)member, 4);
+        cNBT_Store32(cursor, value32, bigEndian);
+        writer->offset += headerLength + 4;
+        continue;
+      case cNBT_I64:
+      case cNBT_F64:
+        memcpy((void *)&value64, (void *)member, 8);
+        cNBT_Store64(cursor, value64, bigEndian);
+        writer->offset += headerLength + 8;
+        continue;
+    }
+
+    writer->offset += headerLength;
+    cNBT_SchemaEncodeValueE(writer, entry, member, bigEndian);
+    // The nested writes may have failed within the capacity.
+    if (writer->errorFlag || !cNBT_Expand(writer, entry->fixedAfter))
+      return;
+  }
+
+  *cNBT_GetCursor(writer) = cNBT_END;
+  writer->offset++;
+}
+
+static void cNBT_SchemaEncodeObjBE(
+  cNBTWriter *writer,
+  const cNBTSchema *schema,
+  const uint8_t *object
+) {
+  cNBT_SchemaEncodeObjE(writer, schema, object, 1);
+}
+
+static void cNBT_SchemaEncodeObjLE(
+  cNBTWriter *writer,
+  const cNBTSchema *schema,
+  const uint8_t *object
+) {
+  cNBT_SchemaEncodeObjE(writer, schema, object, 0);
+}
+
+static void cNBT_SchemaEncodeObj(
+  cNBTWriter *writer,
+  const cNBTSchema *schema,
+  const uint8_t *object
+) {
+  if (writer->bigEndian)
+    cNBT_SchemaEncodeObjBE(writer, schema, object);
+  else
+    cNBT_SchemaEncodeObjLE(writer, schema, object);
+}
+
+const void *cNBT_EncodeStruct(
+  const cNBTSchema *schema,
+  const void *object,
+  size_t initialCapacity,
+  uint8_t bigEndian,
+  size_t *length
+) {
+  if (!schema || !object)
+    return cNBT_NULLPTR;
+  if (!initialCapacity)
+    initialCapacity = 0x40;
+
+  cNBTWriter w = {
+    .bigEndian = bigEndian,
+    .capacity = initialCapacity,
+    .errorFlag = 0,
+    .offset = 0,
+    .data = cNBT_AllocAs(initialCapacity, cNBT_MEM_WRITER)
+  };
+
+  if (!w.data)
+    return cNBT_NULLPTR;
+
+  // Unnamed root object.
+  cNBT_WriteI08(&w, cNBT_OBJ);
+  cNBT_WriteI16E(&w, 0, bigEndian);
+  cNBT_SchemaEncodeObj(&w, schema, (const uint8_t *)object);
+
+  if (w.errorFlag) {
+    cNBT_Free(w.data);
+    return cNBT_NULLPTR;
+  }
+
+  if (length)
+    *length = w.offset;
+
+  return w.data;
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] SHAPES
+//-----------------------------------------------------------------------------
+
+// Objects with more items aren't shaped.
+#define cNBT_SHAPE_MAX_SLOTS 256
+// Objects with fewer items don't get a slot table, walking their children is
+// as fast.
+#define cNBT_SHAPE_TABLE_SLOTS 8
+#define cNBT_SHAPE_DEFAULT_CAPACITY 4096
+// Skeletons up to this size are built on the stack when learning a shape.
+#define cNBT_SHAPE_STACK_SKELETON 1024
+
+typedef struct {
+  // Zero terminated key shared by the items of the slot.
+  const char *key;
+  // Type byte and key as found in the data, followed by the element type for
+  // lists.
+  const uint8_t *header;
+  uint32_t headerLength;
+  uint32_t keyHash;
+  uint16_t keyLength;
+  uint8_t type;
+  // Predicted shape of the object in the slot, or of the objects of the list
+  // in the slot.
+  cNBTShape *child;
+} cNBTShapeSlot;
+
+struct cNBTShape_t {
+  // Next shape of the same bucket of the cache.
+  cNBTShape *next;
+  // Hash of the headers of all slots.
+  uint64_t hash;
+  uint32_t count;
+  uint8_t bigEndian;
+  cNBTShapeSlot *slots;
+  // Open addressing table of slot indices plus one by key hash, 0 for empty
+  // entries.
+  uint32_t *index;
+  uint32_t mask;
+  // Headers of all slots.
+  const uint8_t *skeleton;
+  size_t skeletonLength;
+};
+
+struct cNBTShapeCache_t {
+  cNBTShape **buckets;
+  uint32_t mask;
+  uint32_t count;
+  uint32_t capacity;
+  // Shape of the last root object read in each byte order.
+  cNBTShape *root[2];
+};
+
+cNBTShapeCache *cNBT_CreateShapeCache(
+  uint32_t maxShapes
+) {
+  cNBTShapeCache *result;
+  uint32_t buckets = 1;
+
+  if (!maxShapes)
+    maxShapes = cNBT_SHAPE_DEFAULT_CAPACITY;
+  while (buckets < maxShapes && buckets < 0x80000000U)
+    buckets *= 2;
+
+  result = cNBT_AllocAs(sizeof(cNBTShapeCache), cNBT_MEM_OTHER);
+  if (!result)
+    return cNBT_NULLPTR;
+  memset((void *)result, 0, sizeof(cNBTShapeCache));
+  result->buckets = cNBT_AllocAs((size_t)buckets * sizeof(cNBTShape *), cNBT_MEM_OTHER);
+  if (!result->buckets) {
+    cNBT_Free(result);
+    return cNBT_NULLPTR;
+  }
+  memset((void *)result->buckets, 0, (size_t)buckets * sizeof(cNBTShape *));
+  result->mask = buckets - 1;
+  result->capacity = maxShapes;
+
+  return result;
+}
+
+void cNBT_DeleteShapeCache(
+  cNBTShapeCache *cache
+) {
+  if (!cache)
+    return;
+
+  for (uint32_t i = 0; i <= cache->mask; i++) {
+    for (cNBTShape *shape = cache->buckets[i], *next; shape; shape = next) {
+      next = shape->next;
+      cNBT_Free(shape);
+    }
+  }
+  cNBT_Free(cache->buckets);
+  cNBT_Free(cache);
+}
+
+uint32_t cNBT_GetShapeCount(
+  const cNBTShapeCache *cache
+) {
+  return cache ? cache->count : 0;
+}
+
+// Find the slot of a key, or -1.
+static int32_t cNBT_ShapeFindSlot(
+  const cNBTShape *shape,
+  const char *key,
+  size_t length
+) {
+  uint32_t hash = cNBT_KeyHash(key, length)
+    , entry = hash & shape->mask
+    , index;
+
+  while ((index = shape->index[entry])) {
+    const cNBTShapeSlot *slot = &shape->slots[index - 1];
+    if (
+      slot->keyHash == hash
+      && slot->keyLength == length
+      && !memcmp(slot->key, key, length)
+    )
+      return (int32_t)index - 1;
+    entry = (entry + 1) & shape->mask;
+  }
+
+  return -1;
+}
+
+static cNBT *cNBT_ShapeFindNode(
+  const cNBT *nbt,
+  const char *key,
+  size_t length
+) {
+  int32_t slot = cNBT_ShapeFindSlot(nbt->value.shape, key, length);
+
+  return slot < 0 ? cNBT_NULLPTR : nbt->value.slots[slot];
+}
+
+// Write the headers of the children of an object.
+static void cNBT_ShapeSkeleton(
+  const cNBT *nbt,
+  uint8_t *header,
+  uint8_t bigEndian
+) {
+  cNBT *item;
+
+  cNBT_ForEach(nbt, item) {
+    uint16_t keyLength = (uint16_t)strlen(item->key);
+    header[0] = item->type;
+    cNBT_Store16(header + 1, keyLength, bigEndian);
+    memcpy((void *)(header + 3), item->key, keyLength);
+    header += (size_t)keyLength + 3;
+    if (item->type == cNBT_LST)
+      *header++ = item->listElementType;
+  }
+}
+
+// Find the shape of the children of an object in the cache, or learn it.
+// Returns NULL if the object can't be shaped, or the cache is full and doesn't
+// have the shape.
+static cNBTShape *cNBT_ShapeLearn(
+  cNBTShapeCache *cache,
+  const cNBT *nbt,
+  uint8_t bigEndian
+) {
+  uint8_t stackSkeleton[cNBT_SHAPE_STACK_SKELETON]
+    , *skeleton = stackSkeleton;
+  uint32_t count = 0
+    , entries = 1;
+  size_t skeletonLength = 0
+    , keysLength = 0;
+  cNBTShape *result = cNBT_NULLPTR;
+  cNBT *item;
+  uint64_t hash;
+
+  cNBT_ForEach(nbt, item) {
+    size_t keyLength = strlen(item->key);
+    if (++count > cNBT_SHAPE_MAX_SLOTS)
+      return cNBT_NULLPTR;
+    skeletonLength += keyLength + 3 + (item->type == cNBT_LST);
+    keysLength += keyLength + 1;
+  }
+  if (!count)
+    return cNBT_NULLPTR;
+
+  if (skeletonLength > sizeof(stackSkeleton)) {
+    skeleton = cNBT_Alloc(skeletonLength);
+    if (!skeleton)
+      return cNBT_NULLPTR;
+  }
+  cNBT_ShapeSkeleton(nbt, skeleton, bigEndian);
+  hash = cNBT_HashFinal(cNBT_HashBytes(bigEndian, skeleton, skeletonLength));
+
+  // Reuse the same shape if it was learned before.
+  cNBTShape **bucket = &cache->buckets[hash & cache->mask];
+  for (cNBTShape *shape = *bucket; shape; shape = shape->next) {
+    if (
+      shape->hash == hash
+      && shape->bigEndian == !!bigEndian
+      && shape->skeletonLength == skeletonLength
+      && !memcmp(shape->skeleton, skeleton, skeletonLength)
+    ) {
+      result = shape;
+      goto done;
+    }
+  }
+  if (cache->count >= cache->capacity)
+    goto done;
+
+  // The shape, its slots, index, headers and keys in one allocation.
+  while (entries < count * 2)
+    entries *= 2;
+  result = cNBT_AllocAs(
+    sizeof(cNBTShape)
+      + count * sizeof(cNBTShapeSlot)
+      + entries * sizeof(uint32_t)
+      + skeletonLength
+      + keysLength,
+    cNBT_MEM_OTHER);
+  if (!result)
+    goto done;
+
+  memset((void *)result, 0, sizeof(cNBTShape));
+  result->hash = hash;
+  result->count = count;
+  result->bigEndian = !!bigEndian;
+  result->slots = (cNBTShapeSlot *)(result + 1);
+  result->index = (uint32_t *)(result->slots + count);
+  result->mask = entries - 1;
+  result->skeleton = (const uint8_t *)(result->index + entries);
+  result->skeletonLength = skeletonLength;
+  memset((void *)result->index, 0, entries * sizeof(uint32_t));
+  memcpy((void *)result->skeleton, skeleton, skeletonLength);
+
+  const uint8_t *header = result->skeleton;
+  char *key = (char *)result->skeleton + skeletonLength;
+  uint32_t i = 0;
+
+  cNBT_ForEach(nbt, item) {
+    cNBTShapeSlot *slot = &result->slots[i];
+    uint16_t keyLength = (uint16_t)strlen(item->key);
+
+    slot->key = key;
+    slot->header = header;
+    slot->headerLength = (uint32_t)keyLength + 3 + (item->type == cNBT_LST);
+    slot->keyLength = keyLength;
+    slot->keyHash = cNBT_KeyHash(item->key, keyLength);
+    slot->type = item->type;
+    slot->child = cNBT_NULLPTR;
+    header += slot->headerLength;
+    memcpy((void *)key, item->key, (size_t)keyLength + 1);
+    key += keyLength + 1;
+
+    // Keys are unique in parsed objects, but duplicated keys just make the
+    // lookups find the first one.
+    uint32_t entry = slot->keyHash & result->mask;
+    while (result->index[entry])
+      entry = (entry + 1) & result->mask;
+    result->index[entry] = ++i;
+  }
+
+  result->next = *bucket;
+  *bucket = result;
+  cache->count++;
+
+done:
+  if (skeleton != stackSkeleton)
+    cNBT_Free(skeleton);
+
+  return result;
+}
+
+// Attach a shape to an object, sharing its keys, and build the slot table of
+// large objects.
+static uint8_t cNBT_ShapeAttach(
+  cNBT *nbt,
+  const cNBTShape *shape
+) {
+  cNBT **slots = cNBT_NULLPTR;
+  uint32_t i = 0;
+  cNBT *item;
+
+  if (shape->count >= cNBT_SHAPE_TABLE_SLOTS) {
+    slots = cNBT_AllocAs(shape->count * sizeof(cNBT *), cNBT_MEM_OTHER);
+    if (!slots)
+      return 0;
+  }
+
+  cNBT_ForEach(nbt, item) {
+    if (!(item->flags & cNBT_FLAG_BORROWED_KEY)) {
+      cNBT_Free(item->key);
+      item->flags |= cNBT_FLAG_BORROWED_KEY;
+    }
+    // Borrowed keys may come from the shape the object started to match.
+    item->key = (char *)shape->slots[i].key;
+    if (slots)
+      slots[i] = item;
+    i++;
+  }
+
+  nbt->value.shape = shape;
+  nbt->value.slots = slots;
+  nbt->flags |= cNBT_FLAG_SHAPED;
+
+  return 1;
+}
+
+static void cNBT_ShapePush(
+  cNBTReader *reader,
+  cNBTParseFrame *frames,
+  uint32_t index
+) {
+  cNBTParseFrame *frame = &frames[index]
+    , *parent = index ? &frames[index - 1] : cNBT_NULLPTR;
+
+  frame->slot = 0;
+  if (!parent)
+    frame->shape = frame->item->type == cNBT_OBJ
+      ? reader->shapes->root[!!reader->bigEndian]
+      : cNBT_NULLPTR;
+  else if (parent->remaining < 0)
+    // The key of the item matched the slot before the next one.
+    frame->shape = parent->shape
+      ? parent->shape->slots[parent->slot - 1].child
+      : cNBT_NULLPTR;
+  else
+    frame->shape = frame->item->type == cNBT_OBJ ? parent->shape : cNBT_NULLPTR;
+}
+
+static uint8_t cNBT_ShapeMatchKey(
+  cNBTReader *reader,
+  cNBTParseFrame *frame,
+  cNBT *item
+) {
+  const cNBTShape *shape = frame->shape;
+
+  if (frame->slot < shape->count) {
+    const cNBTShapeSlot *slot = &shape->slots[frame->slot];
+    // The header starts at the type byte. A mismatch isn't an error.
+    if (
+      reader->length - reader->offset >= slot->headerLength - 1
+      && !memcmp(cNBT_GetCursor(reader) - 1, slot->header, slot->headerLength)
+    ) {
+      item->key = (char *)slot->key;
+      item->flags |= cNBT_FLAG_BORROWED_KEY;
+      reader->offset += (size_t)slot->keyLength + 2;
+      frame->slot++;
+      return 1;
+    }
+  }
+
+  frame->shape = cNBT_NULLPTR;
+  return 0;
+}
+
+static void cNBT_ShapePop(
+  cNBTReader *reader,
+  cNBTParseFrame *frames,
+  uint32_t index
+) {
+  cNBTParseFrame *frame = &frames[index]
+    , *parent = index ? &frames[index - 1] : cNBT_NULLPTR;
+  cNBTShape *shape = frame->shape;
+  uint8_t isObject = frame->item->type == cNBT_OBJ;
+
+  if (isObject) {
+    if (!shape || frame->slot != shape->count)
+      shape = cNBT_ShapeLearn(reader->shapes, frame->item, reader->bigEndian);
+    if (shape && !cNBT_ShapeAttach(frame->item, shape))
+      cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_NO_MEMORY);
+  }
+  if (!shape)
+    return;
+
+  // Remember the shape for the next object found at the same place.
+  if (!parent) {
+    if (isObject)
+      reader->shapes->root[!!reader->bigEndian] = shape;
+  } else if (parent->remaining < 0) {
+    if (parent->shape)
+      parent->shape->slots[parent->slot - 1].child = shape;
+  } else if (isObject) {
+    parent->shape = shape;
+  }
+}
+
+const cNBTShape *cNBT_GetShape(
+  const cNBT *nbt
+) {
+  if (!nbt || !(nbt->flags & cNBT_FLAG_SHAPED))
+    return cNBT_NULLPTR;
+
+  return nbt->value.shape;
+}
+
+uint32_t cNBT_GetShapeLength(
+  const cNBTShape *shape
+) {
+  return shape ? shape->count : 0;
+}
+
+int32_t cNBT_GetShapeSlot(
+  const cNBTShape *shape,
+  const char *key
+) {
+  if (!shape || !key)
+    return -1;
+
+  return cNBT_ShapeFindSlot(shape, key, strlen(key));
+}
+
+cNBT *cNBT_GetNodeBySlot(
+  const cNBT *nbt,
+  uint32_t slot
+) {
+  if (!nbt || !(nbt->flags & cNBT_FLAG_SHAPED))
+    return cNBT_NULLPTR;
+
+  if (slot >= nbt->value.shape->count)
+    return cNBT_NULLPTR;
+  if (nbt->value.slots)
+    return nbt->value.slots[slot];
+
+  cNBT *item = nbt->child;
+  for (; slot; slot--)
+    item = item->next;
+  return item;
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] SNAPSHOTS
+//-----------------------------------------------------------------------------
+
+// Share counts saturate here, chains are then copied instead of shared.
+#define cNBT_SHARES_MAX 255
+
+static inline uint8_t cNBT_ChainShared(
+  cNBT *chain
+) {
+  return cNBT_ShareLoad(chain->shares) != 0;
+}
+
+// Add a parent to a chain. Returns the chain, or a deep copy of it if its
+// share count is saturated.
+static cNBT *cNBT_ChainShare(
+  cNBT *chain,
+  cNBT *parent
+) {
+  uint8_t shares = cNBT_ShareLoad(chain->shares);
+
+  do {
+    if (shares == cNBT_SHARES_MAX)
+      return cNBT_CloneChain(chain, parent, cNBT_NULLPTR);
+  } while (!cNBT_ShareSwap(chain->shares, shares, (uint8_t)(shares + 1)));
+
+  return chain;
+}
+
+static inline uint8_t cNBT_ChainRelease(
+  cNBT *chain
+) {
+  uint8_t shares = cNBT_ShareLoad(chain->shares);
+
+  // Another owner may release the chain at the same time, the last one frees
+  // it.
+  while (shares && !cNBT_ShareSwap(chain->shares, shares, (uint8_t)(shares - 1)));
+
+  return !shares;
+}
+
+// Copy a single item, sharing its child chain. Owned keys and payloads are
+// copied, borrowed ones stay borrowed, and the source data is kept so that
+// unmodified copies are still written from it.
+static cNBT *cNBT_CopyShared(
+  const cNBT *nbt,
+  cNBT *parent
+) {
+  cNBT *result = cNBT_AllocAs(sizeof(cNBT), cNBT_MEM_NODE);
+
+  *result = *nbt;
+  result->next = result->prev = cNBT_NULLPTR;
+  result->parent = parent;
+  result->shares = 0;
+  result->flags &= ~(cNBT_FLAG_ARENA | cNBT_FLAG_SHAPED);
+
+  if (nbt->key && !(nbt->flags & cNBT_FLAG_BORROWED_KEY))
+    result->key = cNBT_CloneBytes(nbt->key, strlen(nbt->key), 1, cNBT_NULLPTR, cNBT_MEM_KEY);
+
+  switch (nbt->type) {
+    case cNBT_STR:
+      if (nbt->value.valueString && !(nbt->flags & cNBT_FLAG_BORROWED_VALUE))
+        result->value.valueString = cNBT_CloneBytes(
+          nbt->value.valueString,
+          nbt->value.lengthString,
+          1,
+          cNBT_NULLPTR,
+          cNBT_MEM_STRING);
+      break;
+
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      if (
+        nbt->value.valueArray
+        && nbt->value.lengthArray > 0
+        && !(nbt->flags & cNBT_FLAG_BORROWED_VALUE)
+      )
+        result->value.valueArray = cNBT_CloneBytes(
+          nbt->value.valueArray,
+          (size_t)nbt->value.lengthArray
+            * (nbt->type == cNBT_A08 ? 1 : nbt->type == cNBT_A32 ? 4 : 8),
+          0,
+          cNBT_NULLPTR,
+          cNBT_MEM_ARRAY);
+      break;
+
+    case cNBT_OBJ:
+      // Shapes index the items of the original chain.
+      memset(&result->value, 0, sizeof(cNBTPayload));
+      break;
+  }
+
+  if (nbt->child)
+    result->child = cNBT_ChainShare(nbt->child, result);
+
+  return result;
+}
+
+// Replace the shared child chain of a private item with copies of its items.
+// The children of the copies stay shared, and point to the copies: the tree
+// being modified always owns the parent pointers of shared items.
+static void cNBT_UnshareChain(
+  cNBT *nbt
+) {
+  cNBT *chain = nbt->child
+    , *last = cNBT_NULLPTR;
+
+  nbt->child = cNBT_NULLPTR;
+  for (const cNBT *item = chain; item; item = item->next) {
+    cNBT *copy = cNBT_CopyShared(item, nbt);
+
+    if (copy->child && copy->child == item->child) {
+      cNBT *child;
+      cNBT_ForEach(copy, child)
+        child->parent = copy;
+    }
+
+    if (last) {
+      last->next = copy;
+      copy->prev = last;
+    } else {
+      nbt->child = copy;
+    }
+    last = copy;
+  }
+  if (nbt->child)
+    nbt->child->prev = last;
+
+  cNBT_DropShape(nbt);
+  cNBT_Delete(chain);
+}
+
+const cNBT *cNBT_Snapshot(
+  cNBT *nbt
+) {
+  if (!nbt)
+    return cNBT_NULLPTR;
+
+  // The children keep pointing to `nbt`.
+  return cNBT_CopyShared(nbt, cNBT_NULLPTR);
+}
+
+void cNBT_ReleaseSnapshot(
+  const cNBT *snapshot
+) {
+  cNBT_Delete((cNBT *)snapshot);
+}
+
+uint8_t cNBT_IsShared(
+  const cNBT *nbt
+) {
+  for (; nbt && nbt->parent; nbt = nbt->parent)
+    if (cNBT_ChainShared(nbt->parent->child))
+      return 1;
+
+  return 0;
+}
+
+cNBT *cNBT_Unshare(
+  cNBT *nbt
+) {
+  size_t depth = 0
+    , levels = 0;
+  cNBT *item;
+
+  if (!nbt)
+    return cNBT_NULLPTR;
+
+  // Find the outermost shared chain on the path; the items above it are
+  // private.
+  for (item = nbt; item->parent; item = item->parent) {
+    depth++;
+    if (cNBT_ChainShared(item->parent->child))
+      levels = depth;
+  }
+  if (!levels)
+    return nbt;
+
+  item = nbt;
+  for (size_t i = 0; i < levels; i++)
+    item = item->parent;
+
+  // Find the position of each item of the path in its chain before the chain
+  // is replaced, walking up from `nbt` again at each level rather than
+  // allocating the positions of deep paths. Copying the chains above doesn't
+  // move the items of the path to other chains.
+  for (size_t i = levels; i--;) {
+    cNBT *path = nbt;
+    size_t position = 0;
+
+    for (size_t up = i; up; up--)
+      path = path->parent;
+    for (cNBT *sibling = path->parent->child; sibling != path; sibling = sibling->next)
+      position++;
+
+    if (cNBT_ChainShared(item->child))
+      cNBT_UnshareChain(item);
+    item = item->child;
+    for (; position; position--)
+      item = item->next;
+  }
+
+  return item;
+}
+
+static cNBT *cNBT_UnshareChildren(
+  cNBT *nbt,
+  cNBT **item
+) {
+  size_t position = 0;
+
+  if (!cNBT_IsShared(nbt) && !(nbt->child && cNBT_ChainShared(nbt->child)))
+    return nbt;
+
+  if (item)
+    for (cNBT *sibling = nbt->child; sibling != *item; sibling = sibling->next)
+      position++;
+
+  nbt = cNBT_Unshare(nbt);
+  if (nbt->child && cNBT_ChainShared(nbt->child))
+    cNBT_UnshareChain(nbt);
+
+  if (item) {
+    *item = nbt->child;
+    for (; position; position--)
+      *item = (*item)->next;
+  }
+
+  return nbt;
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] DEDUPLICATION
+//-----------------------------------------------------------------------------
+
+// Lists and objects with bigger payloads aren't deduplicated, which bounds the
+// bytes compared for each of them.
+#define cNBT_DEDUP_MAX_BYTES 4096
+#define cNBT_DEDUP_MIN_CAPACITY 64
+
+// Share the children of `first` with `item`, both having the same payload.
+// Returns 0 if the children of `first` can't be shared anymore.
+static uint8_t cNBT_DedupShare(
+  cNBT *item,
+  cNBT *first
+) {
+  cNBT *chain = item->child;
+
+  if (first->child->shares == cNBT_SHARES_MAX)
+    return 0;
+
+  // The items of the chain being freed are duplicates themselves, so none of
+  // them was recorded.
+  cNBT_DropShape(item);
+  first->child->shares++;
+  item->child = first->child;
+  if (first->flags & cNBT_FLAG_SHAPED) {
+    item->value.shape = first->value.shape;
+    if (first->value.slots) {
+      size_t size = first->value.shape->count * sizeof(cNBT *);
+      item->value.slots = cNBT_AllocAs(size, cNBT_MEM_OTHER);
+      if (item->value.slots)
+        memcpy(item->value.slots, first->value.slots, size);
+    }
+    item->flags |= cNBT_FLAG_SHAPED;
+  }
+  cNBT_Delete(chain);
+
+  return 1;
+}
+
+static void cNBT_DedupPop(
+  cNBTReader *reader,
+  cNBTParseFrame *frames,
+  uint32_t index
+) {
+  cNBTDedup *dedup = reader->dedup;
+  cNBTParseFrame *frame = &frames[index];
+  const uint8_t *data = reader->data;
+  cNBT *item = frame->item;
+  size_t length = reader->offset - frame->start;
+
+  if (reader->errorFlag)
+    return;
+
+  // Finish the hash of the payload, the lists and objects in it were hashed
+  // when they were popped, so each byte is hashed once.
+  uint64_t hash = cNBT_HashBytes(
+    frame->hash, data + frame->hashed, reader->offset - frame->hashed);
+
+  if (index) {
+    cNBTParseFrame *parent = &frames[index - 1];
+    parent->hash = cNBT_HashBytes(
+      parent->hash, data + parent->hashed, frame->start - parent->hashed);
+    parent->hash = cNBT_HashMix(parent->hash, hash);
+    parent->hashed = reader->offset;
+  }
+
+  if (!item->child || length > cNBT_DEDUP_MAX_BYTES)
+    return;
+  hash = cNBT_HashFinal(hash);
+
+  for (size_t i = hash & dedup->mask; dedup->mask && dedup->entries[i].item; i = (i + 1) & dedup->mask) {
+    const cNBTDedupEntry *entry = &dedup->entries[i];
+    cNBT *first = entry->item;
+
+    if (
+      entry->hash != hash
+      || entry->length != length
+      || first->type != item->type
+      || memcmp(data + entry->start, data + frame->start, length)
+    )
+      continue;
+
+    if (cNBT_DedupShare(item, first)) {
+      dedup->stats.duplicates++;
+      dedup->stats.duplicateBytes += length;
+    }
+    return;
+  }
+
+  // Keep the load factor under 1/2.
+  if ((dedup->count + 1) * 2 > dedup->mask) {
+    size_t capacity = dedup->mask ? (dedup->mask + 1) * 2 : cNBT_DEDUP_MIN_CAPACITY;
+    cNBTDedupEntry *entries = cNBT_AllocAs(capacity * sizeof(cNBTDedupEntry), cNBT_MEM_OTHER);
+
+    if (!entries) {
+      cNBT_ReaderFail(reader, cNBT_PARSE_ERROR_NO_MEMORY);
+      return;
+    }
+    memset(entries, 0, capacity * sizeof(cNBTDedupEntry));
+    for (size_t i = 0; dedup->mask && i <= dedup->mask; i++) {
+      const cNBTDedupEntry *entry = &dedup->entries[i];
+      size_t j = entry->hash & (capacity - 1);
+
+      if (!entry->item)
+        continue;
+      while (entries[j].item)
+        j = (j + 1) & (capacity - 1);
+      entries[j] = *entry;
+    }
+    if (dedup->entries)
+      cNBT_Free(dedup->entries);
+    dedup->entries = entries;
+    dedup->mask = capacity - 1;
+  }
+
+  size_t i = hash & dedup->mask;
+  while (dedup->entries[i].item)
+    i = (i + 1) & dedup->mask;
+  dedup->entries[i].hash = hash;
+  dedup->entries[i].start = frame->start;
+  dedup->entries[i].length = length;
+  dedup->entries[i].item = item;
+  dedup->count++;
+  dedup->stats.unique++;
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] FROZEN IMAGES
+//-----------------------------------------------------------------------------
+
+// Layout of a frozen image. All offsets are from the beginning of the image,
+// and all values are in the byte order of the host.
+//
+// - cNBTFrozenHeader, holding the root item.
+// - The payloads of the items, depth first:
+//   - Strings: the bytes, null-terminated.
+//   - Arrays: the elements, 8-byte aligned.
+//   - Lists: cNBTFrozenBlock, then a cNBTFrozenItem per element.
+//   - Objects: cNBTFrozenBlock, then a cNBTFrozenItem per item, the offsets
+//     of their keys as uint32_t, and `mask` + 1 cNBTFrozenSlot, 8-byte
+//     aligned.
+// - Keys are stored once, as a uint16_t length followed by the bytes,
+//   null-terminated.
+#define cNBT_FROZEN_MAGIC 0x46424E63
+#define cNBT_FROZEN_VERSION 1
+
+typedef struct {
+  uint8_t type;
+  uint8_t listElementType;
+  uint16_t reserved;
+  // Number of bytes of strings, elements of arrays, or items of lists and
+  // objects.
+  uint32_t length;
+  // The value of integers, as int64_t, and floating point numbers, as double,
+  // or the offset of the payload of other types.
+  uint64_t value;
+} cNBTFrozenItem;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  // Size of the image in bytes.
+  uint32_t size;
+  // Offset of the key of the root item.
+  uint32_t key;
+  cNBTFrozenItem root;
+} cNBTFrozenHeader;
+
+typedef struct {
+  // Capacity of the key directory - 1, 0 for lists.
+  uint32_t mask;
+  // Offset of the key offsets of an object.
+  uint32_t keys;
+} cNBTFrozenBlock;
+
+// Entry of the key directory of an object.
+typedef struct {
+  uint32_t hash;
+  // Index of the item + 1, or 0 for empty slots.
+  uint32_t index;
+} cNBTFrozenSlot;
+
+// Keys already stored by cNBT_Freeze().
+typedef struct {
+  uint32_t hash;
+  uint32_t offset;
+} cNBTFreezeKey;
+
+typedef struct {
+  cNBTWriter writer;
+  cNBTFreezeKey *keys;
+  // Capacity - 1, or 0 before the first key.
+  size_t mask;
+  size_t count;
+} cNBTFreezer;
+
+static inline uint32_t cNBT_FrozenHash(
+  const char *key,
+  size_t length
+) {
+  return (uint32_t)cNBT_HashFinal(cNBT_HashBytes(0, key, length));
+}
+
+// Pad the image to a multiple of `alignment`, and reserve `length` zeroed
+// bytes. Returns their offset.
+static size_t cNBT_FreezeReserve(
+  cNBTFreezer *freezer,
+  size_t alignment,
+  size_t length
+) {
+  cNBTWriter *writer = &freezer->writer;
+  size_t offset = (writer->offset + alignment - 1) & ~(alignment - 1);
+
+  if (!cNBT_Expand(writer, offset - writer->offset + length))
+    return 0;
+  memset((uint8_t *)writer->data + writer->offset, 0, offset - writer->offset + length);
+  writer->offset = offset + length;
+  if (writer->offset > UINT32_MAX)
+    writer->errorFlag = 1;
+
+  return offset;
+}
+
+// Store a key once. Returns its offset.
+static uint32_t cNBT_FreezeKey(
+  cNBTFreezer *freezer,
+  const char *key
+) {
+  size_t length = strlen(key);
+  uint32_t hash = cNBT_FrozenHash(key, length);
+  uint16_t length16 = (uint16_t)length;
+
+  if (length > UINT16_MAX) {
+    freezer->writer.errorFlag = 1;
+    return 0;
+  }
+
+  for (size_t i = hash & freezer->mask; freezer->mask && freezer->keys[i].offset; i = (i + 1) & freezer->mask) {
+    const uint8_t *stored = (const uint8_t *)freezer->writer.data + freezer->keys[i].offset;
+    uint16_t storedLength;
+
+    memcpy(&storedLength, stored, 2);
+    if (
+      freezer->keys[i].hash == hash
+      && storedLength == length16
+      && !memcmp(stored + 2, key, length)
+    )
+      return freezer->keys[i].offset;
+  }
+
+  // Keep the load factor under 1/2.
+  if ((freezer->count + 1) * 2 > freezer->mask) {
+    size_t capacity = freezer->mask ? (freezer->mask + 1) * 2 : 64;
+    cNBTFreezeKey *keys = cNBT_AllocAs(capacity * sizeof(cNBTFreezeKey), cNBT_MEM_OTHER);
+
+    if (!keys) {
+      freezer->writer.errorFlag = 1;
+      return 0;
+    }
+    memset(keys, 0, capacity * sizeof(cNBTFreezeKey));
+    for (size_t i = 0; freezer->mask && i <= freezer->mask; i++) {
+      size_t j = freezer->keys[i].hash & (capacity - 1);
+
+      if (!freezer->keys[i].offset)
+        continue;
+      while (keys[j].offset)
+        j = (j + 1) & (capacity - 1);
+      keys[j] = freezer->keys[i];
+    }
+    if (freezer->keys)
+      cNBT_Free(freezer->keys);
+    freezer->keys = keys;
+    freezer->mask = capacity - 1;
+  }
+
+  size_t offset = cNBT_FreezeReserve(freezer, 2, length + 3);
+  if (freezer->writer.errorFlag)
+    return 0;
+  uint8_t *stored = (uint8_t *)freezer->writer.data + offset;
+  memcpy(stored, &length16, 2);
+  memcpy(stored + 2, key, length);
+
+  size_t i = hash & freezer->mask;
+  while (freezer->keys[i].offset)
+    i = (i + 1) & freezer->mask;
+  freezer->keys[i].hash = hash;
+  freezer->keys[i].offset = (uint32_t)offset;
+  freezer->count++;
+
+  return (uint32_t)offset;
+}
+
+// Store the payload of `nbt`, and fill its item at offset `at`. Lists and
+// objects are stored recursively.
+static void cNBT_FreezeItem(
+  cNBTFreezer *freezer,
+  const cNBT *nbt,
+  size_t at
+) {
+  cNBTFrozenItem item;
+  size_t offset, size;
+  uint32_t count = 0;
+  const cNBT *child;
+
+  memset(&item, 0, sizeof(cNBTFrozenItem));
+  item.type = nbt->type;
+
+  switch (nbt->type) {
+    case cNBT_I08:
+    case cNBT_I16:
+    case cNBT_I32:
+    case cNBT_I64: {
+      int64_t value = nbt->type == cNBT_I08 ? nbt->value.valueI08
+        : nbt->type == cNBT_I16 ? nbt->value.valueI16
+        : nbt->type == cNBT_I32 ? nbt->value.valueI32
+        : nbt->value.valueI64;
+      memcpy(&item.value, &value, 8);
+      break;
+    }
+
+    case cNBT_F32:
+    case cNBT_F64: {
+      double value = nbt->type == cNBT_F32 ? nbt->value.valueF32 : nbt->value.valueF64;
+      memcpy(&item.value, &value, 8);
+      break;
+    }
+
+    case cNBT_STR:
+      item.length = nbt->value.valueString ? nbt->value.lengthString : 0;
+      offset = cNBT_FreezeReserve(freezer, 1, (size_t)item.length + 1);
+      if (item.length && !freezer->writer.errorFlag)
+        memcpy((uint8_t *)freezer->writer.data + offset, nbt->value.valueString, item.length);
+      item.value = offset;
+      break;
+
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      size = nbt->type == cNBT_A08 ? 1 : nbt->type == cNBT_A32 ? 4 : 8;
+      if (nbt->value.valueArray && nbt->value.lengthArray > 0)
+        item.length = (uint32_t)nbt->value.lengthArray;
+      offset = cNBT_FreezeReserve(freezer, 8, (size_t)item.length * size);
+      if (item.length && !freezer->writer.errorFlag) {
+        void *elements = (uint8_t *)freezer->writer.data + offset;
+        memcpy(elements, nbt->value.valueArray, (size_t)item.length * size);
+        if (nbt->flags & cNBT_FLAG_ARRAY_VIEW)
+          cNBT_SwapArray(
+            elements,
+            item.length,
+            size,
+            !!(nbt->flags & cNBT_FLAG_SOURCE_BIG_ENDIAN));
+      }
+      item.value = offset;
+      break;
+
+    case cNBT_LST:
+    case cNBT_OBJ: {
+      cNBTFrozenBlock block = { 0, 0 };
+      size_t items, keys = 0, slots = 0;
+
+      item.listElementType = nbt->listElementType;
+      cNBT_ForEach(nbt, child)
+        count++;
+      item.length = count;
+
+      offset = cNBT_FreezeReserve(freezer, 8, sizeof(cNBTFrozenBlock));
+      items = cNBT_FreezeReserve(freezer, 8, (size_t)count * sizeof(cNBTFrozenItem));
+      if (nbt->type == cNBT_OBJ && count) {
+        block.mask = 1;
+        while (block.mask + 1 < (size_t)count * 2)
+          block.mask = block.mask * 2 + 1;
+        keys = cNBT_FreezeReserve(freezer, 4, (size_t)count * 4);
+        slots = cNBT_FreezeReserve(freezer, 8, ((size_t)block.mask + 1) * sizeof(cNBTFrozenSlot));
+        block.keys = (uint32_t)keys;
+      }
+      if (freezer->writer.errorFlag)
+        return;
+      memcpy((uint8_t *)freezer->writer.data + offset, &block, sizeof(cNBTFrozenBlock));
+      item.value = offset;
+
+      uint32_t index = 0;
+      cNBT_ForEach(nbt, child) {
+        cNBT_FreezeItem(freezer, child, items + index * sizeof(cNBTFrozenItem));
+        if (nbt->type == cNBT_OBJ) {
+          const char *name = child->key ? child->key : "";
+          uint32_t key = cNBT_FreezeKey(freezer, name);
+          cNBTFrozenSlot slot = { cNBT_FrozenHash(name, strlen(name)), index + 1 }
+            , *table = (cNBTFrozenSlot *)((uint8_t *)freezer->writer.data + slots);
+          size_t i = slot.hash & block.mask;
+
+          if (freezer->writer.errorFlag)
+            return;
+          memcpy((uint8_t *)freezer->writer.data + keys + index * 4, &key, 4);
+          while (table[i].index)
+            i = (i + 1) & block.mask;
+          table[i] = slot;
+        }
+        index++;
+      }
+      break;
+    }
+  }
+
+  if (!freezer->writer.errorFlag)
+    memcpy((uint8_t *)freezer->writer.data + at, &item, sizeof(cNBTFrozenItem));
+}
+
+void *cNBT_Freeze(
+  const cNBT *nbt,
+  size_t *length
+) {
+  if (!nbt)
+    return cNBT_NULLPTR;
+
+  cNBTFreezer freezer = {
+    .writer = {
+      .capacity = 0x1000,
+      .data = cNBT_AllocAs(0x1000, cNBT_MEM_WRITER)
+    }
+  };
+  cNBTFrozenHeader header;
+
+  if (!freezer.writer.data)
+    return cNBT_NULLPTR;
+
+  cNBT_FreezeReserve(&freezer, 8, sizeof(cNBTFrozenHeader));
+  cNBT_FreezeItem(&freezer, nbt, offsetof(cNBTFrozenHeader, root));
+  memcpy(&header, freezer.writer.data, sizeof(cNBTFrozenHeader));
+  header.magic = cNBT_FROZEN_MAGIC;
+  header.version = cNBT_FROZEN_VERSION;
+  header.key = nbt->key ? cNBT_FreezeKey(&freezer, nbt->key) : 0;
+  header.size = (uint32_t)freezer.writer.offset;
+  memcpy(freezer.writer.data, &header, sizeof(cNBTFrozenHeader));
+
+  if (freezer.keys)
+    cNBT_Free(freezer.keys);
+  if (freezer.writer.errorFlag) {
+    cNBT_Free(freezer.writer.data);
+    return cNBT_NULLPTR;
+  }
+
+  if (length)
+    *length = freezer.writer.offset;
+
+  return freezer.writer.data;
+}
+
+uint8_t cNBT_OpenFrozen(
+  const void *image,
+  size_t size,
+  cNBTFrozen *root
+) {
+  const cNBTFrozenHeader *header = image;
+
+  if (
+    !image
+    || ((uintptr_t)image & 7)
+    || size < sizeof(cNBTFrozenHeader)
+    || header->magic != cNBT_FROZEN_MAGIC
+    || header->version != cNBT_FROZEN_VERSION
+    || header->size < sizeof(cNBTFrozenHeader)
+    || header->size > size
+  )
+    return 0;
+
+  if (root) {
+    root->image = image;
+    root->item = offsetof(cNBTFrozenHeader, root);
+    root->key = header->key;
+  }
+
+  return 1;
+}
+
+// Get `length` bytes at `offset` in the image of `nbt`, or NULL if they're
+// out of the image.
+static inline const void *cNBT_FrozenBytes(
+  cNBTFrozen nbt,
+  uint64_t offset,
+  uint64_t length
+) {
+  const cNBTFrozenHeader *header = nbt.image;
+
+  if (!nbt.image || offset > header->size || length > header->size - offset)
+    return cNBT_NULLPTR;
+
+  return (const uint8_t *)nbt.image + offset;
+}
+
+static inline const cNBTFrozenItem *cNBT_FrozenGetItem(
+  cNBTFrozen nbt
+) {
+  return cNBT_FrozenBytes(nbt, nbt.item, sizeof(cNBTFrozenItem));
+}
+
+// Get the block of a list or object, or NULL.
+static const cNBTFrozenBlock *cNBT_FrozenGetBlock(
+  cNBTFrozen nbt,
+  const cNBTFrozenItem **item
+) {
+  *item = cNBT_FrozenGetItem(nbt);
+  if (!*item || ((*item)->type != cNBT_LST && (*item)->type != cNBT_OBJ) || ((*item)->value & 7))
+    return cNBT_NULLPTR;
+
+  return cNBT_FrozenBytes(
+    nbt,
+    (*item)->value,
+    sizeof(cNBTFrozenBlock) + (uint64_t)(*item)->length * sizeof(cNBTFrozenItem));
+}
+
+// Make the frozen item of index `index` of a list or object.
+static cNBTFrozen cNBT_FrozenChild(
+  cNBTFrozen nbt,
+  const cNBTFrozenItem *item,
+  const cNBTFrozenBlock *block,
+  uint32_t index
+) {
+  cNBTFrozen result = { cNBT_NULLPTR, 0, 0 };
+  const uint32_t *key = cNBT_NULLPTR;
+
+  if (item->type == cNBT_OBJ) {
+    key = cNBT_FrozenBytes(nbt, (uint64_t)block->keys + index * 4, 4);
+    if (!key || (block->keys & 3))
+      return result;
+  }
+
+  result.image = nbt.image;
+  result.item = (uint32_t)(item->value + sizeof(cNBTFrozenBlock) + index * sizeof(cNBTFrozenItem));
+  result.key = key ? *key : 0;
+
+  return result;
+}
+
+uint8_t cNBT_FrozenType(
+  cNBTFrozen item
+) {
+  const cNBTFrozenItem *frozen = cNBT_FrozenGetItem(item);
+
+  return frozen ? frozen->type : cNBT_END;
+}
+
+const char *cNBT_FrozenKey(
+  cNBTFrozen item
+) {
+  const uint8_t *key = cNBT_FrozenBytes(item, item.key, 2);
+  uint16_t length;
+
+  if (!item.key || !key)
+    return cNBT_NULLPTR;
+  memcpy(&length, key, 2);
+  if (!cNBT_FrozenBytes(item, item.key, (uint64_t)length + 3) || key[2 + length])
+    return cNBT_NULLPTR;
+
+  return (const char *)key + 2;
+}
+
+int32_t cNBT_FrozenLength(
+  cNBTFrozen item
 ) {
-  double result;
-  int64_t tmp = cNBT_ParseI64(reader);
-  memcpy((void *)&result, (void *)&tmp, sizeof(double));
-  return result;
+  const cNBTFrozenItem *frozen = cNBT_FrozenGetItem(item);
+
+  return frozen && frozen->length <= INT32_MAX ? (int32_t)frozen->length : 0;
 }
 
-// Read a string.
-static uint16_t cNBT_ParseStr(
-  cNBTReader *reader,
-  char **result
+uint8_t cNBT_FrozenElementType(
+  cNBTFrozen list
 ) {
-  uint16_t length = (uint16_t)cNBT_ParseI16(reader);
-  const uint8_t *cursor = cNBT_GetCursor(reader);
-  char *valueString = cNBT_Alloc(length + 1);
+  const cNBTFrozenItem *frozen = cNBT_FrozenGetItem(list);
 
-  if (length)
-    memcpy((void *)valueString, (void *)cursor, length);
-  valueString[length] = '\0';
-  reader->offset += length;
+  return frozen && frozen->type == cNBT_LST ? frozen->listElementType : cNBT_END;
+}
 
-  *result = valueString;
+cNBTFrozen cNBT_FrozenGet(
+  cNBTFrozen object,
+  const char *key
+) {
+  cNBTFrozen result = { cNBT_NULLPTR, 0, 0 };
+  const cNBTFrozenItem *item;
+  const cNBTFrozenBlock *block = cNBT_FrozenGetBlock(object, &item);
+
+  if (!block || !key || item->type != cNBT_OBJ || !item->length)
+    return result;
+
+  const cNBTFrozenSlot *slots = cNBT_FrozenBytes(
+    object,
+    ((uint64_t)block->keys + item->length * 4 + 7) & ~(uint64_t)7,
+    ((uint64_t)block->mask + 1) * sizeof(cNBTFrozenSlot));
+  const uint32_t *keys = cNBT_FrozenBytes(object, block->keys, (uint64_t)item->length * 4);
+  size_t length = strlen(key);
+  uint32_t hash = cNBT_FrozenHash(key, length);
+
+  if (!slots || !keys || (block->keys & 3) || length > UINT16_MAX)
+    return result;
+
+  for (uint32_t i = hash & block->mask, n = 0; slots[i].index && n <= block->mask; i = (i + 1) & block->mask, n++) {
+    uint32_t index = slots[i].index - 1;
+    const uint8_t *stored;
+    uint16_t storedLength;
+
+    if (slots[i].hash != hash || index >= item->length)
+      continue;
+    stored = cNBT_FrozenBytes(object, keys[index], length + 3);
+    if (!stored)
+      continue;
+    memcpy(&storedLength, stored, 2);
+    if (storedLength == length && !memcmp(stored + 2, key, length)) {
+      result.image = object.image;
+      result.item = (uint32_t)(item->value + sizeof(cNBTFrozenBlock) + index * sizeof(cNBTFrozenItem));
+      result.key = keys[index];
+      return result;
+    }
+  }
 
-  return length;
+  return result;
 }
 
-// Read a list.
-static uint8_t cNBT_ParseLst(
-  cNBTReader *reader,
-  cNBT **result
+cNBTFrozen cNBT_FrozenAt(
+  cNBTFrozen nbt,
+  int32_t index
 ) {
-  uint8_t type = cNBT_ParseI08(reader);
-  int32_t length = cNBT_ParseI32(reader);
+  cNBTFrozen result = { cNBT_NULLPTR, 0, 0 };
+  const cNBTFrozenItem *item;
+  const cNBTFrozenBlock *block = cNBT_FrozenGetBlock(nbt, &item);
 
-  if (!length)
-    return type;
+  if (!block || index < 0 || (uint32_t)index >= item->length)
+    return result;
 
-  cNBT *first = cNBT_Alloc(sizeof(cNBT))
-    , *item = first;
+  return cNBT_FrozenChild(nbt, item, block, (uint32_t)index);
+}
 
-  memset((void *)item, 0, sizeof(cNBT));
-  item->prev = item->next = cNBT_NULLPTR;
+int64_t cNBT_FrozenInt(
+  cNBTFrozen item
+) {
+  const cNBTFrozenItem *frozen = cNBT_FrozenGetItem(item);
+  int64_t value;
 
-  while (length > 0) {
-    item->key = cNBT_NULLPTR;
+  if (!frozen || frozen->type < cNBT_I08 || frozen->type > cNBT_I64)
+    return 0;
+  memcpy(&value, &frozen->value, 8);
 
-    cNBT_ParseX(reader, item, type);
+  return value;
+}
 
-    length--;
-    if (length) {
-      // Create next node.
-      cNBT *next = cNBT_Alloc(sizeof(cNBT));
-      memset((void *)next, 0, sizeof(cNBT));
-      item->next = next;
-      next->prev = item;
-      next->next = cNBT_NULLPTR;
-      item = next;
-    }
-  }
+double cNBT_FrozenFloat(
+  cNBTFrozen item
+) {
+  const cNBTFrozenItem *frozen = cNBT_FrozenGetItem(item);
+  double value;
 
-  first->prev = item;
-  *result = first;
+  if (!frozen || (frozen->type != cNBT_F32 && frozen->type != cNBT_F64))
+    return 0;
+  memcpy(&value, &frozen->value, 8);
 
-  return type;
+  return value;
 }
 
-// Read an object.
-static cNBT *cNBT_ParseObj(
-  cNBTReader *reader
+const char *cNBT_FrozenString(
+  cNBTFrozen item
 ) {
-  cNBT *result = cNBT_Alloc(sizeof(cNBT))
-    , *item = result;
-  uint8_t type = cNBT_ParseI08(reader);
-  char *key;
+  const cNBTFrozenItem *frozen = cNBT_FrozenGetItem(item);
+  const char *string;
 
-  item->next = item->prev = cNBT_NULLPTR;
-
-  while (type) {
-    // Parse the key of the element.
-    cNBT_ParseStr(reader, &key);
-    item->key = key;
+  if (!frozen || frozen->type != cNBT_STR)
+    return cNBT_NULLPTR;
 
-    cNBT_ParseX(reader, item, type);
+  string = cNBT_FrozenBytes(item, frozen->value, (uint64_t)frozen->length + 1);
+  if (!string || string[frozen->length])
+    return cNBT_NULLPTR;
 
-    type = cNBT_ParseI08(reader);
-    if (type) {
-      // Create next node.
-      cNBT *next = cNBT_Alloc(sizeof(cNBT));
-      item->next = next;
-      next->prev = item;
-      next->next = cNBT_NULLPTR;
-      item = next;
-    }
-  }
+  return string;
+}
 
-  result->prev = item;
+const void *cNBT_FrozenArray(
+  cNBTFrozen item
+) {
+  const cNBTFrozenItem *frozen = cNBT_FrozenGetItem(item);
 
-  return result;
-}
+  if (
+    !frozen
+    || (frozen->type != cNBT_A08 && frozen->type != cNBT_A32 && frozen->type != cNBT_A64)
+    || (frozen->value & 7)
+  )
+    return cNBT_NULLPTR;
 
-// Read an array.
-#define cNBT_ParseArrTyped(reader, length, data, type, func) {\
-  int32_t l = cNBT_ParseI32(reader);\
-  void *valueArr = cNBT_Alloc(l * sizeof(type));\
-  for (int32_t i = 0; i < l; i++)\
-    ((type *)valueArr)[i] = func(reader);\
-  *(length) = l;\
-  *(data) = valueArr;\
+  return cNBT_FrozenBytes(
+    item,
+    frozen->value,
+    (uint64_t)frozen->length * (frozen->type == cNBT_A08 ? 1 : frozen->type == cNBT_A32 ? 4 : 8));
 }
 
-// Parse an item of the specified type.
-static void cNBT_ParseX(
-  cNBTReader *reader,
-  cNBT *item,
-  uint8_t type
+// Convert a frozen item to a node, and its items recursively. `budget` is
+// more than the number of items the image can hold, so corrupted images with
+// cycles can't make it loop, and is set to 0 on failure.
+static cNBT *cNBT_ThawItem(
+  cNBTFrozen item,
+  cNBT *parent,
+  size_t *budget,
+  uint32_t depth
 ) {
-  item->listElementType = cNBT_END;
-  item->type = type;
-  item->child = cNBT_NULLPTR;
-  memset((void *)&item->value, 0, sizeof(cNBTPayload));
+  uint8_t type = cNBT_FrozenType(item);
+  const char *key = cNBT_FrozenKey(item);
+  cNBT *result;
+
+  if (
+    type == cNBT_END
+    // Keys and strings that aren't terminated inside the image.
+    || (item.key && !key)
+    || (type == cNBT_STR && !cNBT_FrozenString(item))
+    || !*budget
+    || depth > cNBT_MAX_DEPTH
+    || !(result = cNBT_CreateNode(type))
+  )
+    return cNBT_NULLPTR;
+  (*budget)--;
+
+  result->parent = parent;
+  if (key) {
+    uint16_t length;
+
+    // Copy by the stored length, which cNBT_FrozenKey() checked is in the
+    // image.
+    memcpy(&length, key - 2, 2);
+    result->key = cNBT_CloneBytes(key, length, 1, cNBT_NULLPTR, cNBT_MEM_KEY);
+  }
 
   switch (type) {
-    // Basic types.
-    case cNBT_I08:
-      item->value.valueI08 = cNBT_ParseI08(reader);
-      break;
-    case cNBT_I16:
-      item->value.valueI16 = cNBT_ParseI16(reader);
-      break;
-    case cNBT_I32:
-      item->value.valueI32 = cNBT_ParseI32(reader);
-      break;
-    case cNBT_I64:
-      item->value.valueI64 = cNBT_ParseI64(reader);
-      break;
-    case cNBT_F32:
-      item->value.valueF32 = cNBT_ParseF32(reader);
-      break;
-    case cNBT_F64:
-      item->value.valueF64 = cNBT_ParseF64(reader);
+    case cNBT_I08: result->value.valueI08 = (int8_t)cNBT_FrozenInt(item); break;
+    case cNBT_I16: result->value.valueI16 = (int16_t)cNBT_FrozenInt(item); break;
+    case cNBT_I32: result->value.valueI32 = (int32_t)cNBT_FrozenInt(item); break;
+    case cNBT_I64: result->value.valueI64 = cNBT_FrozenInt(item); break;
+    case cNBT_F32: result->value.valueF32 = (float)cNBT_FrozenFloat(item); break;
+    case cNBT_F64: result->value.valueF64 = cNBT_FrozenFloat(item); break;
+
+    case cNBT_STR: {
+      result->value.lengthString = (uint16_t)cNBT_FrozenLength(item);
+      result->value.valueString = cNBT_CloneBytes(
+        cNBT_FrozenString(item), result->value.lengthString, 1, cNBT_NULLPTR, cNBT_MEM_STRING);
       break;
+    }
 
-    // Array of 8-bit integers.
     case cNBT_A08:
-      cNBT_ParseArrTyped(
-        reader,
-        &item->value.lengthArray,
-        &item->value.valueArray,
-        int8_t,
-        cNBT_ParseI08);
-      break;
-
-    // String.
-    case cNBT_STR:
-      item->value.lengthString = cNBT_ParseStr(reader, &item->value.valueString);
+    case cNBT_A32:
+    case cNBT_A64: {
+      const void *elements = cNBT_FrozenArray(item);
+      int32_t length = cNBT_FrozenLength(item);
+      if (elements && length) {
+        result->value.lengthArray = length;
+        result->value.valueArray = cNBT_CloneBytes(
+          elements,
+          (size_t)length * (type == cNBT_A08 ? 1 : type == cNBT_A32 ? 4 : 8),
+          0,
+          cNBT_NULLPTR,
+          cNBT_MEM_ARRAY);
+      }
       break;
+    }
 
-    // List.
     case cNBT_LST:
-      item->listElementType = cNBT_ParseLst(reader, &item->child);
+    case cNBT_OBJ: {
+      int32_t length = cNBT_FrozenLength(item);
+      cNBT *last = cNBT_NULLPTR;
+
+      result->listElementType = cNBT_FrozenElementType(item);
+      for (int32_t i = 0; i < length; i++) {
+        cNBT *child = cNBT_ThawItem(cNBT_FrozenAt(item, i), result, budget, depth + 1);
+
+        if (!child) {
+          // Corrupted image, or out of memory.
+          *budget = 0;
+          break;
+        }
+        if (last) {
+          last->next = child;
+          child->prev = last;
+        } else {
+          result->child = child;
+        }
+        last = child;
+      }
+      if (result->child)
+        result->child->prev = last;
       break;
+    }
+  }
 
-    // Object.
-    case cNBT_OBJ:
-      item->child = cNBT_ParseObj(reader);
-      break;
+  return result;
+}
 
-    // Array of 32-bit integers.
-    case cNBT_A32:
-      cNBT_ParseArrTyped(
-        reader,
-        &item->value.lengthArray,
-        &item->value.valueArray,
-        int32_t,
-        cNBT_ParseI32);
-      break;
+cNBT *cNBT_Thaw(
+  cNBTFrozen item
+) {
+  size_t budget;
 
-    // Array of 64-bit integers.
-    case cNBT_A64:
-      cNBT_ParseArrTyped(
-        reader,
-        &item->value.lengthArray,
-        &item->value.valueArray,
-        int64_t,
-        cNBT_ParseI64);
-      break;
+  if (!item.image)
+    return cNBT_NULLPTR;
+  budget = ((const cNBTFrozenHeader *)item.image)->size / sizeof(cNBTFrozenItem);
+
+  cNBT *result = cNBT_ThawItem(item, cNBT_NULLPTR, &budget, 0);
+
+  if (!budget) {
+    cNBT_Delete(result);
+    return cNBT_NULLPTR;
   }
+
+  return result;
 }
 
-//-----------------------------------------------------------------------------
-// [SECTION] NBT WRITER
-//-----------------------------------------------------------------------------
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
 
-#define cNBT_SetByteLE(curs, offs, data) (void)(*(((uint8_t *)(curs)) + (offs)) = ((data) >> ((offs) * 8)) & 0xFF)
-#define cNBT_SetByteBE(curs, offs, data, size) (void)(*(((uint8_t *)(curs)) + (offs)) = ((data) >> ((size) - (offs) * 8 - 8)) & 0xFF)
+const void *cNBT_MapFile(
+  const char *path,
+  size_t *size
+) {
+  HANDLE file = CreateFileA(
+    path, GENERIC_READ, FILE_SHARE_READ, cNBT_NULLPTR, OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL, cNBT_NULLPTR);
+  HANDLE mapping;
+  LARGE_INTEGER fileSize;
+  void *data = cNBT_NULLPTR;
+
+  if (file == INVALID_HANDLE_VALUE)
+    return cNBT_NULLPTR;
+  if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+    mapping = CreateFileMappingA(file, cNBT_NULLPTR, PAGE_READONLY, 0, 0, cNBT_NULLPTR);
+    if (mapping) {
+      data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+  }
+  CloseHandle(file);
 
-typedef struct {
-  void *data;
-  size_t offset;
-  size_t capacity;
-  uint8_t bigEndian;
-  uint32_t errorFlag;
-} cNBTWriter;
+  if (data && size)
+    *size = (size_t)fileSize.QuadPart;
 
-// Dispatcher function.
-static void cNBT_WriteX(
-  cNBTWriter *writer, cNBT *item);
+  return data;
+}
 
-// Expand the capacity of the writer.
-static inline void cNBT_Expand(
-  cNBTWriter *writer,
-  size_t length
+void cNBT_UnmapFile(
+  const void *data,
+  size_t size
 ) {
-  if (length && writer->offset + length <= writer->capacity)
-    return;
-  void *newData = cNBT_Alloc(writer->capacity * 2);
-  memcpy(newData, writer->data, writer->capacity);
-  writer->capacity *= 2;
-  cNBT_Free(writer->data);
-  writer->data = newData;
+  (void)size;
+  if (data)
+    UnmapViewOfFile(data);
 }
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const void *cNBT_MapFile(
+  const char *path,
+  size_t *size
+) {
+  int file = open(path, O_RDONLY);
+  struct stat status;
+  void *data = cNBT_NULLPTR;
 
-// Basic type writers.
+  if (file < 0)
+    return cNBT_NULLPTR;
+  if (!fstat(file, &status) && status.st_size > 0) {
+    data = mmap(cNBT_NULLPTR, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (data == MAP_FAILED)
+      data = cNBT_NULLPTR;
+  }
+  close(file);
 
-static void cNBT_WriteI08(
-  cNBTWriter *writer,
-  uint8_t data
+  if (data && size)
+    *size = (size_t)status.st_size;
+
+  return data;
+}
+
+void cNBT_UnmapFile(
+  const void *data,
+  size_t size
 ) {
-  cNBT_Expand(writer, sizeof(int8_t));
-  uint8_t *cursor = cNBT_GetCursor(writer);
-  *cursor = data;
-  writer->offset += 1;
+  if (data)
+    munmap((void *)data, size);
 }
+#else
+// Read the whole file instead.
+const void *cNBT_MapFile(
+  const char *path,
+  size_t *size
+) {
+  FILE *file = fopen(path, "rb");
+  long length;
+  void *data = cNBT_NULLPTR;
 
-static void cNBT_WriteI16(
+  if (!file)
+    return cNBT_NULLPTR;
+  if (
+    !fseek(file, 0, SEEK_END)
+    && (length = ftell(file)) > 0
+    && !fseek(file, 0, SEEK_SET)
+    && (data = cNBT_AllocAs((size_t)length, cNBT_MEM_OTHER))
+    && fread(data, 1, (size_t)length, file) != (size_t)length
+  ) {
+    cNBT_Free(data);
+    data = cNBT_NULLPTR;
+  }
+  fclose(file);
+
+  if (data && size)
+    *size = (size_t)length;
+
+  return data;
+}
+
+void cNBT_UnmapFile(
+  const void *data,
+  size_t size
+) {
+  (void)size;
+  cNBT_Free(data);
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// [SECTION] BUNDLES
+//-----------------------------------------------------------------------------
+
+// Layout of a bundle, all little-endian:
+//
+// - A 16-byte header: magic, version (uint16_t), reserved (uint16_t), number
+//   of strings and number of documents.
+// - The offsets of the strings, as uint64_t.
+// - The offsets of the documents, as uint64_t, followed by the end of the
+//   last one.
+// - The strings, as a uint16_t length followed by the bytes, null-terminated.
+// - The documents, as binary NBT data, except that keys and strings are the
+//   index of their string, lengths of lists and arrays are unsigned LEB128
+//   varints like the indices, and numbers are little-endian.
+#define cNBT_BUNDLE_MAGIC 0x42424E63
+#define cNBT_BUNDLE_VERSION 1
+#define cNBT_BUNDLE_HEADER_SIZE 16
+
+// Entry of the string table of a builder.
+typedef struct {
+  uint32_t hash;
+  // Index of the string + 1, or 0 for empty slots.
+  uint32_t index;
+} cNBTBundleSlot;
+
+struct cNBTBundleBuilder_t {
+  // Encoded documents, and the offset of each one in `documents`.
+  cNBTWriter documents;
+  uint64_t *offsets;
+  uint32_t count;
+  uint32_t capacity;
+  // Strings as stored in the bundle, and the offset of each one in `strings`.
+  cNBTWriter strings;
+  uint64_t *stringOffsets;
+  uint32_t stringCount;
+  uint32_t stringCapacity;
+  // Hash table of the strings, with a load factor under 1/2.
+  cNBTBundleSlot *slots;
+  uint32_t mask;
+};
+
+static void cNBT_WriteVarint(
   cNBTWriter *writer,
-  int16_t data
+  uint32_t value
 ) {
-  cNBT_Expand(writer, sizeof(int16_t));
+  if (!cNBT_Expand(writer, 5))
+    return;
 
   uint8_t *cursor = cNBT_GetCursor(writer);
-  uint16_t d = (uint16_t)data;
-  writer->offset += 2;
+  size_t length = 0;
 
-  if (writer->bigEndian) {
-    cNBT_SetByteBE(cursor, 0, d, 16);
-    cNBT_SetByteBE(cursor, 1, d, 16);
-  } else {
-    cNBT_SetByteLE(cursor, 0, d);
-    cNBT_SetByteLE(cursor, 1, d);
+  while (value >= 0x80) {
+    cursor[length++] = (uint8_t)value | 0x80;
+    value >>= 7;
   }
+  cursor[length++] = (uint8_t)value;
+  writer->offset += length;
 }
 
-static void cNBT_WriteI32(
-  cNBTWriter *writer,
-  int32_t data
+static uint32_t cNBT_ParseVarint(
+  cNBTReader *reader
 ) {
-  cNBT_Expand(writer, sizeof(int32_t));
+  uint32_t result = 0;
 
-  uint8_t *cursor = cNBT_GetCursor(writer);
-  uint32_t d = (uint32_t)data;
-  writer->offset += 4;
+  for (uint32_t shift = 0; shift < 32; shift += 7) {
+    uint8_t byte = (uint8_t)cNBT_ParseI08(reader);
 
-  if (writer->bigEndian) {
-    cNBT_SetByteBE(cursor, 0, d, 32);
-    cNBT_SetByteBE(cursor, 1, d, 32);
-    cNBT_SetByteBE(cursor, 2, d, 32);
-    cNBT_SetByteBE(cursor, 3, d, 32);
-  } else {
-    cNBT_SetByteLE(cursor, 0, d);
-    cNBT_SetByteLE(cursor, 1, d);
-    cNBT_SetByteLE(cursor, 2, d);
-    cNBT_SetByteLE(cursor, 3, d);
+    if (reader->errorFlag || (shift == 28 && byte > 0x0F))
+      break;
+    result |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return result;
   }
+
+  // Truncated, or more than 32 bits.
+  reader->errorFlag = 1;
+  return 0;
 }
 
-static void cNBT_WriteI64(
+// Copy `length` elements of `size` bytes from the byte order of the source to
+// the byte order of the target.
+static void cNBT_CopyElements(
   cNBTWriter *writer,
-  int64_t data
+  const uint8_t *data,
+  size_t length,
+  size_t size,
+  uint8_t sourceBigEndian,
+  uint8_t bigEndian
 ) {
-  cNBT_Expand(writer, sizeof(int64_t));
+  if (!cNBT_Expand(writer, length * size))
+    return;
 
   uint8_t *cursor = cNBT_GetCursor(writer);
-  uint64_t d = (uint64_t)data;
-  writer->offset += 8;
 
-  if (writer->bigEndian) {
-    cNBT_SetByteBE(cursor, 0, d, 64);
-    cNBT_SetByteBE(cursor, 1, d, 64);
-    cNBT_SetByteBE(cursor, 2, d, 64);
-    cNBT_SetByteBE(cursor, 3, d, 64);
-    cNBT_SetByteBE(cursor, 4, d, 64);
-    cNBT_SetByteBE(cursor, 5, d, 64);
-    cNBT_SetByteBE(cursor, 6, d, 64);
-    cNBT_SetByteBE(cursor, 7, d, 64);
+  if (size == 1 || !sourceBigEndian == !bigEndian) {
+    if (length)
+      memcpy(cursor, data, length * size);
+  } else if (size == 4) {
+    for (size_t i = 0; i < length; i++)
+      cNBT_Store32(cursor + i * 4, cNBT_Load32(data + i * 4, sourceBigEndian), bigEndian);
   } else {
-    cNBT_SetByteLE(cursor, 0, d);
-    cNBT_SetByteLE(cursor, 1, d);
-    cNBT_SetByteLE(cursor, 2, d);
-    cNBT_SetByteLE(cursor, 3, d);
-    cNBT_SetByteLE(cursor, 4, d);
-    cNBT_SetByteLE(cursor, 5, d);
-    cNBT_SetByteLE(cursor, 6, d);
-    cNBT_SetByteLE(cursor, 7, d);
+    for (size_t i = 0; i < length; i++)
+      cNBT_Store64(cursor + i * 8, cNBT_Load64(data + i * 8, sourceBigEndian), bigEndian);
   }
+  writer->offset += length * size;
 }
 
-static void cNBT_WriteF32(
-  cNBTWriter *writer,
-  float data
-) {
-  int32_t tmp;
-  memcpy((void *)&tmp, (void *)&data, sizeof(float));
-  cNBT_WriteI32(writer, tmp);
+cNBTBundleBuilder *cNBT_CreateBundleBuilder(void) {
+  cNBTBundleBuilder *result = cNBT_AllocAs(sizeof(cNBTBundleBuilder), cNBT_MEM_OTHER);
+
+  if (!result)
+    return cNBT_NULLPTR;
+  memset(result, 0, sizeof(cNBTBundleBuilder));
+  result->documents.capacity = 0x1000;
+  result->documents.data = cNBT_AllocAs(0x1000, cNBT_MEM_WRITER);
+  result->strings.capacity = 0x1000;
+  result->strings.data = cNBT_AllocAs(0x1000, cNBT_MEM_WRITER);
+  if (!result->documents.data || !result->strings.data) {
+    cNBT_DeleteBundleBuilder(result);
+    return cNBT_NULLPTR;
+  }
+
+  return result;
 }
 
-static void cNBT_WriteF64(
-  cNBTWriter *writer,
-  double data
+void cNBT_DeleteBundleBuilder(
+  cNBTBundleBuilder *builder
 ) {
-  int64_t tmp;
-  memcpy((void *)&tmp, (void *)&data, sizeof(double));
-  cNBT_WriteI64(writer, tmp);
+  if (!builder)
+    return;
+
+  cNBT_Free(builder->documents.data);
+  cNBT_Free(builder->offsets);
+  cNBT_Free(builder->strings.data);
+  cNBT_Free(builder->stringOffsets);
+  cNBT_Free(builder->slots);
+  cNBT_Free(builder);
 }
 
-static void cNBT_WriteStr(
-  cNBTWriter *writer,
-  const char *string
+// Double the capacity of an array of offsets. Returns 0 on failure.
+static uint8_t cNBT_GrowOffsets(
+  uint64_t **offsets,
+  uint32_t *capacity
 ) {
-  uint16_t length = 0;
-
-  if (string)
-    length = strlen(string);
-  cNBT_WriteI16(writer, length);
+  uint32_t newCapacity = *capacity ? *capacity * 2 : 64;
+  uint64_t *newOffsets;
 
-  if (string && length) {
-    // We consider NULL strings as empty string.
-    cNBT_Expand(writer, length);
-    memcpy(cNBT_GetCursor(writer), string, length);
-    writer->offset += length;
+  if (newCapacity <= *capacity)
+    return 0;
+  newOffsets = cNBT_AllocAs((size_t)newCapacity * sizeof(uint64_t), cNBT_MEM_OTHER);
+  if (!newOffsets)
+    return 0;
+  if (*offsets) {
+    memcpy(newOffsets, *offsets, (size_t)*capacity * sizeof(uint64_t));
+    cNBT_Free(*offsets);
   }
+  *offsets = newOffsets;
+  *capacity = newCapacity;
+
+  return 1;
 }
 
-static void cNBT_WriteLst(
-  cNBTWriter *writer,
-  cNBT *nbt
+// Find or add a string of the dictionary. Returns its index, or UINT32_MAX on
+// failure.
+static uint32_t cNBT_BundleIntern(
+  cNBTBundleBuilder *builder,
+  const uint8_t *string,
+  uint16_t length
 ) {
-  int32_t length = 0;
-  cNBT *item;
+  uint32_t hash = (uint32_t)cNBT_HashFinal(cNBT_HashBytes(0, string, length));
 
-  if (!nbt)
-    return;
+  for (uint32_t i = hash & builder->mask; builder->mask && builder->slots[i].index; i = (i + 1) & builder->mask) {
+    uint32_t index = builder->slots[i].index - 1;
+    const uint8_t *stored = (const uint8_t *)builder->strings.data + builder->stringOffsets[index];
 
-  cNBT_ForEach(nbt, item)
-    length++;
-  
-  if (length < 0)
-    return;
+    if (
+      builder->slots[i].hash == hash
+      && cNBT_Load16(stored, 0) == length
+      && !memcmp(stored + 2, string, length)
+    )
+      return index;
+  }
 
-  cNBT_WriteI08(writer, nbt->listElementType);
-  cNBT_WriteI32(writer, length);
-  //printf("%d\n", length);
+  if (
+    builder->stringCount == builder->stringCapacity
+    && !cNBT_GrowOffsets(&builder->stringOffsets, &builder->stringCapacity)
+  )
+    return UINT32_MAX;
+
+  if ((builder->stringCount + 1) * 2 > builder->mask) {
+    uint32_t capacity = builder->mask ? (builder->mask + 1) * 2 : 64;
+    cNBTBundleSlot *slots = cNBT_AllocAs((size_t)capacity * sizeof(cNBTBundleSlot), cNBT_MEM_OTHER);
+
+    if (!slots)
+      return UINT32_MAX;
+    memset(slots, 0, (size_t)capacity * sizeof(cNBTBundleSlot));
+    for (uint32_t i = 0; builder->mask && i <= builder->mask; i++) {
+      uint32_t j = builder->slots[i].hash & (capacity - 1);
+
+      if (!builder->slots[i].index)
+        continue;
+      while (slots[j].index)
+        j = (j + 1) & (capacity - 1);
+      slots[j] = builder->slots[i];
+    }
+    cNBT_Free(builder->slots);
+    builder->slots = slots;
+    builder->mask = capacity - 1;
+  }
 
-  cNBT_ForEach(nbt, item) {
-    //printf("%p %d\n", item, item->type);
-    cNBT_WriteX(writer, item);
+  uint32_t index = builder->stringCount++
+    , i = hash & builder->mask;
+
+  builder->stringOffsets[index] = builder->strings.offset;
+  cNBT_WriteI16E(&builder->strings, (int16_t)length, 0);
+  cNBT_WriteBytes(&builder->strings, string, length);
+  cNBT_WriteI08(&builder->strings, 0);
+  if (builder->strings.errorFlag) {
+    builder->strings.offset = builder->stringOffsets[index];
+    builder->strings.errorFlag = 0;
+    builder->stringCount--;
+    return UINT32_MAX;
   }
+
+  while (builder->slots[i].index)
+    i = (i + 1) & builder->mask;
+  builder->slots[i].hash = hash;
+  builder->slots[i].index = index + 1;
+
+  return index;
 }
 
-static void cNBT_WriteObj(
-  cNBTWriter *writer,
-  cNBT *nbt
+// Read a key or string, and write the index of its string.
+static void cNBT_BundleEncodeString(
+  cNBTBundleBuilder *builder,
+  cNBTReader *reader
 ) {
-  if (!nbt)
-    return;
+  uint16_t length = (uint16_t)cNBT_ParseI16(reader);
+  uint32_t index;
 
-  cNBT *item;
-  cNBT_ForEach(nbt, item) {
-    cNBT_WriteI08(writer, item->type);
-    cNBT_WriteStr(writer, item->key);
-    //printf("%p %s\n", item, item->key);
-    cNBT_WriteX(writer, item);
+  if (!cNBT_ReaderCheck(reader, length))
+    return;
+  index = cNBT_BundleIntern(builder, cNBT_GetCursor(reader), length);
+  if (index == UINT32_MAX) {
+    reader->errorFlag = 1;
+    return;
   }
-  cNBT_WriteI08(writer, cNBT_END);
-}
-
-#define cNBT_WriteArrTyped(writer, length, data, type, func) {\
-  cNBT_WriteI32(writer, length);\
-  for (int32_t i = 0; i < length; i++)\
-    func(writer, ((type *)data)[i]);\
+  reader->offset += length;
+  cNBT_WriteVarint(&builder->documents, index);
 }
 
-static void cNBT_WriteX(
-  cNBTWriter *writer,
-  cNBT *item
+// Convert a payload of binary NBT data, checked with cNBT_SkipX() before.
+static void cNBT_BundleEncode(
+  cNBTBundleBuilder *builder,
+  cNBTReader *reader,
+  uint8_t type
 ) {
-  switch (item->type) {
-    // Basic types.
+  cNBTWriter *writer = &builder->documents;
+  int32_t length;
+  size_t size;
+
+  switch (type) {
     case cNBT_I08:
-      return cNBT_WriteI08(writer, item->value.valueI08);
+      cNBT_WriteI08(writer, (uint8_t)cNBT_ParseI08(reader));
+      return;
     case cNBT_I16:
-      return cNBT_WriteI16(writer, item->value.valueI16);
+      cNBT_WriteI16E(writer, cNBT_ParseI16(reader), 0);
+      return;
     case cNBT_I32:
-      return cNBT_WriteI32(writer, item->value.valueI32);
-    case cNBT_I64:
-      return cNBT_WriteI64(writer, item->value.valueI64);
     case cNBT_F32:
-      return cNBT_WriteF32(writer, item->value.valueF32);
+      cNBT_WriteI32E(writer, cNBT_ParseI32(reader), 0);
+      return;
+    case cNBT_I64:
     case cNBT_F64:
-      return cNBT_WriteF64(writer, item->value.valueF64);
-
-    // Array of 8-bit integers.
-    case cNBT_A08:
-      cNBT_WriteArrTyped(
-        writer,
-        item->value.lengthArray,
-        item->value.valueArray,
-        int8_t,
-        cNBT_WriteI08);
+      cNBT_WriteI64E(writer, cNBT_ParseI64(reader), 0);
       return;
 
-    // String.
     case cNBT_STR:
-      return cNBT_WriteStr(writer, item->value.valueString);
-    
-    // List.
-    case cNBT_LST:
-      return cNBT_WriteLst(writer, item);
-
-    // Object.
-    case cNBT_OBJ:
-      return cNBT_WriteObj(writer, item);
+      cNBT_BundleEncodeString(builder, reader);
+      return;
 
-    // Array of 32-bit integers.
+    case cNBT_A08:
     case cNBT_A32:
-      cNBT_WriteArrTyped(
-        writer,
-        item->value.lengthArray,
-        item->value.valueArray,
-        int32_t,
-        cNBT_WriteI32);
-      return;
-    // Array of 64-bit integers.
     case cNBT_A64:
-      cNBT_WriteArrTyped(
-        writer,
-        item->value.lengthArray,
-        item->value.valueArray,
-        int64_t,
-        cNBT_WriteI64);
+      size = type == cNBT_A08 ? 1 : type == cNBT_A32 ? 4 : 8;
+      length = cNBT_ParseI32(reader);
+      if (length < 0 || !cNBT_ReaderCheck(reader, (size_t)length * size)) {
+        reader->errorFlag = 1;
+        return;
+      }
+      cNBT_WriteVarint(writer, (uint32_t)length);
+      cNBT_CopyElements(writer, cNBT_GetCursor(reader), (size_t)length, size, reader->bigEndian, 0);
+      reader->offset += (size_t)length * size;
       return;
 
-    default:
+    case cNBT_LST: {
+      uint8_t elementType = (uint8_t)cNBT_ParseI08(reader);
+
+      length = cNBT_ParseI32(reader);
+      if (length < 0 || elementType > cNBT_A64) {
+        reader->errorFlag = 1;
+        return;
+      }
+      cNBT_WriteI08(writer, elementType);
+      cNBT_WriteVarint(writer, (uint32_t)length);
+      while (length-- > 0 && !reader->errorFlag)
+        cNBT_BundleEncode(builder, reader, elementType);
       return;
+    }
+
+    case cNBT_OBJ:
+      for (;;) {
+        uint8_t childType = (uint8_t)cNBT_ParseI08(reader);
+
+        if (reader->errorFlag || childType > cNBT_A64) {
+          reader->errorFlag = 1;
+          return;
+        }
+        cNBT_WriteI08(writer, childType);
+        if (!childType)
+          return;
+        cNBT_BundleEncodeString(builder, reader);
+        cNBT_BundleEncode(builder, reader, childType);
+      }
   }
 }
 
-//-----------------------------------------------------------------------------
-// [SECTION] VALUE OPERATIONS
-//-----------------------------------------------------------------------------
-
-uint8_t cNBT_IsType(
-  const cNBT *const nbt,
-  uint8_t type
+uint8_t cNBT_BundleAdd(
+  cNBTBundleBuilder *builder,
+  const void *data,
+  size_t size,
+  uint8_t bigEndian
 ) {
-  if (!nbt)
-    // Invalid object.
+  if (!builder || !data)
     return 0;
 
-  if (type > cNBT_A64)
-    // Invalid type byte.
-    return 0;
+  cNBTReader reader = {
+    .data = data,
+    .length = size,
+    .bigEndian = bigEndian
+  };
+  cNBTReader probe = reader;
+  uint8_t type = (uint8_t)cNBT_ParseI08(&probe);
 
-  if (nbt->type != type)
+  // Check the whole document first, so nothing is added if it's malformed.
+  cNBT_SkipX(&probe, cNBT_STR);
+  if (type == cNBT_END || type > cNBT_A64)
+    return 0;
+  cNBT_SkipX(&probe, type);
+  if (probe.errorFlag)
     return 0;
 
-  return 1;
-}
+  if (
+    builder->count == builder->capacity
+    && !cNBT_GrowOffsets(&builder->offsets, &builder->capacity)
+  )
+    return 0;
 
-cNBT *cNBT_GetNodeByKey(
-  const cNBT *const nbt,
-  const char *key
-) {
-  if (!nbt || !key || nbt->type != cNBT_OBJ)
-    return cNBT_NULLPTR;
+  size_t start = builder->documents.offset;
 
-  cNBT *item;
-  cNBT_ForEach(nbt, item) {
-    if (item->key && !strcmp(key, item->key))
-      return item;
+  cNBT_WriteI08(&builder->documents, (uint8_t)cNBT_ParseI08(&reader));
+  cNBT_BundleEncodeString(builder, &reader);
+  cNBT_BundleEncode(builder, &reader, type);
+  if (reader.errorFlag || builder->documents.errorFlag) {
+    // Out of memory.
+    builder->documents.offset = start;
+    builder->documents.errorFlag = 0;
+    return 0;
   }
+  builder->offsets[builder->count++] = start;
 
-  return cNBT_NULLPTR;
+  return 1;
 }
 
-cNBT *cNBT_GetNodeByKeyTyped(
-  const cNBT *const nbt,
-  const char *key,
-  uint8_t type
+void *cNBT_WriteBundle(
+  cNBTBundleBuilder *builder,
+  size_t *length
 ) {
-  if (!nbt || !key || nbt->type != cNBT_OBJ)
+  if (!builder)
     return cNBT_NULLPTR;
 
-  cNBT *item;
-  cNBT_ForEach(nbt, item) {
-    if (item->key && !strcmp(key, item->key) && item->type == type)
-      return item;
-  }
-
-  return cNBT_NULLPTR;
-}
+  size_t strings = cNBT_BUNDLE_HEADER_SIZE
+      + ((size_t)builder->stringCount + builder->count + 1) * sizeof(uint64_t)
+    , documents = strings + builder->strings.offset
+    , size = documents + builder->documents.offset;
+  uint8_t *result = cNBT_AllocAs(size, cNBT_MEM_WRITER)
+    , *cursor = result;
 
-cNBT *cNBT_GetNodeByIndex(
-  const cNBT *const nbt,
-  int32_t index
-) {
-  cNBT *result;
-
-  if (!nbt || index < 0)
+  if (!result)
     return cNBT_NULLPTR;
 
-  if (nbt->type != cNBT_OBJ || nbt->type != cNBT_LST)
-    return cNBT_NULLPTR;
+  cNBT_Store32(cursor, cNBT_BUNDLE_MAGIC, 0);
+  cNBT_Store16(cursor + 4, cNBT_BUNDLE_VERSION, 0);
+  cNBT_Store16(cursor + 6, 0, 0);
+  cNBT_Store32(cursor + 8, builder->stringCount, 0);
+  cNBT_Store32(cursor + 12, builder->count, 0);
+  cursor += cNBT_BUNDLE_HEADER_SIZE;
 
-  result = nbt->child;
+  for (uint32_t i = 0; i < builder->stringCount; i++, cursor += 8)
+    cNBT_Store64(cursor, strings + builder->stringOffsets[i], 0);
+  for (uint32_t i = 0; i < builder->count; i++, cursor += 8)
+    cNBT_Store64(cursor, documents + builder->offsets[i], 0);
+  cNBT_Store64(cursor, size, 0);
 
-  while (index && result) {
-    result = result->next;
-    index--;
-  }
+  memcpy(result + strings, builder->strings.data, builder->strings.offset);
+  memcpy(result + documents, builder->documents.data, builder->documents.offset);
+
+  if (length)
+    *length = size;
 
   return result;
 }
 
-uint8_t cNBT_GetNodeType(
-  const cNBT *const nbt
+uint8_t cNBT_OpenBundle(
+  const void *data,
+  size_t size,
+  cNBTBundle *bundle
 ) {
-  if (!nbt)
-    // Invalid type.
-    return cNBT_END;
+  const uint8_t *cursor = data;
+
+  if (
+    !data
+    || !bundle
+    || size < cNBT_BUNDLE_HEADER_SIZE
+    || cNBT_Load32(cursor, 0) != cNBT_BUNDLE_MAGIC
+    || cNBT_Load16(cursor + 4, 0) != cNBT_BUNDLE_VERSION
+  )
+    return 0;
 
-  return nbt->type;
+  bundle->data = data;
+  bundle->size = size;
+  bundle->stringCount = cNBT_Load32(cursor + 8, 0);
+  bundle->documentCount = cNBT_Load32(cursor + 12, 0);
+
+  // The offset tables must fit.
+  return (size - cNBT_BUNDLE_HEADER_SIZE) / sizeof(uint64_t)
+    > (uint64_t)bundle->stringCount + bundle->documentCount;
 }
 
-const char *cNBT_GetNodeKey(
-  const cNBT *const nbt
+// Get a string of the dictionary, or NULL if it's out of the bundle.
+static const char *cNBT_BundleString(
+  const cNBTBundle *bundle,
+  uint32_t index,
+  uint16_t *length
 ) {
-  if (!nbt)
+  const uint8_t *data = bundle->data;
+  uint64_t offset;
+
+  if (index >= bundle->stringCount)
+    return cNBT_NULLPTR;
+  offset = cNBT_Load64(data + cNBT_BUNDLE_HEADER_SIZE + (size_t)index * 8, 0);
+  if (offset > bundle->size || bundle->size - offset < 3)
+    return cNBT_NULLPTR;
+  *length = cNBT_Load16(data + offset, 0);
+  if (bundle->size - offset < (uint64_t)*length + 3 || data[offset + 2 + *length])
     return cNBT_NULLPTR;
 
-  return nbt->key;
+  return (const char *)data + offset + 2;
 }
 
-uint16_t cNBT_GetValueStringLength(
-  const cNBT *const nbt
+// Set up a reader on a document of a bundle. Returns 0 if it's out of range.
+static uint8_t cNBT_BundleDocument(
+  const cNBTBundle *bundle,
+  uint32_t index,
+  cNBTReader *reader
 ) {
-  if (!nbt || nbt->type != cNBT_STR || !nbt->value.valueString)
+  const uint8_t *offsets;
+  uint64_t start, end;
+
+  if (!bundle || index >= bundle->documentCount)
+    return 0;
+  offsets = (const uint8_t *)bundle->data + cNBT_BUNDLE_HEADER_SIZE
+    + ((size_t)bundle->stringCount + index) * 8;
+  start = cNBT_Load64(offsets, 0);
+  end = cNBT_Load64(offsets + 8, 0);
+  if (start > end || end > bundle->size)
     return 0;
 
-  return nbt->value.lengthString;
+  memset(reader, 0, sizeof(cNBTReader));
+  reader->data = (const uint8_t *)bundle->data + start;
+  reader->length = (size_t)(end - start);
+
+  return 1;
 }
 
-const char *cNBT_GetValueString(
-  const cNBT *const nbt
+// Read the index of a key or string of a document.
+static const char *cNBT_BundleParseString(
+  const cNBTBundle *bundle,
+  cNBTReader *reader,
+  uint16_t *length
 ) {
-  if (!nbt || nbt->type != cNBT_STR  || !nbt->value.valueString)
+  uint32_t index = cNBT_ParseVarint(reader);
+  const char *result;
+
+  if (reader->errorFlag)
     return cNBT_NULLPTR;
+  result = cNBT_BundleString(bundle, index, length);
+  if (!result)
+    reader->errorFlag = 1;
 
-  return nbt->value.valueString;
+  return result;
 }
 
-cNBT *cNBT_CreateNode(
+// Convert a payload of a document back to binary NBT data.
+static void cNBT_BundleDecode(
+  const cNBTBundle *bundle,
+  cNBTReader *reader,
+  cNBTWriter *writer,
   uint8_t type
 ) {
-  if (type > cNBT_A64)
-    // Invalid type byte.
-    return cNBT_NULLPTR;
+  const char *string;
+  uint16_t stringLength;
+  uint32_t length;
+  size_t size;
 
-  cNBT *result = cNBT_Alloc(sizeof(cNBT));
-  memset((void *)result, 0, sizeof(cNBT));
+  switch (type) {
+    case cNBT_I08:
+      cNBT_WriteI08(writer, (uint8_t)cNBT_ParseI08(reader));
+      return;
+    case cNBT_I16:
+      cNBT_WriteI16E(writer, cNBT_ParseI16(reader), writer->bigEndian);
+      return;
+    case cNBT_I32:
+    case cNBT_F32:
+      cNBT_WriteI32E(writer, cNBT_ParseI32(reader), writer->bigEndian);
+      return;
+    case cNBT_I64:
+    case cNBT_F64:
+      cNBT_WriteI64E(writer, cNBT_ParseI64(reader), writer->bigEndian);
+      return;
 
-  result->type = type;
+    case cNBT_STR:
+      string = cNBT_BundleParseString(bundle, reader, &stringLength);
+      if (!string)
+        return;
+      cNBT_WriteI16E(writer, (int16_t)stringLength, writer->bigEndian);
+      cNBT_WriteBytes(writer, string, stringLength);
+      return;
 
-  return result;
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      size = type == cNBT_A08 ? 1 : type == cNBT_A32 ? 4 : 8;
+      length = cNBT_ParseVarint(reader);
+      if (length > INT32_MAX || !cNBT_ReaderCheck(reader, (size_t)length * size)) {
+        reader->errorFlag = 1;
+        return;
+      }
+      cNBT_WriteI32E(writer, (int32_t)length, writer->bigEndian);
+      cNBT_CopyElements(writer, cNBT_GetCursor(reader), length, size, 0, writer->bigEndian);
+      reader->offset += (size_t)length * size;
+      return;
+
+    case cNBT_LST: {
+      uint8_t elementType = (uint8_t)cNBT_ParseI08(reader);
+
+      length = cNBT_ParseVarint(reader);
+      if (
+        reader->errorFlag
+        || length > INT32_MAX
+        || elementType > cNBT_A64
+        || (elementType == cNBT_END && length)
+        || reader->depth >= cNBT_MAX_DEPTH
+      ) {
+        reader->errorFlag = 1;
+        return;
+      }
+      cNBT_WriteI08(writer, elementType);
+      cNBT_WriteI32E(writer, (int32_t)length, writer->bigEndian);
+      reader->depth++;
+      while (length-- > 0 && !reader->errorFlag)
+        cNBT_BundleDecode(bundle, reader, writer, elementType);
+      reader->depth--;
+      return;
+    }
+
+    case cNBT_OBJ:
+      if (reader->depth >= cNBT_MAX_DEPTH) {
+        reader->errorFlag = 1;
+        return;
+      }
+      reader->depth++;
+      for (;;) {
+        uint8_t childType = (uint8_t)cNBT_ParseI08(reader);
+
+        if (reader->errorFlag || childType > cNBT_A64) {
+          reader->errorFlag = 1;
+          break;
+        }
+        cNBT_WriteI08(writer, childType);
+        if (!childType)
+          break;
+        string = cNBT_BundleParseString(bundle, reader, &stringLength);
+        if (!string)
+          break;
+        cNBT_WriteI16E(writer, (int16_t)stringLength, writer->bigEndian);
+        cNBT_WriteBytes(writer, string, stringLength);
+        cNBT_BundleDecode(bundle, reader, writer, childType);
+      }
+      reader->depth--;
+      return;
+  }
 }
 
-cNBT *cNBT_AddNode(
-  cNBT *nbt,
-  cNBT *item,
-  const char *key
+const void *cNBT_BundleExtract(
+  const cNBTBundle *bundle,
+  uint32_t index,
+  uint8_t bigEndian,
+  size_t *length
 ) {
-  if (!nbt || !item)
-    // Invalid parameters.
-    return cNBT_NULLPTR;
+  cNBTReader reader;
 
-  if (nbt->type != cNBT_LST && nbt->type != cNBT_OBJ)
-    // Not compatible types.
+  if (!cNBT_BundleDocument(bundle, index, &reader))
     return cNBT_NULLPTR;
 
-  if (nbt->type == cNBT_OBJ && cNBT_GetNodeByKey(nbt, key))
-    // Existed key.
-    return cNBT_NULLPTR;
+  // Documents are shorter than their binary NBT data.
+  size_t capacity = reader.length * 2 + 0x40;
+  cNBTWriter writer = {
+    .bigEndian = bigEndian,
+    .capacity = capacity,
+    .data = cNBT_AllocAs(capacity, cNBT_MEM_WRITER)
+  };
+  uint8_t type = (uint8_t)cNBT_ParseI08(&reader);
+  const char *key;
+  uint16_t keyLength;
 
-  if (nbt->type == cNBT_LST && item->type != nbt->listElementType)
-    // Not compatible types.
+  if (!writer.data)
     return cNBT_NULLPTR;
 
-  if (item->next || item->prev)
-    // Not independent item.
-    // We don't know where the item from, so we just return.
+  cNBT_WriteI08(&writer, type);
+  key = cNBT_BundleParseString(bundle, &reader, &keyLength);
+  if (key) {
+    cNBT_WriteI16E(&writer, (int16_t)keyLength, bigEndian);
+    cNBT_WriteBytes(&writer, key, keyLength);
+  }
+  if (type == cNBT_END || type > cNBT_A64)
+    reader.errorFlag = 1;
+  else
+    cNBT_BundleDecode(bundle, &reader, &writer, type);
+
+  if (reader.errorFlag) {
+    cNBT_Free(writer.data);
     return cNBT_NULLPTR;
+  }
 
-  // Free the existing key.
-  if (item->key)
-    cNBT_Free(item->key);
+  if (length)
+    *length = writer.offset;
 
-  // Copy the key.
-  if (nbt->type != cNBT_LST)
-    // FIXME: Add length check for the key.
-    item->key = cNBT_StrDup(key);
-  else
-    item->key = cNBT_NULLPTR;
+  return writer.data;
+}
 
-  if (!nbt->child) {
-    // Set as a child of given object.
-    nbt->child = item;
-    item->prev = item;
-    item->next = cNBT_NULLPTR;
+// Read a payload of a document into `item`, and its items recursively.
+static void cNBT_BundleBuild(
+  const cNBTBundle *bundle,
+  cNBTReader *reader,
+  cNBT *item
+) {
+  const char *string;
+  uint16_t stringLength;
+  uint32_t length = 0;
+  size_t size;
+  cNBT *last = cNBT_NULLPTR;
 
-    return nbt;
-  }
+  switch (item->type) {
+    case cNBT_I08:
+      item->value.valueI08 = cNBT_ParseI08(reader);
+      return;
+    case cNBT_I16:
+      item->value.valueI16 = cNBT_ParseI16(reader);
+      return;
+    case cNBT_I32:
+      item->value.valueI32 = cNBT_ParseI32(reader);
+      return;
+    case cNBT_I64:
+      item->value.valueI64 = cNBT_ParseI64(reader);
+      return;
+    case cNBT_F32:
+      item->value.valueF32 = cNBT_ParseF32(reader);
+      return;
+    case cNBT_F64:
+      item->value.valueF64 = cNBT_ParseF64(reader);
+      return;
 
-  cNBT *node;
-  cNBT_ForEach(nbt, node) {
-    if (!node->next) {
-      // Append to the child list.
-      node->next = item;
+    case cNBT_STR:
+      string = cNBT_BundleParseString(bundle, reader, &stringLength);
+      if (!string)
+        return;
+      item->value.lengthString = stringLength;
+      item->value.valueString = cNBT_CloneBytes(
+        string, stringLength, 1, cNBT_NULLPTR, cNBT_MEM_STRING);
+      return;
 
-      item->next = cNBT_NULLPTR;
-      item->prev = node;
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      size = item->type == cNBT_A08 ? 1 : item->type == cNBT_A32 ? 4 : 8;
+      length = cNBT_ParseVarint(reader);
+      if (length > INT32_MAX || !cNBT_ReaderCheck(reader, (size_t)length * size)) {
+        reader->errorFlag = 1;
+        return;
+      }
+      item->value.lengthArray = (int32_t)length;
+      item->value.valueArray = cNBT_CloneBytes(
+        cNBT_GetCursor(reader), (size_t)length * size, 0, cNBT_NULLPTR, cNBT_MEM_ARRAY);
+      cNBT_SwapArray(item->value.valueArray, length, size, 0);
+      reader->offset += (size_t)length * size;
+      return;
 
-      break;
-    }
+    case cNBT_LST:
+    case cNBT_OBJ:
+      if (reader->depth >= cNBT_MAX_DEPTH) {
+        reader->errorFlag = 1;
+        return;
+      }
+      if (item->type == cNBT_LST) {
+        item->listElementType = (uint8_t)cNBT_ParseI08(reader);
+        length = cNBT_ParseVarint(reader);
+        if (
+          length > INT32_MAX
+          || item->listElementType > cNBT_A64
+          || (item->listElementType == cNBT_END && length)
+        )
+          reader->errorFlag = 1;
+      }
+      reader->depth++;
+
+      while (!reader->errorFlag) {
+        uint8_t type = item->listElementType;
+        cNBT *child;
+
+        if (item->type == cNBT_LST) {
+          if (!length--)
+            break;
+        } else {
+          type = (uint8_t)cNBT_ParseI08(reader);
+          if (!type || reader->errorFlag)
+            break;
+          if (type > cNBT_A64) {
+            reader->errorFlag = 1;
+            break;
+          }
+        }
+
+        child = cNBT_CreateNode(type);
+        if (!child) {
+          reader->errorFlag = 1;
+          break;
+        }
+        child->parent = item;
+        if (last) {
+          last->next = child;
+          child->prev = last;
+        } else {
+          item->child = child;
+        }
+        last = child;
+        item->child->prev = last;
+
+        if (item->type == cNBT_OBJ) {
+          // Keys point to the dictionary of the bundle.
+          child->key = (char *)cNBT_BundleParseString(bundle, reader, &stringLength);
+          child->flags |= cNBT_FLAG_BORROWED_KEY;
+        }
+        cNBT_BundleBuild(bundle, reader, child);
+      }
+      reader->depth--;
+      return;
   }
-
-  return nbt;
 }
 
-cNBT *cNBT_SetListElementType(
-  cNBT *nbt,
-  uint8_t type
+cNBT *cNBT_BundleParse(
+  const cNBTBundle *bundle,
+  uint32_t index
 ) {
-  if (!nbt || nbt->type != cNBT_LST)
-    // Invalid NBT object.
+  cNBTReader reader;
+  cNBT *result;
+  uint16_t keyLength;
+
+  if (!cNBT_BundleDocument(bundle, index, &reader))
     return cNBT_NULLPTR;
 
-  if (!type || type > cNBT_A64)
-    // Invalid type byte.
+  uint8_t type = (uint8_t)cNBT_ParseI08(&reader);
+
+  if (type == cNBT_END || type > cNBT_A64 || !(result = cNBT_CreateNode(type)))
+    return cNBT_NULLPTR;
+  result->key = (char *)cNBT_BundleParseString(bundle, &reader, &keyLength);
+  result->flags |= cNBT_FLAG_BORROWED_KEY;
+  cNBT_BundleBuild(bundle, &reader, result);
+
+  if (reader.errorFlag) {
+    cNBT_Delete(result);
     return cNBT_NULLPTR;
+  }
+
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] LOADER
+//-----------------------------------------------------------------------------
+
+// Read the files of loaders with io_uring, submitting the reads with raw
+// system calls. Loaders fall back to the thread pool alone if the kernel
+// doesn't support it or forbids it.
+#if \
+  defined(__linux__) && defined(cNBT_THREADS) && !defined(cNBT_DISABLE_URING) \
+  && (defined(__GNUC__) || defined(__clang__)) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define cNBT_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#endif
+
+#ifdef cNBT_URING
+// Number of pooled buffers per worker: one whose file is parsed while the
+// next file is read into the other.
+#define cNBT_LOADER_BUFFERS 2
+
+// A buffer of the pool shared by the reader thread and the workers.
+typedef struct cNBTLoadBuffer_t {
+  struct cNBTLoadBuffer_t *next;
+  void *data;
+  size_t capacity;
+} cNBTLoadBuffer;
+
+// Submission and completion queues shared with the kernel.
+typedef struct {
+  int fd;
+  // Number of submission entries.
+  uint32_t entries;
+  // Entries queued and not submitted yet.
+  uint32_t pending;
+  unsigned *sqTail;
+  unsigned *sqMask;
+  unsigned *sqArray;
+  struct io_uring_sqe *sqes;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned *cqMask;
+  struct io_uring_cqe *cqes;
+  void *sqRing;
+  void *cqRing;
+  size_t sqSize;
+  size_t cqSize;
+} cNBTRing;
+#endif
 
-  if (nbt->listElementType && nbt->child)
-    // We can't override the type of a list with child nodes.
-    return cNBT_NULLPTR;
+// A submitted file, queued in `jobs` then in `results` once loaded. With
+// io_uring, it is queued in `reads` first, and in `jobs` once its data is read
+// in `buffer`.
+typedef struct cNBTLoadJob_t {
+  struct cNBTLoadJob_t *next;
+  void *userData;
+  cNBT *nbt;
+  uint8_t error;
+  uint8_t parseError;
+#ifdef cNBT_URING
+  cNBTLoadBuffer *buffer;
+  int fd;
+  // Size of the file and number of bytes read so far.
+  size_t length;
+  size_t done;
+  struct iovec vector;
+#endif
+  char path[];
+} cNBTLoadJob;
 
-  nbt->listElementType = type;
+// FIFO of jobs.
+typedef struct {
+  cNBTLoadJob *head;
+  cNBTLoadJob **tail;
+} cNBTLoadQueue;
 
-  return nbt;
+struct cNBTLoader_t {
+  cNBTParseOptions options;
+  uint8_t bigEndian;
+  cNBTLoadQueue jobs;
+  cNBTLoadQueue results;
+  // Number of jobs submitted and not loaded yet.
+  size_t loading;
+  // Buffer of cNBT_LoaderSubmit() when there is no worker.
+  void *buffer;
+  size_t capacity;
+#ifdef cNBT_THREADS
+  cNBTMutex mutex;
+  // Signaled when jobs are queued or the loader is deleted, and when jobs are
+  // loaded or workers exit.
+  cNBTCond queued;
+  cNBTCond done;
+  // Number of running threads, the reader thread included.
+  uint32_t workers;
+  uint8_t closing;
+#endif
+#ifdef cNBT_URING
+  // Set if the reader thread runs, in which case the files are read by it and
+  // only parsed by the workers.
+  uint8_t reading;
+  cNBTLoadQueue reads;
+  // Free buffers of the pool.
+  cNBTLoadBuffer *buffers;
+  // Signaled to the reader thread when files are queued in `reads`, buffers
+  // are released or the loader is deleted.
+  cNBTCond ready;
+  // Only used by the reader thread once it runs.
+  cNBTRing ring;
+#endif
+};
+
+static void cNBT_LoadQueuePush(
+  cNBTLoadQueue *queue,
+  cNBTLoadJob *job
+) {
+  job->next = cNBT_NULLPTR;
+  *queue->tail = job;
+  queue->tail = &job->next;
 }
 
-cNBT *cNBT_SetValueI08(
-  cNBT *nbt,
-  int8_t data
+static cNBTLoadJob *cNBT_LoadQueuePop(
+  cNBTLoadQueue *queue
 ) {
-  if (!nbt || nbt->type != cNBT_I08)
-    return cNBT_NULLPTR;
+  cNBTLoadJob *job = queue->head;
 
-  nbt->value.valueI08 = data;
+  if (job && !(queue->head = job->next))
+    queue->tail = &queue->head;
 
-  return nbt;
+  return job;
 }
 
-cNBT *cNBT_SetValueI16(
-  cNBT *nbt,
-  int16_t data
+// Make a buffer big enough for a file. Returns 0 on failure, with the buffer
+// freed.
+static uint8_t cNBT_LoadReserve(
+  void **buffer,
+  size_t *capacity,
+  size_t length
 ) {
-  if (!nbt || nbt->type != cNBT_I16)
-    return cNBT_NULLPTR;
+  if (length <= *capacity)
+    return 1;
 
-  nbt->value.valueI16 = data;
+  // Round up, so that files of similar sizes don't grow the buffer every time.
+  size_t grown = (length + 0xFFFF) & ~(size_t)0xFFFF;
 
-  return nbt;
+  cNBT_Free(*buffer);
+  *capacity = 0;
+  if (!(*buffer = cNBT_AllocAs(grown, cNBT_MEM_OTHER)))
+    return 0;
+  *capacity = grown;
+
+  return 1;
 }
 
-cNBT *cNBT_SetValueI32(
-  cNBT *nbt,
-  int32_t data
+// Parse the data read from the file of a job.
+static void cNBT_LoadParse(
+  const cNBTLoader *loader,
+  cNBTLoadJob *job,
+  const void *data,
+  size_t length
 ) {
-  if (!nbt || nbt->type != cNBT_I32)
-    return cNBT_NULLPTR;
-
-  nbt->value.valueI32 = data;
+  cNBTParseOptions options = loader->options;
 
-  return nbt;
+  options.error = &job->parseError;
+  job->nbt = cNBT_ParseEx(data, length, loader->bigEndian, &options);
+  job->error = job->nbt ? cNBT_LOAD_OK : cNBT_LOAD_PARSE_FAILED;
 }
 
-cNBT *cNBT_SetValueI64(
-  cNBT *nbt,
-  int64_t data
+// Read and parse the file of a job, reusing the buffer of the caller.
+static void cNBT_LoadFile(
+  const cNBTLoader *loader,
+  cNBTLoadJob *job,
+  void **buffer,
+  size_t *capacity
 ) {
-  if (!nbt || nbt->type != cNBT_I64)
-    return cNBT_NULLPTR;
-
-  nbt->value.valueI64 = data;
+  FILE *file = fopen(job->path, "rb");
+  long length = -1;
+  uint8_t read = 0;
+
+  job->nbt = cNBT_NULLPTR;
+  job->error = cNBT_LOAD_READ_FAILED;
+  job->parseError = cNBT_PARSE_ERROR_NONE;
+  if (!file)
+    return;
+  if (
+    !fseek(file, 0, SEEK_END)
+    && (length = ftell(file)) >= 0
+    && !fseek(file, 0, SEEK_SET)
+  )
+    read = cNBT_LoadReserve(buffer, capacity, (size_t)length)
+      && fread(*buffer, 1, (size_t)length, file) == (size_t)length;
+  fclose(file);
+  if (read)
+    cNBT_LoadParse(loader, job, *buffer, (size_t)length);
+}
 
-  return nbt;
+#ifdef cNBT_URING
+static void cNBT_RingDestroy(
+  cNBTRing *ring
+) {
+  if (ring->sqes)
+    munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+  if (ring->cqRing && ring->cqRing != ring->sqRing)
+    munmap(ring->cqRing, ring->cqSize);
+  if (ring->sqRing)
+    munmap(ring->sqRing, ring->sqSize);
+  close(ring->fd);
 }
 
-cNBT *cNBT_SetValueF32(
-  cNBT *nbt,
-  float data
+// Set up a ring with at least the given number of submission entries. Returns
+// 0 if io_uring isn't available.
+static uint8_t cNBT_RingInit(
+  cNBTRing *ring,
+  uint32_t entries
 ) {
-  if (!nbt || nbt->type != cNBT_F32)
-    return cNBT_NULLPTR;
+  struct io_uring_params params;
+  void *sqes;
 
-  nbt->value.valueF32 = data;
+  memset(ring, 0, sizeof(cNBTRing));
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0)
+    return 0;
+  ring->entries = params.sq_entries;
+
+  ring->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  // Both queues may share one mapping.
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) && ring->cqSize > ring->sqSize)
+    ring->sqSize = ring->cqSize;
+  ring->sqRing = mmap(
+    cNBT_NULLPTR, ring->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqRing == MAP_FAILED) {
+    ring->sqRing = cNBT_NULLPTR;
+    cNBT_RingDestroy(ring);
+    return 0;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring->cqRing = ring->sqRing;
+  else {
+    ring->cqRing = mmap(
+      cNBT_NULLPTR, ring->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqRing == MAP_FAILED) {
+      ring->cqRing = cNBT_NULLPTR;
+      cNBT_RingDestroy(ring);
+      return 0;
+    }
+  }
+  sqes = mmap(
+    cNBT_NULLPTR, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    cNBT_RingDestroy(ring);
+    return 0;
+  }
 
-  return nbt;
+  ring->sqes = sqes;
+  ring->sqTail = (unsigned *)((uint8_t *)ring->sqRing + params.sq_off.tail);
+  ring->sqMask = (unsigned *)((uint8_t *)ring->sqRing + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *)((uint8_t *)ring->sqRing + params.sq_off.array);
+  ring->cqHead = (unsigned *)((uint8_t *)ring->cqRing + params.cq_off.head);
+  ring->cqTail = (unsigned *)((uint8_t *)ring->cqRing + params.cq_off.tail);
+  ring->cqMask = (unsigned *)((uint8_t *)ring->cqRing + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)((uint8_t *)ring->cqRing + params.cq_off.cqes);
+
+  return 1;
 }
 
-cNBT *cNBT_SetValueF64(
-  cNBT *nbt,
-  double data
+// Queue the read of the rest of the file of a job. There must be a free
+// submission entry.
+static void cNBT_RingRead(
+  cNBTRing *ring,
+  cNBTLoadJob *job
 ) {
-  if (!nbt || nbt->type != cNBT_F64)
-    return cNBT_NULLPTR;
+  // Only this thread writes the tail.
+  unsigned tail = *ring->sqTail
+    , index = tail & *ring->sqMask;
+  struct io_uring_sqe *sqe = ring->sqes + index;
+
+  job->vector.iov_base = (uint8_t *)job->buffer->data + job->done;
+  job->vector.iov_len = job->length - job->done;
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = job->fd;
+  sqe->addr = (uint64_t)(uintptr_t)&job->vector;
+  sqe->len = 1;
+  sqe->off = job->done;
+  sqe->user_data = (uint64_t)(uintptr_t)job;
+  ring->sqArray[index] = index;
+  __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+  ring->pending++;
+}
 
-  nbt->value.valueF64 = data;
+// Submit the queued reads, and wait until at least one completes.
+static void cNBT_RingWait(
+  cNBTRing *ring
+) {
+  long submitted = syscall(
+    __NR_io_uring_enter, ring->fd, ring->pending, 1, IORING_ENTER_GETEVENTS,
+    cNBT_NULLPTR, 0);
 
-  return nbt;
+  // Interrupted calls are retried by the caller.
+  if (submitted > 0)
+    ring->pending -= (uint32_t)submitted;
 }
 
-cNBT *cNBT_SetValueString(
-  cNBT *nbt,
-  const char *string,
-  uint16_t length
+// Open the file of a job and prepare its buffer. Returns 0 on failure.
+static uint8_t cNBT_LoadOpen(
+  cNBTLoadJob *job
 ) {
-  size_t actualLength;
-
-  if (!nbt || !string || nbt->type != cNBT_STR)
-    return cNBT_NULLPTR;
+  struct stat status;
 
-  if (!length) {
-    actualLength = strlen(string);
-    if (actualLength > 65535)
-      // Does nothing when the string is too long.
-      return cNBT_NULLPTR;
-    // Get the string's actual length.
-    length = (uint16_t)actualLength;
+  job->nbt = cNBT_NULLPTR;
+  job->error = cNBT_LOAD_READ_FAILED;
+  job->parseError = cNBT_PARSE_ERROR_NONE;
+  job->done = 0;
+  if ((job->fd = open(job->path, O_RDONLY | O_CLOEXEC)) < 0)
+    return 0;
+  if (
+    fstat(job->fd, &status)
+    || status.st_size < 0
+    || !cNBT_LoadReserve(&job->buffer->data, &job->buffer->capacity, (size_t)status.st_size)
+  ) {
+    close(job->fd);
+    return 0;
   }
+  job->length = (size_t)status.st_size;
 
-  if (nbt->value.valueString)
-    cNBT_Free(nbt->value.valueString);
-
-  nbt->value.valueString = cNBT_StrNDup(string, length, &actualLength);
-  nbt->value.lengthString = (uint16_t)actualLength;
+  return 1;
+}
 
-  return nbt;
+// Return a buffer to the pool. The mutex must be locked.
+static void cNBT_LoadRelease(
+  cNBTLoader *loader,
+  cNBTLoadJob *job
+) {
+  job->buffer->next = loader->buffers;
+  loader->buffers = job->buffer;
+  job->buffer = cNBT_NULLPTR;
+  cNBT_CondSignal(&loader->ready);
 }
 
-cNBT *cNBT_SetValueArray(
-  cNBT *nbt,
-  const void *data,
-  int32_t length
+// Pass a job whose read completed or failed to the workers, or to the results
+// on failure. The mutex must be locked.
+static void cNBT_LoadDispatch(
+  cNBTLoader *loader,
+  cNBTLoadJob *job,
+  uint8_t read
 ) {
-  size_t perElement = 0;
+  if (loader->closing) {
+    cNBT_LoadRelease(loader, job);
+    cNBT_Free(job);
+    loader->loading--;
+    cNBT_CondBroadcast(&loader->done);
+  } else if (read) {
+    cNBT_LoadQueuePush(&loader->jobs, job);
+    cNBT_CondSignal(&loader->queued);
+  } else {
+    cNBT_LoadRelease(loader, job);
+    cNBT_LoadQueuePush(&loader->results, job);
+    loader->loading--;
+    cNBT_CondBroadcast(&loader->done);
+  }
+}
 
-  if (!nbt || !data || length < 0)
-    return cNBT_NULLPTR;
+// Read the files of `reads` into the buffers of the pool, as many at a time as
+// there are buffers, and queue them to the workers.
+cNBT_THREAD_FN(cNBT_LoadReader) {
+  cNBTLoader *loader = (cNBTLoader *)arg;
+  cNBTRing *ring = &loader->ring;
+  cNBTLoadQueue finished;
+  cNBTLoadJob *job;
+  uint32_t inflight = 0;
+
+  cNBT_MutexLock(&loader->mutex);
+  for (;;) {
+    while (
+      !loader->closing
+      && loader->reads.head
+      && loader->buffers
+      && inflight < ring->entries
+    ) {
+      job = cNBT_LoadQueuePop(&loader->reads);
+      job->buffer = loader->buffers;
+      loader->buffers = job->buffer->next;
+      cNBT_MutexUnlock(&loader->mutex);
+
+      uint8_t opened = cNBT_LoadOpen(job);
+
+      if (opened && job->length) {
+        cNBT_RingRead(ring, job);
+        inflight++;
+      }
+      cNBT_MutexLock(&loader->mutex);
+      if (!opened || !job->length) {
+        if (opened)
+          close(job->fd);
+        cNBT_LoadDispatch(loader, job, opened);
+      }
+    }
 
-  switch (nbt->type) {
-    case cNBT_A08:
-      perElement = sizeof(int8_t);
-      break;
+    if (!inflight) {
+      if (loader->closing)
+        break;
+      cNBT_CondWait(&loader->ready, &loader->mutex);
+      continue;
+    }
+    cNBT_MutexUnlock(&loader->mutex);
+
+    cNBT_RingWait(ring);
+
+    // Continue short reads, and collect the jobs done.
+    unsigned head = *ring->cqHead
+      , tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+    finished.head = cNBT_NULLPTR;
+    finished.tail = &finished.head;
+    for (; head != tail; head++) {
+      const struct io_uring_cqe *cqe = ring->cqes + (head & *ring->cqMask);
+
+      job = (cNBTLoadJob *)(uintptr_t)cqe->user_data;
+      if (cqe->res > 0)
+        job->done += (size_t)cqe->res;
+      // A read error, or the end of a file that shrank, fails the job.
+      if (cqe->res > 0 && job->done < job->length) {
+        cNBT_RingRead(ring, job);
+        continue;
+      }
+      close(job->fd);
+      cNBT_LoadQueuePush(&finished, job);
+      inflight--;
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
 
-    case cNBT_A32:
-      perElement = sizeof(int32_t);
-      break;
+    cNBT_MutexLock(&loader->mutex);
+    while ((job = cNBT_LoadQueuePop(&finished)))
+      cNBT_LoadDispatch(loader, job, job->done == job->length);
+  }
+  cNBT_MutexUnlock(&loader->mutex);
 
-    case cNBT_A64:
-      perElement = sizeof(int64_t);
-      break;
+  cNBT_RingDestroy(ring);
 
-    default:
-      return cNBT_NULLPTR;
-  }
+  // The loader may be freed as soon as the count reaches 0.
+  cNBT_MutexLock(&loader->mutex);
+  loader->workers--;
+  cNBT_CondBroadcast(&loader->done);
+  cNBT_MutexUnlock(&loader->mutex);
 
-  if (nbt->value.valueArray)
-    cNBT_Free(nbt->value.valueArray);
+  return 0;
+}
 
-  nbt->value.lengthArray = length;
+// Free the buffer pool, once all the buffers are released.
+static void cNBT_LoadFreeBuffers(
+  cNBTLoader *loader
+) {
+  cNBTLoadBuffer *buffer;
 
-  if (length) {
-    nbt->value.valueArray = cNBT_Alloc(length * perElement);
-    memcpy(nbt->value.valueArray, data, length * perElement);
-  } else {
-    nbt->value.valueArray = cNBT_NULLPTR;
+  while ((buffer = loader->buffers)) {
+    loader->buffers = buffer->next;
+    cNBT_Free(buffer->data);
+    cNBT_Free(buffer);
   }
+}
+// Create the buffer pool and start the reader thread. Returns 0 if io_uring
+// isn't available, in which case the workers read the files themselves.
+static uint8_t cNBT_LoadStartReader(
+  cNBTLoader *loader,
+  uint32_t buffers
+) {
+  for (uint32_t i = 0; i < buffers; i++) {
+    cNBTLoadBuffer *buffer = cNBT_AllocAs(sizeof(cNBTLoadBuffer), cNBT_MEM_OTHER);
 
-  return nbt;
+    if (!buffer)
+      break;
+    buffer->data = cNBT_NULLPTR;
+    buffer->capacity = 0;
+    buffer->next = loader->buffers;
+    loader->buffers = buffer;
+  }
+  if (loader->buffers && cNBT_RingInit(&loader->ring, buffers)) {
+    if (cNBT_ThreadStart(cNBT_LoadReader, loader)) {
+      loader->workers++;
+      loader->reading = 1;
+      return 1;
+    }
+    cNBT_RingDestroy(&loader->ring);
+  }
+  cNBT_LoadFreeBuffers(loader);
+
+  return 0;
 }
 
-cNBT *cNBT_RemoveNode(
-  cNBT *nbt,
-  cNBT *item
-) {
-  if (!nbt || !item)
-    // Invalid parameters.
-    return cNBT_NULLPTR;
+#endif
 
-  if (item != nbt->child && !item->prev)
-    // The item is the first child of other objects.
-    return cNBT_NULLPTR;
+#ifdef cNBT_THREADS
+cNBT_THREAD_FN(cNBT_LoadWorker) {
+  cNBTLoader *loader = (cNBTLoader *)arg;
+  void *buffer = cNBT_NULLPTR;
+  size_t capacity = 0;
+  cNBTLoadJob *job;
+
+  cNBT_MutexLock(&loader->mutex);
+  for (;;) {
+    while (!loader->jobs.head && !loader->closing)
+      cNBT_CondWait(&loader->queued, &loader->mutex);
+    if (!(job = cNBT_LoadQueuePop(&loader->jobs)))
+      break;
+    cNBT_MutexUnlock(&loader->mutex);
 
-  if (item != nbt->child)
-    // Not the first element.
-    item->prev->next = item->next;
+#ifdef cNBT_URING
+    // Read by the reader thread.
+    if (job->buffer)
+      cNBT_LoadParse(loader, job, job->buffer->data, job->length);
+    else
+#endif
+    cNBT_LoadFile(loader, job, &buffer, &capacity);
 
-  if (item->next)
-    // Not the last element.
-    item->next->prev = item->prev;
+    cNBT_MutexLock(&loader->mutex);
+#ifdef cNBT_URING
+    if (job->buffer)
+      cNBT_LoadRelease(loader, job);
+#endif
+    cNBT_LoadQueuePush(&loader->results, job);
+    loader->loading--;
+    cNBT_CondBroadcast(&loader->done);
+  }
+  cNBT_MutexUnlock(&loader->mutex);
 
-  if (item == nbt->child)
-    // The first element of the list.
-    nbt->child = item->next;
-  else if (!item->next)
-    // The last element of the list.
-    nbt->child->prev = item->prev;
+  cNBT_Free(buffer);
 
-  // Detach the node from the list.
-  item->next = item->prev = cNBT_NULLPTR;
+  // The loader may be freed as soon as the count reaches 0.
+  cNBT_MutexLock(&loader->mutex);
+  loader->workers--;
+  cNBT_CondBroadcast(&loader->done);
+  cNBT_MutexUnlock(&loader->mutex);
 
-  return item;
+  return 0;
 }
+#endif
 
-cNBT *cNBT_Clear(
-  cNBT *nbt
+cNBTLoader *cNBT_CreateLoader(
+  uint32_t threads,
+  uint8_t bigEndian,
+  const cNBTParseOptions *options
 ) {
-  if (!nbt)
-    return cNBT_NULLPTR;
+  cNBTLoader *loader = cNBT_AllocAs(sizeof(cNBTLoader), cNBT_MEM_OTHER);
 
-  if (nbt->type != cNBT_LST || nbt->type != cNBT_OBJ)
+  if (!loader)
     return cNBT_NULLPTR;
 
-  if (nbt->type == cNBT_LST)
-    nbt->listElementType = cNBT_END;
-
-  cNBT_Delete(nbt->child);
+  memset(loader, 0, sizeof(cNBTLoader));
+  if (options)
+    loader->options = *options;
+  // The buffers are reused, and the shape caches, statistics and error codes
+  // aren't shared between threads. Error codes are returned per file.
+  loader->options.flags &= ~(uint32_t)(cNBT_PARSE_TRACK_SOURCE | cNBT_PARSE_ARRAY_VIEWS);
+  loader->options.shapes = cNBT_NULLPTR;
+  loader->options.dedupStats = cNBT_NULLPTR;
+  loader->options.error = cNBT_NULLPTR;
+  loader->bigEndian = bigEndian;
+  loader->jobs.tail = &loader->jobs.head;
+  loader->results.tail = &loader->results.head;
+
+#ifdef cNBT_THREADS
+  cNBT_MutexInit(&loader->mutex);
+  cNBT_CondInit(&loader->queued);
+  cNBT_CondInit(&loader->done);
+  if (!threads)
+    threads = cNBT_LOADER_THREADS;
+  // Workers only touch the loader under the mutex.
+  cNBT_MutexLock(&loader->mutex);
+  while (loader->workers < threads && cNBT_ThreadStart(cNBT_LoadWorker, loader))
+    loader->workers++;
+#ifdef cNBT_URING
+  loader->reads.tail = &loader->reads.head;
+  cNBT_CondInit(&loader->ready);
+  if (loader->workers)
+    cNBT_LoadStartReader(loader, loader->workers * cNBT_LOADER_BUFFERS);
+#endif
+  cNBT_MutexUnlock(&loader->mutex);
+#else
+  (void)threads;
+#endif
 
-  return nbt;
+  return loader;
 }
 
-//-----------------------------------------------------------------------------
-// [SECTION] GENERAL OPERATIONS
-//-----------------------------------------------------------------------------
-
-void cNBT_Delete(
-  cNBT *nbt
+uint8_t cNBT_LoaderSubmit(
+  cNBTLoader *loader,
+  const char *path,
+  void *userData
 ) {
-  for (cNBT *item = nbt, *next, *child; item; item = next) {
-    // Save the next and child nodes to avoid access freed items.
-    next = item->next;
-    child = item->child;
-    if (
-      item->type == cNBT_A08
-      || item->type == cNBT_A32
-      || item->type == cNBT_A64
-    )
-      cNBT_Free(item->value.valueArray);
-    if (item->type == cNBT_STR)
-      cNBT_Free(item->value.valueString);
-    if (item->key)
-      cNBT_Free(item->key);
+  if (!loader || !path)
+    return 0;
 
-    if (child)
-      // Free child nodes recursively.
-      cNBT_Delete(child);
+  size_t length = strlen(path) + 1;
+  cNBTLoadJob *job = cNBT_AllocAs(sizeof(cNBTLoadJob) + length, cNBT_MEM_OTHER);
 
-    cNBT_Free(item);
+  if (!job)
+    return 0;
+  job->userData = userData;
+#ifdef cNBT_URING
+  job->buffer = cNBT_NULLPTR;
+#endif
+  memcpy(job->path, path, length);
+
+#ifdef cNBT_THREADS
+  cNBT_MutexLock(&loader->mutex);
+#ifdef cNBT_URING
+  if (loader->reading) {
+    cNBT_LoadQueuePush(&loader->reads, job);
+    loader->loading++;
+    cNBT_CondSignal(&loader->ready);
+    cNBT_MutexUnlock(&loader->mutex);
+    return 1;
   }
+#endif
+  if (loader->workers) {
+    cNBT_LoadQueuePush(&loader->jobs, job);
+    loader->loading++;
+    cNBT_CondSignal(&loader->queued);
+    cNBT_MutexUnlock(&loader->mutex);
+    return 1;
+  }
+  cNBT_MutexUnlock(&loader->mutex);
+#endif
+
+  // No worker available.
+  cNBT_LoadFile(loader, job, &loader->buffer, &loader->capacity);
+  cNBT_LoadQueuePush(&loader->results, job);
+
+  return 1;
 }
 
-cNBT *cNBT_Parse(
-  const void *data,
-  size_t size,
-  uint8_t bigEndian
+uint8_t cNBT_LoaderNext(
+  cNBTLoader *loader,
+  cNBTLoadResult *result,
+  uint8_t wait
 ) {
-  if (!data)
-    return cNBT_NULLPTR;
-
-  cNBTReader reader = {
-    .bigEndian = bigEndian,
-    .data = data,
-    .length = size,
-    .offset = 0,
-    .errorFlag = 0
-  };
+  cNBTLoadJob *job;
 
-  cNBT *result = cNBT_Alloc(sizeof(cNBT));
-  uint8_t type = cNBT_ParseI08(&reader);
+  if (!loader || !result)
+    return 0;
 
-  result->next = result->prev = cNBT_NULLPTR;
+#ifdef cNBT_THREADS
+  cNBT_MutexLock(&loader->mutex);
+  while (wait && !loader->results.head && loader->loading)
+    cNBT_CondWait(&loader->done, &loader->mutex);
+  job = cNBT_LoadQueuePop(&loader->results);
+  cNBT_MutexUnlock(&loader->mutex);
+#else
+  (void)wait;
+  job = cNBT_LoadQueuePop(&loader->results);
+#endif
 
-  // Parse the key of the element.
-  cNBT_ParseStr(&reader, &result->key);
-  cNBT_ParseX(&reader, result, type);
+  if (!job)
+    return 0;
+  result->nbt = job->nbt;
+  result->userData = job->userData;
+  result->error = job->error;
+  result->parseError = job->parseError;
+  cNBT_Free(job);
 
-  return result;
+  return 1;
 }
 
-const void *cNBT_Write(
-  cNBT *nbt,
-  size_t initialCapacity,
-  uint8_t bigEndian,
-  size_t *length
+void cNBT_DeleteLoader(
+  cNBTLoader *loader
 ) {
-  if (!nbt)
-    return cNBT_NULLPTR;
-  if (!initialCapacity)
-    initialCapacity = 0x40;
+  cNBTLoadJob *job;
 
-  cNBTWriter w = {
-    .bigEndian = bigEndian,
-    .capacity = initialCapacity,
-    .errorFlag = 0,
-    .offset = 0,
-    .data = cNBT_Alloc(initialCapacity)
-  };
+  if (!loader)
+    return;
 
-  cNBT_WriteI08(&w, nbt->type);
-  cNBT_WriteStr(&w, nbt->key);
-  cNBT_WriteX(&w, nbt);
+#ifdef cNBT_THREADS
+  cNBT_MutexLock(&loader->mutex);
+#ifdef cNBT_URING
+  while ((job = cNBT_LoadQueuePop(&loader->reads))) {
+    loader->loading--;
+    cNBT_Free(job);
+  }
+#endif
+  while ((job = cNBT_LoadQueuePop(&loader->jobs))) {
+#ifdef cNBT_URING
+    if (job->buffer)
+      cNBT_LoadRelease(loader, job);
+#endif
+    loader->loading--;
+    cNBT_Free(job);
+  }
+  loader->closing = 1;
+  cNBT_CondBroadcast(&loader->queued);
+#ifdef cNBT_URING
+  cNBT_CondSignal(&loader->ready);
+#endif
+  while (loader->workers)
+    cNBT_CondWait(&loader->done, &loader->mutex);
+  cNBT_MutexUnlock(&loader->mutex);
 
-  if (length)
-    *length = w.offset;
+#ifdef cNBT_URING
+  cNBT_LoadFreeBuffers(loader);
+  cNBT_CondDestroy(&loader->ready);
+#endif
+  cNBT_CondDestroy(&loader->done);
+  cNBT_CondDestroy(&loader->queued);
+  cNBT_MutexDestroy(&loader->mutex);
+#endif
 
-  return w.data;
+  while ((job = cNBT_LoadQueuePop(&loader->results))) {
+    cNBT_Delete(job->nbt);
+    cNBT_Free(job);
+  }
+  cNBT_Free(loader->buffer);
+  cNBT_Free(loader);
 }
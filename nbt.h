@@ -1,6 +1,7 @@
 #ifndef __NBT_H__
 #define __NBT_H__
 
+#include <stddef.h>
 #include <stdint.h>
 #include "nbtconfig.h"
 
@@ -73,8 +74,33 @@ typedef union {
     int32_t lengthArray;
     void *valueArray;
   };
+
+  // Shaped object, see cNBT_FLAG_SHAPED.
+  struct {
+    const struct cNBTShape_t *shape;
+    // Children by slot, NULL for small objects.
+    struct cNBT_t **slots;
+  };
 } cNBTPayload;
 
+// The item is allocated from an arena, and won't be freed by cNBT_Delete().
+#define cNBT_FLAG_ARENA 0x01
+// The key of the item is not owned by the item.
+#define cNBT_FLAG_BORROWED_KEY 0x02
+// The string or array carried by the item is not owned by the item.
+#define cNBT_FLAG_BORROWED_VALUE 0x04
+// The item or one of its descendants has been modified since parsing.
+#define cNBT_FLAG_DIRTY 0x08
+// The source data of the item is big-endian.
+#define cNBT_FLAG_SOURCE_BIG_ENDIAN 0x10
+// The array carried by the item points to its elements in the source data, in
+// the byte order given by cNBT_FLAG_SOURCE_BIG_ENDIAN. Always combined with
+// cNBT_FLAG_BORROWED_VALUE. See cNBT_PARSE_ARRAY_VIEWS.
+#define cNBT_FLAG_ARRAY_VIEW 0x20
+// The object was parsed with a shape cache, and `value.shape` holds its shape.
+// Dropped when its children change. See cNBT_GetShape().
+#define cNBT_FLAG_SHAPED 0x40
+
 struct cNBT_t;
 typedef struct cNBT_t {
   // The chain of the items in the list/object.
@@ -86,6 +112,8 @@ typedef struct cNBT_t {
   // A list or object item will have a child pointer pointing to another chain
   // of the items in the list/object.
   struct cNBT_t *child;
+  // The list or object containing this item.
+  struct cNBT_t *parent;
 
   // The name of the item. This will be NBT_NULLPTR if the item is in a list.
   // When the key is empty (length == 0), it's recorded as a pointer points 
@@ -97,9 +125,21 @@ typedef struct cNBT_t {
   // The element is considered as a list if this field is set. Note that we
   // won't record the length of a list.
   uint8_t listElementType;
+  // Ownership and state flags of the item, see cNBT_FLAG_*.
+  uint8_t flags;
+  // On the first item of a chain, the number of other lists or objects whose
+  // child pointer points to the chain, see cNBT_Snapshot().
+  uint8_t shares;
+  // Length of the payload in the source data.
+  uint32_t sourceLength;
 
   // Stored data.
   cNBTPayload value;
+
+  // The payload of the item in the binary data it was parsed from, recorded
+  // when parsing with cNBT_PARSE_TRACK_SOURCE. Unmodified items are copied
+  // from here by cNBT_Write().
+  const void *source;
 } cNBT;
 
 //-----------------------------------------------------------------------------
@@ -116,10 +156,98 @@ cNBT_ATTR void cNBT_API cNBT_GetAllocators(
   cNBTMemAllocFn *allocFn, cNBTMemFreeFn *freeFn, void **userData);
 
 // Set current memory allocator functions. you can implement your own
-// allocator with this function.
+// allocator with this function. The free-many and realloc functions are
+// reset.
 cNBT_ATTR void cNBT_API cNBT_SetAllocators(
   cNBTMemAllocFn allocFn, cNBTMemFreeFn freeFn, void *userData);
 
+// Free `count` pointers at once, called with the user data of the allocators.
+typedef void (cNBT_API *cNBTMemFreeManyFn)(
+  void **, size_t, void *);
+
+// Set a function freeing pointers in batches, used by cNBT_Delete() instead of
+// calling the free function for each pointer. NULL to disable. Call this after
+// cNBT_SetAllocators().
+cNBT_ATTR void cNBT_API cNBT_SetFreeManyFn(
+  cNBTMemFreeManyFn freeManyFn);
+
+// Resize a block of the allocator, keeping its contents, called with the
+// user data of the allocators. Returns NULL on failure, and the block is left
+// as is.
+typedef void *(cNBT_API *cNBTMemReallocFn)(
+  void *, size_t, void *);
+
+// Set a function resizing blocks, used by the writers to grow their output in
+// place, e.g. with realloc() or mremap(), instead of allocating a new block
+// and copying the old one. NULL to disable. It's realloc() with the default
+// allocators. Call this after cNBT_SetAllocators().
+cNBT_ATTR void cNBT_API cNBT_SetReallocFn(
+  cNBTMemReallocFn reallocFn);
+
+// Categories of the memory allocated by cNBT.
+// Tree nodes.
+#define cNBT_MEM_NODE 0
+// Keys of the nodes.
+#define cNBT_MEM_KEY 1
+// String payloads.
+#define cNBT_MEM_STRING 2
+// Array payloads.
+#define cNBT_MEM_ARRAY 3
+// Output buffers of cNBT_Write() and the functions alike.
+#define cNBT_MEM_WRITER 4
+// Arena blocks.
+#define cNBT_MEM_ARENA 5
+// Temporary buffers and memory from cNBT_Alloc().
+#define cNBT_MEM_OTHER 6
+#define cNBT_MEM_CATEGORIES 7
+
+typedef struct {
+  uint64_t allocations;
+  uint64_t frees;
+  // Requested bytes currently allocated, and the highest value of it.
+  size_t liveBytes;
+  size_t peakBytes;
+} cNBTMemoryCounters;
+
+typedef struct {
+  cNBTMemoryCounters total;
+  cNBTMemoryCounters category[cNBT_MEM_CATEGORIES];
+} cNBTMemoryStats;
+
+// Get the allocation counters. Returns 0 and zeroes `stats` if cNBT is not
+// compiled with cNBT_ENABLE_MEMORY_STATS.
+cNBT_ATTR uint8_t cNBT_API cNBT_GetMemoryStats(
+  cNBTMemoryStats *stats);
+
+// Reset the allocation and free counts, and the high-water marks to the
+// current live bytes.
+cNBT_ATTR void cNBT_API cNBT_ResetMemoryStats(void);
+
+// Get the heap memory owned by a node and its descendants, in bytes. Borrowed
+// keys and values are not counted, and chains shared by several items are
+// counted once. If `breakdown` is given, it receives cNBT_MEM_CATEGORIES
+// counts indexed by cNBT_MEM_*. Works without cNBT_ENABLE_MEMORY_STATS.
+cNBT_ATTR size_t cNBT_API cNBT_MemoryUsage(
+  const cNBT *nbt, size_t *breakdown);
+
+// A bump allocator. Memory allocated from an arena is released all at once
+// when the arena is deleted.
+struct cNBTArena_t;
+typedef struct cNBTArena_t cNBTArena;
+
+// Create an arena. Memory is requested from the cNBT allocator in blocks of
+// `blockSize` bytes, 64 KiB if 0.
+cNBT_ATTR cNBTArena *cNBT_API cNBT_CreateArena(
+  size_t blockSize);
+
+// Allocate memory from an arena. The memory is aligned to 8 bytes.
+cNBT_ATTR void *cNBT_API cNBT_ArenaAlloc(
+  cNBTArena *arena, size_t size);
+
+// Release all memory allocated from the arena, and the arena itself.
+cNBT_ATTR void cNBT_API cNBT_DeleteArena(
+  cNBTArena *arena);
+
 //-----------------------------------------------------------------------------
 // [SECTION] VALUE OPERATIONS
 //-----------------------------------------------------------------------------
@@ -162,6 +290,30 @@ cNBT_ATTR uint16_t cNBT_API cNBT_GetValueStringLength(
 cNBT_ATTR const char *cNBT_API cNBT_GetValueString(
   const cNBT *const nbt);
 
+// Obtain the number of elements of an array node.
+// Avaliable only for array nodes.
+cNBT_ATTR int32_t cNBT_API cNBT_GetArrayLength(
+  const cNBT *const nbt);
+
+// Obtain an element of an array node. Array views are decoded on read.
+// The node's type must match the function, or the function returns 0. Returns
+// 0 when `index` is out of range.
+cNBT_ATTR int8_t cNBT_API cNBT_GetArrayElementI08(
+  const cNBT *const nbt,
+  int32_t index);
+cNBT_ATTR int32_t cNBT_API cNBT_GetArrayElementI32(
+  const cNBT *const nbt,
+  int32_t index);
+cNBT_ATTR int64_t cNBT_API cNBT_GetArrayElementI64(
+  const cNBT *const nbt,
+  int32_t index);
+
+// Decode an array view into an array owned by the node, so `valueArray` can be
+// accessed directly. Does nothing for other arrays. Returns 0 when the memory
+// can't be allocated.
+cNBT_ATTR uint8_t cNBT_API cNBT_ArrayMaterialize(
+  cNBT *nbt);
+
 // Create an NBT item.
 cNBT_ATTR cNBT *cNBT_API cNBT_CreateNode(
   uint8_t type);
@@ -222,6 +374,17 @@ cNBT_ATTR cNBT *cNBT_API cNBT_RemoveNode(
 cNBT_ATTR cNBT *cNBT_API cNBT_Clear(
   cNBT *nbt);
 
+// Mark a node and its ancestors as modified. The functions above do it
+// automatically; call this after modifying the fields of a node directly.
+cNBT_ATTR void cNBT_API cNBT_MarkDirty(
+  cNBT *nbt);
+
+// Forget the source data of a tree parsed with cNBT_PARSE_TRACK_SOURCE or
+// cNBT_PARSE_ARRAY_VIEWS, array views are materialized. Call this before the
+// source data is freed if the tree is still in use.
+cNBT_ATTR void cNBT_API cNBT_ReleaseSource(
+  cNBT *nbt);
+
 //-----------------------------------------------------------------------------
 // [SECTION] GENERAL OPERATIONS
 //-----------------------------------------------------------------------------
@@ -235,18 +398,837 @@ cNBT_ATTR void *cNBT_API cNBT_Alloc(
 cNBT_ATTR void cNBT_API cNBT_Free(
   const void *ptr);
 
-// Free the whole NBT object recursively. DO NOT access deleted NBT objects.
+// Free the whole NBT object. DO NOT access deleted NBT objects. The tree is
+// walked without recursion, so any nesting level can be freed. Chains shared
+// with snapshots are freed by their last owner.
 cNBT_ATTR void cNBT_API cNBT_Delete(
   cNBT *nbt);
 
-// Parse a binary NBT data.
+// Hand an NBT object to a background thread which frees it with cNBT_Delete().
+// The object must not be accessed anymore, and the allocator functions must be
+// thread-safe. Falls back to cNBT_Delete() if threads are not available.
+cNBT_ATTR void cNBT_API cNBT_DeleteAsync(
+  cNBT *nbt);
+
+// Wait until all objects passed to cNBT_DeleteAsync() are freed.
+cNBT_ATTR void cNBT_API cNBT_WaitDeletes(void);
+
+// Parse a binary NBT data. Returns NULL if the data is truncated or malformed.
 cNBT_ATTR cNBT *cNBT_API cNBT_Parse(
   const void *data, size_t size, uint8_t bigEndian);
 
-// Serialize a NBT object to binary data.
+// Record the position of each payload in the source data. cNBT_Write() then
+// copies the payloads of unmodified subtrees from the source data instead of
+// encoding them again, as long as the endianness matches. The source data must
+// outlive the tree, or be detached with cNBT_ReleaseSource().
+#define cNBT_PARSE_TRACK_SOURCE 0x01
+// Don't copy arrays. Array nodes point to their elements in the source data
+// instead, and are decoded only when read, see cNBT_FLAG_ARRAY_VIEW. Use
+// cNBT_GetArrayElement*(), or call cNBT_ArrayMaterialize() before accessing
+// `valueArray` directly. The source data must outlive the tree, or be
+// detached with cNBT_ReleaseSource().
+#define cNBT_PARSE_ARRAY_VIEWS 0x02
+// Share the items of identical lists and objects. Each list or object of at
+// most 4 KiB is hashed once read, and when its payload is identical to one
+// read before, its children are freed and its item points to the same chain
+// of children instead. The `parent` pointers of shared items point to the
+// first occurrence, so the tree must not be modified; cNBT_Clone() it to get
+// a modifiable copy. See cNBTDedupStats.
+#define cNBT_PARSE_DEDUPLICATE 0x04
+
+// Statistics of a parse with cNBT_PARSE_DEDUPLICATE.
+typedef struct {
+  // Distinct non-empty lists and objects recorded.
+  size_t unique;
+  // Lists and objects identical to one read before, including the ones
+  // nested in other duplicates.
+  size_t duplicates;
+  // Bytes of source data of the duplicates.
+  size_t duplicateBytes;
+} cNBTDedupStats;
+
+struct cNBTShapeCache_t;
+typedef struct cNBTShapeCache_t cNBTShapeCache;
+
+typedef struct {
+  // Combination of cNBT_PARSE_* flags.
+  uint32_t flags;
+  // Maximum nesting level of lists and objects, deeper data is rejected. 0 for
+  // cNBT_MAX_DEPTH. The parser doesn't recurse, so the limit only bounds the
+  // heap used by its stack. Note that cNBT_Write() and other functions walking
+  // the tree still recurse once per level.
+  uint32_t maxDepth;
+  // Shapes of the objects seen so far, shared by the parsed trees, or NULL.
+  // See cNBT_CreateShapeCache().
+  cNBTShapeCache *shapes;
+  // Receives the statistics of cNBT_PARSE_DEDUPLICATE, or NULL.
+  cNBTDedupStats *dedupStats;
+  // Budgets for untrusted data, 0 for no limit. The parse stops as soon as one
+  // is exceeded, before allocating. Lengths are checked against the remaining
+  // data first, so the time spent on any data is proportional to its size.
+  // Heap bytes of the tree: nodes, keys, strings and arrays.
+  size_t maxBytes;
+  // Number of nodes, including the root.
+  size_t maxNodes;
+  // Elements of each array.
+  uint32_t maxArrayLength;
+  // Bytes of each key and string.
+  uint32_t maxStringLength;
+  // Receives one of the cNBT_PARSE_ERROR_* codes, or NULL.
+  uint8_t *error;
+} cNBTParseOptions;
+
+// Error codes of cNBT_ParseEx().
+#define cNBT_PARSE_ERROR_NONE 0
+// The data is truncated or malformed.
+#define cNBT_PARSE_ERROR_MALFORMED 1
+// An allocation failed.
+#define cNBT_PARSE_ERROR_NO_MEMORY 2
+// The data is nested deeper than `maxDepth`.
+#define cNBT_PARSE_ERROR_DEPTH 3
+// The tree would use more than `maxBytes`.
+#define cNBT_PARSE_ERROR_BYTES 4
+// The tree would have more than `maxNodes` nodes.
+#define cNBT_PARSE_ERROR_NODES 5
+// An array is longer than `maxArrayLength`.
+#define cNBT_PARSE_ERROR_ARRAY_LENGTH 6
+// A key or string is longer than `maxStringLength`.
+#define cNBT_PARSE_ERROR_STRING_LENGTH 7
+
+// Parse a binary NBT data with options. `options` can be NULL.
+cNBT_ATTR cNBT *cNBT_API cNBT_ParseEx(
+  const void *data,
+  size_t size,
+  uint8_t bigEndian,
+  const cNBTParseOptions *options);
+
+// Serialize a NBT object to binary data. Returns NULL if the memory can't be
+// allocated.
 cNBT_ATTR const void *cNBT_API cNBT_Write(
   cNBT *nbt, size_t initialCapacity, uint8_t bigEndian, size_t *length);
 
+// A range of bytes of the output of cNBT_WriteV(). Laid out like `struct
+// iovec` of POSIX systems, so an array of segments can be passed to writev()
+// or sendmsg() as is.
+typedef struct {
+  const void *data;
+  size_t length;
+} cNBTSegment;
+
+// Default minimum length of the payloads referenced by cNBT_WriteV().
+#define cNBT_WRITEV_MIN_LENGTH 1024
+
+// Serialize a NBT object to a list of segments, whose concatenation is the
+// output of cNBT_Write(). Strings, arrays in the target byte order (byte
+// arrays always), and unmodified payloads of trees parsed with
+// cNBT_PARSE_TRACK_SOURCE of at least `minLength` bytes, 0 for
+// cNBT_WRITEV_MIN_LENGTH, are referenced where they are instead of being
+// copied. The other bytes are written to one compact buffer. The tree, and
+// its source data if any, must stay valid and unmodified while the segments
+// are used. Note that writev() takes at most IOV_MAX segments per call. Free
+// the segments with cNBT_FreeSegments(). Returns NULL on failure.
+cNBT_ATTR const cNBTSegment *cNBT_API cNBT_WriteV(
+  cNBT *nbt,
+  uint8_t bigEndian,
+  size_t minLength,
+  size_t *count,
+  size_t *length);
+
+cNBT_ATTR void cNBT_API cNBT_FreeSegments(
+  const cNBTSegment *segments);
+
+// A writer keeping its buffer from one write to the next, e.g. to serialize
+// packets without allocating once the buffer is big enough.
+struct cNBTWriteSession_t;
+typedef struct cNBTWriteSession_t cNBTWriteSession;
+
+// Create a write session whose buffer starts with `initialCapacity` bytes, 64
+// if 0. Returns NULL on failure.
+cNBT_ATTR cNBTWriteSession *cNBT_API cNBT_CreateWriteSession(
+  size_t initialCapacity);
+
+// Serialize a NBT object after the output of the session, like cNBT_Write().
+// Returns a view of the bytes written by this call, which stays valid until
+// the next write, reset or deletion of the session. Returns NULL if the buffer
+// can't grow, the output of the previous writes is then kept as is.
+cNBT_ATTR const void *cNBT_API cNBT_SessionWrite(
+  cNBTWriteSession *session,
+  cNBT *nbt,
+  uint8_t bigEndian,
+  size_t *length);
+
+// Get a view of the whole output of the session since the last reset, valid
+// under the same conditions.
+cNBT_ATTR const void *cNBT_API cNBT_SessionData(
+  const cNBTWriteSession *session,
+  size_t *length);
+
+// Empty the output of the session, keeping its buffer.
+cNBT_ATTR void cNBT_API cNBT_SessionReset(
+  cNBTWriteSession *session);
+
+cNBT_ATTR void cNBT_API cNBT_DeleteWriteSession(
+  cNBTWriteSession *session);
+
+//-----------------------------------------------------------------------------
+// [SECTION] JSON EXPORT
+//-----------------------------------------------------------------------------
+
+// Output callback of streaming functions. Return 0 to abort the output.
+typedef uint8_t (cNBT_API *cNBTSinkFn)(
+  const void *, size_t, void *);
+
+// Wrap every value except list elements in an object carrying its type, e.g.
+// {"type":"int","value":1}. Lists also carry "elementType", and elements of
+// lists of lists are wrapped too, so the element types of inner lists are
+// kept.
+#define cNBT_JSON_TYPED 0x01
+// Emit arrays as base64 strings of their elements in little-endian byte order
+// instead of JSON arrays of numbers.
+#define cNBT_JSON_BASE64_ARRAYS 0x02
+
+typedef struct {
+  // Combination of cNBT_JSON_* flags.
+  uint32_t flags;
+  // With cNBT_JSON_BASE64_ARRAYS, arrays shorter than this are still emitted
+  // as JSON arrays.
+  int32_t base64Threshold;
+} cNBTJSONOptions;
+
+// Export the value of an NBT object as JSON. The key of the given object is
+// ignored. The output is passed to `sink` in chunks of at most 4 KiB, so the
+// memory usage doesn't depend on the size of the output. `options` can be
+// NULL.
+//
+// Returns the total length of the output, or 0 if the sink aborted.
+cNBT_ATTR size_t cNBT_API cNBT_WriteJSON(
+  const cNBT *nbt,
+  const cNBTJSONOptions *options,
+  cNBTSinkFn sink,
+  void *userData);
+
+// Export binary NBT data as JSON directly, without building cNBT objects.
+//
+// Returns the total length of the output, or 0 if the data is malformed or
+// the sink aborted. The output may be incomplete in these cases.
+cNBT_ATTR size_t cNBT_API cNBT_WriteJSONRaw(
+  const void *data,
+  size_t size,
+  uint8_t bigEndian,
+  const cNBTJSONOptions *options,
+  cNBTSinkFn sink,
+  void *userData);
+
+//-----------------------------------------------------------------------------
+// [SECTION] CLONE, COMPARISON AND HASHING
+//-----------------------------------------------------------------------------
+
+// Deep copy an NBT object, including its key. The copy is an independent node.
+//
+// When `arena` is not NULL, all nodes, keys and payloads of the copy are
+// allocated from the arena. Such trees are released with cNBT_DeleteArena();
+// cNBT_Delete() only frees the memory attached to them by later
+// modifications.
+cNBT_ATTR cNBT *cNBT_API cNBT_Clone(
+  const cNBT *nbt, cNBTArena *arena);
+
+// Compare two NBT objects structurally. Objects are compared as maps, so the
+// order of their items doesn't matter, while the order of list elements does.
+// Items sharing a key are compared as multisets. Floating point values are
+// compared bitwise. The keys of `a` and `b` themselves are ignored. Returns 0
+// when comparing objects with many items runs out of memory.
+cNBT_ATTR uint8_t cNBT_API cNBT_Equal(
+  const cNBT *a, const cNBT *b);
+
+// Compute a 64-bit structural hash of an NBT object, consistent with
+// cNBT_Equal(). The hash only depends on the content, so it's stable across
+// runs, processes and platforms. The key of `nbt` itself is ignored.
+cNBT_ATTR uint64_t cNBT_API cNBT_Hash(
+  const cNBT *nbt);
+
+//-----------------------------------------------------------------------------
+// [SECTION] DIFF AND PATCH
+//-----------------------------------------------------------------------------
+
+// Compute a binary patch which turns `oldNbt` into `newNbt`. The patch records
+// the added, removed and changed paths, and the new values are stored in the
+// given endianness. Objects are compared as maps, list elements by position.
+// Returns NULL when the memory can't be allocated. Free the result with
+// cNBT_Free().
+cNBT_ATTR const void *cNBT_API cNBT_Diff(
+  const cNBT *oldNbt, const cNBT *newNbt, uint8_t bigEndian, size_t *length);
+
+// Apply a patch created by cNBT_Diff() to an NBT object in place. Returns NULL
+// if the patch is malformed or doesn't match the object, which may be
+// partially patched in that case.
+cNBT_ATTR cNBT *cNBT_API cNBT_ApplyPatch(
+  cNBT *nbt, const void *patch, size_t size);
+
+// Apply a patch to binary NBT data, without building cNBT objects. Unchanged
+// items are copied as is. Returns the patched data in the same endianness, or
+// NULL if the data or the patch is malformed, or they don't match. Free the
+// result with cNBT_Free().
+cNBT_ATTR const void *cNBT_API cNBT_ApplyPatchRaw(
+  const void *data,
+  size_t size,
+  uint8_t bigEndian,
+  const void *patch,
+  size_t patchSize,
+  size_t *length);
+
+//-----------------------------------------------------------------------------
+// [SECTION] OFFSET INDEX
+//-----------------------------------------------------------------------------
+
+// Location of a payload in binary NBT data.
+typedef struct {
+  // Offset of the payload from the beginning of the data, or SIZE_MAX if the
+  // path was not found.
+  size_t offset;
+  // Type of the payload.
+  uint8_t type;
+  // Length of string payloads, or element count of array payloads.
+  int32_t length;
+} cNBTOffset;
+
+// Find the payloads of several paths in binary NBT data in a single scan.
+//
+// Paths are relative to the root tag: keys are separated by '.', and list
+// elements are selected by "[index]", e.g. "Inventory[3].Count". A backslash
+// escapes the next character of a key. An empty path matches the root tag.
+//
+// The results stay valid while the layout of the data isn't changed, so they
+// can be used with the functions below for in-place access. Returns 0 if the
+// data is malformed or the memory can't be allocated.
+cNBT_ATTR uint8_t cNBT_API cNBT_IndexOffsets(
+  const void *data,
+  size_t size,
+  uint8_t bigEndian,
+  const char *const *paths,
+  size_t count,
+  cNBTOffset *offsets);
+
+// Read or overwrite an integer payload (cNBT_I08 to cNBT_I64) in place. The
+// setter fails if the value doesn't fit in the payload.
+cNBT_ATTR uint8_t cNBT_API cNBT_GetRawInt(
+  const void *data, uint8_t bigEndian, const cNBTOffset *offset, int64_t *value);
+cNBT_ATTR uint8_t cNBT_API cNBT_SetRawInt(
+  void *data, uint8_t bigEndian, const cNBTOffset *offset, int64_t value);
+
+// Read or overwrite a floating point payload (cNBT_F32 or cNBT_F64) in place.
+cNBT_ATTR uint8_t cNBT_API cNBT_GetRawFloat(
+  const void *data, uint8_t bigEndian, const cNBTOffset *offset, double *value);
+cNBT_ATTR uint8_t cNBT_API cNBT_SetRawFloat(
+  void *data, uint8_t bigEndian, const cNBTOffset *offset, double value);
+
+// Read or overwrite an element of an array payload in place. The setter fails
+// if the value doesn't fit in the element.
+cNBT_ATTR uint8_t cNBT_API cNBT_GetRawArrayElement(
+  const void *data,
+  uint8_t bigEndian,
+  const cNBTOffset *offset,
+  int32_t index,
+  int64_t *value);
+cNBT_ATTR uint8_t cNBT_API cNBT_SetRawArrayElement(
+  void *data,
+  uint8_t bigEndian,
+  const cNBTOffset *offset,
+  int32_t index,
+  int64_t value);
+
+//-----------------------------------------------------------------------------
+// [SECTION] PROFILING
+//-----------------------------------------------------------------------------
+
+// Items nested deeper than this are counted in the last depth entry.
+#define cNBT_PROFILE_DEPTHS 16
+
+typedef struct {
+  uint64_t count;
+  uint64_t bytes;
+  // Time including and excluding nested items, in timer ticks.
+  uint64_t ticks;
+  uint64_t selfTicks;
+} cNBTProfileCounter;
+
+typedef struct {
+  // Items read by cNBT_Parse() and written by cNBT_Write(), indexed by type.
+  cNBTProfileCounter parseTypes[cNBT_A64 + 1];
+  cNBTProfileCounter writeTypes[cNBT_A64 + 1];
+  // The same items, indexed by nesting depth.
+  cNBTProfileCounter parseDepths[cNBT_PROFILE_DEPTHS];
+  cNBTProfileCounter writeDepths[cNBT_PROFILE_DEPTHS];
+  // Calls to the allocator functions. Calls to the realloc function are
+  // counted as allocations.
+  cNBTProfileCounter alloc;
+  cNBTProfileCounter free;
+  uint64_t parses;
+  uint64_t writes;
+  // Frequency of the timer. Ticks are CPU cycles on x86, nanoseconds
+  // elsewhere.
+  uint64_t ticksPerSecond;
+} cNBTProfile;
+
+// Get a snapshot of the profile counters. Returns 0 and zeroes `profile` if
+// cNBT is not compiled with cNBT_ENABLE_PROFILING. Counters of a parse or write
+// are added when the call returns.
+cNBT_ATTR uint8_t cNBT_API cNBT_GetProfile(
+  cNBTProfile *profile);
+
+// Reset the profile counters.
+cNBT_ATTR void cNBT_API cNBT_ResetProfile(void);
+
+//-----------------------------------------------------------------------------
+// [SECTION] PACKED ARRAYS
+//-----------------------------------------------------------------------------
+
+// Layouts of indices packed in cNBT_A64 arrays, such as block states and
+// heightmaps. Indices are stored from the least significant bit of each long.
+//
+// Indices are packed continuously and may span two longs (before Minecraft
+// 1.16).
+#define cNBT_PACKED_SPANNING 0
+// Each long holds 64 / bits indices, and the remaining high bits are unused
+// (Minecraft 1.16 and later).
+#define cNBT_PACKED_ALIGNED 1
+
+// Number of longs needed to pack `count` indices of `bits` bits, or -1 if the
+// arguments are invalid. `bits` must be between 1 and 16.
+cNBT_ATTR int32_t cNBT_API cNBT_PackedLength(
+  size_t count,
+  uint8_t bits,
+  uint8_t layout);
+
+// Unpack `count` indices of `bits` bits from an array node of type cNBT_A64.
+// Array views are decoded on the fly. Returns 0 if the array is too short or
+// the arguments are invalid.
+cNBT_ATTR uint8_t cNBT_API cNBT_UnpackIndices(
+  const cNBT *nbt,
+  uint16_t *output,
+  size_t count,
+  uint8_t bits,
+  uint8_t layout);
+
+// Pack `count` indices of `bits` bits into an array node of type cNBT_A64,
+// replacing its value. Higher bits of the indices are ignored.
+cNBT_ATTR cNBT *cNBT_API cNBT_PackIndices(
+  cNBT *nbt,
+  const uint16_t *input,
+  size_t count,
+  uint8_t bits,
+  uint8_t layout);
+
+//-----------------------------------------------------------------------------
+// [SECTION] SCHEMAS
+//-----------------------------------------------------------------------------
+
+// Decode binary NBT objects straight into C structs, and encode them back,
+// without building cNBT trees. A schema describes the members of a struct as
+// an array of fields, and is compiled once with cNBT_CompileSchema().
+//
+// Members have the following C types:
+// - cNBT_I08 to cNBT_F64: int8_t, int16_t, int32_t, int64_t, float, double.
+// - cNBT_STR: char *, zero terminated.
+// - cNBT_A08, cNBT_A32, cNBT_A64: cNBTSchemaArray of the elements.
+// - cNBT_LST: cNBTSchemaArray of the elements, which have the C types above.
+//   Lists of lists and lists of arrays are not supported.
+// - cNBT_OBJ: the struct described by `fields`, embedded in the outer one.
+// Strings and arrays are allocated with the cNBT allocators, and freed by
+// cNBT_ReleaseStruct().
+
+typedef struct {
+  void *data;
+  int32_t length;
+} cNBTSchemaArray;
+
+// Decoding fails if the field is missing.
+#define cNBT_FIELD_REQUIRED 0x01
+
+typedef struct cNBTSchemaField_t {
+  const char *key;
+  // Tag type of the field. Decoding fails if the item has another type.
+  uint8_t type;
+  // Type of the elements of cNBT_LST fields.
+  uint8_t elementType;
+  // Combination of cNBT_FIELD_* flags.
+  uint8_t flags;
+  // Offset of the member in the struct, see offsetof().
+  size_t offset;
+  // Fields of the embedded struct of cNBT_OBJ fields, or of the elements of
+  // lists of objects.
+  const struct cNBTSchemaField_t *fields;
+  size_t fieldCount;
+  // Size of the elements of lists of objects.
+  size_t elementSize;
+  // Value of missing scalar and string fields. Other missing fields are zeroed.
+  cNBTPayload defaultValue;
+} cNBTSchemaField;
+
+typedef struct cNBTSchema_t cNBTSchema;
+
+// Compile a schema from its fields, nested fields included. The fields are
+// not referenced by the result. Returns NULL if a field is invalid.
+cNBT_ATTR cNBTSchema *cNBT_API cNBT_CompileSchema(
+  const cNBTSchemaField *fields,
+  size_t fieldCount);
+
+// Free a compiled schema.
+cNBT_ATTR void cNBT_API cNBT_FreeSchema(
+  cNBTSchema *schema);
+
+// Decode a binary NBT object into `object`. Keys without a field are skipped.
+// All members described by the schema are written, missing ones with their
+// defaults. Returns 0 if the data is truncated, malformed or doesn't match the
+// schema, in which case `object` holds no allocated member.
+cNBT_ATTR uint8_t cNBT_API cNBT_DecodeStruct(
+  const cNBTSchema *schema,
+  const void *data,
+  size_t size,
+  uint8_t bigEndian,
+  void *object);
+
+// Free the strings and arrays of a struct decoded by cNBT_DecodeStruct(), and
+// zero the pointers.
+cNBT_ATTR void cNBT_API cNBT_ReleaseStruct(
+  const cNBTSchema *schema,
+  void *object);
+
+// Encode a struct as an unnamed binary NBT object, with its items in the
+// order of the fields. NULL strings are written as empty strings, and empty
+// lists with the element type cNBT_END. Returns a buffer like cNBT_Write().
+cNBT_ATTR const void *cNBT_API cNBT_EncodeStruct(
+  const cNBTSchema *schema,
+  const void *object,
+  size_t initialCapacity,
+  uint8_t bigEndian,
+  size_t *length);
+
+//-----------------------------------------------------------------------------
+// [SECTION] SHAPES
+//-----------------------------------------------------------------------------
+
+// The shape of an object is the sequence of the types and keys of its items,
+// with the element types of its lists. Objects parsed with a shape cache are
+// checked against the shape predicted from the previous objects found at the
+// same place, such as the previous element of a list, by comparing the bytes
+// of each type and key. Matching objects share the keys of the shape instead
+// of allocating them, and new shapes are learned when the prediction fails.
+//
+// Shaped objects with more than a few items get a table of their children by
+// slot, the index of an item in the shape, so lookups by key hash the key once
+// and don't walk the children. Adding, removing or replacing children drops
+// the shape.
+
+struct cNBTShape_t;
+typedef struct cNBTShape_t cNBTShape;
+
+// Create a shape cache holding up to `maxShapes` shapes, 0 for 4096. Objects
+// with more than 256 items aren't shaped. A cache must not be used by several
+// parsers at the same time.
+cNBT_ATTR cNBTShapeCache *cNBT_API cNBT_CreateShapeCache(
+  uint32_t maxShapes);
+
+// Free a shape cache and its shapes. The trees parsed with it borrow their
+// keys from the shapes, so they must be deleted first.
+cNBT_ATTR void cNBT_API cNBT_DeleteShapeCache(
+  cNBTShapeCache *cache);
+
+// Number of shapes learned by a cache.
+cNBT_ATTR uint32_t cNBT_API cNBT_GetShapeCount(
+  const cNBTShapeCache *cache);
+
+// Get the shape of an object, or NULL if it isn't shaped.
+cNBT_ATTR const cNBTShape *cNBT_API cNBT_GetShape(
+  const cNBT *nbt);
+
+// Number of slots of a shape.
+cNBT_ATTR uint32_t cNBT_API cNBT_GetShapeLength(
+  const cNBTShape *shape);
+
+// Find the slot of a key in a shape. Returns -1 if the key isn't in the
+// shape. Slots can be looked up once, and used with every object of the
+// shape.
+cNBT_ATTR int32_t cNBT_API cNBT_GetShapeSlot(
+  const cNBTShape *shape,
+  const char *key);
+
+// Get the item of a shaped object at a slot of its shape. Returns NULL if the
+// object isn't shaped or the slot is out of range.
+cNBT_ATTR cNBT *cNBT_API cNBT_GetNodeBySlot(
+  const cNBT *nbt,
+  uint32_t slot);
+
+//-----------------------------------------------------------------------------
+// [SECTION] SNAPSHOTS
+//-----------------------------------------------------------------------------
+
+// A snapshot is a read-only view of a tree at the time it was taken, which can
+// be written or exported by other threads while the tree is modified. Taking a
+// snapshot doesn't copy the tree: the chains of items are reference-counted
+// and shared between the snapshot and the tree.
+//
+// Modifying a shared item with the cNBT_SetValue*() functions, cNBT_AddNode(),
+// cNBT_RemoveNode(), cNBT_Clear(), cNBT_SetListElementType(),
+// cNBT_PackIndices() or cNBT_ApplyPatch() first copies the chains on the path
+// from the root to the item, the children of the copied items stay shared.
+// These functions then return the copy, and the items previously looked up
+// below the root in the copied chains belong to the snapshots: use the
+// returned items, or look them up again from the root. Other functions
+// modifying items, and direct modifications of their fields, need an item
+// returned by cNBT_Unshare().
+//
+// The tree must be modified by one thread at a time, which also takes the
+// snapshots. Snapshots are never modified, and can be read and released by
+// any thread; with compilers other than GCC and Clang, they must be released
+// by the thread modifying the tree. The `parent` pointers of the items of a
+// snapshot are meaningless, and trees allocated from an arena must outlive
+// their snapshots.
+
+// Take a snapshot of a tree, or of a subtree. Only the given item is copied.
+// Release it with cNBT_ReleaseSnapshot().
+cNBT_ATTR const cNBT *cNBT_API cNBT_Snapshot(
+  cNBT *nbt);
+
+// Release a snapshot taken with cNBT_Snapshot(). The items no longer shared
+// with the tree or with other snapshots are freed.
+cNBT_ATTR void cNBT_API cNBT_ReleaseSnapshot(
+  const cNBT *snapshot);
+
+// Check whether an item is shared with a snapshot, i.e. whether modifying it
+// copies it.
+cNBT_ATTR uint8_t cNBT_API cNBT_IsShared(
+  const cNBT *nbt);
+
+// Copy the chains on the path from the root to a shared item, and return the
+// copy of the item, which can be modified. Returns the item itself if it
+// isn't shared.
+cNBT_ATTR cNBT *cNBT_API cNBT_Unshare(
+  cNBT *nbt);
+
+//-----------------------------------------------------------------------------
+// [SECTION] FROZEN IMAGES
+//-----------------------------------------------------------------------------
+
+// Item of a frozen image, see cNBT_Freeze(). Passed by value, it's only a
+// position in the image. Missing items have a NULL `image`, and their type is
+// cNBT_END.
+typedef struct {
+  const void *image;
+  // Offsets of the item and of its key in the image, 0 for the key of list
+  // elements.
+  uint32_t item;
+  uint32_t key;
+} cNBTFrozen;
+
+// Convert a tree to a frozen image: an immutable, relocatable binary image in
+// the byte order of the host, read in place with the functions below without
+// parsing nor allocating. Objects have a hashed directory of their keys, so
+// items are found by key or index in constant time, and arrays are stored as
+// aligned native arrays. Identical keys are stored once. Images are limited
+// to 4 GiB. Free the image with cNBT_Free(). Returns NULL on failure.
+cNBT_ATTR void *cNBT_API cNBT_Freeze(
+  const cNBT *nbt,
+  size_t *length);
+
+// Check the header of a frozen image and get its root item. The image must be
+// 8-byte aligned, such as the data of cNBT_Freeze() or cNBT_MapFile(), and
+// stay valid while its items are used. Images frozen on a host of the other
+// byte order are rejected. Returns 0 if the data isn't a frozen image.
+cNBT_ATTR uint8_t cNBT_API cNBT_OpenFrozen(
+  const void *image,
+  size_t size,
+  cNBTFrozen *root);
+
+// Map a file into memory read-only, e.g. a frozen image saved with fwrite().
+// Falls back to reading the file on platforms without mmap() or
+// MapViewOfFile(). Returns NULL on failure. Release it with cNBT_UnmapFile().
+cNBT_ATTR const void *cNBT_API cNBT_MapFile(
+  const char *path,
+  size_t *size);
+cNBT_ATTR void cNBT_API cNBT_UnmapFile(
+  const void *data,
+  size_t size);
+
+// Get the type of a frozen item, or cNBT_END if it's missing.
+cNBT_ATTR uint8_t cNBT_API cNBT_FrozenType(
+  cNBTFrozen item);
+
+// Get the key of a frozen item, or NULL for list elements and for keys that
+// aren't null-terminated inside the image.
+cNBT_ATTR const char *cNBT_API cNBT_FrozenKey(
+  cNBTFrozen item);
+
+// Get the number of items of a list or object, of elements of an array, or of
+// bytes of a string.
+cNBT_ATTR int32_t cNBT_API cNBT_FrozenLength(
+  cNBTFrozen item);
+
+// Get the element type of a list.
+cNBT_ATTR uint8_t cNBT_API cNBT_FrozenElementType(
+  cNBTFrozen list);
+
+// Find the item of an object matching the given key, in constant time.
+cNBT_ATTR cNBTFrozen cNBT_API cNBT_FrozenGet(
+  cNBTFrozen object,
+  const char *key);
+
+// Get the item of a list or object with the given index, in constant time.
+cNBT_ATTR cNBTFrozen cNBT_API cNBT_FrozenAt(
+  cNBTFrozen nbt,
+  int32_t index);
+
+// Get the value of an integer item (cNBT_I08 to cNBT_I64), or 0.
+cNBT_ATTR int64_t cNBT_API cNBT_FrozenInt(
+  cNBTFrozen item);
+
+// Get the value of a floating point item, or 0.
+cNBT_ATTR double cNBT_API cNBT_FrozenFloat(
+  cNBTFrozen item);
+
+// Get the null-terminated bytes of a string item, or NULL if it isn't a string
+// or isn't null-terminated inside the image.
+cNBT_ATTR const char *cNBT_API cNBT_FrozenString(
+  cNBTFrozen item);
+
+// Get the elements of an array item, as int8_t, int32_t or int64_t in the
+// byte order of the host, or NULL. The length is given by cNBT_FrozenLength().
+cNBT_ATTR const void *cNBT_API cNBT_FrozenArray(
+  cNBTFrozen item);
+
+// Convert a frozen item back to a tree. Returns NULL on failure.
+cNBT_ATTR cNBT *cNBT_API cNBT_Thaw(
+  cNBTFrozen item);
+
+//-----------------------------------------------------------------------------
+// [SECTION] BUNDLES
+//-----------------------------------------------------------------------------
+
+// Builder of a bundle, an archive of many binary NBT documents sharing a
+// dictionary of their keys and strings. Each key or string is stored once,
+// and documents refer to it by index.
+struct cNBTBundleBuilder_t;
+typedef struct cNBTBundleBuilder_t cNBTBundleBuilder;
+
+// A bundle opened with cNBT_OpenBundle(), read in place.
+typedef struct {
+  const void *data;
+  size_t size;
+  uint32_t stringCount;
+  uint32_t documentCount;
+} cNBTBundle;
+
+// Create an empty bundle builder. Returns NULL on failure.
+cNBT_ATTR cNBTBundleBuilder *cNBT_API cNBT_CreateBundleBuilder(void);
+
+// Add a binary NBT document to a bundle. Its index is the number of documents
+// added before. Returns 0 if the data is malformed.
+cNBT_ATTR uint8_t cNBT_API cNBT_BundleAdd(
+  cNBTBundleBuilder *builder,
+  const void *data,
+  size_t size,
+  uint8_t bigEndian);
+
+// Serialize the documents added so far to a bundle. Free it with cNBT_Free().
+// Bundles are little-endian, and can be read on any host.
+cNBT_ATTR void *cNBT_API cNBT_WriteBundle(
+  cNBTBundleBuilder *builder,
+  size_t *length);
+
+cNBT_ATTR void cNBT_API cNBT_DeleteBundleBuilder(
+  cNBTBundleBuilder *builder);
+
+// Check the header and the tables of a bundle. The data must stay valid while
+// the bundle is used. Returns 0 if the data isn't a bundle.
+cNBT_ATTR uint8_t cNBT_API cNBT_OpenBundle(
+  const void *data,
+  size_t size,
+  cNBTBundle *bundle);
+
+// Convert a document of a bundle to binary NBT data, as written by
+// cNBT_Write(). Free it with cNBT_Free(). Returns NULL if the document is
+// malformed or out of range.
+cNBT_ATTR const void *cNBT_API cNBT_BundleExtract(
+  const cNBTBundle *bundle,
+  uint32_t index,
+  uint8_t bigEndian,
+  size_t *length);
+
+// Parse a document of a bundle into a tree, without converting it first. The
+// keys of the tree point to the dictionary of the bundle, so the bundle must
+// outlive the tree. Returns NULL if the document is malformed or out of range.
+cNBT_ATTR cNBT *cNBT_API cNBT_BundleParse(
+  const cNBTBundle *bundle,
+  uint32_t index);
+
+//-----------------------------------------------------------------------------
+// [SECTION] LOADER
+//-----------------------------------------------------------------------------
+
+// Loader of binary NBT files, reading and parsing them on a pool of worker
+// threads. Files are submitted by path, and their trees are returned in the
+// order they complete, so slow reads don't hold back the others. On Linux, the
+// files are read with io_uring by one more thread, keeping many reads in
+// flight, and only parsed by the workers.
+struct cNBTLoader_t;
+typedef struct cNBTLoader_t cNBTLoader;
+
+// Default number of workers of a loader. Workers mostly wait for reads, so
+// there can be more than processors.
+#define cNBT_LOADER_THREADS 8
+
+// The file was parsed.
+#define cNBT_LOAD_OK 0
+// The file can't be opened or read, or its buffer can't be allocated.
+#define cNBT_LOAD_READ_FAILED 1
+// The file is truncated or malformed, or its tree can't be allocated.
+#define cNBT_LOAD_PARSE_FAILED 2
+
+typedef struct {
+  // The tree of the file, or NULL on failure. Delete it with cNBT_Delete().
+  cNBT *nbt;
+  // The `userData` given to cNBT_LoaderSubmit().
+  void *userData;
+  // One of the cNBT_LOAD_* codes.
+  uint8_t error;
+  // The cNBT_PARSE_ERROR_* code of the parse, cNBT_PARSE_ERROR_NONE if the
+  // file wasn't parsed.
+  uint8_t parseError;
+} cNBTLoadResult;
+
+// Create a loader with the given number of workers, 0 for
+// cNBT_LOADER_THREADS. Files are read into buffers reused from one file to the
+// next, a pool of two per worker with io_uring or one per worker otherwise, so
+// the trees are always parsed with copies of their data:
+// cNBT_PARSE_TRACK_SOURCE and cNBT_PARSE_ARRAY_VIEWS are ignored, as are
+// `shapes`, `dedupStats` and `error`, the error code of each file being
+// returned in its cNBTLoadResult. `options` can be NULL. Without threads,
+// files are loaded by cNBT_LoaderSubmit() itself. Returns NULL on failure.
+cNBT_ATTR cNBTLoader *cNBT_API cNBT_CreateLoader(
+  uint32_t threads,
+  uint8_t bigEndian,
+  const cNBTParseOptions *options);
+
+// Queue a file to load. The path is copied. Returns 0 on failure.
+cNBT_ATTR uint8_t cNBT_API cNBT_LoaderSubmit(
+  cNBTLoader *loader,
+  const char *path,
+  void *userData);
+
+// Get the result of a loaded file. If none is ready and `wait` is set, wait
+// until one is, as long as files are still being loaded. Returns 0 if no
+// result was returned, so that all the results are drained with:
+//
+//   while (cNBT_LoaderNext(loader, &result, 1)) ...
+cNBT_ATTR uint8_t cNBT_API cNBT_LoaderNext(
+  cNBTLoader *loader,
+  cNBTLoadResult *result,
+  uint8_t wait);
+
+// Cancel the queued files, wait for the ones being loaded, and delete the
+// loader with the trees of the results not returned yet.
+cNBT_ATTR void cNBT_API cNBT_DeleteLoader(
+  cNBTLoader *loader);
+
 #ifdef __cplusplus
 }
 #endif
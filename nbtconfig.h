@@ -16,4 +16,32 @@
 // linking them. cNBT_SetAllocators() need to be called to set allocators.
 //#define cNBT_DISABLE_DEFAULT_ALLOCATORS
 
+// Maximum nesting level of lists and objects accepted when reading binary
+// data. Deeper data is rejected as malformed. Defaults to 512.
+//#define cNBT_MAX_DEPTH 512
+
+// Count allocations, frees and live bytes per category, see
+// cNBT_GetMemoryStats(). Each allocation gets a 16-byte header.
+//#define cNBT_ENABLE_MEMORY_STATS
+
+// Record count, bytes and time of each item read and written per type and per
+// depth, see cNBT_GetProfile(). Adds two timer reads per item.
+//#define cNBT_ENABLE_PROFILING
+
+// Don't use threads. cNBT_DeleteAsync() then frees objects synchronously, and
+// loaders load files in cNBT_LoaderSubmit().
+//#define cNBT_DISABLE_THREADS
+
+// Don't read the files of loaders with io_uring on Linux, each worker then
+// reads its files with stdio like on other systems.
+//#define cNBT_DISABLE_URING
+
+// Dispatch on tag types with a switch even if the compiler supports computed
+// goto (GCC and Clang).
+//#define cNBT_DISABLE_COMPUTED_GOTO
+
+// Don't use the AVX2 kernels of cNBT_UnpackIndices() and cNBT_PackIndices()
+// on x86, even if the CPU supports them.
+//#define cNBT_DISABLE_SIMD
+
 #endif
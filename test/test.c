@@ -0,0 +1,2276 @@
+// cNBT behaviour tests.
+//
+// Each test builds its input in memory, so no fixture files are needed. Tests
+// of malformed input run the library on corrupted data; build with
+// `make test` so AddressSanitizer reports any out of bounds access.
+//
+// Prints one line per test and exits with a nonzero status if any failed.
+//
+// Usage: test [name...]
+
+#include <limits.h>
+#include <locale.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../nbt.h"
+
+//-----------------------------------------------------------------------------
+// [SECTION] HELPERS
+//-----------------------------------------------------------------------------
+
+static int gFailures = 0;
+
+#ifdef __SANITIZE_ADDRESS__
+// Also catch pointers to the stack of returned functions, e.g. kept in
+// options.
+const char *__asan_default_options(void) {
+  return "detect_stack_use_after_return=1";
+}
+#endif
+
+#define Test_Check(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #condition); \
+      gFailures++; \
+    } \
+  } while (0)
+
+// Number of allocations left before the allocator fails, or -1.
+static long gAllocationsLeft = -1;
+
+static void *cNBT_API Test_Alloc(size_t size, void *userData) {
+  (void)userData;
+  if (!gAllocationsLeft)
+    return cNBT_NULLPTR;
+  if (gAllocationsLeft > 0)
+    gAllocationsLeft--;
+  return malloc(size);
+}
+
+// Pointers freed by Test_Free().
+static size_t gFreed = 0;
+
+static void cNBT_API Test_Free(void *ptr, void *userData) {
+  (void)userData;
+  if (ptr)
+    gFreed++;
+  free(ptr);
+}
+
+// Number of reallocations left before growing the output of writers fails,
+// or -1.
+static long gReallocationsLeft = -1;
+
+static void *cNBT_API Test_Realloc(void *ptr, size_t size, void *userData) {
+  (void)userData;
+  if (!gReallocationsLeft)
+    return cNBT_NULLPTR;
+  if (gReallocationsLeft > 0)
+    gReallocationsLeft--;
+  return realloc(ptr, size);
+}
+
+// Pointers and batches freed by Test_FreeMany().
+static size_t gFreedMany = 0;
+static size_t gFreeManyCalls = 0;
+
+static void cNBT_API Test_FreeMany(void **ptrs, size_t count, void *userData) {
+  (void)userData;
+  gFreedMany += count;
+  gFreeManyCalls++;
+  for (size_t i = 0; i < count; i++)
+    free(ptrs[i]);
+}
+
+static cNBT *Test_Add(cNBT *parent, uint8_t type, const char *key) {
+  cNBT *item = cNBT_CreateNode(type);
+  cNBT_AddNode(parent, item, key);
+  return item;
+}
+
+static cNBT *Test_AddList(cNBT *parent, uint8_t elementType, const char *key) {
+  cNBT *item = Test_Add(parent, cNBT_LST, key);
+  cNBT_SetListElementType(item, elementType);
+  return item;
+}
+
+#define Test_AddI32(p, k, v) cNBT_SetValueI32(Test_Add(p, cNBT_I32, k), v)
+#define Test_AddF64(p, k, v) cNBT_SetValueF64(Test_Add(p, cNBT_F64, k), v)
+#define Test_AddStr(p, k, v) cNBT_SetValueString(Test_Add(p, cNBT_STR, k), v, 0)
+
+typedef struct {
+  char data[4096];
+  size_t length;
+} TestText;
+
+static uint8_t cNBT_API Test_Sink(const void *data, size_t length, void *userData) {
+  TestText *text = userData;
+
+  if (text->length + length >= sizeof(text->data))
+    return 0;
+  memcpy(text->data + text->length, data, length);
+  text->length += length;
+  text->data[text->length] = '\0';
+  return 1;
+}
+
+// Export a tree and the binary data written from it as JSON, and check both
+// exports match `expected`.
+static void Test_CheckJSON(cNBT *nbt, uint32_t flags, const char *expected) {
+  cNBTJSONOptions options = { flags, 0 };
+  TestText tree = { "", 0 }, raw = { "", 0 };
+  size_t length;
+  const void *data = cNBT_Write(nbt, 0, 1, &length);
+
+  Test_Check(cNBT_WriteJSON(nbt, &options, Test_Sink, &tree));
+  Test_Check(!strcmp(tree.data, expected));
+  Test_Check(data && cNBT_WriteJSONRaw(data, length, 1, &options, Test_Sink, &raw));
+  Test_Check(!strcmp(raw.data, expected));
+  if (strcmp(tree.data, expected))
+    fprintf(stderr, "  got %s\n  expected %s\n", tree.data, expected);
+  cNBT_Free((void *)data);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] PARSER
+//-----------------------------------------------------------------------------
+
+// Nodes: root, "deep" and its 3 nested objects, the list and its 4 elements,
+// "name" and "array".
+#define Test_PARSE_NODES 12
+
+static const void *Test_MakeParseData(size_t *length) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ), *deep = root;
+  cNBT *list = Test_AddList(root, cNBT_I32, "list");
+  int32_t array[100] = { 0 };
+  const void *result;
+
+  for (int i = 0; i < 4; i++)
+    deep = Test_Add(deep, cNBT_OBJ, "deep");
+  for (int i = 0; i < 4; i++)
+    Test_AddI32(list, cNBT_NULLPTR, i);
+  Test_AddStr(root, "name", "0123456789012345678901234567890123456789");
+  cNBT_SetValueArray(Test_Add(root, cNBT_A32, "array"), array, 100);
+
+  result = cNBT_Write(root, 0, 1, length);
+  cNBT_Delete(root);
+  return result;
+}
+
+// Parse with the given options, and check the error code.
+static void Test_CheckParse(const void *data, size_t length, cNBTParseOptions options, uint8_t expected) {
+  uint8_t error = 0xFF;
+  cNBT *result;
+
+  options.error = &error;
+  result = cNBT_ParseEx(data, length, 1, &options);
+  Test_Check(error == expected);
+  Test_Check(!result == (expected != cNBT_PARSE_ERROR_NONE));
+  if (error != expected)
+    fprintf(stderr, "  got error %d, expected %d\n", error, expected);
+  cNBT_Delete(result);
+}
+
+static void Test_ParseBudgets(void) {
+  size_t length;
+  const void *data = Test_MakeParseData(&length);
+  cNBTParseOptions options = { 0 };
+
+  Test_Check(data);
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_NONE);
+
+  options.maxDepth = 5;
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_NONE);
+  options.maxDepth = 4;
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_DEPTH);
+  options.maxDepth = 0;
+
+  options.maxNodes = Test_PARSE_NODES;
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_NONE);
+  options.maxNodes = Test_PARSE_NODES - 1;
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_NODES);
+  options.maxNodes = 0;
+
+  options.maxArrayLength = 100;
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_NONE);
+  options.maxArrayLength = 99;
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_ARRAY_LENGTH);
+  options.maxArrayLength = 0;
+
+  options.maxStringLength = 40;
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_NONE);
+  options.maxStringLength = 39;
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_STRING_LENGTH);
+  options.maxStringLength = 0;
+
+  // The array alone takes 400 bytes.
+  options.maxBytes = 1 << 20;
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_NONE);
+  options.maxBytes = 400;
+  Test_CheckParse(data, length, options, cNBT_PARSE_ERROR_BYTES);
+
+  cNBT_Free(data);
+}
+
+static void Test_ParseTruncated(void) {
+  size_t length;
+  const void *data = Test_MakeParseData(&length);
+  cNBTParseOptions options = { 0 };
+
+  for (size_t i = 0; data && i < length; i++) {
+    // Copied so reading past the truncated data is caught.
+    uint8_t *truncated = malloc(i ? i : 1);
+
+    memcpy(truncated, data, i);
+    Test_CheckParse(truncated, i, options, cNBT_PARSE_ERROR_MALFORMED);
+    free(truncated);
+  }
+
+  cNBT_Free(data);
+}
+
+static void Test_ParseOversizedList(void) {
+  // A list of 2^31 - 1 objects, rejected from its header.
+  static const uint8_t header[] = {
+    cNBT_OBJ, 0, 0,
+    cNBT_LST, 0, 1, 'l', cNBT_OBJ, 0x7F, 0xFF, 0xFF, 0xFF
+  };
+  uint8_t data[sizeof(header) + 2000 + 1] = { 0 };
+  cNBTParseOptions options = { 0 };
+
+  memcpy(data, header, sizeof(header));
+  Test_CheckParse(data, sizeof(data), options, cNBT_PARSE_ERROR_MALFORMED);
+
+  // 2000 empty objects, which fit in the data but not in the budget.
+  data[sizeof(header) - 4] = 0;
+  data[sizeof(header) - 3] = 0;
+  data[sizeof(header) - 2] = 2000 >> 8;
+  data[sizeof(header) - 1] = 2000 & 0xFF;
+  Test_CheckParse(data, sizeof(data), options, cNBT_PARSE_ERROR_NONE);
+  options.maxNodes = 1000;
+  Test_CheckParse(data, sizeof(data), options, cNBT_PARSE_ERROR_NODES);
+}
+
+static void Test_ParseOutOfMemory(void) {
+  size_t length;
+  const void *data = Test_MakeParseData(&length);
+  cNBTParseOptions options = { 0 };
+  long n = 0;
+
+  for (; data && n < 256; n++) {
+    uint8_t error = 0xFF;
+    cNBT *result;
+
+    options.error = &error;
+    gAllocationsLeft = n;
+    result = cNBT_ParseEx(data, length, 1, &options);
+    gAllocationsLeft = -1;
+
+    Test_Check(result ? error == cNBT_PARSE_ERROR_NONE : error == cNBT_PARSE_ERROR_NO_MEMORY);
+    cNBT_Delete(result);
+    if (result)
+      break;
+  }
+  Test_Check(n > 0 && n < 256);
+
+  cNBT_Free(data);
+}
+
+static void Test_ArrayViews(void) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ), *nbt, *clone, *ints, *longs;
+  cNBTParseOptions options = { .flags = cNBT_PARSE_ARRAY_VIEWS };
+  int8_t bytes[10];
+  int32_t values[100];
+  int64_t wide[50];
+  size_t length, outputLength;
+  const void *data, *output;
+  uint8_t *source;
+
+  for (int i = 0; i < 10; i++)
+    bytes[i] = (int8_t)(i - 5);
+  for (int i = 0; i < 100; i++)
+    values[i] = i * 3 - 50;
+  for (int i = 0; i < 50; i++)
+    wide[i] = -((int64_t)i << 40);
+  cNBT_SetValueArray(Test_Add(root, cNBT_A08, "bytes"), bytes, 10);
+  cNBT_SetValueArray(Test_Add(root, cNBT_A32, "ints"), values, 100);
+  cNBT_SetValueArray(Test_Add(Test_Add(Test_AddList(root, cNBT_OBJ, "list"), cNBT_OBJ, cNBT_NULLPTR), cNBT_A64, "longs"), wide, 50);
+  data = cNBT_Write(root, 0, 1, &length);
+  source = data ? malloc(length) : cNBT_NULLPTR;
+  Test_Check(data && source);
+  if (!source)
+    goto done;
+  memcpy(source, data, length);
+
+  nbt = cNBT_ParseEx(source, length, 1, &options);
+  Test_Check(nbt);
+  if (!nbt)
+    goto done;
+  ints = cNBT_GetNodeByKey(nbt, "ints");
+  longs = cNBT_GetNodeByKey(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(nbt, "list"), 0), "longs");
+
+  // The arrays point into the source data, decoded on read.
+  Test_Check(ints->flags & cNBT_FLAG_ARRAY_VIEW && ints->flags & cNBT_FLAG_BORROWED_VALUE);
+  Test_Check((uint8_t *)ints->value.valueArray > source && (uint8_t *)ints->value.valueArray < source + length);
+  Test_Check(longs && longs->flags & cNBT_FLAG_ARRAY_VIEW);
+  Test_Check(cNBT_GetArrayLength(ints) == 100 && cNBT_GetArrayElementI32(ints, 99) == 99 * 3 - 50);
+  Test_Check(!cNBT_GetArrayElementI32(ints, 100) && !cNBT_GetArrayElementI32(ints, -1));
+  Test_Check(cNBT_GetArrayElementI08(cNBT_GetNodeByKey(nbt, "bytes"), 0) == -5);
+  Test_Check(longs && cNBT_GetArrayElementI64(longs, 49) == wide[49]);
+  Test_Check(!cNBT_GetArrayElementI64(ints, 0));
+
+  // Clones own decoded copies.
+  clone = cNBT_Clone(nbt, cNBT_NULLPTR);
+  Test_Check(clone && cNBT_Equal(clone, root));
+  Test_Check(clone && !(cNBT_GetNodeByKey(clone, "ints")->flags & cNBT_FLAG_ARRAY_VIEW));
+
+  // Materialized arrays are owned and native.
+  Test_Check(cNBT_ArrayMaterialize(ints));
+  Test_Check(!(ints->flags & (cNBT_FLAG_ARRAY_VIEW | cNBT_FLAG_BORROWED_VALUE)));
+  Test_Check(!memcmp(ints->value.valueArray, values, sizeof(values)));
+  Test_Check(cNBT_ArrayMaterialize(ints) && cNBT_ArrayMaterialize(nbt));
+
+  // Once released, the tree outlives its source data.
+  cNBT_ReleaseSource(nbt);
+  Test_Check(!(cNBT_GetNodeByKey(nbt, "bytes")->flags & cNBT_FLAG_ARRAY_VIEW));
+  Test_Check(longs && !(longs->flags & cNBT_FLAG_ARRAY_VIEW));
+  memset(source, 0xCC, length);
+  free(source);
+  source = cNBT_NULLPTR;
+  Test_Check(longs && cNBT_GetArrayElementI64(longs, 49) == wide[49]);
+  Test_Check(cNBT_Equal(nbt, root) && cNBT_Equal(nbt, clone));
+  output = cNBT_Write(nbt, 0, 1, &outputLength);
+  Test_Check(output && outputLength == length && !memcmp(output, data, length));
+
+  cNBT_Free(output);
+  cNBT_Delete(clone);
+  cNBT_Delete(nbt);
+done:
+  free(source);
+  cNBT_Free(data);
+  cNBT_Delete(root);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] WRITER
+//-----------------------------------------------------------------------------
+
+static void Test_WriteOutOfMemory(void) {
+  size_t length, expectedLength;
+  const void *expected = Test_MakeParseData(&expectedLength);
+  cNBT *nbt = cNBT_Parse(expected, expectedLength, 1);
+  cNBTWriteSession *session = cNBT_CreateWriteSession(0);
+  const void *data;
+  long n = 0;
+
+  Test_Check(nbt && session);
+
+  // Every failed growth of the buffer fails the write as a whole.
+  for (; nbt && n < 64; n++) {
+    gReallocationsLeft = n;
+    data = cNBT_Write(nbt, 0, 1, &length);
+    gReallocationsLeft = -1;
+
+    Test_Check(!data || (length == expectedLength && !memcmp(data, expected, length)));
+    cNBT_Free(data);
+    if (data)
+      break;
+  }
+  Test_Check(n > 0 && n < 64);
+
+  for (n = 0; nbt && n < 64; n++) {
+    const cNBTSegment *segments;
+    size_t count, offset = 0;
+
+    gReallocationsLeft = n;
+    segments = cNBT_WriteV(nbt, 1, 0, &count, &length);
+    gReallocationsLeft = -1;
+
+    for (size_t i = 0; segments && i < count; i++) {
+      Test_Check(offset + segments[i].length <= expectedLength);
+      Test_Check(!memcmp((const uint8_t *)expected + offset, segments[i].data, segments[i].length));
+      offset += segments[i].length;
+    }
+    Test_Check(!segments || (length == expectedLength && offset == length));
+    cNBT_FreeSegments(segments);
+    if (segments)
+      break;
+  }
+  Test_Check(n > 0 && n < 64);
+
+  // A failed write of a session keeps the previous output, and the session
+  // can be written again.
+  data = session && nbt ? cNBT_SessionWrite(session, nbt, 1, &length) : cNBT_NULLPTR;
+  Test_Check(data && length == expectedLength);
+  gReallocationsLeft = 0;
+  Test_Check(session && nbt && !cNBT_SessionWrite(session, nbt, 1, &length));
+  gReallocationsLeft = -1;
+  data = cNBT_SessionData(session, &length);
+  Test_Check(data && length == expectedLength && !memcmp(data, expected, length));
+  data = session && nbt ? cNBT_SessionWrite(session, nbt, 1, &length) : cNBT_NULLPTR;
+  Test_Check(data && length == expectedLength && !memcmp(data, expected, length));
+  cNBT_SessionData(session, &length);
+  Test_Check(length == expectedLength * 2);
+
+  cNBT_DeleteWriteSession(session);
+  cNBT_Delete(nbt);
+  cNBT_Free(expected);
+}
+
+static void Test_WriteSourceSpans(void) {
+  size_t length, expectedLength, outputLength;
+  const void *data = Test_MakeParseData(&length);
+  uint8_t *source = malloc(length);
+  cNBTParseOptions options = { .flags = cNBT_PARSE_TRACK_SOURCE };
+  cNBT *nbt, *edited, *item;
+  const void *expected, *output;
+  size_t flipped;
+
+  Test_Check(data && source);
+  memcpy(source, data, length);
+  nbt = cNBT_ParseEx(source, length, 1, &options);
+  edited = cNBT_Parse(data, length, 1);
+  Test_Check(nbt && edited);
+  if (!nbt || !edited)
+    goto done;
+
+  // Every payload points into the source data, and nothing is dirty yet.
+  item = cNBT_GetNodeByKey(nbt, "array");
+  Test_Check(item && item->source && !(nbt->flags & cNBT_FLAG_DIRTY));
+  Test_Check((const uint8_t *)nbt->source > source && (const uint8_t *)nbt->source < source + length);
+  Test_Check(item->sourceLength == 4 + 100 * 4);
+
+  // Changed behind the back of the tree, so the untouched spans copied from
+  // the source data can be told from re-encoded ones.
+  flipped = (size_t)((const uint8_t *)item->source - source) + item->sourceLength - 1;
+  source[flipped] ^= 0x5A;
+
+  // One leaf edited in both trees, dirtying it and its ancestors only.
+  cNBT_SetValueI32(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(nbt, "list"), 2), 42);
+  cNBT_SetValueI32(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(edited, "list"), 2), 42);
+  Test_Check(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(nbt, "list"), 2)->flags & cNBT_FLAG_DIRTY);
+  Test_Check(cNBT_GetNodeByKey(nbt, "list")->flags & cNBT_FLAG_DIRTY);
+  Test_Check(nbt->flags & cNBT_FLAG_DIRTY);
+  Test_Check(!(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(nbt, "list"), 1)->flags & cNBT_FLAG_DIRTY));
+  Test_Check(!(cNBT_GetNodeByKey(nbt, "deep")->flags & cNBT_FLAG_DIRTY));
+  Test_Check(!(cNBT_GetNodeByKey(nbt, "name")->flags & cNBT_FLAG_DIRTY));
+  Test_Check(!(item->flags & cNBT_FLAG_DIRTY));
+
+  expected = cNBT_Write(edited, 0, 1, &expectedLength);
+  output = cNBT_Write(nbt, 0, 1, &outputLength);
+  Test_Check(expected && output && outputLength == expectedLength && expectedLength == length);
+  if (expected && output && outputLength == expectedLength && flipped < length) {
+    // The edit is encoded, and the untouched array is spliced from its source.
+    Test_Check(((const uint8_t *)output)[flipped] == (((const uint8_t *)expected)[flipped] ^ 0x5A));
+    Test_Check(!memcmp(output, expected, flipped));
+    Test_Check(!memcmp((const uint8_t *)output + flipped + 1, (const uint8_t *)expected + flipped + 1, length - flipped - 1));
+  }
+  cNBT_Free(output);
+  cNBT_Free(expected);
+
+  // The other byte order re-encodes everything.
+  expected = cNBT_Write(edited, 0, 0, &expectedLength);
+  output = cNBT_Write(nbt, 0, 0, &outputLength);
+  Test_Check(expected && output && outputLength == expectedLength && !memcmp(output, expected, outputLength));
+  cNBT_Free(output);
+  cNBT_Free(expected);
+
+  // So does a tree detached from its source.
+  cNBT_ReleaseSource(nbt);
+  Test_Check(!item->source);
+  expected = cNBT_Write(edited, 0, 1, &expectedLength);
+  output = cNBT_Write(nbt, 0, 1, &outputLength);
+  Test_Check(expected && output && outputLength == expectedLength && !memcmp(output, expected, outputLength));
+  cNBT_Free(output);
+  cNBT_Free(expected);
+
+done:
+  cNBT_Delete(edited);
+  cNBT_Delete(nbt);
+  free(source);
+  cNBT_Free(data);
+}
+
+// A tree with every type, nested lists, and arrays long enough for the
+// vectorized byte swaps, with a tail.
+static cNBT *Test_MakeTypesTree(void) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ), *lists = Test_AddList(root, cNBT_LST, "lists");
+  int8_t bytes[37];
+  int32_t ints[1003];
+  int64_t longs[501];
+
+  for (int i = 0; i < 37; i++)
+    bytes[i] = (int8_t)(i * 7);
+  for (int i = 0; i < 1003; i++)
+    ints[i] = (int32_t)((uint32_t)i * 0x01010101u - 0x12345678u);
+  for (int i = 0; i < 501; i++)
+    longs[i] = (int64_t)((uint64_t)i * 0x0102030405060708ULL);
+  cNBT_SetValueI08(Test_Add(root, cNBT_I08, "i08"), -2);
+  cNBT_SetValueI16(Test_Add(root, cNBT_I16, "i16"), 0x1234);
+  Test_AddI32(root, "i32", 0x01020304);
+  cNBT_SetValueI64(Test_Add(root, cNBT_I64, "i64"), -0x0102030405060708LL);
+  cNBT_SetValueF32(Test_Add(root, cNBT_F32, "f32"), -1.5f);
+  Test_AddF64(root, "f64", 1e300);
+  Test_AddStr(root, "str", "text");
+  cNBT_SetValueArray(Test_Add(root, cNBT_A08, "a08"), bytes, 37);
+  cNBT_SetValueArray(Test_Add(root, cNBT_A32, "a32"), ints, 1003);
+  cNBT_SetValueArray(Test_Add(root, cNBT_A64, "a64"), longs, 501);
+  for (int i = 0; i < 3; i++) {
+    cNBT *list = Test_AddList(lists, cNBT_I16, cNBT_NULLPTR);
+
+    for (int j = 0; j <= i; j++)
+      cNBT_SetValueI16(Test_Add(list, cNBT_I16, cNBT_NULLPTR), (int16_t)(j - 0x100));
+  }
+  for (int i = 0; i < 2; i++)
+    Test_AddF64(Test_Add(Test_AddList(root, cNBT_OBJ, i ? "objects" : "more"), cNBT_OBJ, cNBT_NULLPTR), "x", i + 0.25);
+
+  return root;
+}
+
+// Reverse the bytes of a field.
+static uint8_t Test_Swap(uint8_t *data, size_t length, size_t *offset, size_t size) {
+  if (*offset + size > length)
+    return 0;
+  for (size_t i = 0; i < size / 2; i++) {
+    uint8_t byte = data[*offset + i];
+
+    data[*offset + i] = data[*offset + size - 1 - i];
+    data[*offset + size - 1 - i] = byte;
+  }
+  *offset += size;
+  return 1;
+}
+
+// Convert a payload to the other byte order, walking the tree it was written
+// from.
+static uint8_t Test_SwapPayload(uint8_t *data, size_t length, size_t *offset, const cNBT *item, uint8_t type) {
+  const cNBT *child;
+  size_t size;
+
+  switch (type) {
+    case cNBT_I08:
+      return ++*offset <= length;
+    case cNBT_I16:
+      return Test_Swap(data, length, offset, 2);
+    case cNBT_I32:
+    case cNBT_F32:
+      return Test_Swap(data, length, offset, 4);
+    case cNBT_I64:
+    case cNBT_F64:
+      return Test_Swap(data, length, offset, 8);
+    case cNBT_STR:
+      if (!Test_Swap(data, length, offset, 2))
+        return 0;
+      *offset += item->value.lengthString;
+      return *offset <= length;
+    case cNBT_A08:
+    case cNBT_A32:
+    case cNBT_A64:
+      size = type == cNBT_A08 ? 1 : type == cNBT_A32 ? 4 : 8;
+      if (!Test_Swap(data, length, offset, 4))
+        return 0;
+      for (int32_t i = 0; i < item->value.lengthArray; i++)
+        if (!Test_Swap(data, length, offset, size))
+          return 0;
+      return 1;
+    case cNBT_LST:
+      if (++*offset > length || !Test_Swap(data, length, offset, 4))
+        return 0;
+      cNBT_ForEach(item, child)
+        if (!Test_SwapPayload(data, length, offset, child, item->listElementType))
+          return 0;
+      return 1;
+    case cNBT_OBJ:
+      cNBT_ForEach(item, child) {
+        size_t keyLength = strlen(child->key);
+
+        if (++*offset > length || !Test_Swap(data, length, offset, 2))
+          return 0;
+        *offset += keyLength;
+        if (!Test_SwapPayload(data, length, offset, child, child->type))
+          return 0;
+      }
+      return ++*offset <= length;
+  }
+  return 0;
+}
+
+static void Test_WriteByteOrders(void) {
+  // A named root holding one integer.
+  static const uint8_t bigEndian[] = {
+    cNBT_OBJ, 0, 1, 'r', cNBT_I32, 0, 1, 'a', 1, 2, 3, 4, 0
+  };
+  static const uint8_t littleEndian[] = {
+    cNBT_OBJ, 1, 0, 'r', cNBT_I32, 1, 0, 'a', 4, 3, 2, 1, 0
+  };
+  cNBT *small = cNBT_Parse(bigEndian, sizeof(bigEndian), 1)
+    , *parsed = cNBT_Parse(littleEndian, sizeof(littleEndian), 0)
+    , *nbt = Test_MakeTypesTree();
+  // The root is unnamed, its header is the same in both byte orders.
+  size_t bigLength, littleLength, offset = 3;
+  const void *big, *little;
+  uint8_t *swapped;
+
+  Test_Check(small && parsed && cNBT_Equal(small, parsed));
+  Test_Check(small && cNBT_GetNodeByKey(small, "a")->value.valueI32 == 0x01020304);
+  cNBT_Delete(parsed);
+  big = cNBT_Write(small, 0, 1, &bigLength);
+  little = cNBT_Write(small, 0, 0, &littleLength);
+  Test_Check(big && bigLength == sizeof(bigEndian) && !memcmp(big, bigEndian, bigLength));
+  Test_Check(little && littleLength == sizeof(littleEndian) && !memcmp(little, littleEndian, littleLength));
+  cNBT_Free(big);
+  cNBT_Free(little);
+  cNBT_Delete(small);
+
+  // Swapping every field of the big-endian output gives the little-endian
+  // one, and both parse back to the tree.
+  big = cNBT_Write(nbt, 0, 1, &bigLength);
+  little = cNBT_Write(nbt, 0, 0, &littleLength);
+  swapped = big ? malloc(bigLength) : cNBT_NULLPTR;
+  Test_Check(big && little && swapped && bigLength == littleLength);
+  if (swapped) {
+    memcpy(swapped, big, bigLength);
+    Test_Check(Test_SwapPayload(swapped, bigLength, &offset, nbt, cNBT_OBJ) && offset == bigLength);
+    Test_Check(littleLength == bigLength && !memcmp(swapped, little, littleLength));
+  }
+  parsed = big ? cNBT_Parse(big, bigLength, 1) : cNBT_NULLPTR;
+  Test_Check(parsed && cNBT_Equal(parsed, nbt));
+  cNBT_Delete(parsed);
+  parsed = little ? cNBT_Parse(little, littleLength, 0) : cNBT_NULLPTR;
+  Test_Check(parsed && cNBT_Equal(parsed, nbt));
+  cNBT_Delete(parsed);
+
+  free(swapped);
+  cNBT_Free(big);
+  cNBT_Free(little);
+  cNBT_Delete(nbt);
+}
+
+// Check that the segments of cNBT_WriteV() add up to the output of
+// cNBT_Write(), and count the ones referencing the bytes at `begin`.
+static size_t Test_CheckSegments(cNBT *nbt, uint8_t bigEndian, size_t minLength, const void *begin, size_t size) {
+  size_t expectedLength, count = 0, length = 0, offset = 0, referenced = 0;
+  const void *expected = cNBT_Write(nbt, 0, bigEndian, &expectedLength);
+  const cNBTSegment *segments = cNBT_WriteV(nbt, bigEndian, minLength, &count, &length);
+
+  Test_Check(expected && segments && length == expectedLength);
+  for (size_t i = 0; expected && segments && i < count; i++) {
+    const uint8_t *data = segments[i].data;
+
+    Test_Check(segments[i].length && offset + segments[i].length <= expectedLength);
+    if (!segments[i].length || offset + segments[i].length > expectedLength)
+      break;
+    Test_Check(!memcmp((const uint8_t *)expected + offset, data, segments[i].length));
+    offset += segments[i].length;
+    if (begin && data >= (const uint8_t *)begin && data + segments[i].length <= (const uint8_t *)begin + size)
+      referenced++;
+  }
+  Test_Check(offset == expectedLength);
+  cNBT_FreeSegments(segments);
+  cNBT_Free(expected);
+
+  return referenced;
+}
+
+static void Test_WriteSegments(void) {
+  static const uint16_t one = 1;
+  uint8_t hostBigEndian = *(const uint8_t *)&one == 0;
+  cNBT *nbt = Test_MakeTypesTree()
+    , *parsed = cNBT_NULLPTR
+    , *views = cNBT_NULLPTR
+    , *bytes, *text, *ints, *small;
+  cNBTParseOptions options = { .flags = cNBT_PARSE_TRACK_SOURCE };
+  char string[3000];
+  int8_t array[5000];
+  size_t length;
+  const void *data = cNBT_NULLPTR;
+  uint8_t *source = cNBT_NULLPTR;
+
+  // Large payloads, some of them nested.
+  memset(string, 'x', sizeof(string) - 1);
+  string[sizeof(string) - 1] = 0;
+  for (size_t i = 0; i < sizeof(array); i++)
+    array[i] = (int8_t)(i * 3);
+  text = Test_AddStr(nbt, "text", string);
+  bytes = cNBT_SetValueArray(Test_Add(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(nbt, "objects"), 0), cNBT_A08, "bytes"), array, sizeof(array));
+  ints = cNBT_GetNodeByKey(nbt, "a32");
+  small = cNBT_GetNodeByKey(nbt, "a08");
+  Test_Check(text && bytes && ints && small);
+  if (!text || !bytes || !ints || !small)
+    goto done;
+
+  for (uint8_t bigEndian = 0; bigEndian < 2; bigEndian++) {
+    // Strings and byte arrays are referenced in both byte orders, larger
+    // arrays only in the byte order of the host.
+    Test_Check(Test_CheckSegments(nbt, bigEndian, 0, text->value.valueString, sizeof(string) - 1) == 1);
+    Test_Check(Test_CheckSegments(nbt, bigEndian, 0, bytes->value.valueArray, sizeof(array)) == 1);
+    Test_Check(Test_CheckSegments(nbt, bigEndian, 0, ints->value.valueArray, 1003 * 4) == (bigEndian == hostBigEndian));
+    Test_Check(Test_CheckSegments(nbt, bigEndian, 0, small->value.valueArray, 37) == 0);
+    Test_Check(Test_CheckSegments(nbt, bigEndian, 1, small->value.valueArray, 37) == 1);
+    Test_Check(Test_CheckSegments(nbt, bigEndian, SIZE_MAX, text->value.valueString, sizeof(string) - 1) == 0);
+  }
+
+  // Unmodified payloads are referenced in the source data, in its byte order.
+  data = cNBT_Write(nbt, 0, 1, &length);
+  source = data ? malloc(length) : cNBT_NULLPTR;
+  Test_Check(data && source);
+  if (!data || !source)
+    goto done;
+  memcpy(source, data, length);
+  parsed = cNBT_ParseEx(source, length, 1, &options);
+  Test_Check(parsed && cNBT_Equal(parsed, nbt));
+  if (!parsed)
+    goto done;
+  Test_Check(Test_CheckSegments(parsed, 1, 0, source, length) > 0);
+  Test_Check(Test_CheckSegments(parsed, 0, 0, source, length) == 0);
+  cNBT_SetValueI32(cNBT_GetNodeByKey(parsed, "i32"), 7);
+  cNBT_SetValueI16(cNBT_GetNodeByIndex(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(parsed, "lists"), 2), 1), 7);
+  Test_Check(Test_CheckSegments(parsed, 1, 0, source, length) > 0);
+  Test_CheckSegments(parsed, 0, 0, cNBT_NULLPTR, 0);
+
+  // So are array views.
+  options.flags = cNBT_PARSE_ARRAY_VIEWS;
+  views = cNBT_ParseEx(source, length, 1, &options);
+  Test_Check(views && cNBT_Equal(views, nbt));
+  if (views) {
+    Test_Check(Test_CheckSegments(views, 1, 0, source, length) >= 2);
+    Test_CheckSegments(views, 0, 0, cNBT_NULLPTR, 0);
+  }
+
+done:
+  cNBT_Delete(views);
+  cNBT_Delete(parsed);
+  free(source);
+  cNBT_Free(data);
+  cNBT_Delete(nbt);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] GENERAL OPERATIONS
+//-----------------------------------------------------------------------------
+
+// Nesting of the trees deleted below, far deeper than the C stack allows with
+// recursion under AddressSanitizer.
+#define Test_DELETE_DEPTH 200000
+
+// Make objects nested `depth` times. Built from the innermost one, so adding
+// a node doesn't walk up its ancestors.
+static cNBT *Test_MakeDeepTree(int depth) {
+  cNBT *nbt = cNBT_CreateNode(cNBT_OBJ);
+
+  Test_AddStr(nbt, "leaf", "value");
+  for (int i = 1; nbt && i < depth; i++) {
+    cNBT *parent = cNBT_CreateNode(cNBT_OBJ);
+
+    cNBT_AddNode(parent, nbt, "d");
+    nbt = parent;
+  }
+  return nbt;
+}
+
+// Parse the data of Test_MakeParseData(), and count its allocations.
+static cNBT *Test_ParseCounted(const void *data, size_t length, size_t *allocations) {
+  cNBT *nbt;
+
+  gAllocationsLeft = LONG_MAX;
+  nbt = cNBT_Parse(data, length, 1);
+  *allocations = (size_t)(LONG_MAX - gAllocationsLeft);
+  gAllocationsLeft = -1;
+  return nbt;
+}
+
+static void Test_DeleteBatches(void) {
+  size_t length, allocations;
+  const void *data = Test_MakeParseData(&length);
+  cNBT *nbt = Test_ParseCounted(data, length, &allocations);
+
+  cNBT_SetFreeManyFn(Test_FreeMany);
+  gFreedMany = gFreeManyCalls = 0;
+
+  // Every pointer of the tree goes through the free-many function, in one
+  // batch for a small tree.
+  Test_Check(nbt && allocations > Test_PARSE_NODES);
+  cNBT_Delete(nbt);
+  Test_Check(gFreedMany == allocations && gFreeManyCalls == 1);
+
+  // Batches of a big tree, without recursion.
+  gFreedMany = gFreeManyCalls = 0;
+  cNBT_Delete(Test_MakeDeepTree(Test_DELETE_DEPTH));
+  Test_Check(gFreedMany == (size_t)Test_DELETE_DEPTH * 2 + 2);
+  Test_Check(gFreeManyCalls >= gFreedMany / 256);
+
+  cNBT_SetFreeManyFn(cNBT_NULLPTR);
+  cNBT_Delete(Test_MakeDeepTree(Test_DELETE_DEPTH));
+  cNBT_Free(data);
+}
+
+static void Test_DeleteAsync(void) {
+  size_t length, allocations, total = 0;
+  const void *data = Test_MakeParseData(&length);
+
+  cNBT_SetFreeManyFn(Test_FreeMany);
+  gFreedMany = gFreeManyCalls = 0;
+
+  // Freed by the background thread once cNBT_WaitDeletes() returns.
+  for (int i = 0; data && i < 8; i++) {
+    cNBT *nbt = Test_ParseCounted(data, length, &allocations);
+
+    Test_Check(nbt);
+    total += allocations;
+    cNBT_DeleteAsync(nbt);
+  }
+  cNBT_DeleteAsync(Test_MakeDeepTree(Test_DELETE_DEPTH));
+  total += (size_t)Test_DELETE_DEPTH * 2 + 2;
+  cNBT_DeleteAsync(cNBT_NULLPTR);
+  cNBT_WaitDeletes();
+  Test_Check(gFreedMany == total);
+
+  // Nothing pending.
+  cNBT_WaitDeletes();
+
+  cNBT_SetFreeManyFn(cNBT_NULLPTR);
+  cNBT_Free(data);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] JSON EXPORT
+//-----------------------------------------------------------------------------
+
+static void Test_JSONTypedNestedLists(void) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBT *outer = Test_AddList(root, cNBT_LST, "a");
+
+  Test_AddI32(Test_AddList(outer, cNBT_I32, cNBT_NULLPTR), cNBT_NULLPTR, 7);
+  Test_AddList(outer, cNBT_STR, cNBT_NULLPTR);
+
+  Test_CheckJSON(
+    root,
+    cNBT_JSON_TYPED,
+    "{\"type\":\"compound\",\"value\":{\"a\":{\"type\":\"list\",\"elementType\":\"list\",\"value\":["
+      "{\"type\":\"list\",\"elementType\":\"int\",\"value\":[7]},"
+      "{\"type\":\"list\",\"elementType\":\"string\",\"value\":[]}]}}}");
+  Test_CheckJSON(root, 0, "{\"a\":[[7],[]]}");
+  cNBT_Delete(root);
+}
+
+static void Test_JSONFloatLocale(void) {
+  static const char *const locales[] = {
+    "de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8", "ru_RU.UTF-8", "German_Germany.1252"
+  };
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+
+  Test_AddF64(root, "x", -1.5);
+  Test_AddF64(root, "y", 2.5e-300);
+  Test_CheckJSON(root, 0, "{\"x\":-1.5,\"y\":2.5e-300}");
+
+  // Only checked where a locale with a comma radix is installed.
+  for (size_t i = 0; i < sizeof(locales) / sizeof(locales[0]); i++) {
+    if (setlocale(LC_NUMERIC, locales[i])) {
+      Test_CheckJSON(root, 0, "{\"x\":-1.5,\"y\":2.5e-300}");
+      setlocale(LC_NUMERIC, "C");
+      break;
+    }
+  }
+  cNBT_Delete(root);
+}
+
+static void Test_JSONRawInvalidType(void) {
+  // Root types out of range, and the same in an object.
+  static const uint8_t root[] = { 40, 0, 0, 0, 0, 0, 0 };
+  static const uint8_t child[] = { cNBT_OBJ, 0, 0, 40, 0, 1, 'a', 0, 0, 0, 0, 0 };
+  static const uint32_t flags[] = { 0, cNBT_JSON_TYPED };
+
+  for (size_t i = 0; i < 2; i++) {
+    cNBTJSONOptions options = { flags[i], 0 };
+    TestText text = { "", 0 };
+
+    Test_Check(!cNBT_WriteJSONRaw(root, sizeof(root), 1, &options, Test_Sink, &text));
+    Test_Check(!cNBT_WriteJSONRaw(child, sizeof(child), 1, &options, Test_Sink, &text));
+  }
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] CLONE, COMPARISON AND HASHING
+//-----------------------------------------------------------------------------
+
+// Build an object of `count` items, all keyed "k" but one in four, holding
+// their index rotated by `shift`, optionally in reverse order. cNBT_AddNode()
+// rejects duplicate keys, while the parser accepts them, so the object is
+// parsed from binary data.
+static cNBT *Test_MakeDuplicateKeys(int count, int shift, int reverse) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ), *item, *result;
+  const void *data;
+  size_t length;
+
+  for (int n = 0; n < count; n++) {
+    int i = reverse ? count - 1 - n : n;
+    char key[16];
+
+    snprintf(key, sizeof(key), "u%d", i);
+    item = Test_Add(root, cNBT_I32, key);
+    cNBT_SetValueI32(item, (i + shift) % count);
+    if (i % 4)
+      strcpy(item->key, "k");
+  }
+
+  data = cNBT_Write(root, 0, 1, &length);
+  result = data ? cNBT_Parse(data, length, 1) : cNBT_NULLPTR;
+  cNBT_Free((void *)data);
+  cNBT_Delete(root);
+  return result;
+}
+
+static void Test_EqualDuplicateKeys(void) {
+  // Below and above cNBT_EQUAL_LINEAR_LIMIT.
+  static const int counts[] = { 3, 8, 40 };
+
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    cNBT *a = Test_MakeDuplicateKeys(counts[i], 0, 0), *copy = cNBT_Clone(a, cNBT_NULLPTR);
+    cNBT *reversed = Test_MakeDuplicateKeys(counts[i], 0, 1);
+    cNBT *other = Test_MakeDuplicateKeys(counts[i], 1, 0);
+
+    Test_Check(a && copy && reversed && other);
+    Test_Check(cNBT_Equal(a, a));
+    Test_Check(cNBT_Equal(a, copy) && cNBT_Equal(copy, a));
+    Test_Check(cNBT_Hash(a) == cNBT_Hash(copy));
+    Test_Check(cNBT_Equal(a, reversed) && cNBT_Equal(reversed, a));
+    Test_Check(cNBT_Hash(a) == cNBT_Hash(reversed));
+    Test_Check(!cNBT_Equal(a, other) && !cNBT_Equal(other, a));
+
+    cNBT_Delete(other);
+    cNBT_Delete(reversed);
+    cNBT_Delete(copy);
+    cNBT_Delete(a);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] DIFF AND PATCH
+//-----------------------------------------------------------------------------
+
+static cNBT *Test_MakePatchTree(int version) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBT *list = Test_AddList(root, cNBT_I32, "list");
+
+  Test_AddStr(root, "name", version ? "new" : "old");
+  Test_AddI32(root, version ? "added" : "removed", 1);
+  for (int i = 0; i < 3 + version; i++)
+    Test_AddI32(list, cNBT_NULLPTR, i * (version + 1));
+  return root;
+}
+
+static void Test_PatchRoundTrip(void) {
+  cNBT *oldNbt = Test_MakePatchTree(0), *newNbt = Test_MakePatchTree(1);
+  size_t length, size, patchedLength;
+  const void *patch = cNBT_Diff(oldNbt, newNbt, 1, &length);
+  const void *data = cNBT_Write(oldNbt, 0, 1, &size), *patched;
+  cNBT *parsed;
+
+  Test_Check(patch && data);
+  Test_Check(cNBT_ApplyPatch(oldNbt, patch, length) == oldNbt);
+  Test_Check(cNBT_Equal(oldNbt, newNbt));
+
+  patched = cNBT_ApplyPatchRaw(data, size, 1, patch, length, &patchedLength);
+  parsed = patched ? cNBT_Parse(patched, patchedLength, 1) : cNBT_NULLPTR;
+  Test_Check(cNBT_Equal(parsed, newNbt));
+
+  cNBT_Delete(parsed);
+  cNBT_Free(patched);
+  cNBT_Free(data);
+  cNBT_Free(patch);
+  cNBT_Delete(newNbt);
+  cNBT_Delete(oldNbt);
+}
+
+static void Test_PatchTruncated(void) {
+  cNBT *oldNbt = Test_MakePatchTree(0), *newNbt = Test_MakePatchTree(1);
+  size_t length, size, patchedLength;
+  const uint8_t *patch = cNBT_Diff(oldNbt, newNbt, 1, &length);
+  const void *data = cNBT_Write(oldNbt, 0, 1, &size);
+
+  Test_Check(patch && data);
+  for (size_t i = 0; patch && data && i < length; i++) {
+    // Copied so reading past the truncated patch is caught.
+    uint8_t *truncated = malloc(i ? i : 1);
+    cNBT *target = cNBT_Clone(oldNbt, cNBT_NULLPTR);
+
+    memcpy(truncated, patch, i);
+    Test_Check(!cNBT_ApplyPatch(target, truncated, i));
+    Test_Check(!cNBT_ApplyPatchRaw(data, size, 1, truncated, i, &patchedLength));
+    cNBT_Delete(target);
+    free(truncated);
+  }
+
+  cNBT_Free(data);
+  cNBT_Free(patch);
+  cNBT_Delete(newNbt);
+  cNBT_Delete(oldNbt);
+}
+
+static void Test_PatchKeyWithNul(void) {
+  // Removes the key "a\0bcdef", which only matches "a" up to the NUL.
+  static const uint8_t patch[] = {
+    'c', 'N', 'B', 'P', 1, 1,
+    2, 0, 1, cNBT_STR, 0, 7, 'a', 0, 'b', 'c', 'd', 'e', 'f',
+    0
+  };
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  size_t size, patchedLength;
+  const void *data;
+
+  Test_AddI32(root, "a", 1);
+  data = cNBT_Write(root, 0, 1, &size);
+
+  Test_Check(!cNBT_ApplyPatch(root, patch, sizeof(patch)));
+  Test_Check(cNBT_GetNodeByKey(root, "a"));
+  Test_Check(!cNBT_ApplyPatchRaw(data, size, 1, patch, sizeof(patch), &patchedLength));
+
+  cNBT_Free(data);
+  cNBT_Delete(root);
+}
+
+static void Test_PatchOutOfMemory(void) {
+  cNBT *oldNbt = Test_MakePatchTree(0), *newNbt = Test_MakePatchTree(1);
+  cNBT *changed = Test_MakePatchTree(0);
+  size_t length;
+  const void *patch;
+  long failures = 0;
+
+  // Only changes values, as cNBT_AddNode() doesn't handle allocation failures.
+  cNBT_SetValueString(cNBT_GetNodeByKey(changed, "name"), "changed", 0);
+  patch = cNBT_Diff(oldNbt, changed, 1, &length);
+  Test_Check(patch);
+
+  for (long n = 0; n < 64; n++) {
+    cNBT *target = cNBT_Clone(oldNbt, cNBT_NULLPTR);
+    const void *partial;
+
+    gAllocationsLeft = n;
+    partial = cNBT_Diff(oldNbt, newNbt, 1, cNBT_NULLPTR);
+    failures += !partial;
+    gAllocationsLeft = n;
+    failures += !cNBT_ApplyPatch(target, patch, length);
+    gAllocationsLeft = -1;
+
+    cNBT_Free(partial);
+    cNBT_Delete(target);
+  }
+  // Both succeed once enough allocations are left.
+  Test_Check(failures > 0 && failures < 128);
+
+  cNBT_Free(patch);
+  cNBT_Delete(changed);
+  cNBT_Delete(newNbt);
+  cNBT_Delete(oldNbt);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] OFFSET INDEX
+//-----------------------------------------------------------------------------
+
+static const char *const gTestIndexPaths[] = {
+  "Inventory[1].Count", "Health", "pos", "a\\.b", "", "Inventory[5].Count", "missing"
+};
+#define Test_INDEX_PATHS (sizeof(gTestIndexPaths) / sizeof(gTestIndexPaths[0]))
+
+static const void *Test_MakeIndexData(size_t *length) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBT *inventory = Test_AddList(root, cNBT_OBJ, "Inventory");
+  int32_t pos[] = { 1, 2, 3 };
+  const void *result;
+
+  for (int i = 0; i < 3; i++) {
+    cNBT *slot = Test_Add(inventory, cNBT_OBJ, cNBT_NULLPTR);
+
+    Test_AddStr(slot, "id", "stone");
+    cNBT_SetValueI08(Test_Add(slot, cNBT_I08, "Count"), (int8_t)(10 + i));
+  }
+  cNBT_SetValueF32(Test_Add(root, cNBT_F32, "Health"), 20.0f);
+  cNBT_SetValueArray(Test_Add(root, cNBT_A32, "pos"), pos, 3);
+  cNBT_SetValueI64(Test_Add(root, cNBT_I64, "a.b"), -5);
+
+  result = cNBT_Write(root, 0, 1, length);
+  cNBT_Delete(root);
+  return result;
+}
+
+static void Test_IndexOffsets(void) {
+  size_t length;
+  const void *written = Test_MakeIndexData(&length);
+  uint8_t *data = malloc(length);
+  cNBTOffset offsets[Test_INDEX_PATHS];
+  int64_t value = 0;
+  double number = 0;
+  cNBT *nbt;
+
+  Test_Check(written && data);
+  if (!written || !data)
+    goto done;
+  memcpy(data, written, length);
+  Test_Check(cNBT_IndexOffsets(data, length, 1, gTestIndexPaths, Test_INDEX_PATHS, offsets));
+  Test_Check(offsets[0].type == cNBT_I08 && offsets[0].offset < length);
+  Test_Check(offsets[1].type == cNBT_F32);
+  Test_Check(offsets[2].type == cNBT_A32 && offsets[2].length == 3);
+  Test_Check(offsets[3].type == cNBT_I64);
+  Test_Check(offsets[4].type == cNBT_OBJ && offsets[4].offset == 3);
+  Test_Check(offsets[5].offset == SIZE_MAX && offsets[6].offset == SIZE_MAX);
+
+  // Reads in place.
+  Test_Check(cNBT_GetRawInt(data, 1, &offsets[0], &value) && value == 11);
+  Test_Check(cNBT_GetRawFloat(data, 1, &offsets[1], &number) && number == 20.0);
+  Test_Check(cNBT_GetRawArrayElement(data, 1, &offsets[2], 2, &value) && value == 3);
+  Test_Check(!cNBT_GetRawArrayElement(data, 1, &offsets[2], 3, &value));
+  Test_Check(cNBT_GetRawInt(data, 1, &offsets[3], &value) && value == -5);
+  Test_Check(!cNBT_GetRawInt(data, 1, &offsets[1], &value));
+  Test_Check(!cNBT_GetRawInt(data, 1, &offsets[5], &value));
+
+  // Writes in place, seen by the parser.
+  Test_Check(!cNBT_SetRawInt(data, 1, &offsets[0], 300));
+  Test_Check(cNBT_SetRawInt(data, 1, &offsets[0], -7));
+  Test_Check(cNBT_SetRawFloat(data, 1, &offsets[1], 0.5));
+  Test_Check(cNBT_SetRawArrayElement(data, 1, &offsets[2], 0, 1 << 20));
+  nbt = cNBT_Parse(data, length, 1);
+  Test_Check(nbt);
+  if (nbt) {
+    cNBT *slot = cNBT_GetNodeByIndex(cNBT_GetNodeByKey(nbt, "Inventory"), 1);
+
+    Test_Check(cNBT_GetNodeByKey(slot, "Count")->value.valueI08 == -7);
+    Test_Check(cNBT_GetNodeByKey(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(nbt, "Inventory"), 0), "Count")->value.valueI08 == 10);
+    Test_Check(cNBT_GetNodeByKey(nbt, "Health")->value.valueF32 == 0.5f);
+    Test_Check(cNBT_GetArrayElementI32(cNBT_GetNodeByKey(nbt, "pos"), 0) == 1 << 20);
+    Test_Check(cNBT_GetArrayElementI32(cNBT_GetNodeByKey(nbt, "pos"), 1) == 2);
+  }
+  cNBT_Delete(nbt);
+
+  gAllocationsLeft = 0;
+  Test_Check(!cNBT_IndexOffsets(data, length, 1, gTestIndexPaths, Test_INDEX_PATHS, offsets));
+  gAllocationsLeft = -1;
+
+  // The missing path makes the whole data scanned, so any truncation is
+  // rejected.
+  for (size_t i = 0; i < length; i++) {
+    uint8_t *truncated = malloc(i ? i : 1);
+
+    memcpy(truncated, data, i);
+    Test_Check(!cNBT_IndexOffsets(truncated, i, 1, gTestIndexPaths, Test_INDEX_PATHS, offsets));
+    Test_Check(offsets[0].offset == SIZE_MAX);
+    free(truncated);
+  }
+
+done:
+  free(data);
+  cNBT_Free(written);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] PROFILING
+//-----------------------------------------------------------------------------
+
+// Check the counters of one parse or write of the data of
+// Test_MakeParseData().
+static void Test_CheckProfileCounters(const cNBTProfileCounter *types, const cNBTProfileCounter *depths, size_t length) {
+  uint64_t count = 0;
+
+  Test_Check(types[cNBT_OBJ].count == 5 && types[cNBT_LST].count == 1);
+  Test_Check(types[cNBT_I32].count == 4 && types[cNBT_I32].bytes == 4 * 4);
+  Test_Check(types[cNBT_STR].count == 1 && types[cNBT_STR].bytes == 2 + 40);
+  Test_Check(types[cNBT_A32].count == 1 && types[cNBT_A32].bytes == 4 + 100 * 4);
+  for (int i = 0; i <= cNBT_A64; i++)
+    Test_Check(types[i].selfTicks <= types[i].ticks);
+  for (int i = 0; i < cNBT_PROFILE_DEPTHS; i++)
+    count += depths[i].count;
+  Test_Check(count == Test_PARSE_NODES);
+  // The root payload, after its type and empty key.
+  Test_Check(depths[0].count == 1 && depths[0].bytes == length - 3);
+}
+
+static void Test_Profile(void) {
+  size_t length, writtenLength;
+  const void *data = Test_MakeParseData(&length), *written;
+  cNBTProfile profile;
+  cNBT *nbt;
+
+  cNBT_ResetProfile();
+  if (!cNBT_GetProfile(&profile)) {
+    // Not compiled with cNBT_ENABLE_PROFILING.
+    Test_Check(!profile.parses && !profile.writes && !profile.alloc.count);
+    cNBT_Free(data);
+    return;
+  }
+  Test_Check(!profile.parses && !profile.writes && !profile.parseTypes[cNBT_OBJ].count);
+  Test_Check(profile.ticksPerSecond > 0);
+
+  nbt = cNBT_Parse(data, length, 1);
+  Test_Check(nbt && cNBT_GetProfile(&profile));
+  Test_Check(profile.parses == 1 && !profile.writes && profile.alloc.count > 0);
+  Test_CheckProfileCounters(profile.parseTypes, profile.parseDepths, length);
+
+  cNBT_ResetProfile();
+  written = cNBT_Write(nbt, 0, 1, &writtenLength);
+  Test_Check(written && writtenLength == length && cNBT_GetProfile(&profile));
+  Test_Check(profile.writes == 1 && !profile.parses && !profile.parseTypes[cNBT_OBJ].count);
+  Test_CheckProfileCounters(profile.writeTypes, profile.writeDepths, length);
+
+  cNBT_Free(written);
+  cNBT_Delete(nbt);
+  cNBT_Free(data);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] PACKED ARRAYS
+//-----------------------------------------------------------------------------
+
+static uint64_t gRandom = 0x243F6A8885A308D3ULL;
+
+// xorshift64, with a fixed seed so every run tests the same cases.
+static uint64_t Test_Random(void) {
+  gRandom ^= gRandom << 13;
+  gRandom ^= gRandom >> 7;
+  gRandom ^= gRandom << 17;
+  return gRandom;
+}
+
+// Reference packing, one bit at a time.
+static void Test_PackReference(uint64_t *packed, const uint16_t *input, size_t count, uint8_t bits, uint8_t layout) {
+  for (size_t i = 0; i < count; i++) {
+    for (uint8_t bit = 0; bit < bits; bit++) {
+      size_t position = layout == cNBT_PACKED_SPANNING
+        ? i * bits + bit
+        : i / (64 / bits) * 64 + i % (64 / bits) * bits + bit;
+
+      if (input[i] >> bit & 1)
+        packed[position / 64] |= 1ULL << position % 64;
+    }
+  }
+}
+
+// Unpack the array of `item` from data written in the given byte order and
+// parsed with array views, copied so reading past the buffer is caught. Empty
+// arrays are never views.
+static void Test_CheckUnpackView(cNBT *root, const uint16_t *expected, size_t count, uint8_t bits, uint8_t layout, uint8_t bigEndian) {
+  size_t length;
+  const void *data = cNBT_Write(root, 0, bigEndian, &length);
+  cNBTParseOptions options = { .flags = cNBT_PARSE_ARRAY_VIEWS };
+  uint8_t *copy = malloc(length);
+  uint16_t *output = malloc((count ? count : 1) * sizeof(uint16_t));
+  cNBT *nbt;
+
+  Test_Check(data && copy && output);
+  if (data && copy && output) {
+    memcpy(copy, data, length);
+    nbt = cNBT_ParseEx(copy, length, bigEndian, &options);
+    Test_Check(nbt && (!count || cNBT_GetNodeByKey(nbt, "packed")->flags & cNBT_FLAG_ARRAY_VIEW));
+    Test_Check(nbt && cNBT_UnpackIndices(cNBT_GetNodeByKey(nbt, "packed"), output, count, bits, layout));
+    Test_Check(!memcmp(output, expected, count * sizeof(uint16_t)));
+    cNBT_Delete(nbt);
+  }
+  free(output);
+  free(copy);
+  cNBT_Free(data);
+}
+
+static void Test_PackedKernels(void) {
+  // Counts around the vector widths, and random ones.
+  static const size_t counts[] = { 0, 1, 3, 4, 15, 16, 17, 63, 64, 65, 255, 256, 257, 4096 };
+
+  for (int trial = 0; trial < 400; trial++) {
+    uint8_t bits = (uint8_t)(1 + trial % 16)
+      , layout = (uint8_t)(trial / 16 % 2);
+    size_t count = trial < 16 * 2 * 7
+      ? counts[trial / 32 % (sizeof(counts) / sizeof(counts[0]))]
+      : (size_t)(Test_Random() % 5000);
+    int32_t length = cNBT_PackedLength(count, bits, layout);
+    uint16_t *input = malloc((count ? count : 1) * sizeof(uint16_t))
+      , *expected = malloc((count ? count : 1) * sizeof(uint16_t))
+      , *output = malloc((count + 1) * sizeof(uint16_t));
+    uint64_t *reference = calloc(length > 0 ? (size_t)length : 1, sizeof(uint64_t));
+    cNBT *root = cNBT_CreateNode(cNBT_OBJ), *packed = Test_Add(root, cNBT_A64, "packed");
+
+    Test_Check(input && expected && output && reference && length >= 0);
+    if (!input || !expected || !output || !reference || length < 0)
+      count = 0;
+    // The higher bits of the input are ignored.
+    for (size_t i = 0; i < count; i++) {
+      input[i] = (uint16_t)Test_Random();
+      expected[i] = (uint16_t)(input[i] & ((1u << bits) - 1));
+    }
+    Test_PackReference(reference, expected, count, bits, layout);
+
+    Test_Check(cNBT_PackIndices(packed, input, count, bits, layout) == packed);
+    Test_Check(cNBT_GetArrayLength(packed) == length);
+    Test_Check(!count || !memcmp(packed->value.valueArray, reference, (size_t)length * sizeof(uint64_t)));
+    Test_Check(cNBT_UnpackIndices(packed, output, count, bits, layout));
+    Test_Check(!memcmp(output, expected, count * sizeof(uint16_t)));
+    // One more index fits only if the last long has room for it.
+    Test_Check(cNBT_UnpackIndices(packed, output, count + 1, bits, layout) == (cNBT_PackedLength(count + 1, bits, layout) == length));
+    Test_Check(!cNBT_UnpackIndices(packed, output, count + 64, bits, layout));
+
+    // Little-endian views take the vector kernels where available, big-endian
+    // ones the scalar kernels.
+    Test_CheckUnpackView(root, expected, count, bits, layout, 0);
+    Test_CheckUnpackView(root, expected, count, bits, layout, 1);
+
+    cNBT_Delete(root);
+    free(reference);
+    free(output);
+    free(expected);
+    free(input);
+  }
+
+  Test_Check(cNBT_PackedLength(1, 0, cNBT_PACKED_ALIGNED) < 0 && cNBT_PackedLength(1, 17, cNBT_PACKED_ALIGNED) < 0);
+  Test_Check(cNBT_PackedLength(4096, 5, cNBT_PACKED_SPANNING) == 320);
+  Test_Check(cNBT_PackedLength(4096, 5, cNBT_PACKED_ALIGNED) == 342);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] SCHEMAS
+//-----------------------------------------------------------------------------
+
+typedef struct {
+  int16_t x;
+  int16_t y;
+} TestPosition;
+
+typedef struct {
+  char *id;
+  int32_t count;
+  double weight;
+  cNBTSchemaArray tags;
+  cNBTSchemaArray values;
+  TestPosition position;
+} TestItem;
+
+static const cNBTSchemaField gPositionFields[] = {
+  { "x", cNBT_I16, 0, 0, offsetof(TestPosition, x) },
+  { "y", cNBT_I16, 0, 0, offsetof(TestPosition, y) }
+};
+static const cNBTSchemaField gItemFields[] = {
+  { "id", cNBT_STR, 0, cNBT_FIELD_REQUIRED, offsetof(TestItem, id) },
+  { "count", cNBT_I32, 0, 0, offsetof(TestItem, count), cNBT_NULLPTR, 0, 0, { .valueI32 = 1 } },
+  { "weight", cNBT_F64, 0, 0, offsetof(TestItem, weight) },
+  { "tags", cNBT_LST, cNBT_STR, 0, offsetof(TestItem, tags) },
+  { "values", cNBT_A32, 0, 0, offsetof(TestItem, values) },
+  { "position", cNBT_OBJ, 0, 0, offsetof(TestItem, position), gPositionFields, 2 }
+};
+
+static cNBT *Test_MakeItem(int withCount) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBT *tags = Test_AddList(root, cNBT_STR, "tags");
+  cNBT *position = Test_Add(root, cNBT_OBJ, "position");
+  int32_t values[3] = { 3, -2, 1 };
+
+  Test_AddStr(root, "id", "stone");
+  if (withCount)
+    Test_AddI32(root, "count", 64);
+  Test_AddF64(root, "weight", 0.5);
+  Test_AddStr(tags, cNBT_NULLPTR, "block");
+  Test_AddStr(tags, cNBT_NULLPTR, "solid");
+  cNBT_SetValueArray(Test_Add(root, cNBT_A32, "values"), values, 3);
+  cNBT_SetValueI16(Test_Add(position, cNBT_I16, "x"), 7);
+  cNBT_SetValueI16(Test_Add(position, cNBT_I16, "y"), -8);
+  // Not in the schema.
+  Test_AddI32(root, "unknown", 0);
+  return root;
+}
+
+static void Test_SchemaDecode(void) {
+  cNBTSchema *schema = cNBT_CompileSchema(gItemFields, sizeof(gItemFields) / sizeof(gItemFields[0]));
+  cNBT *root = Test_MakeItem(1), *missing = Test_MakeItem(0);
+  size_t length, missingLength;
+  const void *data = cNBT_Write(root, 0, 1, &length);
+  const void *missingData = cNBT_Write(missing, 0, 0, &missingLength);
+  TestItem item;
+
+  Test_Check(schema && data && missingData);
+  Test_Check(cNBT_DecodeStruct(schema, data, length, 1, &item));
+  Test_Check(item.id && !strcmp(item.id, "stone"));
+  Test_Check(item.count == 64 && item.weight == 0.5);
+  Test_Check(item.tags.length == 2 && !strcmp(((char **)item.tags.data)[1], "solid"));
+  Test_Check(item.values.length == 3 && ((int32_t *)item.values.data)[1] == -2);
+  Test_Check(item.position.x == 7 && item.position.y == -8);
+  cNBT_ReleaseStruct(schema, &item);
+  Test_Check(!item.id && !item.tags.data && !item.values.data);
+
+  // Missing fields take their default.
+  Test_Check(cNBT_DecodeStruct(schema, missingData, missingLength, 0, &item));
+  Test_Check(item.count == 1);
+  cNBT_ReleaseStruct(schema, &item);
+
+  cNBT_Free(missingData);
+  cNBT_Free(data);
+  cNBT_Delete(missing);
+  cNBT_Delete(root);
+  cNBT_FreeSchema(schema);
+}
+
+static void Test_SchemaDecodeMismatch(void) {
+  cNBTSchema *schema = cNBT_CompileSchema(gItemFields, sizeof(gItemFields) / sizeof(gItemFields[0]));
+  cNBT *root = Test_MakeItem(1);
+  size_t length;
+  const void *data;
+  TestItem item;
+
+  // The required "id" has another type, after the strings and arrays of
+  // other fields were decoded, which are released. The leak checker reports
+  // any that isn't.
+  cNBT_Delete(cNBT_RemoveNode(root, cNBT_GetNodeByKey(root, "id")));
+  Test_AddI32(root, "id", 1);
+  data = cNBT_Write(root, 0, 1, &length);
+  Test_Check(!cNBT_DecodeStruct(schema, data, length, 1, &item));
+  cNBT_Free(data);
+
+  // The required "id" is missing.
+  cNBT_Delete(cNBT_RemoveNode(root, cNBT_GetNodeByKey(root, "id")));
+  data = cNBT_Write(root, 0, 1, &length);
+  Test_Check(!cNBT_DecodeStruct(schema, data, length, 1, &item));
+  cNBT_Free(data);
+
+  cNBT_Delete(root);
+  cNBT_FreeSchema(schema);
+}
+
+static void Test_SchemaDecodeTruncated(void) {
+  cNBTSchema *schema = cNBT_CompileSchema(gItemFields, sizeof(gItemFields) / sizeof(gItemFields[0]));
+  cNBT *root = Test_MakeItem(1);
+  size_t length;
+  const void *data = cNBT_Write(root, 0, 1, &length);
+  TestItem item;
+
+  for (size_t i = 0; schema && data && i < length; i++) {
+    // Copied so reading past the truncated data is caught.
+    uint8_t *truncated = malloc(i ? i : 1);
+
+    memcpy(truncated, data, i);
+    Test_Check(!cNBT_DecodeStruct(schema, truncated, i, 1, &item));
+    free(truncated);
+  }
+
+  cNBT_Free(data);
+  cNBT_Delete(root);
+  cNBT_FreeSchema(schema);
+}
+
+static void Test_SchemaEncode(void) {
+  cNBTSchema *schema = cNBT_CompileSchema(gItemFields, sizeof(gItemFields) / sizeof(gItemFields[0]));
+  cNBT *root = Test_MakeItem(1), *parsed;
+  size_t length, encodedLength;
+  const void *data = cNBT_Write(root, 0, 1, &length), *encoded;
+  TestItem item, empty = { 0 };
+
+  Test_Check(schema && cNBT_DecodeStruct(schema, data, length, 1, &item));
+  encoded = cNBT_EncodeStruct(schema, &item, 0, 0, &encodedLength);
+  parsed = encoded ? cNBT_Parse(encoded, encodedLength, 0) : cNBT_NULLPTR;
+
+  // The same tree, without the key missing from the schema.
+  cNBT_Delete(cNBT_RemoveNode(root, cNBT_GetNodeByKey(root, "unknown")));
+  Test_Check(cNBT_Equal(parsed, root));
+  cNBT_Delete(parsed);
+  cNBT_Free(encoded);
+  cNBT_ReleaseStruct(schema, &item);
+
+  // NULL strings and empty arrays.
+  encoded = cNBT_EncodeStruct(schema, &empty, 0, 1, &encodedLength);
+  Test_Check(encoded && cNBT_DecodeStruct(schema, encoded, encodedLength, 1, &item));
+  Test_Check(item.id && !*item.id && !item.tags.length && !item.values.length);
+  cNBT_ReleaseStruct(schema, &item);
+  cNBT_Free(encoded);
+
+  cNBT_Free(data);
+  cNBT_Delete(root);
+  cNBT_FreeSchema(schema);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] SHAPES
+//-----------------------------------------------------------------------------
+
+// Key orders of the objects of the list, by digit of their keys. Objects with
+// the same order share a shape.
+static const char *const gShapeOrders[] = {
+  "0123456789", "0123456789", "9876543210", "0123456789", "9876543210",
+  "0123465789", "012",
+};
+static const int gShapeGroups[] = { 0, 0, 1, 0, 1, 2, 3 };
+#define Test_SHAPE_OBJECTS ((int)(sizeof(gShapeOrders) / sizeof(gShapeOrders[0])))
+// Shapes of the list objects plus the root.
+#define Test_SHAPES 5
+
+static cNBT *Test_MakeShapesTree(void) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ)
+    , *list = Test_AddList(root, cNBT_OBJ, "list");
+
+  for (int i = 0; i < Test_SHAPE_OBJECTS; i++) {
+    cNBT *object = Test_Add(list, cNBT_OBJ, cNBT_NULLPTR);
+    for (const char *digit = gShapeOrders[i]; *digit; digit++) {
+      char key[3] = { 'k', *digit, 0 };
+      Test_AddI32(object, key, i * 10 + *digit - '0');
+    }
+  }
+
+  return root;
+}
+
+// Check the lookups of the objects of a parsed tree, and that objects with
+// the same key order have the same shape.
+static void Test_CheckShapes(const cNBT *root, const cNBTShape **shapes) {
+  const cNBT *list = cNBT_GetNodeByKey(root, "list");
+
+  Test_Check(cNBT_GetShape(root) && cNBT_GetShapeLength(cNBT_GetShape(root)) == 1);
+  for (int i = 0; i < Test_SHAPE_OBJECTS; i++) {
+    const cNBT *object = cNBT_GetNodeByIndex(list, i);
+    const cNBTShape *shape = cNBT_GetShape(object);
+    const char *order = gShapeOrders[i];
+
+    Test_Check(shape && cNBT_GetShapeLength(shape) == strlen(order));
+    if (!shapes[gShapeGroups[i]])
+      shapes[gShapeGroups[i]] = shape;
+    Test_Check(shape == shapes[gShapeGroups[i]]);
+    for (int j = 0; j < i; j++)
+      Test_Check((cNBT_GetShape(cNBT_GetNodeByIndex(list, j)) == shape) == (gShapeGroups[i] == gShapeGroups[j]));
+
+    for (size_t slot = 0; order[slot]; slot++) {
+      char key[3] = { 'k', order[slot], 0 };
+      cNBT *item = cNBT_GetNodeByKey(object, key);
+      Test_Check(item && item->value.valueI32 == i * 10 + order[slot] - '0');
+      Test_Check(!strcmp(cNBT_GetNodeKey(item), key));
+      Test_Check(cNBT_GetShapeSlot(shape, key) == (int32_t)slot);
+      Test_Check(cNBT_GetNodeBySlot(object, (uint32_t)slot) == item);
+    }
+    Test_Check(!cNBT_GetNodeByKey(object, "k"));
+    Test_Check(cNBT_GetShapeSlot(shape, "kx") < 0);
+    Test_Check(!cNBT_GetNodeBySlot(object, (uint32_t)strlen(order)));
+  }
+}
+
+static void Test_ShapeCache(void) {
+  cNBT *tree = Test_MakeShapesTree()
+    , *first = cNBT_NULLPTR
+    , *second = cNBT_NULLPTR
+    , *little = cNBT_NULLPTR
+    , *small = cNBT_NULLPTR;
+  const cNBTShape *shapes[4] = { 0 }
+    , *again[4] = { 0 }
+    , *littleShapes[4] = { 0 };
+  cNBTShapeCache *cache = cNBT_CreateShapeCache(0)
+    , *smallCache = cNBT_CreateShapeCache(2);
+  cNBTParseOptions options = { .shapes = cache };
+  size_t length, littleLength;
+  const void *data = cNBT_Write(tree, 0, 1, &length)
+    , *littleData = cNBT_Write(tree, 0, 0, &littleLength);
+  cNBT *object, *extra;
+
+  Test_Check(data && littleData && cache && smallCache);
+  if (!data || !littleData || !cache || !smallCache)
+    goto done;
+
+  // Reordered keys miss the predicted shape, and find or learn their own.
+  first = cNBT_ParseEx(data, length, 1, &options);
+  Test_Check(first && cNBT_Equal(first, tree));
+  Test_Check(cNBT_GetShapeCount(cache) == Test_SHAPES);
+  if (first)
+    Test_CheckShapes(first, shapes);
+
+  // Every object hits a known shape the second time.
+  second = cNBT_ParseEx(data, length, 1, &options);
+  Test_Check(second && cNBT_Equal(second, tree));
+  Test_Check(cNBT_GetShapeCount(cache) == Test_SHAPES);
+  if (second)
+    Test_CheckShapes(second, again);
+  Test_Check(!memcmp(shapes, again, sizeof(shapes)));
+  Test_Check(cNBT_GetShape(first) == cNBT_GetShape(second));
+
+  // Shapes hold the headers in one byte order.
+  little = cNBT_ParseEx(littleData, littleLength, 0, &options);
+  Test_Check(little && cNBT_Equal(little, tree));
+  Test_Check(cNBT_GetShapeCount(cache) == Test_SHAPES * 2);
+  if (little)
+    Test_CheckShapes(little, littleShapes);
+  for (int i = 0; i < 4; i++)
+    Test_Check(littleShapes[i] != shapes[i]);
+
+  // A full cache leaves the other objects unshaped.
+  options.shapes = smallCache;
+  small = cNBT_ParseEx(data, length, 1, &options);
+  Test_Check(small && cNBT_Equal(small, tree));
+  Test_Check(cNBT_GetShapeCount(smallCache) == 2);
+  if (small) {
+    int shaped = 0;
+    cNBT_ForEach(cNBT_GetNodeByKey(small, "list"), object) {
+      shaped += !!cNBT_GetShape(object);
+      Test_Check(cNBT_GetNodeByKey(object, "k2")->value.valueI32 % 10 == 2);
+    }
+    Test_Check(shaped > 0 && shaped < Test_SHAPE_OBJECTS);
+  }
+
+  // Adding a child drops the shape, and the lookups walk the children.
+  object = first ? cNBT_GetNodeByIndex(cNBT_GetNodeByKey(first, "list"), 0) : cNBT_NULLPTR;
+  if (object) {
+    extra = cNBT_CreateNode(cNBT_I32);
+    Test_Check(cNBT_AddNode(object, extra, "extra"));
+    Test_Check(!cNBT_GetShape(object));
+    Test_Check(cNBT_GetNodeByKey(object, "extra") == extra);
+    Test_Check(cNBT_GetNodeByKey(object, "k7")->value.valueI32 == 7);
+    Test_Check(!cNBT_GetNodeBySlot(object, 0));
+    Test_Check(cNBT_GetShape(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(second, "list"), 0)) == shapes[0]);
+  }
+
+done:
+  // The trees borrow their keys from the shapes.
+  cNBT_Delete(small);
+  cNBT_Delete(little);
+  cNBT_Delete(second);
+  cNBT_Delete(first);
+  cNBT_DeleteShapeCache(smallCache);
+  cNBT_DeleteShapeCache(cache);
+  cNBT_Free(littleData);
+  cNBT_Free(data);
+  cNBT_Delete(tree);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] SNAPSHOTS
+//-----------------------------------------------------------------------------
+
+#define Test_SNAPSHOT_DEPTH 40
+// More snapshots than the share count of a chain holds.
+#define Test_SNAPSHOT_SHARES 300
+
+static void Test_Snapshots(void) {
+  cNBT *reference = Test_MakeTypesTree()
+    , *tree
+    , *deep
+    , *middle
+    , *item;
+  const cNBT *snapshot, *later, *deepSnapshot, *shares[Test_SNAPSHOT_SHARES];
+  size_t allocations;
+
+  // Count the allocations and the frees of the trees and of their snapshots.
+  cNBT_SetFreeManyFn(Test_FreeMany);
+  gFreedMany = gFreed = 0;
+  gAllocationsLeft = LONG_MAX;
+  tree = Test_MakeTypesTree();
+  deep = Test_MakeDeepTree(Test_SNAPSHOT_DEPTH);
+
+  snapshot = cNBT_Snapshot(tree);
+  Test_Check(snapshot && cNBT_Equal(snapshot, tree));
+  Test_Check(!cNBT_IsShared(tree) && cNBT_IsShared(cNBT_GetNodeByKey(tree, "i32")));
+
+  // Setters return the copies of the shared items.
+  item = cNBT_GetNodeByKey(tree, "i32");
+  Test_Check(cNBT_SetValueI32(item, 7) != item);
+  item = cNBT_GetNodeByKey(tree, "i32");
+  Test_Check(item->value.valueI32 == 7 && !cNBT_IsShared(item));
+  Test_Check(cNBT_GetNodeByKey(snapshot, "i32")->value.valueI32 == 0x01020304);
+
+  // Nested items copy the whole path, their siblings stay shared.
+  item = cNBT_GetNodeByIndex(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(tree, "lists"), 2), 1);
+  item = cNBT_SetValueI16(item, 99);
+  Test_Check(item && cNBT_GetNodeByIndex(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(tree, "lists"), 2), 1) == item);
+  Test_Check(cNBT_IsShared(cNBT_GetNodeByIndex(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(tree, "lists"), 0), 0)));
+  Test_AddF64(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(tree, "objects"), 0), "y", 2.5);
+  Test_Check(cNBT_GetNodeByKey(cNBT_GetNodeByIndex(cNBT_GetNodeByKey(tree, "objects"), 0), "y"));
+  cNBT_Delete(cNBT_RemoveNode(tree, cNBT_GetNodeByKey(tree, "a32")));
+  Test_Check(!cNBT_GetNodeByKey(tree, "a32"));
+  Test_Check(cNBT_Clear(cNBT_GetNodeByKey(tree, "more")));
+  Test_Check(cNBT_SetValueString(cNBT_GetNodeByKey(tree, "str"), "changed", 0));
+  Test_Check(cNBT_Equal(snapshot, reference) && !cNBT_Equal(tree, reference));
+
+  // A second snapshot shares the chains copied for the first one.
+  later = cNBT_Snapshot(tree);
+  middle = cNBT_Clone(tree, cNBT_NULLPTR);
+  Test_Check(later && middle && cNBT_Equal(later, middle));
+  Test_Check(cNBT_SetValueI08(cNBT_GetNodeByKey(tree, "i08"), 5));
+  Test_Check(cNBT_Clear(cNBT_GetNodeByKey(tree, "lists")));
+  Test_Check(cNBT_Equal(snapshot, reference) && cNBT_Equal(later, middle));
+  Test_Check(!cNBT_Equal(tree, middle));
+
+  // Snapshots can be released before or after the tree.
+  cNBT_ReleaseSnapshot(snapshot);
+  Test_Check(cNBT_Equal(later, middle));
+  cNBT_Delete(tree);
+  tree = cNBT_NULLPTR;
+  Test_Check(cNBT_Equal(later, middle));
+  cNBT_ReleaseSnapshot(later);
+  cNBT_Delete(middle);
+
+  // Unsharing a deep item, through a chain shared too many times, which is
+  // copied whole.
+  for (int i = 0; i < Test_SNAPSHOT_SHARES; i++)
+    shares[i] = cNBT_Snapshot(cNBT_GetNodeByKey(deep, "d"));
+  deepSnapshot = cNBT_Snapshot(deep);
+  item = deep;
+  for (int i = 1; i < Test_SNAPSHOT_DEPTH; i++)
+    item = cNBT_GetNodeByKey(item, "d");
+  item = cNBT_SetValueString(cNBT_GetNodeByKey(item, "leaf"), "other", 0);
+  Test_Check(item && !cNBT_IsShared(item));
+  for (int i = 0; item && i < Test_SNAPSHOT_DEPTH; i++)
+    item = item->parent;
+  Test_Check(item == deep);
+  item = (cNBT *)deepSnapshot;
+  for (int i = 1; item && i < Test_SNAPSHOT_DEPTH; i++)
+    item = cNBT_GetNodeByKey(item, "d");
+  Test_Check(item && !strcmp(cNBT_GetValueString(cNBT_GetNodeByKey(item, "leaf")), "value"));
+  cNBT_Delete(deep);
+  deep = cNBT_NULLPTR;
+  cNBT_ReleaseSnapshot(deepSnapshot);
+  for (int i = 0; i < Test_SNAPSHOT_SHARES; i++)
+    cNBT_ReleaseSnapshot(shares[i]);
+
+  // Every item is freed once, by the tree or by the last snapshot sharing it.
+  allocations = (size_t)(LONG_MAX - gAllocationsLeft);
+  gAllocationsLeft = -1;
+  Test_Check(gFreed + gFreedMany == allocations);
+  cNBT_SetFreeManyFn(cNBT_NULLPTR);
+  cNBT_Delete(reference);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] DEDUPLICATION
+//-----------------------------------------------------------------------------
+
+// Objects of the "items" list, the same letters being identical objects.
+static const char gDedupItems[] = "ABACAB";
+// Elements of the identical "big" lists, too large to be deduplicated.
+#define Test_DEDUP_BIG 600
+
+static cNBT *Test_MakeDedupTree(void) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ)
+    , *items = Test_AddList(root, cNBT_OBJ, "items");
+
+  for (const char *letter = gDedupItems; *letter; letter++) {
+    cNBT *item = Test_Add(items, cNBT_OBJ, cNBT_NULLPTR)
+      , *tags
+      , *pos;
+    int c = *letter == 'C';
+
+    Test_AddI32(item, "id", *letter);
+    tags = Test_AddList(item, cNBT_STR, "tags");
+    Test_AddStr(tags, cNBT_NULLPTR, c ? "c" : "a");
+    if (!c)
+      Test_AddStr(tags, cNBT_NULLPTR, "b");
+    pos = Test_Add(item, cNBT_OBJ, "pos");
+    Test_AddI32(pos, "x", c ? 5 : 1);
+    Test_AddI32(pos, "y", c ? 6 : 2);
+  }
+  for (int i = 0; i < 2; i++) {
+    cNBT *big = Test_AddList(root, cNBT_I64, i ? "big1" : "big0");
+    for (int j = 0; j < Test_DEDUP_BIG; j++)
+      cNBT_SetValueI64(Test_Add(big, cNBT_I64, cNBT_NULLPTR), j);
+  }
+
+  return root;
+}
+
+// Payload bytes of the duplicates: the list of tags "a" and "b", the object
+// {x, y} of I32, and an item with both.
+#define Test_DEDUP_TAGS (1 + 4 + 2 * 3)
+#define Test_DEDUP_POS (2 * 8 + 1)
+#define Test_DEDUP_ITEM (9 + 7 + Test_DEDUP_TAGS + 6 + Test_DEDUP_POS + 1)
+
+static void Test_Dedup(void) {
+  cNBT *tree = Test_MakeDedupTree()
+    , *nbt = cNBT_NULLPTR
+    , *copy = cNBT_NULLPTR
+    , *items;
+  cNBTDedupStats stats = { 99, 99, 99 };
+  cNBTParseOptions options = { .flags = cNBT_PARSE_DEDUPLICATE, .dedupStats = &stats };
+  size_t length, allocations;
+  const void *data = cNBT_Write(tree, 0, 1, &length)
+    , *written = cNBT_NULLPTR;
+
+  Test_Check(data);
+  if (!data)
+    goto done;
+
+  // Count the allocations and the frees of the parse and of the tree, to check
+  // that shared chains are freed once.
+  cNBT_SetFreeManyFn(Test_FreeMany);
+  gFreedMany = gFreed = 0;
+  gAllocationsLeft = LONG_MAX;
+  nbt = cNBT_ParseEx(data, length, 1, &options);
+  Test_Check(nbt && cNBT_Equal(nbt, tree));
+
+  // The first A, B and C, their tags and positions, and the items list are
+  // unique, the root and the big lists being too large. The tags and
+  // positions of the other items are duplicates, and so are the last two A
+  // and the last B.
+  Test_Check(stats.unique == 8);
+  Test_Check(stats.duplicates == 4 * 2 + 3);
+  Test_Check(stats.duplicateBytes == 4 * (Test_DEDUP_TAGS + Test_DEDUP_POS) + 3 * Test_DEDUP_ITEM);
+
+  items = nbt ? cNBT_GetNodeByKey(nbt, "items") : cNBT_NULLPTR;
+  Test_Check(items);
+  if (items) {
+    cNBT *a = cNBT_GetNodeByIndex(items, 0)
+      , *b = cNBT_GetNodeByIndex(items, 1)
+      , *c = cNBT_GetNodeByIndex(items, 3);
+
+    Test_Check(cNBT_GetNodeByIndex(items, 2)->child == a->child);
+    Test_Check(cNBT_GetNodeByIndex(items, 4)->child == a->child);
+    Test_Check(cNBT_GetNodeByIndex(items, 5)->child == b->child);
+    Test_Check(b->child != a->child && c->child != a->child);
+    Test_Check(cNBT_GetNodeByKey(b, "tags")->child == cNBT_GetNodeByKey(a, "tags")->child);
+    Test_Check(cNBT_GetNodeByKey(b, "pos")->child == cNBT_GetNodeByKey(a, "pos")->child);
+    Test_Check(cNBT_GetNodeByKey(c, "pos")->child != cNBT_GetNodeByKey(a, "pos")->child);
+    Test_Check(cNBT_GetNodeByKey(nbt, "big0")->child != cNBT_GetNodeByKey(nbt, "big1")->child);
+  }
+
+  // Shared chains are written as many times as they're found.
+  written = nbt ? cNBT_Write(nbt, 0, 1, cNBT_NULLPTR) : cNBT_NULLPTR;
+  Test_Check(written && !memcmp(written, data, length));
+
+  // Clones are modifiable, and their copies independent.
+  copy = nbt ? cNBT_Clone(nbt, cNBT_NULLPTR) : cNBT_NULLPTR;
+  Test_Check(copy && cNBT_Equal(copy, tree));
+  if (copy) {
+    cNBT *list = cNBT_GetNodeByKey(copy, "items");
+
+    Test_Check(cNBT_GetNodeByIndex(list, 2)->child != cNBT_GetNodeByIndex(list, 0)->child);
+    cNBT_SetValueI32(cNBT_GetNodeByKey(cNBT_GetNodeByIndex(list, 2), "id"), 'D');
+    cNBT_SetValueI32(cNBT_GetNodeByKey(cNBT_GetNodeByKey(cNBT_GetNodeByIndex(list, 5), "pos"), "x"), 9);
+    Test_Check(cNBT_GetNodeByKey(cNBT_GetNodeByIndex(list, 0), "id")->value.valueI32 == 'A');
+    Test_Check(cNBT_GetNodeByKey(cNBT_GetNodeByIndex(list, 4), "id")->value.valueI32 == 'A');
+    Test_Check(cNBT_GetNodeByKey(cNBT_GetNodeByKey(cNBT_GetNodeByIndex(list, 1), "pos"), "x")->value.valueI32 == 1);
+    Test_Check(!cNBT_Equal(copy, tree) && cNBT_Equal(nbt, tree));
+  }
+
+  cNBT_Delete(copy);
+  cNBT_Delete(nbt);
+  cNBT_Free(written);
+  copy = nbt = cNBT_NULLPTR;
+  written = cNBT_NULLPTR;
+  allocations = (size_t)(LONG_MAX - gAllocationsLeft);
+  gAllocationsLeft = -1;
+  Test_Check(gFreed + gFreedMany == allocations);
+  cNBT_SetFreeManyFn(cNBT_NULLPTR);
+
+  // The statistics are only set when deduplicating.
+  options.flags = 0;
+  stats.unique = 99;
+  nbt = cNBT_ParseEx(data, length, 1, &options);
+  Test_Check(nbt && cNBT_Equal(nbt, tree) && stats.unique == 99);
+
+done:
+  cNBT_Delete(nbt);
+  cNBT_Free(data);
+  cNBT_Delete(tree);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] FROZEN IMAGES
+//-----------------------------------------------------------------------------
+
+// Freeze `nbt` into a buffer of the exact size of the image, so reading past
+// the image is caught by AddressSanitizer.
+static uint8_t *Test_Freeze(const cNBT *nbt, size_t *length) {
+  void *image = cNBT_Freeze(nbt, length);
+  uint8_t *result = image ? malloc(*length) : cNBT_NULLPTR;
+
+  if (result)
+    memcpy(result, image, *length);
+  cNBT_Free(image);
+  return result;
+}
+
+static uint8_t *Test_Find(uint8_t *data, size_t length, const void *bytes, size_t count) {
+  for (size_t i = 0; i + count <= length; i++)
+    if (!memcmp(data + i, bytes, count))
+      return data + i;
+  return cNBT_NULLPTR;
+}
+
+static void Test_FrozenRoundTrip(void) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ), *thawed;
+  cNBTFrozen frozen;
+  size_t length;
+  uint8_t *image;
+
+  Test_AddStr(root, "name", "abc");
+  Test_AddI32(Test_AddList(root, cNBT_I32, "list"), cNBT_NULLPTR, -3);
+  image = Test_Freeze(root, &length);
+
+  Test_Check(image && cNBT_OpenFrozen(image, length, &frozen));
+  Test_Check(!strcmp(cNBT_FrozenString(cNBT_FrozenGet(frozen, "name")), "abc"));
+  Test_Check(!strcmp(cNBT_FrozenKey(cNBT_FrozenGet(frozen, "name")), "name"));
+  Test_Check(cNBT_FrozenInt(cNBT_FrozenAt(cNBT_FrozenGet(frozen, "list"), 0)) == -3);
+  thawed = cNBT_Thaw(frozen);
+  Test_Check(cNBT_Equal(root, thawed));
+
+  cNBT_Delete(thawed);
+  cNBT_Delete(root);
+  free(image);
+}
+
+static void Test_FrozenUnterminatedKey(void) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBTFrozen frozen;
+  size_t length;
+  uint8_t *image, *key;
+
+  Test_AddStr(root, "name", "abc");
+  image = Test_Freeze(root, &length);
+  key = image ? Test_Find(image, length, "name", 5) : cNBT_NULLPTR;
+  Test_Check(key);
+  if (!key)
+    goto done;
+  key[4] = 'x';
+
+  Test_Check(cNBT_OpenFrozen(image, length, &frozen));
+  Test_Check(!cNBT_FrozenKey(cNBT_FrozenAt(frozen, 0)));
+  Test_Check(!cNBT_Thaw(frozen));
+
+done:
+  cNBT_Delete(root);
+  free(image);
+}
+
+static void Test_FrozenUnterminatedString(void) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBTFrozen frozen;
+  size_t length;
+  uint8_t *image, *string;
+
+  Test_AddStr(root, "name", "abc");
+  image = Test_Freeze(root, &length);
+  string = image ? Test_Find(image, length, "abc", 4) : cNBT_NULLPTR;
+  Test_Check(string);
+  if (!string)
+    goto done;
+  string[3] = 'x';
+
+  Test_Check(cNBT_OpenFrozen(image, length, &frozen));
+  Test_Check(!cNBT_FrozenString(cNBT_FrozenGet(frozen, "name")));
+  Test_Check(!cNBT_Thaw(frozen));
+
+done:
+  cNBT_Delete(root);
+  free(image);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] BUNDLES
+//-----------------------------------------------------------------------------
+
+static cNBT *Test_MakeBundleDocument(int index) {
+  cNBT *root = cNBT_CreateNode(cNBT_OBJ);
+  cNBT *list = Test_AddList(root, cNBT_STR, "tags");
+  int32_t array[3] = { index, -1, 2 };
+
+  Test_AddStr(root, "name", index ? "second" : "first");
+  Test_AddI32(root, "index", index);
+  Test_AddStr(list, cNBT_NULLPTR, "shared");
+  Test_AddStr(list, cNBT_NULLPTR, "name");
+  cNBT_SetValueArray(Test_Add(root, cNBT_A32, "array"), array, 3);
+  return root;
+}
+
+// Build a bundle of two documents into a buffer of its exact size.
+static uint8_t *Test_MakeBundle(cNBT **documents, size_t *length) {
+  cNBTBundleBuilder *builder = cNBT_CreateBundleBuilder();
+  uint8_t *result = cNBT_NULLPTR;
+  void *bundle;
+
+  for (int i = 0; i < 2; i++) {
+    size_t size;
+    const void *data = cNBT_Write(documents[i], 0, 1, &size);
+
+    Test_Check(cNBT_BundleAdd(builder, data, size, 1));
+    cNBT_Free(data);
+  }
+  bundle = cNBT_WriteBundle(builder, length);
+  if (bundle && (result = malloc(*length)))
+    memcpy(result, bundle, *length);
+
+  cNBT_Free(bundle);
+  cNBT_DeleteBundleBuilder(builder);
+  return result;
+}
+
+static void Test_BundleRoundTrip(void) {
+  cNBT *documents[2] = { Test_MakeBundleDocument(0), Test_MakeBundleDocument(1) };
+  size_t length;
+  uint8_t *data = Test_MakeBundle(documents, &length);
+  cNBTBundle bundle;
+
+  Test_Check(data && cNBT_OpenBundle(data, length, &bundle));
+  Test_Check(bundle.documentCount == 2);
+  for (uint32_t i = 0; data && i < 2; i++) {
+    cNBT *parsed = cNBT_BundleParse(&bundle, i), *extracted;
+    size_t size, expectedSize;
+    const void *binary = cNBT_BundleExtract(&bundle, i, 1, &size);
+    const void *expected = cNBT_Write(documents[i], 0, 1, &expectedSize);
+
+    Test_Check(cNBT_Equal(parsed, documents[i]));
+    Test_Check(binary && size == expectedSize && !memcmp(binary, expected, size));
+    extracted = binary ? cNBT_Parse(binary, size, 1) : cNBT_NULLPTR;
+    Test_Check(cNBT_Equal(extracted, documents[i]));
+
+    cNBT_Delete(extracted);
+    cNBT_Free(expected);
+    cNBT_Free(binary);
+    cNBT_Delete(parsed);
+  }
+  Test_Check(!cNBT_BundleParse(&bundle, 2));
+
+  free(data);
+  cNBT_Delete(documents[1]);
+  cNBT_Delete(documents[0]);
+}
+
+static void Test_BundleCorrupted(void) {
+  cNBT *documents[2] = { Test_MakeBundleDocument(0), Test_MakeBundleDocument(1) };
+  size_t length;
+  uint8_t *data = Test_MakeBundle(documents, &length);
+
+  // Truncated bundles, and every byte flipped. Either may still open, but
+  // nothing may be read out of the bundle.
+  for (size_t i = 0; data && i < length * 2; i++) {
+    size_t size = i < length ? i : length;
+    uint8_t *corrupted = malloc(size ? size : 1);
+    cNBTBundle bundle;
+
+    memcpy(corrupted, data, size);
+    if (i >= length)
+      corrupted[i - length] ^= 0xFF;
+
+    if (cNBT_OpenBundle(corrupted, size, &bundle)) {
+      for (uint32_t j = 0; j < bundle.documentCount && j < 4; j++) {
+        size_t extractedLength;
+        cNBT *parsed = cNBT_BundleParse(&bundle, j);
+
+        // Reads every key, which point to the dictionary.
+        cNBT_Hash(parsed);
+        cNBT_Delete(parsed);
+        cNBT_Free(cNBT_BundleExtract(&bundle, j, 1, &extractedLength));
+      }
+    }
+    free(corrupted);
+  }
+
+  free(data);
+  cNBT_Delete(documents[1]);
+  cNBT_Delete(documents[0]);
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] LOADER
+//-----------------------------------------------------------------------------
+
+static uint8_t Test_WriteFile(const char *path, const void *data, size_t length) {
+  FILE *file = fopen(path, "wb");
+  uint8_t result;
+
+  if (!file)
+    return 0;
+  result = fwrite(data, 1, length, file) == length;
+  return (uint8_t)(fclose(file) == 0 && result);
+}
+
+static void Test_Loader(void) {
+  // Valid, truncated and missing files, each submitted a few times.
+  static const char *const paths[] = {
+    "test_loader_valid.nbt", "test_loader_truncated.nbt", "test_loader_missing.nbt"
+  };
+  static const uint8_t expected[] = { cNBT_LOAD_OK, cNBT_LOAD_PARSE_FAILED, cNBT_LOAD_READ_FAILED };
+  static const uint8_t expectedParse[] = {
+    cNBT_PARSE_ERROR_NONE, cNBT_PARSE_ERROR_MALFORMED, cNBT_PARSE_ERROR_NONE
+  };
+  size_t length;
+  const void *data = Test_MakeParseData(&length);
+  cNBTLoader *loader = cNBT_CreateLoader(2, 1, cNBT_NULLPTR);
+  cNBTLoadResult result;
+  int counts[3] = { 0 };
+
+  remove(paths[2]);
+  Test_Check(data && loader);
+  Test_Check(Test_WriteFile(paths[0], data, length));
+  Test_Check(Test_WriteFile(paths[1], data, length / 2));
+
+  for (size_t i = 0; loader && i < 12; i++)
+    Test_Check(cNBT_LoaderSubmit(loader, paths[i % 3], (void *)(paths + i % 3)));
+  while (loader && cNBT_LoaderNext(loader, &result, 1)) {
+    size_t index = (const char *const *)result.userData - paths;
+
+    Test_Check(index < 3 && result.error == expected[index]);
+    Test_Check(index < 3 && result.parseError == expectedParse[index]);
+    Test_Check(!result.nbt == (result.error != cNBT_LOAD_OK));
+    if (result.nbt) {
+      cNBT *parsed = cNBT_Parse(data, length, 1);
+
+      Test_Check(cNBT_Equal(result.nbt, parsed));
+      cNBT_Delete(parsed);
+      cNBT_Delete(result.nbt);
+    }
+    counts[index < 3 ? index : 0]++;
+  }
+  Test_Check(counts[0] == 4 && counts[1] == 4 && counts[2] == 4);
+
+  cNBT_DeleteLoader(loader);
+  cNBT_Free(data);
+  remove(paths[0]);
+  remove(paths[1]);
+}
+
+static void Test_LoaderBuffers(void) {
+  // More files than pooled buffers, some growing them past 64 KB, and an empty
+  // one.
+  static const char *const paths[] = {
+    "test_loader_small.nbt", "test_loader_large.nbt", "test_loader_empty.nbt"
+  };
+  cNBT *trees[2] = { cNBT_CreateNode(cNBT_OBJ), cNBT_CreateNode(cNBT_OBJ) };
+  int32_t *array = calloc(50000, sizeof(int32_t));
+  size_t lengths[2];
+  const void *data[2];
+  cNBTLoader *loader = cNBT_CreateLoader(2, 1, cNBT_NULLPTR);
+  cNBTLoadResult result;
+  int counts[3] = { 0 };
+
+  for (int i = 0; array && i < 50000; i++)
+    array[i] = i;
+  Test_AddStr(trees[0], "name", "small");
+  Test_AddStr(trees[1], "name", "large");
+  cNBT_SetValueArray(Test_Add(trees[1], cNBT_A32, "array"), array, 50000);
+  data[0] = cNBT_Write(trees[0], 0, 1, &lengths[0]);
+  data[1] = cNBT_Write(trees[1], 0, 1, &lengths[1]);
+  Test_Check(array && data[0] && data[1] && lengths[1] > 0x10000 && loader);
+  Test_Check(Test_WriteFile(paths[0], data[0], lengths[0]));
+  Test_Check(Test_WriteFile(paths[1], data[1], lengths[1]));
+  Test_Check(Test_WriteFile(paths[2], "", 0));
+
+  for (size_t i = 0; loader && i < 60; i++)
+    Test_Check(cNBT_LoaderSubmit(loader, paths[i % 3], (void *)(paths + i % 3)));
+  while (loader && cNBT_LoaderNext(loader, &result, 1)) {
+    size_t index = (const char *const *)result.userData - paths;
+
+    Test_Check(index < 3);
+    if (index < 2) {
+      Test_Check(result.error == cNBT_LOAD_OK && cNBT_Equal(result.nbt, trees[index]));
+    } else {
+      Test_Check(!result.nbt && result.error == cNBT_LOAD_PARSE_FAILED);
+    }
+    cNBT_Delete(result.nbt);
+    counts[index < 3 ? index : 0]++;
+  }
+  Test_Check(counts[0] == 20 && counts[1] == 20 && counts[2] == 20);
+
+  // Deleted with files queued and being read.
+  for (size_t i = 0; loader && i < 60; i++)
+    Test_Check(cNBT_LoaderSubmit(loader, paths[i % 3], cNBT_NULLPTR));
+  cNBT_DeleteLoader(loader);
+
+  for (int i = 0; i < 3; i++)
+    remove(paths[i]);
+  for (int i = 0; i < 2; i++) {
+    cNBT_Free(data[i]);
+    cNBT_Delete(trees[i]);
+  }
+  free(array);
+}
+
+// Create a loader whose options point to a local error code, gone once the
+// function returns.
+static cNBTLoader *Test_CreateBudgetLoader(void) {
+  uint8_t error = 0xFF;
+  cNBTParseOptions options = { .maxNodes = Test_PARSE_NODES - 1, .error = &error };
+
+  return cNBT_CreateLoader(2, 1, &options);
+}
+
+static void Test_LoaderParseErrors(void) {
+  size_t length;
+  const void *data = Test_MakeParseData(&length);
+  cNBTLoader *loader = Test_CreateBudgetLoader();
+  cNBTLoadResult result;
+  int count = 0;
+
+  Test_Check(data && loader);
+  Test_Check(Test_WriteFile("test_loader_budget.nbt", data, length));
+  for (int i = 0; loader && i < 4; i++)
+    Test_Check(cNBT_LoaderSubmit(loader, "test_loader_budget.nbt", cNBT_NULLPTR));
+  while (loader && cNBT_LoaderNext(loader, &result, 1)) {
+    Test_Check(!result.nbt && result.error == cNBT_LOAD_PARSE_FAILED);
+    Test_Check(result.parseError == cNBT_PARSE_ERROR_NODES);
+    count++;
+  }
+  Test_Check(count == 4);
+
+  cNBT_DeleteLoader(loader);
+  cNBT_Free(data);
+  remove("test_loader_budget.nbt");
+}
+
+//-----------------------------------------------------------------------------
+// [SECTION] MAIN
+//-----------------------------------------------------------------------------
+
+typedef struct {
+  const char *name;
+  void (*run)(void);
+} TestCase;
+
+#define Test_Case(name) { #name, Test_##name }
+
+static const TestCase gTests[] = {
+  Test_Case(ParseBudgets),
+  Test_Case(ParseTruncated),
+  Test_Case(ParseOversizedList),
+  Test_Case(ParseOutOfMemory),
+  Test_Case(ArrayViews),
+  Test_Case(WriteOutOfMemory),
+  Test_Case(WriteSourceSpans),
+  Test_Case(WriteByteOrders),
+  Test_Case(WriteSegments),
+  Test_Case(DeleteBatches),
+  Test_Case(DeleteAsync),
+  Test_Case(JSONTypedNestedLists),
+  Test_Case(JSONFloatLocale),
+  Test_Case(JSONRawInvalidType),
+  Test_Case(EqualDuplicateKeys),
+  Test_Case(PatchRoundTrip),
+  Test_Case(PatchTruncated),
+  Test_Case(PatchKeyWithNul),
+  Test_Case(PatchOutOfMemory),
+  Test_Case(IndexOffsets),
+  Test_Case(Profile),
+  Test_Case(PackedKernels),
+  Test_Case(SchemaDecode),
+  Test_Case(SchemaDecodeMismatch),
+  Test_Case(SchemaDecodeTruncated),
+  Test_Case(SchemaEncode),
+  Test_Case(ShapeCache),
+  Test_Case(Snapshots),
+  Test_Case(Dedup),
+  Test_Case(FrozenRoundTrip),
+  Test_Case(FrozenUnterminatedKey),
+  Test_Case(FrozenUnterminatedString),
+  Test_Case(BundleRoundTrip),
+  Test_Case(BundleCorrupted),
+  Test_Case(Loader),
+  Test_Case(LoaderBuffers),
+  Test_Case(LoaderParseErrors),
+};
+
+int main(int argc, char **argv) {
+  int failed = 0;
+
+  cNBT_SetAllocators(Test_Alloc, Test_Free, cNBT_NULLPTR);
+  cNBT_SetReallocFn(Test_Realloc);
+
+  for (size_t i = 0; i < sizeof(gTests) / sizeof(gTests[0]); i++) {
+    int selected = argc < 2, before = gFailures;
+
+    for (int j = 1; j < argc; j++)
+      selected |= !strcmp(argv[j], gTests[i].name);
+    if (!selected)
+      continue;
+
+    gTests[i].run();
+    printf("%s %s\n", gFailures == before ? "ok" : "FAIL", gTests[i].name);
+    failed += gFailures != before;
+  }
+
+  return failed ? 1 : 0;
+}